@@ -47,6 +47,7 @@ l10nstrings.strExpired = _('Expired:');
 l10nstrings.strRefresh = _('Refresh');
 l10nstrings.strShutdown = _('Shutdown Server');
 l10nstrings.strServerUptime = _('Server uptime');
+l10nstrings.strSpareKits = _('Spare kits (target)');
 l10nstrings.strRefreshLog = _('Refresh Log');
 l10nstrings.strChannelFilter = _('Channel Filter:');
 l10nstrings.strChannelFilterNone = _('None');
@@ -52,6 +52,7 @@ var AdminSocketAnalytics = AdminSocketBase.extend({
 		this.base.call(this);
 
 		this.socket.send('subscribe mem_stats cpu_stats sent_activity recv_activity settings');
+		this.socket.send('batch 1000');
 		this.socket.send('settings');
 		this.socket.send('sent_activity');
 		this.socket.send('recv_activity');
@@ -20,7 +20,7 @@ var AdminSocketBase = Base.extend({
 			this.socket = new WebSocket(host);
 			this.socket.onopen = this.onSocketOpen.bind(this);
 			this.socket.onclose = this.onSocketClose.bind(this);
-			this.socket.onmessage = this.onSocketMessage.bind(this);
+			this.socket.onmessage = this.onSocketFrame.bind(this);
 			this.socket.onerror = this.onSocketError.bind(this);
 			this.socket.binaryType = 'arraybuffer';
 		}
@@ -42,6 +42,21 @@ var AdminSocketBase = Base.extend({
 		/* Implemented by child */
 	},
 
+	// Unpacks the batched notifications, one message per line, see 'batch' in protocol.txt.
+	onSocketFrame: function (e) {
+		if (typeof e.data !== 'string' || !e.data.startsWith('batch\n')) {
+			this.onSocketMessage(e);
+			return;
+		}
+
+		var lines = e.data.split('\n');
+		for (var i = 1; i < lines.length; i++) {
+			if (lines[i] && !lines[i].startsWith('dropped ')) {
+				this.onSocketMessage({ data: lines[i] });
+			}
+		}
+	},
+
 	onSocketClose: function () {
 		this.socket.onerror = function () { };
 		this.socket.onclose = function () { };
@@ -224,6 +224,7 @@ var AdminSocketOverview = AdminSocketBase.extend({
 		this.socket.send('sent_bytes');
 		this.socket.send('recv_bytes');
 		this.socket.send('uptime');
+		this.socket.send('prespawn_stats');
 	},
 
 	onSocketOpen: function() {
@@ -232,6 +233,7 @@ var AdminSocketOverview = AdminSocketBase.extend({
 
 		this.socket.send('documents');
 		this.socket.send('subscribe adddoc rmdoc resetidle propchange modifications uploaded');
+		this.socket.send('batch 1000');
 
 		this._getBasicStats();
 		var socketOverview = this;
@@ -330,6 +332,15 @@ var AdminSocketOverview = AdminSocketBase.extend({
 			}
 			$(document.getElementById(sCommand)).text(nData);
 		}
+		else if (textMsg.startsWith('prespawn_stats')) {
+			var stats = JSON.parse(textMsg.substring('prespawn_stats'.length).trim());
+			var $stats = $(document.getElementById('prespawn_stats'));
+			$stats.text(stats['available'] + ' (' + stats['target'] + ')');
+			$stats.attr('title', (stats['adaptive'] ? _('Adaptive') : _('Fixed')) +
+				': ' + stats['arrivalRate'].toFixed(2) + _(' opens/s') +
+				', p90 ' + stats['spawnP90Ms'] + _(' ms spawn') +
+				', ' + stats['coldOpens'] + '/' + stats['arrivals'] + _(' cold opens'));
+		}
 		else if (textMsg.startsWith('rmdoc')) {
 			textMsg = textMsg.substring('rmdoc'.length);
 			docProps = textMsg.trim().split(' ');
@@ -13,6 +13,8 @@ declare var postMobileMessage: any;
 class IdleHandler {
     _serverRecycling: boolean = false;
     _documentIdle: boolean = false;
+    _documentHibernated: boolean = false;
+    _hibernatedCursor: any = null;
     _active: boolean = true;
     map: any;
 	dimId: 'inactive_user_message';
@@ -22,7 +24,7 @@ class IdleHandler {
 	}
 
 	_activate() {
-		if (this._serverRecycling || this._documentIdle) {
+		if (this._serverRecycling || this._documentIdle || this._documentHibernated) {
 			return false;
 		}
 
@@ -87,6 +89,41 @@ class IdleHandler {
 		this.map.fire('postMessage', {msgId: 'User_Idle'});
 	}
 
+	// The server unloaded the idle document: keep showing it,
+	// and load it again as soon as the user interacts with it.
+	_hibernate() {
+		this._active = false;
+		this._documentHibernated = true;
+
+		var docLayer = this.map._docLayer;
+		if (docLayer && docLayer.isWriter() && docLayer._cursorCorePixels) {
+			this._hibernatedCursor = docLayer._corePixelsToTwips(docLayer._cursorCorePixels.getCenter());
+		}
+
+		var events = ['mousedown', 'keydown', 'wheel', 'touchstart'];
+		var wakeUp = function() {
+			events.forEach(function(name: string) { document.removeEventListener(name, wakeUp, true); });
+			if (app.idleHandler._documentHibernated) {
+				window.app.console.debug('hibernation: reloading');
+				app.idleHandler._documentHibernated = false;
+				app.idleHandler._activate();
+			}
+		};
+		events.forEach(function(name: string) { document.addEventListener(name, wakeUp, true); });
+	}
+
+	// Puts the cursor back where it was before hibernating.
+	_restoreCursor() {
+		var cursor = this._hibernatedCursor;
+		var docLayer = this.map._docLayer;
+		if (!cursor || !docLayer)
+			return;
+
+		this._hibernatedCursor = null;
+		// Not a click, which could follow a link or toggle a checkbox there.
+		docLayer._postSelectTextEvent('reset', Math.round(cursor.x), Math.round(cursor.y));
+	}
+
 	notifyActive() {
 		if (window.ThisIsTheAndroidApp) {
 			window.postMobileMessage('LIGHT_SCREEN');
@@ -15,9 +15,6 @@ app.definitions.Socket = L.Class.extend({
 	/// turned on (and off again), not whether it is on.)
 	enableTraceEventLogging: false,
 
-	// Will be set from lokitversion message
-	TunnelledDialogImageCacheSize: 0,
-
 	getParameterValue: function (s) {
 		var i = s.indexOf('=');
 		if (i === -1)
@@ -482,9 +479,6 @@ app.definitions.Socket = L.Class.extend({
 		    !e.textMsg.startsWith('windowpaint:'))
 			return;
 
-		if (e.textMsg.indexOf(' nopng') !== -1)
-			return;
-
 		// pass deltas through quickly.
 		if (e.imgBytes && (isTile || isDelta) && e.imgBytes[e.imgIndex] != 80 /* P(ng) */)
 		{
@@ -495,6 +489,14 @@ app.definitions.Socket = L.Class.extend({
 			return;
 		}
 
+		// window paints are cells of deltas and keyframes too.
+		if (e.imgBytes && e.textMsg.startsWith('windowpaint:'))
+		{
+			e.image = { rawData: e.imgBytes.subarray(e.imgIndex) };
+			e.imageIsComplete = true;
+			return;
+		}
+
 		// window.app.console.log('PNG preview');
 
 		// lazy-loaded PNG slide previews
@@ -505,7 +507,7 @@ app.definitions.Socket = L.Class.extend({
 			return;
 		}
 
-		// PNG dialog bits
+		// PNG bits, e.g. fonts
 		var that = this;
 		e.image = new Image();
 		e.image.onload = function() {
@@ -604,7 +606,6 @@ app.definitions.Socket = L.Class.extend({
 			$('#lokit-version').html(lokitVersionObj.ProductName + ' ' +
 			                         lokitVersionObj.ProductVersion + lokitVersionObj.ProductExtension +
 			                         '<span> git hash:&nbsp;' + h + '<span>');
-			this.TunnelledDialogImageCacheSize = lokitVersionObj.tunnelled_dialog_image_cache_size;
 		}
 		else if (textMsg.startsWith('enabletraceeventlogging ')) {
 			this.enableTraceEventLogging = true;
@@ -717,6 +718,10 @@ app.definitions.Socket = L.Class.extend({
 				if (textMsg === 'oom')
 					postMsgData['Reason'] = 'OOM';
 			}
+			else if (textMsg === 'hibernated') {
+				// Not for the user to notice: we load it again on their next input.
+				app.idleHandler._hibernate();
+			}
 			else if (textMsg === 'shuttingdown') {
 				msg = _('Server is shutting down for maintenance (auto-saving)');
 				postMsgData['Reason'] = 'ShuttingDown';
@@ -1346,6 +1351,7 @@ app.definitions.Socket = L.Class.extend({
 		this._map.fire('docloaded', {status: true});
 		if (this._map._docLayer) {
 			this._map._docLayer._onMessage(textMsg);
+			app.idleHandler._restoreCursor();
 		}
 	},
 
@@ -1487,7 +1493,7 @@ app.definitions.Socket = L.Class.extend({
 		setTimeout(function () {
 			if (!that._reconnecting) {
 				that._reconnecting = true;
-				if (!app.idleHandler._documentIdle)
+				if (!app.idleHandler._documentIdle && !app.idleHandler._documentHibernated)
 					that._map.showBusy(_('Reconnecting...'), false);
 				app.idleHandler._activate();
 			}
@@ -1633,11 +1639,13 @@ app.definitions.Socket = L.Class.extend({
 					command.rtlParts.push(parseInt(item));
 				});
 			}
-			else if (tokens[i].startsWith('hash=')) {
-				command.hash = tokens[i].substring('hash='.length);
+			else if (tokens[i].startsWith('cellsize=')) {
+				command.cellSize = parseInt(tokens[i].substring('cellsize='.length));
 			}
-			else if (tokens[i] === 'nopng') {
-				command.nopng = true;
+			else if (tokens[i].startsWith('cells=')) {
+				command.cells = tokens[i].substring('cells='.length).split(',').map(function (size) {
+					return parseInt(size);
+				});
 			}
 			else if (tokens[i].substring(0, 9) === 'username=') {
 				command.username = tokens[i].substring(9);
@@ -852,7 +852,8 @@ L.CanvasTileLayer = L.Layer.extend({
 		previewInvalidationTimeout: 1000,
 	},
 
-	_pngCache: [],
+	// The last paint of each dialog and sidebar window, by id.
+	_windowPaints: {},
 
 	initialize: function (url, options) {
 		this._url = url;
@@ -3429,70 +3430,94 @@ L.CanvasTileLayer = L.Layer.extend({
 		}
 	},
 
+	// Split a window paint into cells as the server does: by rows, from left to right,
+	// all cellSize square but the last row and column.
+	_getWindowCells: function(width, height, cellSize) {
+		var cells = [];
+		for (var y = 0; y < height; y += cellSize) {
+			for (var x = 0; x < width; x += cellSize) {
+				cells.push({ x: x, y: y, width: Math.min(cellSize, width - x),
+					     height: Math.min(cellSize, height - y), imgData: null });
+			}
+		}
+		return cells;
+	},
+
 	_onDialogPaintMsg: function(textMsg, img) {
 		var command = app.socket.parseServerCmd(textMsg);
+		var x = 0;
+		var y = 0;
+		if (command.rectangle) {
+			var rectangle = command.rectangle.split(',');
+			x = parseInt(rectangle[0]) || 0;
+			y = parseInt(rectangle[1]) || 0;
+		}
+
+		// The deltas are against the last paint of the same area of the window.
+		var area = x + ',' + y + ',' + command.width + ',' + command.height;
+		var paint = this._windowPaints[command.id];
+		if (!paint || paint.area !== area) {
+			paint = {
+				area: area,
+				cells: this._getWindowCells(command.width, command.height, command.cellSize),
+				canvas: document.createElement('canvas')
+			};
+			paint.canvas.width = command.width;
+			paint.canvas.height = command.height;
+			this._windowPaints[command.id] = paint;
+		}
 
-		// app.socket.sendMessage('DEBUG _onDialogPaintMsg: hash=' + command.hash + ' img=' + typeof(img) + (typeof(img) == 'string' ? (' (length:' + img.length + ':"' + img.substring(0, 30) + (img.length > 30 ? '...' : '') + '")') : '') + ', cache size ' + this._pngCache.length);
-		if (command.nopng) {
-			var found = false;
-			for (var i = 0; i < this._pngCache.length; i++) {
-				if (this._pngCache[i].hash == command.hash) {
-					found = true;
-					// app.socket.sendMessage('DEBUG - Found in cache');
-					img = this._pngCache[i].img;
-					// Remove item (and add it below at the start of the array)
-					this._pngCache.splice(i, 1);
-					break;
-				}
+		var sizes = command.cells || [];
+		if (sizes.length !== paint.cells.length) {
+			window.app.console.error('windowpaint: ' + sizes.length + ' cells instead of ' +
+						 paint.cells.length + ' for ' + area);
+			return;
+		}
+
+		var data = img && img.rawData ? img.rawData : new Uint8Array(0);
+		var ctx = paint.canvas.getContext('2d');
+		var offset = 0;
+		for (var i = 0; i < sizes.length; ++i) {
+			if (!sizes[i])
+				continue; // unchanged
+
+			var cell = paint.cells[i];
+			var type = data[offset];
+			var cellData = window.fzstd.decompress(data.subarray(offset + 1, offset + sizes[i]));
+			offset += sizes[i];
+
+			if (type === 90 /* Z */) {
+				var pixels = new Uint8ClampedArray(cellData.buffer, cellData.byteOffset,
+								   cell.width * cell.height * 4);
+				cell.imgData = new ImageData(pixels, cell.width, cell.height);
 			}
-			if (!found) {
-				var message = 'windowpaint: message assumed PNG for hash ' + command.hash
-				    + ' is cached here in the client but not found';
-				if (L.Browser.cypressTest)
-					throw new Error(message);
-				app.socket.sendMessage('ERROR ' + message);
-				// Not sure what to do. Ask the server to re-send the windowpaint: message but this time including the PNG?
+			else if (type === 68 /* D */ && cell.imgData) {
+				var oldData = new Uint8ClampedArray(cell.imgData.data);
+				this._applyDeltaChunk(cell.imgData, cellData, oldData, cell.width, cell.height);
 			}
-		} else {
-			// Sanity check: If we get a PNG it should be for a hash that we don't have cached
-			for (i = 0; i < this._pngCache.length; i++) {
-				if (this._pngCache[i].hash == command.hash) {
-					message = 'windowpaint: message included PNG for hash ' + command.hash
-					    + ' even if it was already cached here in the client';
-					if (L.Browser.cypressTest)
-						throw new Error(message);
-					app.socket.sendMessage('ERROR ' + message);
-					// Remove the extra copy, code below will add it at the start of the array
-					this._pngCache.splice(i, 1);
-					break;
-				}
+			else {
+				window.app.console.error('windowpaint: cannot apply cell ' + i + ' of type ' + type +
+							 ' for ' + area);
+				continue;
 			}
-		}
 
-		// If cache is max size, drop the last element
-		if (this._pngCache.length == app.socket.TunnelledDialogImageCacheSize) {
-			// app.socket.sendMessage('DEBUG - Dropping last cache element');
-			this._pngCache.pop();
+			ctx.putImageData(cell.imgData, cell.x, cell.y);
 		}
 
-		// Add element to cache
-		this._pngCache.unshift({hash: command.hash, img:img});
-
-		// app.socket.sendMessage('DEBUG - Cache size now ' + this._pngCache.length);
-
 		this._map.fire('windowpaint', {
 			id: command.id,
-			img: img,
+			img: paint.canvas,
 			width: command.width,
 			height: command.height,
-			rectangle: command.rectangle,
-			hash: command.hash
+			rectangle: command.rectangle
 		});
 	},
 
 	_onDialogMsg: function(textMsg) {
 		textMsg = textMsg.substring('window: '.length);
 		var dialogMsg = JSON.parse(textMsg);
+		if (dialogMsg.action === 'close')
+			delete this._windowPaints[dialogMsg.id];
 		// e.type refers to signal type
 		dialogMsg.winType = dialogMsg.type;
 		this._map.fire('window', dialogMsg);
@@ -6917,6 +6942,27 @@ L.CanvasTileLayer = L.Layer.extend({
 					}
 				}
 				break;
+			case 98: // 'b': // copy block
+				var srcCol = delta[i+1];
+				srcRow = delta[i+2];
+				var destCol = delta[i+3];
+				destRow = delta[i+4];
+				var blockWidth = delta[i+5];
+				count = delta[i+6];
+				if (this._debugDeltasDetail)
+					window.app.console.log('[' + i + ']: copy block ' + blockWidth + 'x' + count + ' from ' +
+							       srcCol + ', ' + srcRow + ' to ' + destCol + ', ' + destRow);
+				i += 7;
+				for (cnt = 0; cnt < count; ++cnt)
+				{
+					src = ((srcRow + cnt) * width + srcCol) * 4;
+					dest = ((destRow + cnt) * width + destCol) * 4;
+					for (j = 0; j < blockWidth * 4; ++j)
+					{
+						imgData.data[dest + j] = oldData[src + j];
+					}
+				}
+				break;
 			case 100: // 'd': // new run
 				destRow = delta[i+1];
 				var destCol = delta[i+2];
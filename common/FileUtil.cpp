@@ -18,6 +18,10 @@
 #include <sys/time.h>
 #ifdef __linux__
 #include <sys/vfs.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>
 #elif defined IOS
 #import <Foundation/Foundation.h>
 #elif defined __FreeBSD__
@@ -26,7 +30,9 @@
 #endif
 
 #include <fcntl.h>
+#include <atomic>
 #include <chrono>
+#include <cinttypes>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -50,6 +56,7 @@ namespace filesystem = ::std::filesystem;
 #include <Poco/Path.h>
 
 #include "Log.hpp"
+#include "SpookyV2.h"
 #include "Util.hpp"
 #include "Unit.hpp"
 
@@ -92,6 +99,98 @@ namespace FileUtil
         return name;
     }
 
+    namespace
+    {
+        std::atomic<int> FastestCopyMethod(0);
+        std::atomic<std::uint64_t> CopyCounts[CopyMethodCount];
+        std::atomic<std::uint64_t> CopyBytes[CopyMethodCount];
+
+        /// Once the kernel told us it doesn't have copy_file_range, don't ask again.
+        std::atomic<bool> CopyFileRangeMissing(false);
+
+        /// Whether a kernel copy method failed because it can't handle these files,
+        /// rather than due to an I/O error, so we should try the next method.
+        bool isUnsupported(int error)
+        {
+            return error == ENOSYS || error == EOPNOTSUPP || error == ENOTSUP || error == EXDEV
+                   || error == EINVAL || error == ENOTTY || error == EBADF || error == EPERM;
+        }
+
+        /// Copies from the current offsets with copy_file_range or sendfile,
+        /// updating @bytesIn. Returns false if unsupported, to fall back; throws on errors.
+        bool copyInKernel(CopyMethod method, int from, int to, off_t size, off_t& bytesIn)
+        {
+#ifdef __linux__
+            while (bytesIn < size)
+            {
+                const std::size_t count = std::min<off_t>(size - bytesIn, 1 << 30);
+                ssize_t n;
+                if (method == CopyMethod::CopyFileRange)
+                {
+#ifdef __NR_copy_file_range
+                    n = ::syscall(__NR_copy_file_range, from, nullptr, to, nullptr, count, 0);
+#else
+                    n = -1;
+                    errno = ENOSYS;
+#endif
+                }
+                else
+                    n = ::sendfile(to, from, nullptr, count);
+
+                if (n < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+
+                    if (method == CopyMethod::CopyFileRange && errno == ENOSYS)
+                        CopyFileRangeMissing = true;
+
+                    // The offsets are consistent, so the next method continues from there.
+                    if (isUnsupported(errno))
+                        return false;
+
+                    throw std::runtime_error(std::string("Failed to ") + nameOf(method) + " at "
+                                             + std::to_string(bytesIn)
+                                             + " bytes in: " + std::strerror(errno));
+                }
+
+                if (n == 0) // EOF; the file shrank, or a pseudo-file that needs read().
+                    return bytesIn > 0;
+
+                bytesIn += n;
+            }
+
+            return true;
+#else
+            (void)method; (void)from; (void)to; (void)size; (void)bytesIn;
+            return false;
+#endif
+        }
+    }
+
+    const char* nameOf(CopyMethod method)
+    {
+        switch (method)
+        {
+            case CopyMethod::Reflink:
+                return "reflink";
+            case CopyMethod::CopyFileRange:
+                return "copy_file_range";
+            case CopyMethod::SendFile:
+                return "sendfile";
+            case CopyMethod::ReadWrite:
+                return "read_write";
+        }
+
+        return "unknown";
+    }
+
+    void setFastestCopyMethod(CopyMethod method) { FastestCopyMethod = static_cast<int>(method); }
+
+    std::uint64_t getCopyCount(CopyMethod method) { return CopyCounts[static_cast<int>(method)]; }
+
+    std::uint64_t getCopyBytes(CopyMethod method) { return CopyBytes[static_cast<int>(method)]; }
+
     bool copy(const std::string& fromPath, const std::string& toPath, bool log, bool throw_on_error)
     {
         int from = -1, to = -1;
@@ -114,11 +213,37 @@ namespace FileUtil
                 LOG_INF("Copying " << st.st_size << " bytes from " << anonymizeUrl(fromPath)
                                    << " to " << anonymizeUrl(toPath));
 
+            // The kernel methods need the size, which pseudo-files (e.g. in /proc) report as 0.
+            off_t bytesIn = 0;
+            CopyMethod method = static_cast<CopyMethod>(FastestCopyMethod.load());
+            if (!S_ISREG(st.st_mode) || st.st_size == 0)
+                method = CopyMethod::ReadWrite;
+
+#ifdef FICLONE
+            if (method == CopyMethod::Reflink)
+            {
+                if (::ioctl(to, FICLONE, from) == 0)
+                    bytesIn = st.st_size;
+                else
+                    method = CopyMethod::CopyFileRange;
+            }
+#else
+            if (method == CopyMethod::Reflink)
+                method = CopyMethod::CopyFileRange;
+#endif
+
+            if (method == CopyMethod::CopyFileRange
+                && (CopyFileRangeMissing || !copyInKernel(method, from, to, st.st_size, bytesIn)))
+                method = CopyMethod::SendFile;
+
+            if (method == CopyMethod::SendFile
+                && !copyInKernel(method, from, to, st.st_size, bytesIn))
+                method = CopyMethod::ReadWrite;
+
             char buffer[64 * 1024];
 
             int n;
-            off_t bytesIn = 0;
-            do
+            while (method == CopyMethod::ReadWrite)
             {
                 while ((n = ::read(from, buffer, sizeof(buffer))) < 0 && errno == EINTR)
                     LOG_TRC("EINTR reading from " << anonymizeUrl(fromPath));
@@ -145,12 +270,16 @@ namespace FileUtil
                     }
                     j += written;
                 }
-            } while (true);
+            }
+
             if (bytesIn != st.st_size)
             {
                 LOG_WRN("Unusual: file " << anonymizeUrl(fromPath) << " changed size "
                         "during copy from " << st.st_size << " to " << bytesIn);
             }
+
+            ++CopyCounts[static_cast<int>(method)];
+            CopyBytes[static_cast<int>(method)] += bytesIn;
             close(from);
             close(to);
             return true;
@@ -409,6 +538,42 @@ namespace FileUtil
                           std::istreambuf_iterator<char>(lhs.rdbuf()));
     }
 
+    std::string hashFile(const std::string& path)
+    {
+        const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return std::string();
+
+        SpookyHash hash;
+        hash.Init(0, 0);
+
+        char buffer[64 * 1024];
+        ssize_t n;
+        while ((n = read(fd, buffer, sizeof(buffer))) != 0)
+        {
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+
+                close(fd);
+                return std::string();
+            }
+
+            hash.Update(buffer, n);
+        }
+
+        close(fd);
+
+        uint64_t hash1 = 0;
+        uint64_t hash2 = 0;
+        hash.Final(&hash1, &hash2);
+
+        char hex[33];
+        snprintf(hex, sizeof(hex), "%016" PRIx64 "%016" PRIx64, hash1, hash2);
+        return hex;
+    }
+
 } // namespace FileUtil
 
 namespace
@@ -11,6 +11,7 @@
 
 #include <cerrno>
 #include <chrono>
+#include <cstdint>
 #include <string>
 #include <sys/stat.h>
 
@@ -80,6 +81,28 @@ namespace FileUtil
     /// Update the access-time and modified-time metadata for the given file.
     bool updateTimestamps(const std::string& filename, timespec tsAccess, timespec tsModified);
 
+    /// The ways in which copy() can copy the data, fastest first.
+    /// Each is tried in turn, falling back when the kernel or filesystem doesn't support it.
+    enum class CopyMethod
+    {
+        Reflink, ///< FICLONE: shares the extents, on e.g. Btrfs and XFS.
+        CopyFileRange, ///< copy_file_range: in-kernel, or offloaded to the storage.
+        SendFile, ///< sendfile: in-kernel, but copies the pages.
+        ReadWrite, ///< A buffered read/write loop.
+    };
+
+    constexpr int CopyMethodCount = static_cast<int>(CopyMethod::ReadWrite) + 1;
+
+    /// Returns the name of @method, e.g. for metrics.
+    const char* nameOf(CopyMethod method);
+
+    /// Skip the copy methods faster than @method, e.g. to benchmark or test the slower ones.
+    void setFastestCopyMethod(CopyMethod method);
+
+    /// The number of files, and their bytes, copied using @method so far in this process.
+    std::uint64_t getCopyCount(CopyMethod method);
+    std::uint64_t getCopyBytes(CopyMethod method);
+
     /// Copy the source file to the target.
     bool copy(const std::string& fromPath, const std::string& toPath, bool log,
               bool throw_on_error);
@@ -149,6 +172,10 @@ namespace FileUtil
     /// have equal size and every byte of their contents match.
     bool compareFileContents(const std::string& rhsPath, const std::string& lhsPath);
 
+    /// Returns the 128-bit SpookyHash of the contents of the file, in hex,
+    /// reading it in chunks, or an empty string if it can't be read.
+    std::string hashFile(const std::string& path);
+
     /// File/Directory stat helper.
     class Stat
     {
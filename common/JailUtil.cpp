@@ -156,6 +156,7 @@ void removeAuxFolders(const std::string &root)
 {
     FileUtil::removeFile(Poco::Path(root, "tmp").toString(), true);
     FileUtil::removeFile(Poco::Path(root, "linkable").toString(), true);
+    FileUtil::removeFile(Poco::Path(root, "template").toString(), true);
 }
 
 bool tryRemoveJail(const std::string& root)
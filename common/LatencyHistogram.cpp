@@ -0,0 +1,301 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <config.h>
+
+#include "LatencyHistogram.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+#include <StringVector.hpp>
+
+namespace
+{
+/// A registered histogram.
+struct Entry
+{
+    std::string _help;
+    std::unique_ptr<LatencyHistogram> _histogram;
+    /// What we reported last, to only serialize new observations.
+    LatencyHistogram::Snapshot _lastSerialized;
+};
+
+/// The registry, keyed by name and labels, so a family is contiguous.
+using Registry = std::map<std::pair<std::string, std::string>, Entry>;
+
+std::mutex& getRegistryMutex()
+{
+    static std::mutex mutex;
+    return mutex;
+}
+
+Registry& getRegistry()
+{
+    static Registry registry;
+    return registry;
+}
+
+/// Formats microseconds as seconds, without losing precision.
+std::string formatSeconds(std::uint64_t us)
+{
+    std::string fraction = std::to_string(1000000 + us % 1000000).substr(1);
+    while (!fraction.empty() && fraction.back() == '0')
+        fraction.pop_back();
+
+    return std::to_string(us / 1000000) + (fraction.empty() ? "" : '.' + fraction);
+}
+
+/// Appends the le label to the labels of a series.
+std::string withLe(const std::string& labels, const std::string& le)
+{
+    return '{' + labels + (labels.empty() ? "" : ",") + "le=\"" + le + "\"}";
+}
+} // namespace
+
+std::uint64_t LatencyHistogram::Snapshot::getCount() const
+{
+    std::uint64_t count = 0;
+    for (const std::uint64_t bucket : _buckets)
+        count += bucket;
+
+    return count;
+}
+
+std::uint64_t LatencyHistogram::Snapshot::getPercentileUs(double percentile) const
+{
+    const std::uint64_t count = getCount();
+    if (count == 0)
+        return 0;
+
+    const double wanted = percentile * count;
+    std::uint64_t cumulative = 0;
+    for (std::size_t i = 0; i < NumBuckets; ++i)
+    {
+        cumulative += _buckets[i];
+        if (cumulative > 0 && cumulative >= wanted)
+            return getBucketBoundUs(i);
+    }
+
+    return getBucketBoundUs(NumBuckets - 1);
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::Snapshot::operator-(const Snapshot& older) const
+{
+    Snapshot res;
+    for (std::size_t i = 0; i < NumBuckets; ++i)
+        res._buckets[i] = _buckets[i] - older._buckets[i];
+
+    res._sumUs = _sumUs - older._sumUs;
+    return res;
+}
+
+const LatencyHistogram::Description LatencyHistogram::KitTileRender = {
+    "kit_tile_render_duration_seconds", "", "Time spent in paintPartTile per tile-combine."
+};
+
+const LatencyHistogram::Description LatencyHistogram::KitTileEncode = {
+    "kit_tile_encode_duration_seconds", "",
+    "Time spent compressing or delta-encoding a single tile."
+};
+
+const std::vector<LatencyHistogram::Description> LatencyHistogram::KitHistograms = {
+    KitTileRender, KitTileEncode
+};
+
+LatencyHistogram& LatencyHistogram::get(const std::string& name, const std::string& labels,
+                                        const std::string& help)
+{
+    std::lock_guard<std::mutex> lock(getRegistryMutex());
+
+    Entry& entry = getRegistry()[std::make_pair(name, labels)];
+    if (!entry._histogram)
+        entry._histogram.reset(new LatencyHistogram());
+
+    if (entry._help.empty())
+        entry._help = help;
+
+    return *entry._histogram;
+}
+
+std::size_t LatencyHistogram::getBucketIndex(std::uint64_t us)
+{
+    std::size_t index = 0;
+    while (index < NumBuckets - 1 && us > (FirstBucketUs << index))
+        ++index;
+
+    return index;
+}
+
+std::uint64_t LatencyHistogram::getBucketBoundUs(std::size_t index)
+{
+    return index < NumBuckets - 1 ? FirstBucketUs << index
+                                  : std::numeric_limits<std::uint64_t>::max();
+}
+
+LatencyHistogram::Shard& LatencyHistogram::getShard()
+{
+    // Threads are assigned a shard round-robin, on first use.
+    static std::atomic<std::size_t> nextThreadIndex(0);
+    static thread_local const std::size_t threadIndex = nextThreadIndex++;
+    return _shards[threadIndex % NumShards];
+}
+
+void LatencyHistogram::observeUs(std::uint64_t us)
+{
+    Shard& shard = getShard();
+    shard._buckets[getBucketIndex(us)].fetch_add(1, std::memory_order_relaxed);
+    shard._sumUs.fetch_add(us, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::merge(const Snapshot& snapshot)
+{
+    Shard& shard = getShard();
+    for (std::size_t i = 0; i < NumBuckets; ++i)
+    {
+        if (snapshot._buckets[i])
+            shard._buckets[i].fetch_add(snapshot._buckets[i], std::memory_order_relaxed);
+    }
+
+    shard._sumUs.fetch_add(snapshot._sumUs, std::memory_order_relaxed);
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::snapshot() const
+{
+    Snapshot res;
+    for (const Shard& shard : _shards)
+    {
+        for (std::size_t i = 0; i < NumBuckets; ++i)
+            res._buckets[i] += shard._buckets[i].load(std::memory_order_relaxed);
+
+        res._sumUs += shard._sumUs.load(std::memory_order_relaxed);
+    }
+
+    return res;
+}
+
+void LatencyHistogram::print(std::ostream& os, const std::string& name,
+                             const std::string& labels) const
+{
+    const Snapshot snap = snapshot();
+
+    std::uint64_t cumulative = 0;
+    for (std::size_t i = 0; i < NumBuckets - 1; ++i)
+    {
+        cumulative += snap._buckets[i];
+        os << name << "_bucket" << withLe(labels, formatSeconds(getBucketBoundUs(i))) << ' '
+           << cumulative << '\n';
+    }
+
+    cumulative += snap._buckets[NumBuckets - 1];
+    os << name << "_bucket" << withLe(labels, "+Inf") << ' ' << cumulative << '\n';
+
+    const std::string braced = labels.empty() ? std::string() : '{' + labels + '}';
+    os << name << "_sum" << braced << ' ' << formatSeconds(snap._sumUs) << '\n';
+    os << name << "_count" << braced << ' ' << cumulative << '\n';
+}
+
+void LatencyHistogram::printAll(std::ostream& os)
+{
+    std::lock_guard<std::mutex> lock(getRegistryMutex());
+
+    const std::string* lastName = nullptr;
+    for (const auto& pair : getRegistry())
+    {
+        const std::string& name = pair.first.first;
+        if (!lastName || *lastName != name)
+        {
+            os << "# HELP " << name << ' ' << pair.second._help << '\n';
+            os << "# TYPE " << name << " histogram\n";
+            lastName = &name;
+        }
+
+        pair.second._histogram->print(os, name, pair.first.second);
+    }
+}
+
+std::string LatencyHistogram::serializeNew()
+{
+    std::lock_guard<std::mutex> lock(getRegistryMutex());
+
+    std::ostringstream oss;
+    for (auto& pair : getRegistry())
+    {
+        Entry& entry = pair.second;
+        const Snapshot current = entry._histogram->snapshot();
+        const Snapshot delta = current - entry._lastSerialized;
+        if (delta.getCount() == 0)
+            continue;
+
+        entry._lastSerialized = current;
+
+        // name <tab> labels <tab> help <tab> sum <tab> buckets
+        oss << pair.first.first << '\t' << pair.first.second << '\t' << entry._help << '\t'
+            << delta._sumUs << '\t';
+        for (std::size_t i = 0; i < NumBuckets; ++i)
+            oss << (i ? "," : "") << delta._buckets[i];
+        oss << '\n';
+    }
+
+    return oss.str();
+}
+
+std::size_t LatencyHistogram::mergeSerialized(const std::string& data,
+                                              const std::vector<Description>& allowed)
+{
+    std::size_t merged = 0;
+    std::istringstream iss(data);
+    std::string line;
+    while (std::getline(iss, line))
+    {
+        // Labels may be empty, so we can't use StringVector, which skips empty tokens.
+        std::vector<std::string> fields;
+        std::istringstream lineStream(line);
+        std::string field;
+        while (std::getline(lineStream, field, '\t'))
+            fields.push_back(field);
+
+        if (fields.size() != 5 || fields[0].empty())
+            continue;
+
+        // Only what we know, lest another process fill our registry, or our scrapes.
+        const auto description = std::find_if(
+            allowed.begin(), allowed.end(), [&fields](const Description& candidate)
+            { return fields[0] == candidate._name && fields[1] == candidate._labels; });
+        if (description == allowed.end())
+            continue;
+
+        const StringVector buckets = StringVector::tokenize(fields[4], ',');
+        if (buckets.size() != NumBuckets)
+            continue;
+
+        Snapshot snap;
+        try
+        {
+            snap._sumUs = std::stoull(fields[3]);
+            for (std::size_t i = 0; i < NumBuckets; ++i)
+                snap._buckets[i] = std::stoull(buckets[i]);
+        }
+        catch (const std::exception&)
+        {
+            continue; // Malformed; ignore.
+        }
+
+        get(*description).merge(snap);
+        ++merged;
+    }
+
+    return merged;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
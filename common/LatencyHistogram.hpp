@@ -0,0 +1,139 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/// A latency histogram with fixed log-scale buckets, exported in the
+/// Prometheus histogram format.
+///
+/// Observing is lock-free: each thread accumulates into one of a few
+/// cache-line-aligned shards with relaxed atomics, and the shards are
+/// only merged when the histogram is read (i.e. on scrape).
+///
+/// Histograms are registered by name and label-set via get(), which
+/// returns a reference that stays valid for the lifetime of the process,
+/// so hot paths can cache it in a function-local static.
+class LatencyHistogram
+{
+public:
+    /// Bucket i counts observations of at most (FirstBucketUs << i) microseconds.
+    /// The last bucket is +Inf.
+    static constexpr std::size_t NumBuckets = 21;
+    static constexpr std::uint64_t FirstBucketUs = 100;
+
+    /// Concurrent observers are spread over this many shards.
+    static constexpr std::size_t NumShards = 16;
+
+    /// The merged state of a histogram.
+    struct Snapshot
+    {
+        Snapshot()
+            : _buckets{}
+            , _sumUs(0)
+        {
+        }
+
+        std::uint64_t getCount() const;
+
+        /// Returns the upper bound of the bucket in which
+        /// the given percentile (0-1) falls, in microseconds.
+        /// Returns 0 when empty, and UINT64_MAX for the +Inf bucket.
+        std::uint64_t getPercentileUs(double percentile) const;
+
+        /// Returns the observations added since @older was taken.
+        Snapshot operator-(const Snapshot& older) const;
+
+        std::array<std::uint64_t, NumBuckets> _buckets; ///< Not cumulative.
+        std::uint64_t _sumUs;
+    };
+
+    /// Identifies a histogram, by name and labels, and describes it.
+    struct Description
+    {
+        const char* _name;
+        const char* _labels;
+        const char* _help;
+    };
+
+    /// The histograms that kits observe and report to WSD, which merges no others.
+    static const Description KitTileRender;
+    static const Description KitTileEncode;
+    static const std::vector<Description> KitHistograms;
+
+    /// Returns the histogram @name with the given @labels (e.g. op="GetFile", may be empty),
+    /// creating it if necessary. The @help text is used if it isn't yet set.
+    static LatencyHistogram& get(const std::string& name, const std::string& labels,
+                                 const std::string& help);
+
+    /// Returns the histogram of @description, creating it if necessary.
+    static LatencyHistogram& get(const Description& description)
+    {
+        return get(description._name, description._labels, description._help);
+    }
+
+    /// Returns the index of the bucket for the given duration in microseconds.
+    static std::size_t getBucketIndex(std::uint64_t us);
+
+    /// Returns the upper bound of bucket @index in microseconds (UINT64_MAX for the last).
+    static std::uint64_t getBucketBoundUs(std::size_t index);
+
+    template <typename Rep, typename Period>
+    void observe(const std::chrono::duration<Rep, Period>& duration)
+    {
+        const auto us = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+        observeUs(us > 0 ? us : 0);
+    }
+
+    void observeUs(std::uint64_t us);
+
+    /// Adds the observations of another histogram, e.g. one reported by a kit.
+    void merge(const Snapshot& snapshot);
+
+    /// Merges the shards.
+    Snapshot snapshot() const;
+
+    /// Writes the histogram series (buckets, sum and count), without the HELP and TYPE lines.
+    void print(std::ostream& os, const std::string& name,
+               const std::string& labels = std::string()) const;
+
+    /// Writes all registered histograms in the Prometheus text format.
+    static void printAll(std::ostream& os);
+
+    /// Serializes the observations since the last call, one histogram per line,
+    /// for a kit to report to WSD. Returns an empty string if there is nothing new.
+    static std::string serializeNew();
+
+    /// Merges histograms serialized with serializeNew() in another process,
+    /// only those of the @allowed names and labels, with the help given there.
+    /// Returns the number of histograms merged.
+    static std::size_t mergeSerialized(const std::string& data,
+                                       const std::vector<Description>& allowed);
+
+private:
+    LatencyHistogram() = default;
+
+    struct alignas(64) Shard
+    {
+        std::array<std::atomic<std::uint64_t>, NumBuckets> _buckets{};
+        std::atomic<std::uint64_t> _sumUs{ 0 };
+    };
+
+    Shard& getShard();
+
+    std::array<Shard, NumShards> _shards;
+};
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -22,6 +22,18 @@
 #include "Log.hpp"
 #include <TileDesc.hpp>
 
+namespace
+{
+/// How long each lane may wait for busier ones, before it's served first.
+constexpr std::chrono::milliseconds MaxLaneWait[] = {
+    std::chrono::milliseconds(0), // Input is first anyway.
+    std::chrono::milliseconds(100), // Callback
+    std::chrono::milliseconds(200), // Tile
+    std::chrono::milliseconds(1000), // OffscreenTile
+    std::chrono::milliseconds(2000), // Preview
+};
+}
+
 void TileQueue::put_impl(const Payload& value)
 {
     const std::string firstToken = LOOLProtocol::getFirstToken(value);
@@ -30,33 +42,33 @@ void TileQueue::put_impl(const Payload& value)
     {
         const std::string msg = std::string(value.data(), value.size());
         LOG_TRC("Processing [" << LOOLProtocol::getAbbreviatedMessage(msg)
-                               << "]. Before canceltiles have " << getQueue().size()
-                               << " in queue.");
+                               << "]. Before canceltiles have " << size() << " in queue.");
         const std::string seqs = msg.substr(12);
         StringVector tokens(StringVector::tokenize(seqs, ','));
-        getQueue().erase(std::remove_if(getQueue().begin(), getQueue().end(),
-                [&tokens](const Payload& v)
-                {
-                    const std::string s(v.data(), v.size());
-                    // Tile is for a thumbnail, don't cancel it
-                    if (s.find("id=") != std::string::npos)
-                        return false;
-                    for (size_t i = 0; i < tokens.size(); ++i)
+        // The previews, in their own lane, are not cancelled.
+        for (const Lane lane : { Lane::Tile, Lane::OffscreenTile })
+        {
+            std::vector<Payload>& queue = getLane(lane);
+            queue.erase(std::remove_if(queue.begin(), queue.end(),
+                    [&tokens](const Payload& v)
                     {
-                        if (s.find("ver=" + tokens[i]) != std::string::npos)
+                        const std::string s(v.data(), v.size());
+                        for (size_t i = 0; i < tokens.size(); ++i)
                         {
-                            LOG_TRC("Matched " << tokens[i] << ", Removing [" << s << ']');
-                            return true;
+                            if (s.find("ver=" + tokens[i]) != std::string::npos)
+                            {
+                                LOG_TRC("Matched " << tokens[i] << ", Removing [" << s << ']');
+                                return true;
+                            }
                         }
-                    }
 
-                    return false;
+                        return false;
 
-                }), getQueue().end());
+                    }), queue.end());
+        }
 
         // Don't push canceltiles into the queue.
-        LOG_TRC("After canceltiles have " << getQueue().size() << " in queue.");
-        return;
+        LOG_TRC("After canceltiles have " << size() << " in queue.");
     }
     else if (firstToken == "tilecombine")
     {
@@ -70,16 +82,15 @@ void TileQueue::put_impl(const Payload& value)
 
             removeTileDuplicate(newMsg);
 
-            MessageQueue::put_impl(Payload(newMsg.data(), newMsg.data() + newMsg.size()));
+            getLane(getTileLane(tile)).emplace_back(newMsg.data(), newMsg.data() + newMsg.size());
         }
-        return;
     }
     else if (firstToken == "tile")
     {
-        removeTileDuplicate(std::string(value.data(), value.size()));
+        const std::string msg = std::string(value.data(), value.size());
+        removeTileDuplicate(msg);
 
-        MessageQueue::put_impl(value);
-        return;
+        getLane(getTileLane(TileDesc::parse(msg))).emplace_back(value);
     }
     else if (firstToken == "callback")
     {
@@ -87,17 +98,157 @@ void TileQueue::put_impl(const Payload& value)
 
         if (newMsg.empty())
         {
-            MessageQueue::put_impl(value);
+            getLane(Lane::Callback).emplace_back(value);
         }
         else
         {
-            MessageQueue::put_impl(Payload(newMsg.data(), newMsg.data() + newMsg.size()));
+            getLane(Lane::Callback).emplace_back(newMsg.data(), newMsg.data() + newMsg.size());
         }
+    }
+    else
+    {
+        if (LOOLProtocol::matchPrefix("child-", firstToken))
+            trackVisibleArea(StringVector::tokenize(value.data(), value.size()));
 
+        MessageQueue::put_impl(value);
+    }
+
+    updateWaiting(_clock());
+}
+
+TileQueue::Lane TileQueue::getTileLane(const TileDesc& tile) const
+{
+    if (tile.getId() >= 0)
+        return Lane::Preview;
+
+    return isVisible(tile) ? Lane::Tile : Lane::OffscreenTile;
+}
+
+void TileQueue::trackVisibleArea(const StringVector& tokens)
+{
+    // "child-<id> clientvisiblearea x=<x> y=<y> width=<w> height=<h> [splitx=<x> splity=<y>]"
+    if (tokens.equals(1, "disconnect"))
+    {
+        _visibleParts.erase(tokens[0]);
+        if (_visibleAreas.erase(tokens[0]))
+            reclassifyTiles();
         return;
     }
 
-    MessageQueue::put_impl(value);
+    // "child-<id> setclientpart part=<part>", the sheet or the slide it sees, not in Writer.
+    if (tokens.equals(1, "setclientpart"))
+    {
+        int part = 0;
+        if (tokens.size() < 3 || !LOOLProtocol::getTokenInteger(tokens[2], "part", part))
+            return;
+
+        const auto it = _visibleParts.find(tokens[0]);
+        if (it != _visibleParts.end() && it->second == part)
+            return;
+
+        _visibleParts[tokens[0]] = part;
+        if (_visibleAreas.find(tokens[0]) != _visibleAreas.end())
+            reclassifyTiles();
+        return;
+    }
+
+    int x = 0;
+    int y = 0;
+    int width = 0;
+    int height = 0;
+    if (!tokens.equals(1, "clientvisiblearea") || tokens.size() < 6 ||
+        !LOOLProtocol::getTokenInteger(tokens[2], "x", x) ||
+        !LOOLProtocol::getTokenInteger(tokens[3], "y", y) ||
+        !LOOLProtocol::getTokenInteger(tokens[4], "width", width) ||
+        !LOOLProtocol::getTokenInteger(tokens[5], "height", height))
+    {
+        return;
+    }
+
+    // The frozen rows and columns stay in view, whatever the scrolling.
+    int splitX = 0;
+    int splitY = 0;
+    if (tokens.size() >= 8 && LOOLProtocol::getTokenInteger(tokens[6], "splitx", splitX) &&
+        LOOLProtocol::getTokenInteger(tokens[7], "splity", splitY))
+    {
+        if (splitX > 0)
+        {
+            width += std::max(x, 0);
+            x = 0;
+        }
+
+        if (splitY > 0)
+        {
+            height += std::max(y, 0);
+            y = 0;
+        }
+    }
+
+    const Util::Rectangle area(x, y, width, height);
+    const auto it = _visibleAreas.find(tokens[0]);
+    if (it != _visibleAreas.end() && it->second.getLeft() == area.getLeft() &&
+        it->second.getTop() == area.getTop() && it->second.getRight() == area.getRight() &&
+        it->second.getBottom() == area.getBottom())
+    {
+        return;
+    }
+
+    _visibleAreas[tokens[0]] = area;
+    reclassifyTiles();
+}
+
+bool TileQueue::isVisible(const TileDesc& tile) const
+{
+    // Until we know what the clients see, all may be.
+    if (_visibleAreas.empty())
+        return true;
+
+    for (const auto& pair : _visibleAreas)
+    {
+        // The area is of the part the session shows, when it has parts.
+        const auto part = _visibleParts.find(pair.first);
+        if (part != _visibleParts.end() && part->second != tile.getPart())
+            continue;
+
+        const Util::Rectangle& area = pair.second;
+        if (tile.intersectsWithRect(area.getLeft(), area.getTop(), area.getWidth(),
+                                    area.getHeight()))
+            return true;
+    }
+
+    return false;
+}
+
+void TileQueue::reclassifyTiles()
+{
+    std::vector<Payload> visible;
+    std::vector<Payload> offscreen;
+    for (const Lane lane : { Lane::Tile, Lane::OffscreenTile })
+    {
+        for (Payload& payload : getLane(lane))
+        {
+            const TileDesc tile = TileDesc::parse(std::string(payload.data(), payload.size()));
+            (isVisible(tile) ? visible : offscreen).push_back(std::move(payload));
+        }
+    }
+
+    LOG_TRC("Reclassified tiles: " << visible.size() << " visible, " << offscreen.size()
+                                   << " offscreen.");
+    getLane(Lane::Tile) = std::move(visible);
+    getLane(Lane::OffscreenTile) = std::move(offscreen);
+    updateWaiting(_clock());
+}
+
+void TileQueue::updateWaiting(std::chrono::steady_clock::time_point now)
+{
+    for (int i = 0; i < LaneCount; ++i)
+    {
+        LaneState& state = _lanes[i];
+        if (getLane(static_cast<Lane>(i)).empty())
+            state._waitingSince = std::chrono::steady_clock::time_point();
+        else if (state._waitingSince == std::chrono::steady_clock::time_point())
+            state._waitingSince = now;
+    }
 }
 
 void TileQueue::removeTileDuplicate(const std::string& tileMsg)
@@ -114,15 +265,19 @@ void TileQueue::removeTileDuplicate(const std::string& tileMsg)
         newMsgPos = tileMsg.size() - 1;
     }
 
-    for (size_t i = 0; i < getQueue().size(); ++i)
+    for (const Lane lane : { Lane::Tile, Lane::OffscreenTile, Lane::Preview })
     {
-        auto& it = getQueue()[i];
-        if (it.size() > newMsgPos &&
-            strncmp(tileMsg.data(), it.data(), newMsgPos) == 0)
+        std::vector<Payload>& queue = getLane(lane);
+        for (size_t i = 0; i < queue.size(); ++i)
         {
-            LOG_TRC("Remove duplicate tile request: " << std::string(it.data(), it.size()) << " -> " << LOOLProtocol::getAbbreviatedMessage(tileMsg));
-            getQueue().erase(getQueue().begin() + i);
-            break;
+            auto& it = queue[i];
+            if (it.size() > newMsgPos &&
+                strncmp(tileMsg.data(), it.data(), newMsgPos) == 0)
+            {
+                LOG_TRC("Remove duplicate tile request: " << std::string(it.data(), it.size()) << " -> " << LOOLProtocol::getAbbreviatedMessage(tileMsg));
+                queue.erase(queue.begin() + i);
+                return;
+            }
         }
     }
 }
@@ -206,6 +361,8 @@ std::string TileQueue::removeCallbackDuplicate(const std::string& callbackMsg)
 
     const auto callbackType = static_cast<LibreOfficeKitCallbackType>(pair.first);
 
+    std::vector<Payload>& queue = getLane(Lane::Callback);
+
     switch (callbackType)
     {
         case LOK_CALLBACK_INVALIDATE_TILES: // invalidation
@@ -219,9 +376,9 @@ std::string TileQueue::removeCallbackDuplicate(const std::string& callbackMsg)
 
             // we always travel the entire queue
             std::size_t i = 0;
-            while (i < getQueue().size())
+            while (i < queue.size())
             {
-                auto& it = getQueue()[i];
+                auto& it = queue[i];
 
                 StringVector queuedTokens = StringVector::tokenize(it.data(), it.size());
                 if (queuedTokens.size() < 3)
@@ -269,7 +426,7 @@ std::string TileQueue::removeCallbackDuplicate(const std::string& callbackMsg)
                             << msgW << ' ' << msgH << ' ' << msgPart << ' ' << msgMode);
 
                     // remove from the queue
-                    getQueue().erase(getQueue().begin() + i);
+                    queue.erase(queue.begin() + i);
                     continue;
                 }
 
@@ -307,7 +464,7 @@ std::string TileQueue::removeCallbackDuplicate(const std::string& callbackMsg)
                     performedMerge = true;
 
                     // remove from the queue
-                    getQueue().erase(getQueue().begin() + i);
+                    queue.erase(queue.begin() + i);
                     continue;
                 }
 
@@ -346,9 +503,9 @@ std::string TileQueue::removeCallbackDuplicate(const std::string& callbackMsg)
                 return std::string();
 
             // remove obsolete states of the same .uno: command
-            for (std::size_t i = 0; i < getQueue().size(); ++i)
+            for (std::size_t i = 0; i < queue.size(); ++i)
             {
-                auto& it = getQueue()[i];
+                auto& it = queue[i];
 
                 StringVector queuedTokens = StringVector::tokenize(it.data(), it.size());
                 if (queuedTokens.size() < 4)
@@ -369,7 +526,7 @@ std::string TileQueue::removeCallbackDuplicate(const std::string& callbackMsg)
                     LOG_TRC("Remove obsolete uno command: "
                             << std::string(it.data(), it.size()) << " -> "
                             << LOOLProtocol::getAbbreviatedMessage(callbackMsg));
-                    getQueue().erase(getQueue().begin() + i);
+                    queue.erase(queue.begin() + i);
                     break;
                 }
             }
@@ -392,9 +549,9 @@ std::string TileQueue::removeCallbackDuplicate(const std::string& callbackMsg)
             const std::string viewId
                 = (isViewCallback ? extractViewId(callbackMsg, tokens) : std::string());
 
-            for (std::size_t i = 0; i < getQueue().size(); ++i)
+            for (std::size_t i = 0; i < queue.size(); ++i)
             {
-                const auto& it = getQueue()[i];
+                const auto& it = queue[i];
 
                 // skip non-callbacks quickly
                 if (!LOOLProtocol::matchPrefix("callback", it))
@@ -410,7 +567,7 @@ std::string TileQueue::removeCallbackDuplicate(const std::string& callbackMsg)
                     LOG_TRC("Remove obsolete callback: "
                             << std::string(it.data(), it.size()) << " -> "
                             << LOOLProtocol::getAbbreviatedMessage(callbackMsg));
-                    getQueue().erase(getQueue().begin() + i);
+                    queue.erase(queue.begin() + i);
                     break;
                 }
                 else if (isViewCallback
@@ -428,7 +585,7 @@ std::string TileQueue::removeCallbackDuplicate(const std::string& callbackMsg)
                         LOG_TRC("Remove obsolete view callback: "
                                 << std::string(it.data(), it.size()) << " -> "
                                 << LOOLProtocol::getAbbreviatedMessage(callbackMsg));
-                        getQueue().erase(getQueue().begin() + i);
+                        queue.erase(queue.begin() + i);
                         break;
                     }
                 }
@@ -459,69 +616,81 @@ int TileQueue::priority(const std::string& tileMsg)
     return -1;
 }
 
-void TileQueue::deprioritizePreviews()
+TileQueue::Lane TileQueue::nextLane(std::chrono::steady_clock::time_point now)
 {
-    for (size_t i = 0; i < getQueue().size(); ++i)
+    // Serve a lane that waited too long first, lest busier ones starve it.
+    for (int i = static_cast<int>(Lane::Callback); i < LaneCount; ++i)
     {
-        const Payload front = getQueue().front();
-        const std::string message(front.data(), front.size());
-
-        // stop at the first non-tile or non-'id' (preview) message
-        std::string id;
-        if (!LOOLProtocol::matchPrefix("tile", message) ||
-            !LOOLProtocol::getTokenStringFromMessage(message, "id", id))
+        const Lane lane = static_cast<Lane>(i);
+        if (!getLane(lane).empty() && now - _lanes[i]._waitingSince > MaxLaneWait[i])
         {
-            break;
+            LOG_TRC("TileQueue lane " << nameShort(lane) << " waited for "
+                                      << std::chrono::duration_cast<std::chrono::milliseconds>(
+                                             now - _lanes[i]._waitingSince)
+                                             .count()
+                                      << "ms, serving it first.");
+            ++_lanes[i]._aged;
+            return lane;
         }
+    }
 
-        getQueue().erase(getQueue().begin());
-        getQueue().push_back(front);
+    for (int i = 0; i < LaneCount; ++i)
+    {
+        if (!getLane(static_cast<Lane>(i)).empty())
+            return static_cast<Lane>(i);
     }
+
+    return Lane::Input;
 }
 
 TileQueue::Payload TileQueue::get_impl()
 {
-    LOG_TRC("MessageQueue depth: " << getQueue().size());
-
-    const Payload front = getQueue().front();
-
-    std::string msg(front.data(), front.size());
-
-    std::string id;
-    bool isTile = LOOLProtocol::matchPrefix("tile", msg);
-    bool isPreview = isTile && LOOLProtocol::getTokenStringFromMessage(msg, "id", id);
-    if (!isTile || isPreview)
+    LOG_TRC("MessageQueue depth: " << size());
+
+    const auto now = _clock();
+    const Lane lane = nextLane(now);
+    std::vector<Payload>& queue = getLane(lane);
+    if (queue.empty())
+        return Payload();
+
+    LaneState& state = _lanes[static_cast<int>(lane)];
+    const auto waited = now - state._waitingSince;
+    ++state._served;
+    state._totalWait += waited;
+    state._maxWait = std::max(state._maxWait, waited);
+
+    Payload result;
+    if (lane == Lane::Tile || lane == Lane::OffscreenTile)
+    {
+        result = getTiles(lane);
+    }
+    else
     {
         // Don't combine non-tiles or tiles with id.
-        LOG_TRC("MessageQueue res: " << LOOLProtocol::getAbbreviatedMessage(msg));
-        getQueue().erase(getQueue().begin());
+        result = queue.front();
+        queue.erase(queue.begin());
+        LOG_TRC("MessageQueue res: " << LOOLProtocol::getAbbreviatedMessage(result));
+    }
 
-        // de-prioritize the other tiles with id - usually the previews in
-        // Impress
-        if (isPreview)
-            deprioritizePreviews();
+    state._waitingSince = std::chrono::steady_clock::time_point();
+    updateWaiting(now);
+    return result;
+}
 
-        return front;
-    }
+TileQueue::Payload TileQueue::getTiles(Lane lane)
+{
+    std::vector<Payload>& queue = getLane(lane);
+    std::string msg(queue.front().data(), queue.front().size());
 
-    // We are handling a tile; first try to find one that is at the cursor's
-    // position, otherwise handle the one that is at the front
+    // First try to find one that is at the cursor's position, otherwise
+    // handle the one that is at the front
     int prioritized = 0;
     int prioritySoFar = -1;
-    for (size_t i = 0; i < getQueue().size(); ++i)
+    for (size_t i = 0; i < queue.size(); ++i)
     {
-        auto& it = getQueue()[i];
+        auto& it = queue[i];
         const std::string prio(it.data(), it.size());
 
-        // avoid starving - stop the search when we reach a non-tile,
-        // otherwise we may keep growing the queue of unhandled stuff (both
-        // tiles and non-tiles)
-        if (!LOOLProtocol::matchPrefix("tile", prio) ||
-            LOOLProtocol::getTokenStringFromMessage(prio, "id", id))
-        {
-            break;
-        }
-
         const int p = priority(prio);
         if (p > prioritySoFar)
         {
@@ -537,40 +706,38 @@ TileQueue::Payload TileQueue::get_impl()
         }
     }
 
-    getQueue().erase(getQueue().begin() + prioritized);
+    queue.erase(queue.begin() + prioritized);
 
     std::vector<TileDesc> tiles;
     tiles.emplace_back(TileDesc::parse(msg));
 
-    // Combine as many tiles as possible with the top one.
-    for (size_t i = 0; i < getQueue().size(); )
+    // Combine as many tiles as possible with the top one, the visible and the
+    // offscreen ones alike, as rendering a row at once is cheaper.
+    for (const Lane other : { lane, lane == Lane::Tile ? Lane::OffscreenTile : Lane::Tile })
     {
-        auto& it = getQueue()[i];
-        msg = std::string(it.data(), it.size());
-        if (!LOOLProtocol::matchPrefix("tile", msg) ||
-            LOOLProtocol::getTokenStringFromMessage(msg, "id", id))
+        std::vector<Payload>& candidates = getLane(other);
+        for (size_t i = 0; i < candidates.size(); )
         {
-            // Don't combine non-tiles or tiles with id.
-            ++i;
-            continue;
-        }
+            auto& it = candidates[i];
+            msg = std::string(it.data(), it.size());
 
-        TileDesc tile2 = TileDesc::parse(msg);
-        LOG_TRC("Combining candidate: " << LOOLProtocol::getAbbreviatedMessage(msg));
+            TileDesc tile2 = TileDesc::parse(msg);
+            LOG_TRC("Combining candidate: " << LOOLProtocol::getAbbreviatedMessage(msg));
 
-        // Check if it's on the same row.
-        if (tiles[0].canCombine(tile2))
-        {
-            tiles.emplace_back(tile2);
-            getQueue().erase(getQueue().begin() + i);
-        }
-        else
-        {
-            ++i;
+            // Check if it's on the same row.
+            if (tiles[0].canCombine(tile2))
+            {
+                tiles.emplace_back(tile2);
+                candidates.erase(candidates.begin() + i);
+            }
+            else
+            {
+                ++i;
+            }
         }
     }
 
-    LOG_TRC("Combined " << tiles.size() << " tiles, leaving " << getQueue().size() << " in queue.");
+    LOG_TRC("Combined " << tiles.size() << " tiles, leaving " << size() << " in queue.");
 
     if (tiles.size() == 1)
     {
@@ -634,7 +801,56 @@ void TileQueue::dumpState(std::ostream& oss)
         oss << separator << viewId;
         separator = ", ";
     }
-    oss << "]\n";
+    oss << ']';
+
+    oss << "\n\t\tvisibleAreas:";
+    for (const auto& it : _visibleAreas)
+    {
+        oss << "\n\t\t\t" << it.first
+            << " x: " << it.second.getLeft()
+            << " y: " << it.second.getTop()
+            << " width: " << it.second.getWidth()
+            << " height: " << it.second.getHeight();
+
+        const auto part = _visibleParts.find(it.first);
+        if (part != _visibleParts.end())
+            oss << " part: " << part->second;
+    }
+
+    oss << "\n\t\tlanes:";
+    for (int i = 0; i < LaneCount; ++i)
+    {
+        const LaneState& state = _lanes[i];
+        const auto totalWaitUs =
+            std::chrono::duration_cast<std::chrono::microseconds>(state._totalWait).count();
+        oss << "\n\t\t\t" << nameShort(static_cast<Lane>(i))
+            << " depth: " << getLane(static_cast<Lane>(i)).size()
+            << " served: " << state._served
+            << " aged: " << state._aged
+            << " avgWaitUs: "
+            << (state._served ? totalWaitUs / static_cast<std::int64_t>(state._served) : 0)
+            << " maxWaitUs: "
+            << std::chrono::duration_cast<std::chrono::microseconds>(state._maxWait).count();
+    }
+    oss << '\n';
+}
+
+void TileQueue::clear_impl()
+{
+    MessageQueue::clear_impl();
+    for (LaneState& state : _lanes)
+    {
+        state._queue.clear();
+        state._waitingSince = std::chrono::steady_clock::time_point();
+    }
+}
+
+std::size_t TileQueue::size_impl() const
+{
+    std::size_t size = 0;
+    for (int i = 0; i < LaneCount; ++i)
+        size += getLane(static_cast<Lane>(i)).size();
+    return size;
 }
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -11,6 +11,9 @@
 
 #include <stdexcept>
 #include <algorithm>
+#include <array>
+#include <cassert>
+#include <chrono>
 #include <functional>
 #include <map>
 #include <string>
@@ -18,6 +21,10 @@
 
 #include "Log.hpp"
 #include "Protocol.hpp"
+#include "Rectangle.hpp"
+#include "StateEnum.hpp"
+
+class TileDesc;
 
 /// Thread-safe message queue (FIFO).
 class MessageQueue
@@ -64,15 +71,21 @@ public:
     /// Get a message without waiting
     Payload pop()
     {
-        if (_queue.empty())
+        if (isEmpty())
             return Payload();
         return get_impl();
     }
 
     /// Anything in the queue ?
-    bool isEmpty()
+    bool isEmpty() const
     {
-        return _queue.empty();
+        return size() == 0;
+    }
+
+    /// The number of queued messages.
+    std::size_t size() const
+    {
+        return size_impl();
     }
 
     /// Thread safe removal of all the pending messages.
@@ -120,12 +133,18 @@ protected:
         return result;
     }
 
-    void clear_impl()
+    virtual void clear_impl()
     {
         _queue.clear();
     }
 
+    virtual std::size_t size_impl() const
+    {
+        return _queue.size();
+    }
+
     std::vector<Payload>& getQueue() { return _queue; }
+    const std::vector<Payload>& getQueue() const { return _queue; }
 
     /// Search the queue for a previous textinput message and if found, remove it and combine its
     /// input with that in the current textinput message. We check that there aren't any interesting
@@ -250,6 +269,12 @@ private:
 };
 
 /// MessageQueue specialized for priority handling of tiles.
+///
+/// Messages are queued in lanes, served in the order of their priority:
+/// user input first, so that a backlog of tiles doesn't delay typing, then
+/// callbacks, tiles visible to a client (those at the cursors first), tiles
+/// requested ahead of scrolling, and last the previews of parts. A lane
+/// left waiting longer than its limit by busier ones is served next.
 class TileQueue : public MessageQueue
 {
     friend class TileQueueTests;
@@ -282,7 +307,39 @@ private:
         int _height = 0;
     };
 
+    STATE_ENUM(Lane,
+               Input, //< User input and other session messages, in order.
+               Callback, //< LOK callbacks, to send to the clients.
+               Tile, //< Tiles a client sees, or all until we know what they see.
+               OffscreenTile, //< Tiles a client requested ahead of scrolling to them.
+               Preview //< Thumbnails of the parts, tiles with 'id'.
+    );
+
+    static constexpr int LaneCount = static_cast<int>(Lane::Preview) + 1;
+
+    class LaneState
+    {
+    public:
+        /// The queue of the lane, but that of Input is MessageQueue's.
+        std::vector<Payload> _queue;
+        /// Since it was last served, or since its first message was queued.
+        std::chrono::steady_clock::time_point _waitingSince;
+        std::size_t _served = 0;
+        /// How many times it was served first for having waited too long.
+        std::size_t _aged = 0;
+        std::chrono::steady_clock::duration _totalWait = std::chrono::steady_clock::duration::zero();
+        std::chrono::steady_clock::duration _maxWait = std::chrono::steady_clock::duration::zero();
+    };
+
 public:
+    /// Tells the time the lanes wait, for tests to control it.
+    using Clock = std::function<std::chrono::steady_clock::time_point()>;
+
+    explicit TileQueue(Clock clock = std::chrono::steady_clock::now)
+        : _clock(std::move(clock))
+    {
+    }
+
     void updateCursorPosition(int viewId, int part, int x, int y, int width, int height)
     {
         const TileQueue::CursorPosition cursorPosition = CursorPosition(part, x, y, width, height);
@@ -326,7 +383,45 @@ protected:
 
     virtual Payload get_impl() override;
 
+    virtual void clear_impl() override;
+
+    virtual std::size_t size_impl() const override;
+
 private:
+    std::vector<Payload>& getLane(Lane lane)
+    {
+        return lane == Lane::Input ? getQueue() : _lanes[static_cast<int>(lane)]._queue;
+    }
+
+    const std::vector<Payload>& getLane(Lane lane) const
+    {
+        return lane == Lane::Input ? getQueue() : _lanes[static_cast<int>(lane)]._queue;
+    }
+
+    /// The lane of the given tile message.
+    Lane getTileLane(const TileDesc& tile) const;
+
+    /// The lane to serve next: the first that waited too long, or else the
+    /// first with anything in it.
+    Lane nextLane(std::chrono::steady_clock::time_point now);
+
+    /// Pops the tile at the highest priority off the @lane, combined with
+    /// those on its row from the tile lanes.
+    Payload getTiles(Lane lane);
+
+    /// Starts the wait of the lanes that got their first message, ends that of the emptied ones.
+    void updateWaiting(std::chrono::steady_clock::time_point now);
+
+    /// Tracks the area, and the part, each session sees from its messages,
+    /// to tell the visible tiles from the others.
+    void trackVisibleArea(const StringVector& tokens);
+
+    /// True iff the tile intersects the area a session sees, in the part it sees.
+    bool isVisible(const TileDesc& tile) const;
+
+    /// Moves the tiles that came into view, or went out of it, to their lane.
+    void reclassifyTiles();
+
     /// Search the queue for a duplicate tile and remove it (if present).
     void removeTileDuplicate(const std::string& tileMsg);
 
@@ -338,16 +433,22 @@ private:
     /// @return New message to put into the queue.  If empty, use what was in callbackMsg.
     std::string removeCallbackDuplicate(const std::string& callbackMsg);
 
-    /// De-prioritize the previews (tiles with 'id') - move them to the end of
-    /// the queue.
-    void deprioritizePreviews();
-
     /// Priority of the given tile message.
     /// -1 means the lowest prio (the tile does not intersect any of the cursors),
     /// the higher the number, the bigger is priority [up to _viewOrder.size()-1].
     int priority(const std::string& tileMsg);
 
 private:
+    const Clock _clock;
+
+    std::array<LaneState, LaneCount> _lanes;
+
+    /// The area each session sees, by its "child-<id>" prefix.
+    std::map<std::string, Util::Rectangle> _visibleAreas;
+
+    /// The part each session sees, once it set one, by its "child-<id>" prefix.
+    std::map<std::string, int> _visibleParts;
+
     std::map<int, CursorPosition> _cursorPositions;
 
     /// Check the views in the order of how the editing (cursor movement) has
@@ -19,6 +19,7 @@
 
 #include "Png.hpp"
 #include "Delta.hpp"
+#include "LatencyHistogram.hpp"
 #include "Rectangle.hpp"
 #include "TileDesc.hpp"
 
@@ -239,6 +240,11 @@ namespace RenderTiles
                                 renderArea.getLeft(), renderArea.getTop(),
                                 renderArea.getWidth(), renderArea.getHeight());
         auto duration = std::chrono::steady_clock::now() - start;
+#if !MOBILEAPP
+        static LatencyHistogram& renderHistogram =
+            LatencyHistogram::get(LatencyHistogram::KitTileRender);
+        renderHistogram.observe(duration);
+#endif
         const auto elapsedMs = std::chrono::duration_cast<std::chrono::milliseconds>(duration);
         const double elapsedMics = elapsedMs.count() * 1000.; // Need MPixels/sec, use Pixels/mics.
         LOG_DBG("paintPartTile at ("
@@ -295,6 +301,7 @@ namespace RenderTiles
                 pngPool.pushWork([=,&output,&pixmap,&tiles,&renderedTiles,
                                   &pngMutex,&deltaGen]()
                     {
+                        const auto encodeStart = std::chrono::steady_clock::now();
                         std::vector< char > data;
                         data.reserve(pixmapWidth * pixmapHeight * 1);
 
@@ -329,6 +336,12 @@ namespace RenderTiles
                             }
                         }
 
+#if !MOBILEAPP
+                        static LatencyHistogram& encodeHistogram =
+                            LatencyHistogram::get(LatencyHistogram::KitTileEncode);
+                        encodeHistogram.observe(std::chrono::steady_clock::now() - encodeStart);
+#endif
+
                         LOG_TRC("Tile " << tileIndex << " is " << data.size() << " bytes.");
                         std::unique_lock<std::mutex> pngLock(pngMutex);
                         output.insert(output.end(), data.begin(), data.end());
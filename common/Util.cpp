@@ -373,6 +373,29 @@ namespace Util
         return totalMemKb;
     }
 
+    std::size_t getAvailableSystemMemoryKb()
+    {
+        std::size_t availMemKb = 0;
+        FILE* file = fopen("/proc/meminfo", "r");
+        if (file != nullptr)
+        {
+            char line[4096] = { 0 };
+            while (fgets(line, sizeof(line), file))
+            {
+                const char* value;
+                if ((value = startsWith(line, "MemAvailable:", 13)))
+                {
+                    availMemKb = atoi(value);
+                    break;
+                }
+            }
+
+            fclose(file);
+        }
+
+        return availMemKb;
+    }
+
     std::pair<std::size_t, std::size_t> getPssAndDirtyFromSMaps(FILE* file)
     {
         std::size_t numPSSKb = 0;
@@ -403,6 +426,68 @@ namespace Util
         return std::make_pair(numPSSKb, numDirtyKb);
     }
 
+    bool readProcFile(int fd, std::string& buffer)
+    {
+        // Keep the capacity across calls, to avoid allocating when sampling many processes.
+        buffer.resize(std::max<std::size_t>(buffer.capacity(), 4096));
+        std::size_t size = 0;
+        for (;;)
+        {
+            if (size == buffer.size())
+                buffer.resize(buffer.size() * 2);
+
+            const ssize_t n = ::pread(fd, &buffer[size], buffer.size() - size, size);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+
+                buffer.clear();
+                return false;
+            }
+
+            if (n == 0)
+                break;
+
+            size += n;
+        }
+
+        buffer.resize(size);
+        return true;
+    }
+
+    std::pair<std::size_t, std::size_t> getPssAndDirtyFromSMaps(int fd)
+    {
+        static thread_local std::string buffer;
+
+        std::size_t numPSSKb = 0;
+        std::size_t numDirtyKb = 0;
+        if (fd < 0 || !readProcFile(fd, buffer))
+            return std::make_pair(numPSSKb, numDirtyKb);
+
+        // Same as above, but on the buffer; with smaps_rollup there is a single record.
+        const char* line = buffer.c_str();
+        const char* const end = line + buffer.size();
+        while (line < end)
+        {
+            if (line[0] == 'P')
+            {
+                const char* value;
+                if ((value = startsWith(line, "Private_Dirty:", 14)))
+                    numDirtyKb += atoi(value);
+                else if ((value = startsWith(line, "Pss:", 4)))
+                    numPSSKb += atoi(value);
+            }
+
+            line = static_cast<const char*>(memchr(line, '\n', end - line));
+            if (!line)
+                break;
+            ++line;
+        }
+
+        return std::make_pair(numPSSKb, numDirtyKb);
+    }
+
     std::string getMemoryStats(FILE* file)
     {
         const std::pair<std::size_t, std::size_t> pssAndDirtyKb = getPssAndDirtyFromSMaps(file);
@@ -418,8 +503,11 @@ namespace Util
     {
         if (pid > 0)
         {
-            const auto cmd = "/proc/" + std::to_string(pid) + "/smaps";
-            FILE* fp = fopen(cmd.c_str(), "r");
+            // smaps_rollup is much cheaper, but needs Linux 4.14.
+            const std::string proc = "/proc/" + std::to_string(pid);
+            FILE* fp = fopen((proc + "/smaps_rollup").c_str(), "r");
+            if (fp == nullptr)
+                fp = fopen((proc + "/smaps").c_str(), "r");
             if (fp != nullptr)
             {
                 const std::size_t pss = getPssAndDirtyFromSMaps(fp).first;
@@ -446,20 +534,31 @@ namespace Util
         return 0;
     }
 
-    std::size_t getCpuUsage(const pid_t pid)
+    /// Returns the 0-based field @ind of a /proc/<pid>/stat line.
+    static std::size_t getStatField(const std::string& stat, int ind)
     {
-        if (pid > 0)
+        // The command name (field 1) may contain spaces; skip to its closing parenthesis.
+        std::size_t pos = stat.rfind(')');
+        if (pos == std::string::npos || ind < 2)
+            return 0;
+
+        int index = 2;
+        pos = stat.find(' ', pos);
+        while (pos != std::string::npos)
         {
-            std::size_t totalJiffies = 0;
-            totalJiffies += getStatFromPid(pid, 13);
-            totalJiffies += getStatFromPid(pid, 14);
-            return totalJiffies;
+            if (index == ind)
+                return strtol(&stat[pos], nullptr, 10);
+
+            ++index;
+            pos = stat.find(' ', pos + 1);
         }
+
         return 0;
     }
 
-    std::size_t getStatFromPid(const pid_t pid, int ind)
+    static std::string readStat(const pid_t pid)
     {
+        std::string stat;
         if (pid > 0)
         {
             const auto cmd = "/proc/" + std::to_string(pid) + "/stat";
@@ -468,24 +567,32 @@ namespace Util
             {
                 char line[4096] = { 0 };
                 if (fgets(line, sizeof (line), fp))
-                {
-                    const std::string s(line);
-                    int index = 1;
-                    std::size_t pos = s.find(' ');
-                    while (pos != std::string::npos)
-                    {
-                        if (index == ind)
-                        {
-                            fclose(fp);
-                            return strtol(&s[pos], nullptr, 10);
-                        }
-                        ++index;
-                        pos = s.find(' ', pos + 1);
-                    }
-                }
+                    stat = line;
+                fclose(fp);
             }
         }
-        return 0;
+
+        return stat;
+    }
+
+    std::size_t getCpuUsage(const pid_t pid)
+    {
+        const std::string stat = readStat(pid);
+        return getStatField(stat, 13) + getStatField(stat, 14);
+    }
+
+    std::size_t getCpuUsageFromStat(int fd)
+    {
+        static thread_local std::string buffer;
+        if (fd < 0 || !readProcFile(fd, buffer))
+            return 0;
+
+        return getStatField(buffer, 13) + getStatField(buffer, 14);
+    }
+
+    std::size_t getStatFromPid(const pid_t pid, int ind)
+    {
+        return getStatField(readStat(pid), ind);
     }
 
     void setProcessAndThreadPriorities(const pid_t pid, int prio)
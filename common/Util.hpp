@@ -241,6 +241,9 @@ namespace Util
     /// Returns the total physical memory (in kB) available in the system
     size_t getTotalSystemMemoryKb();
 
+    /// Returns the physical memory (in kB) available for new allocations, per MemAvailable.
+    size_t getAvailableSystemMemoryKb();
+
     /// Returns the process PSS in KB (works only when we have perms for /proc/pid/smaps).
     size_t getMemoryUsagePSS(const pid_t pid);
 
@@ -255,8 +258,20 @@ namespace Util
     /// returns them as a pair in the same order
     std::pair<size_t, size_t> getPssAndDirtyFromSMaps(FILE* file);
 
+    /// As above, from an smaps or smaps_rollup file kept open as @fd.
+    /// Uses pread, so neither re-opens nor seeks the file.
+    std::pair<size_t, size_t> getPssAndDirtyFromSMaps(int fd);
+
+    /// Reads the whole of a /proc or /sys file, kept open as @fd, from offset 0 into @buffer.
+    /// Such files are regenerated on each read. Returns false on failure, eg. the process is gone.
+    bool readProcFile(int fd, std::string& buffer);
+
+    /// Returns the user and system time, in jiffies, of the process.
     size_t getCpuUsage(const pid_t pid);
 
+    /// As above, from a /proc/<pid>/stat file kept open as @fd.
+    size_t getCpuUsageFromStat(int fd);
+
     size_t getStatFromPid(const pid_t pid, int ind);
 
     /// Sets priorities for a given pid & the current thread
@@ -619,7 +634,7 @@ namespace Util
     /// Return true iff s ends with t.
     inline bool endsWith(const std::string& s, const std::string& t)
     {
-        return equal(t.rbegin(), t.rend(), s.rbegin());
+        return s.length() >= t.length() && equal(t.rbegin(), t.rend(), s.rbegin());
     }
 
 #ifdef IOS
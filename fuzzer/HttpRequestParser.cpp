@@ -0,0 +1,35 @@
+#include <cassert>
+
+#include "config.h"
+
+#include <net/HttpParser.hpp>
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    const char* input = reinterpret_cast<const char*>(data);
+
+    // All at once.
+    http::RequestParser whole;
+    const http::RequestParser::State state = whole.parse(input, size);
+
+    // As it would arrive over many reads, which must not change the outcome.
+    http::RequestParser incremental;
+    for (size_t i = 0; i <= size; ++i)
+    {
+        if (incremental.parse(input, i) != http::RequestParser::State::Incomplete)
+            break;
+    }
+
+    assert(incremental.getState() == state);
+    if (state == http::RequestParser::State::Complete)
+    {
+        assert(incremental.getHeaderSize() == whole.getHeaderSize());
+        assert(incremental.getFieldCount() == whole.getFieldCount());
+        assert(incremental.getUri() == whole.getUri());
+        assert(whole.getHeaderSize() <= size);
+    }
+
+    return 0;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
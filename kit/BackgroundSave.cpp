@@ -0,0 +1,286 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <config.h>
+
+#include "BackgroundSave.hpp"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+#define LOK_USE_UNSTABLE_API
+#include <LibreOfficeKit/LibreOfficeKit.hxx>
+
+#include <Poco/URI.h>
+
+#include <common/Log.hpp>
+#include <common/Util.hpp>
+#include <net/Socket.hpp>
+
+bool BackgroundSave::IsChild = false;
+
+BackgroundSave::BackgroundSave()
+    : _pid(0)
+    , _fd(-1)
+    , _timeout(std::chrono::seconds(5))
+    , _modifiedDuringSave(false)
+    , _reportedUnmodified(false)
+{
+}
+
+BackgroundSave::~BackgroundSave()
+{
+    if (isSaving())
+        poll(/*wait=*/true);
+}
+
+bool BackgroundSave::isSupportedFormat(const std::string& path)
+{
+    // Those we save without filter options, as .uno:Save does.
+    static const char* const extensions[] = { "odt", "ott",  "ods",  "ots", "odp", "otp",
+                                              "odg", "otg",  "docx", "xlsx", "pptx", "doc",
+                                              "xls", "ppt" };
+
+    const std::size_t dot = path.rfind('.');
+    if (dot == std::string::npos || path.find('/', dot) != std::string::npos)
+        return false;
+
+    const std::string extension = Util::toLower(path.substr(dot + 1));
+    for (const char* supported : extensions)
+    {
+        if (extension == supported)
+            return true;
+    }
+
+    return false;
+}
+
+bool BackgroundSave::start(lok::Office& office, lok::Document& document, const std::string& path)
+{
+    assert(!isSaving() && "Already saving in the background");
+
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) < 0)
+    {
+        LOG_SYS("Failed to create the pipe to save in the background");
+        return false;
+    }
+
+    // The child only gets the forking thread: Core's other threads, e.g. of
+    // its thread pools, must not hold locks the child would wait for forever.
+    if (!office.joinThreads())
+    {
+        LOG_WRN("Core is busy in its threads, not saving in the background");
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+
+    const pid_t parent = getpid();
+    const auto startTime = std::chrono::steady_clock::now();
+    const pid_t pid = fork();
+    if (pid != 0)
+        office.startThreads();
+
+    if (pid < 0)
+    {
+        LOG_SYS("Failed to fork to save in the background");
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+
+    if (pid == 0)
+    {
+        // Child: don't outlive the kit, and leave WSD to it.
+        IsChild = true;
+        if (prctl(PR_SET_PDEATHSIG, SIGKILL) < 0 || getppid() != parent)
+            _exit(EX_SOFTWARE);
+
+        close(fds[0]);
+
+        const std::string error = save(document, path);
+        const std::string result = error.empty() ? "ok" : "error: " + error;
+        // Less than PIPE_BUF is written at once.
+        if (write(fds[1], result.data(), result.size()) < 0)
+            LOG_SYS("Failed to report the background save");
+
+        close(fds[1]);
+        SocketPoll::wakeupWorld();
+        _exit(error.empty() ? EX_OK : EX_SOFTWARE);
+    }
+
+    close(fds[1]);
+    if (fcntl(fds[0], F_SETFL, O_NONBLOCK) < 0)
+        LOG_SYS("Failed to make the background save pipe non-blocking");
+
+    LOG_INF("Saving [" << path << "] in the background in child #" << pid);
+    _pid = pid;
+    _fd = fds[0];
+    _result.clear();
+    _error.clear();
+    _startTime = startTime;
+    _modifiedDuringSave = false;
+    return true;
+}
+
+std::string BackgroundSave::save(lok::Document& document, const std::string& path)
+{
+    // Write next to the document, so we replace it at once.
+    const std::size_t slash = path.rfind('/') + 1;
+    const std::string tempPath = path.substr(0, slash) + ".bgsave-" + path.substr(slash);
+
+    Poco::URI uri;
+    uri.setScheme("file");
+    uri.setPath(tempPath);
+    if (!document.saveAs(uri.toString().c_str()))
+    {
+        unlink(tempPath.c_str());
+        return "saveAs failed";
+    }
+
+    if (rename(tempPath.c_str(), path.c_str()) < 0)
+    {
+        const std::string error = std::string("rename failed: ") + std::strerror(errno);
+        unlink(tempPath.c_str());
+        return error;
+    }
+
+    return std::string();
+}
+
+BackgroundSave::State BackgroundSave::poll(bool wait)
+{
+    if (!isSaving())
+        return State::None;
+
+    for (;;)
+    {
+        char buffer[256];
+        const ssize_t size = read(_fd, buffer, sizeof(buffer));
+        if (size > 0)
+        {
+            _result.append(buffer, size);
+            continue;
+        }
+
+        if (size == 0)
+            break; // The child is done.
+
+        if (errno == EINTR)
+            continue;
+
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            LOG_SYS("Failed to read the result of the background save");
+            break;
+        }
+
+        const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+            _startTime + _timeout - std::chrono::steady_clock::now());
+        if (remaining.count() <= 0)
+            return kill();
+
+        if (!wait)
+            return State::Saving;
+
+        pollfd pfd = { _fd, POLLIN, 0 };
+        ::poll(&pfd, 1, remaining.count());
+    }
+
+    close(_fd);
+    _fd = -1;
+
+    // It has closed the pipe, so is about to exit.
+    int status = 0;
+    pid_t reaped;
+    while ((reaped = waitpid(_pid, &status, WNOHANG)) == 0 ||
+           (reaped < 0 && errno == EINTR))
+    {
+        if (std::chrono::steady_clock::now() >= _startTime + _timeout)
+            return kill();
+
+        usleep(1000);
+    }
+
+    // Unless it's reaped already, it must have exited fine too.
+    const bool exited = reaped != _pid || (WIFEXITED(status) && WEXITSTATUS(status) == EX_OK);
+    if (_result == "ok" && exited)
+        return finish(true);
+
+    if (Util::startsWith(_result, "error: "))
+        _error = _result.substr(7);
+    else if (reaped == _pid && WIFSIGNALED(status))
+        _error = std::string("killed by ") + strsignal(WTERMSIG(status));
+    else
+        _error = "exited without a result";
+
+    return finish(false);
+}
+
+BackgroundSave::State BackgroundSave::kill()
+{
+    LOG_WRN("Killing child #" << _pid << " that saves in the background, it timed out");
+    ::kill(_pid, SIGKILL);
+
+    if (_fd >= 0)
+    {
+        close(_fd);
+        _fd = -1;
+    }
+
+    // Dies at once now, so reap it.
+    while (waitpid(_pid, nullptr, 0) < 0 && errno == EINTR)
+        ;
+
+    _error = "timed out after " + std::to_string(_timeout.count()) + "ms";
+    return finish(false);
+}
+
+BackgroundSave::State BackgroundSave::finish(bool success)
+{
+    const auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - _startTime);
+    if (success)
+    {
+        LOG_INF("Saved in the background by child #" << _pid << " in " << duration.count()
+                                                      << "ms, the document was "
+                                                      << (_modifiedDuringSave ? "" : "not ")
+                                                      << "modified meanwhile");
+        _reportedUnmodified = !_modifiedDuringSave;
+    }
+    else
+    {
+        LOG_WRN("Failed to save in the background by child #" << _pid << " in "
+                                                               << duration.count()
+                                                               << "ms: " << _error);
+    }
+
+    _pid = 0;
+    return success ? State::Succeeded : State::Failed;
+}
+
+bool BackgroundSave::noteModified()
+{
+    if (isSaving())
+        _modifiedDuringSave = true;
+
+    const bool report = _reportedUnmodified;
+    _reportedUnmodified = false;
+    return report;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,122 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <sys/types.h>
+
+#include <cassert>
+#include <chrono>
+#include <ostream>
+#include <string>
+
+#include <common/StateEnum.hpp>
+
+namespace lok
+{
+class Office;
+class Document;
+}
+
+/// Saves a document in a forked child of the kit, so the kit keeps serving
+/// its views while the document is written.
+///
+/// The child is a copy-on-write snapshot of the document as of the fork.
+/// It writes the document to a temporary file next to it, renames that over
+/// the document, reports the outcome over a pipe, wakes up the kit's poll,
+/// and exits. It dies with the kit, and never leaves a partial document.
+/// It is killed when it takes longer than the timeout, which counts as failed.
+///
+/// Core in the kit still has the document as modified after the save. When
+/// nothing changed during the save, we report it unmodified ourselves, and
+/// so must report it modified again on the next change, as Core won't.
+class BackgroundSave
+{
+public:
+    STATE_ENUM(State,
+               None, //< Not saving.
+               Saving, //< The child is writing the document.
+               Succeeded, //< The document was saved.
+               Failed //< The child failed or died; save in the foreground instead.
+    );
+
+    BackgroundSave();
+
+    /// Waits for the save in progress, if any, killing it on timeout.
+    ~BackgroundSave();
+
+    BackgroundSave(const BackgroundSave&) = delete;
+    BackgroundSave& operator=(const BackgroundSave&) = delete;
+
+    /// True iff we save the file at @path, by its extension, as .uno:Save would.
+    static bool isSupportedFormat(const std::string& path);
+
+    /// True in the forked child, which must not talk to WSD.
+    static bool isChild() { return IsChild; }
+
+    /// Forks a child to save @document of @office to @path, with Core's threads
+    /// joined meanwhile. Returns false if we can't, and the caller should save
+    /// in the foreground.
+    bool start(lok::Office& office, lok::Document& document, const std::string& path);
+
+    bool isSaving() const { return _pid > 0; }
+
+    /// Sets how long the child may take to save, before we kill it.
+    void setTimeout(std::chrono::milliseconds timeout) { _timeout = timeout; }
+
+    /// Checks on the save in progress, waiting for it to finish if @wait,
+    /// but no longer than the timeout since it started.
+    /// Returns Saving until it finishes, then Succeeded or Failed, once.
+    State poll(bool wait = false);
+
+    /// The reason of the last failure.
+    const std::string& getError() const { return _error; }
+
+    /// True iff the document changed while it was last saved in the background.
+    bool wasModifiedDuringSave() const { return _modifiedDuringSave; }
+
+    /// Notes that the document changed, or may have, on input forwarded to Core.
+    /// Returns true when we had reported it unmodified after saving in the
+    /// background, and should report it modified.
+    bool noteModified();
+
+    /// Notes that Core reported the document unmodified, having saved it itself.
+    void noteUnmodified() { _reportedUnmodified = false; }
+
+    /// True iff we reported the document unmodified, while Core still has it modified.
+    bool isReportedUnmodified() const { return _reportedUnmodified; }
+
+private:
+    /// Run in the child: saves @document to @path, returns an empty string or the error.
+    static std::string save(lok::Document& document, const std::string& path);
+
+    /// Kills and reaps the child that timed out.
+    State kill();
+
+    State finish(bool success);
+
+private:
+    static bool IsChild;
+
+    pid_t _pid;
+    /// The read end of the pipe from the child.
+    int _fd;
+    std::string _result;
+    std::string _error;
+    std::chrono::steady_clock::time_point _startTime;
+    std::chrono::milliseconds _timeout;
+    bool _modifiedDuringSave;
+    bool _reportedUnmodified;
+};
+
+inline std::ostream& operator<<(std::ostream& os, const BackgroundSave::State& state)
+{
+    os << BackgroundSave::name(state);
+    return os;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
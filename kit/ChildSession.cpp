@@ -95,6 +95,23 @@ std::string formatUnoCommandInfo(const std::string& sessionId, const std::string
     return unoCommandInfo;
 }
 
+/// True iff the input can edit the document, once forwarded to Core.
+bool isEditingInput(const StringVector& tokens)
+{
+    if (tokens.equals(0, "mouse") || tokens.equals(0, "windowmouse"))
+        return !tokens.equals(1, "type=move");
+
+    if (tokens.equals(0, "uno"))
+        return tokens[1].find(".uno:Save") == std::string::npos;
+
+    return tokens.equals(0, "key") || tokens.equals(0, "windowkey") ||
+           tokens.equals(0, "textinput") || tokens.equals(0, "paste") ||
+           tokens.equals(0, "insertfile") || tokens.equals(0, "windowgesture") ||
+           tokens.equals(0, "selectgraphic") || tokens.equals(0, "dialogevent") ||
+           tokens.equals(0, "formfieldevent") || tokens.equals(0, "contentcontrolevent") ||
+           tokens.equals(0, "completefunction") || tokens.equals(0, "removetextcontext");
+}
+
 }
 
 ChildSession::ChildSession(
@@ -110,6 +127,7 @@ ChildSession::ChildSession(
     _viewId(-1),
     _isDocLoaded(false),
     _copyToClipboard(false),
+    _windowDeltas(LOKitHelper::tunnelledDialogImageCacheSize),
     _canonicalViewId(-1)
 {
     LOG_INF("ChildSession ctor [" << getName() << "]. JailRoot: [" << _jailRoot << ']');
@@ -304,19 +322,27 @@ bool ChildSession::_handleInput(const char *buffer, int length)
         if (!getTokenInteger(tokens[2], "y", y))
             y = 0;
 
-        bool success = false;
+        // Size of thumbnail in pixels, unless given.
+        int width = 1200;
+        int height = 630;
+        if (tokens.size() > 4 && (!getTokenInteger(tokens[3], "width", width) ||
+                                  !getTokenInteger(tokens[4], "height", height) || width <= 0 ||
+                                  height <= 0 || width > 4096 || height > 4096))
+        {
+            sendTextFrameAndLogError("error: cmd=getthumbnail kind=syntax");
+            return false;
+        }
 
-        // Size of thumbnail in pixels
-        constexpr int width = 1200;
-        constexpr int height = 630;
+        bool success = false;
 
         // Unclear what this "zoom" level means
         constexpr float zoom = 2;
 
         // The magic number 15 is the number of twips per pixel for a resolution of 96 pixels per
-        // inch, which apparently is some "standard".
-        constexpr int widthTwips = width * 15 / zoom;
-        constexpr int heightTwips = height * 15 / zoom;
+        // inch, which apparently is some "standard". Other sizes show the same width of the
+        // document, scaled, as much of its height as fits.
+        constexpr int widthTwips = 1200 * 15 / zoom;
+        const int heightTwips = static_cast<int64_t>(widthTwips) * height / width;
         constexpr int offsetXTwips = 15 * 15; // start 15 pixels before the target to get a clearer thumbnail
         constexpr int offsetYTwips = 15 * 15;
 
@@ -444,6 +470,10 @@ bool ChildSession::_handleInput(const char *buffer, int length)
 
         std::string pzName("ChildSession::_handleInput:" + tokens[0]);
         ProfileZone pz(pzName.c_str());
+
+        if (isEditingInput(tokens))
+            _docManager->noteEditingInput();
+
         if (tokens.equals(0, "clientzoom"))
         {
             return clientZoom(tokens);
@@ -521,6 +551,18 @@ bool ChildSession::_handleInput(const char *buffer, int length)
             }
             else if (tokens[1].find(".uno:Save") != std::string::npos)
             {
+                // Autosaves leave the edit in progress alone, so can run in the background.
+                if (tokens.equals(1, ".uno:Save") &&
+                    firstLine.find("\"DontTerminateEdit\"") != std::string::npos &&
+                    firstLine.find("\"DontSaveIfUnmodified\"") != std::string::npos &&
+                    _docManager->saveInBackground(getId(), firstLine))
+                {
+                    return true;
+                }
+
+                // Not to write the document twice at once.
+                _docManager->finishBackgroundSave();
+
                 // Disable processing of other messages while saving document
                 InputProcessingManager processInput(getProtocol(), false);
                 return unoCommand(tokens);
@@ -1794,6 +1836,13 @@ bool ChildSession::unoCommand(const StringVector& tokens)
     return true;
 }
 
+bool ChildSession::saveInForeground(const std::string& command)
+{
+    // Disable processing of other messages while saving document
+    InputProcessingManager processInput(getProtocol(), false);
+    return unoCommand(StringVector::tokenize(command.data(), command.size()));
+}
+
 bool ChildSession::selectText(const StringVector& tokens,
                               const LokEventTargetEnum target)
 {
@@ -1846,32 +1895,6 @@ bool ChildSession::selectText(const StringVector& tokens,
     return true;
 }
 
-// FIXME: remove SpookyHash et. al.
-
-namespace {
-inline
-uint64_t hashSubBuffer(unsigned char* pixmap, size_t startX, size_t startY,
-                       long width, long height, int bufferWidth, int bufferHeight)
-{
-    if (bufferWidth < width || bufferHeight < height)
-        return 0; // magic invalid hash.
-
-    // assume a consistent mode - RGBA vs. BGRA for process
-    SpookyHash hash;
-    hash.Init(1073741789, 1073741789); // Seeds can be anything.
-    for (long y = 0; y < height; ++y)
-    {
-        const size_t position = ((startY + y) * bufferWidth * 4) + (startX * 4);
-        hash.Update(pixmap + position, width * 4);
-    }
-
-    uint64_t hash1;
-    uint64_t hash2;
-    hash.Final(&hash1, &hash2);
-    return hash1;
-}
-}
-
 bool ChildSession::renderWindow(const StringVector& tokens)
 {
     const unsigned winId = (tokens.size() > 1 ? std::stoul(tokens[1]) : 0);
@@ -1904,13 +1927,13 @@ bool ChildSession::renderWindow(const StringVector& tokens)
             dpiScale = 1.0;
     }
 
-    const size_t pixmapDataSize = 4 * bufferWidth * bufferHeight;
-    std::vector<unsigned char> pixmap(pixmapDataSize);
+    // Reuse the buffer, we paint the same windows over and over.
+    _windowPixmap.resize(4 * bufferWidth * bufferHeight);
     const int width = bufferWidth;
     const int height = bufferHeight;
     const auto start = std::chrono::steady_clock::now();
-    getLOKitDocument()->paintWindow(winId, pixmap.data(), startX, startY, width, height, dpiScale,
-                                    _viewId);
+    getLOKitDocument()->paintWindow(winId, _windowPixmap.data(), startX, startY, width, height,
+                                    dpiScale, _viewId);
     const double area = width * height;
 
     const auto elapsedMs = std::chrono::duration_cast<std::chrono::milliseconds>(
@@ -1921,47 +1944,12 @@ bool ChildSession::renderWindow(const StringVector& tokens)
                                << " and rendered in " << elapsedMs << " (" << area / elapsedMics
                                << " MP/s).");
 
-    uint64_t pixmapHash = hashSubBuffer(pixmap.data(), 0, 0, width, height, bufferWidth, bufferHeight) + getViewId();
-
-    auto found = std::find(_pixmapCache.begin(), _pixmapCache.end(), pixmapHash);
-
-    assert(_pixmapCache.size() <= LOKitHelper::tunnelledDialogImageCacheSize);
-
-    // If not found in cache, we need to encode to PNG and send to client
-
-    // To artificially induce intentional cache inconsistency between server and client, to be able
-    // to test error handling, you can do something like:
-    // const bool doPng = (found == _pixmapCache.end() || (time(NULL) % 10 == 0)) && ((time(NULL) % 10) < 8);
-
-    const bool doPng = (found == _pixmapCache.end());
-
-    LOG_DBG("Pixmap hash: " << pixmapHash << (doPng ? " NOT in cache, doing PNG" : " in cache, not encoding to PNG") << ", cache size now:" << _pixmapCache.size());
-
-    // If it is already the first in the cache, no need to do anything. Otherwise, if in cache, move
-    // to beginning. If not in cache, add it as first. Keep cache size limited.
-    if (_pixmapCache.size() > 0)
-    {
-        if (found != _pixmapCache.begin())
-        {
-            if (found != _pixmapCache.end())
-            {
-                LOG_DBG("Erasing found entry");
-                _pixmapCache.erase(found);
-            }
-            else if (_pixmapCache.size() == LOKitHelper::tunnelledDialogImageCacheSize)
-            {
-                LOG_DBG("Popping last entry");
-                _pixmapCache.pop_back();
-            }
-            _pixmapCache.insert(_pixmapCache.begin(), pixmapHash);
-        }
-    }
-    else
-        _pixmapCache.insert(_pixmapCache.begin(), pixmapHash);
-
-    LOG_DBG("Pixmap cache size now:" << _pixmapCache.size());
-
-    assert(_pixmapCache.size() <= LOKitHelper::tunnelledDialogImageCacheSize);
+    // Typing into a field, or hovering over a control, only changes a few rows
+    // of a window, so send what changed since the last paint, rather than a PNG.
+    _windowPaintData.clear();
+    _windowCellSizes.clear();
+    _windowDeltas.encode(winId, startX, startY, width, height, _windowPixmap.data(),
+                         _windowPaintData, _windowCellSizes);
 
     std::string response = "windowpaint: id=" + std::to_string(winId) + " width=" + std::to_string(width)
                            + " height=" + std::to_string(height);
@@ -1969,44 +1957,20 @@ bool ChildSession::renderWindow(const StringVector& tokens)
     if (!paintRectangle.empty())
         response += " rectangle=" + paintRectangle;
 
-    response += " hash=" + std::to_string(pixmapHash);
-
-    if (!doPng)
+    response += " cellsize=" + std::to_string(WindowDeltaEncoder::CellSize) + " cells=";
+    for (std::size_t i = 0; i < _windowCellSizes.size(); ++i)
     {
-        // Just so that we might see in the client console log that no PNG was included.
-        response += " nopng";
-        sendTextFrame(response.c_str());
-        return true;
+        if (i > 0)
+            response += ',';
+        response += std::to_string(_windowCellSizes[i]);
     }
 
-    response += "\n";
+    response += '\n';
 
     std::vector<char> output;
-    output.reserve(response.size() + pixmapDataSize);
-    output.resize(response.size());
-    std::memcpy(output.data(), response.data(), response.size());
-
-    const auto mode = static_cast<LibreOfficeKitTileMode>(getLOKitDocument()->getTileMode());
-
-    // TODO: use png cache for dialogs too
-    if (!Png::encodeSubBufferToPNG(pixmap.data(), 0, 0, width, height, bufferWidth, bufferHeight, output, mode))
-    {
-        LOG_ERR("Failed to encode into PNG.");
-        return false;
-    }
-
-#if 0
-    {
-        static const std::string tempDir = FileUtil::createRandomTmpDir();
-        static int pngDumpCounter = 0;
-        std::stringstream ss;
-        ss << tempDir << "/" << "renderwindow-" << pngDumpCounter++ << ".png";
-        LOG_INF("Dumping PNG to '"<< ss.str() << "'");
-        FILE *f = fopen(ss.str().c_str(), "w");
-        fwrite(output.data() + response.size(), output.size() - response.size(), 1, f);
-        fclose(f);
-    }
-#endif
+    output.reserve(response.size() + _windowPaintData.size());
+    output.insert(output.end(), response.begin(), response.end());
+    output.insert(output.end(), _windowPaintData.begin(), _windowPaintData.end());
 
     LOG_TRC("Sending response (" << output.size() << " bytes) for: " << std::string(output.data(), response.size() - 1));
     sendBinaryFrame(output.data(), output.size());
@@ -2902,8 +2866,29 @@ void ChildSession::loKitCallback(const int type, const std::string& payload)
         sendTextFrame("rulerupdate: " + payload);
         break;
     case LOK_CALLBACK_WINDOW:
+    {
+        // The client drops its copy of the last paint of a closed window.
+        if (payload.find("\"close\"") != std::string::npos)
+        {
+            try
+            {
+                Poco::JSON::Object::Ptr object;
+                std::string action;
+                unsigned winId = 0;
+                if (JsonUtil::parseJSON(payload, object) &&
+                    JsonUtil::findJSONValue(object, "action", action) && action == "close" &&
+                    JsonUtil::findJSONValue(object, "id", winId))
+                    _windowDeltas.forget(winId);
+            }
+            catch (const std::exception& exc)
+            {
+                LOG_WRN("Failed to parse window callback [" << payload << "]: " << exc.what());
+            }
+        }
+
         sendTextFrame("window: " + payload);
         break;
+    }
     case LOK_CALLBACK_VALIDITY_LIST_BUTTON:
         sendTextFrame("validitylistbutton: " + payload);
         break;
@@ -18,6 +18,7 @@
 #include <LibreOfficeKit/LibreOfficeKit.hxx>
 
 #include "Common.hpp"
+#include "Delta.hpp"
 #include "Kit.hpp"
 #include "Session.hpp"
 #include "Watermark.hpp"
@@ -75,6 +76,16 @@ public:
 
     /// See if we should clear out our memory
     virtual void trimIfInactive() = 0;
+
+    /// Saves the document in a forked child, for the .uno:Save @command of @sessionId.
+    /// Returns false if it can't, and the caller should save in the foreground.
+    virtual bool saveInBackground(const std::string& sessionId, const std::string& command) = 0;
+
+    /// Waits for the background save in progress, if any, not to save at the same time.
+    virtual void finishBackgroundSave() = 0;
+
+    /// Notes input that can edit the document, about to be forwarded to Core.
+    virtual void noteEditingInput() = 0;
 };
 
 struct RecordedEvent
@@ -218,8 +229,14 @@ public:
     void updateSpeed();
     int getSpeed();
 
+    /// The memory of the last window paints, to delta against.
+    std::size_t getWindowDeltaBytes() { return _windowDeltas.getBytes(); }
+
     void loKitCallback(const int type, const std::string& payload);
 
+    /// Saves with the .uno:Save @command, which failed in the background.
+    bool saveInForeground(const std::string& command);
+
     /// Initializes the watermark support, if enabled and required.
     /// Returns true if watermark is enabled and initialized.
     bool initWatermark()
@@ -384,7 +401,12 @@ private:
     /// If we are copying to clipboard.
     bool _copyToClipboard;
 
-    std::vector<uint64_t> _pixmapCache;
+    /// The last paints of the windows, which the next are deltas against.
+    WindowDeltaEncoder _windowDeltas;
+    /// Reused between window paints.
+    std::vector<unsigned char> _windowPixmap;
+    std::vector<char> _windowPaintData;
+    std::vector<std::size_t> _windowCellSizes;
 
     /// How many sessions / clients we have
     static size_t NumSessions;
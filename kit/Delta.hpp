@@ -9,8 +9,12 @@
 
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <list>
+#include <memory>
 #include <vector>
-#include <unordered_set>
+#include <unordered_map>
 #include <assert.h>
 #include <zlib.h>
 #include <zstd.h>
@@ -61,6 +65,8 @@ class DeltaGenerator {
 
     // fast - and deltas take lots of size off.
     static const int compressionLevel = -3;
+    // cold bitmaps are kept longer, so are worth a little more.
+    static const int coldCompressionLevel = 1;
 
     /// Bitmap row with a CRC for quick vertical shift detection
     struct DeltaBitmapRow {
@@ -83,19 +89,41 @@ class DeltaGenerator {
         DeltaData(const DeltaData&) = delete;
         DeltaData& operator=(const DeltaData&) = delete;
 
-        static inline uint64_t copyWithCrc(uint32_t *to, const uint32_t *from, unsigned int width)
-        {
-            assert ((width & 0x1) == 0); // copy 64bits at a time.
+        /// What we keep of the bitmap. Those not used lately take less memory:
+        /// compressed, or, for tiles that get repainted anyway, just row hashes,
+        /// which still tell us of unchanged and moved rows.
+        enum class Form { Pixels, Compressed, RowHashes };
 
-            const uint64_t *src = reinterpret_cast<const uint64_t *>(from);
-            uint64_t *dest = reinterpret_cast<uint64_t *>(to);
+        /// A stronger hash of a row than the CRC, as we can't compare the pixels
+        /// of RowHashes to rule out collisions.
+        static uint64_t rowHash(const uint32_t *pixels, unsigned int width)
+        {
+            uint64_t hash = width;
+            for (unsigned int x = 0; x < width; ++x)
+            {
+                hash = (hash ^ pixels[x]) * 0x9e3779b97f4a7c15ULL;
+                hash ^= hash >> 29;
+            }
+            return hash;
+        }
 
+        static inline uint64_t copyWithCrc(uint32_t *to, const uint32_t *from, unsigned int width)
+        {
             // We get the hash ~for free as we copy - with a cheap hash.
             uint64_t crc = 0x7fffffff - 1;
-            for (unsigned int x = 0; x < (width>>1); ++x)
+            unsigned int x = 0;
+            for (; x + 1 < width; x += 2) // copy 64bits at a time.
             {
-                crc = (crc << 7) + crc + src[x];
-                dest[x] = src[x];
+                // Rows of an odd width, e.g. of windows, needn't be aligned.
+                uint64_t pixels;
+                std::memcpy(&pixels, from + x, sizeof(pixels));
+                crc = (crc << 7) + crc + pixels;
+                std::memcpy(to + x, &pixels, sizeof(pixels));
+            }
+            if (x < width)
+            {
+                crc = (crc << 7) + crc + from[x];
+                to[x] = from[x];
             }
             return crc;
         }
@@ -111,6 +139,8 @@ class DeltaGenerator {
             // in Pixels
             _width(width),
             _height(height),
+            _form(Form::Pixels),
+            _repainted(false),
             _rows(new DeltaBitmapRow[height])
         {
             assert (startX + width <= (size_t)bufferWidth);
@@ -133,6 +163,7 @@ class DeltaGenerator {
                     const_cast<uint32_t *>(row._pixels),
                     reinterpret_cast<uint32_t *>(pixmap + position), width);
             }
+            updateBytes();
         }
 
         ~DeltaData()
@@ -177,6 +208,98 @@ class DeltaGenerator {
             return _rows[y];
         }
 
+        /// What we keep, which may change while in use on another thread.
+        Form getForm() const
+        {
+            return _form;
+        }
+
+        uint64_t getRowHash(int y) const
+        {
+            return _rowHashes[y];
+        }
+
+        /// Whether most rows changed in the last delta, so would likely again.
+        void setRepainted(bool repainted)
+        {
+            _repainted = repainted;
+        }
+
+        bool isRepainted() const
+        {
+            return _repainted;
+        }
+
+        /// The memory we take, which may change while in use on another thread.
+        size_t getBytes() const
+        {
+            return _bytes;
+        }
+
+        /// Compresses the pixels, or keeps only row hashes if @rowHashesOnly.
+        void cool(bool rowHashesOnly)
+        {
+            if (_form != Form::Pixels)
+                return;
+
+            if (rowHashesOnly)
+            {
+                _rowHashes.resize(_height);
+                for (int y = 0; y < _height; ++y)
+                    _rowHashes[y] = rowHash(_rows[y]._pixels, _width);
+                _form = Form::RowHashes;
+            }
+            else
+            {
+                const size_t size = (size_t)_width * _height * 4;
+                _compressed.resize(ZSTD_COMPRESSBOUND(size));
+                const size_t compSize = ZSTD_compress(_compressed.data(), _compressed.size(),
+                                                      _pixels, size, coldCompressionLevel);
+                if (ZSTD_isError(compSize))
+                {
+                    LOG_ERR("Failed to compress bitmap of size " << size << " with " << ZSTD_getErrorName(compSize));
+                    _compressed = std::vector<char>();
+                    return;
+                }
+                _compressed.resize(compSize);
+                _compressed.shrink_to_fit();
+                _form = Form::Compressed;
+            }
+
+            free(_pixels);
+            _pixels = nullptr;
+            for (int y = 0; y < _height; ++y)
+                _rows[y]._pixels = nullptr;
+            updateBytes();
+        }
+
+        /// Decompresses the pixels, if compressed, to delta against.
+        /// Returns false if that fails, when we have nothing to delta against.
+        bool warm()
+        {
+            if (_form != Form::Compressed)
+                return true;
+
+            const size_t size = (size_t)_width * _height * 4;
+            _pixels = (uint32_t *)malloc(size);
+            const size_t decompSize = _pixels ?
+                ZSTD_decompress(_pixels, size, _compressed.data(), _compressed.size()) : 0;
+            if (!_pixels || decompSize != size)
+            {
+                LOG_ERR("Failed to decompress bitmap of size " << size);
+                free(_pixels);
+                _pixels = nullptr;
+                return false;
+            }
+
+            for (int y = 0; y < _height; ++y)
+                _rows[y]._pixels = _pixels + _width * y;
+            _compressed = std::vector<char>();
+            _form = Form::Pixels;
+            updateBytes();
+            return true;
+        }
+
         void replaceAndFree(std::shared_ptr<DeltaData> &repl)
         {
             assert (_loc == repl->_loc);
@@ -185,22 +308,32 @@ class DeltaGenerator {
                 assert("replacing with yourself should never happen");
                 return;
             }
-            _wid = repl->_wid;
+            _wid = repl->_wid.load();
             _width = repl->_width;
             _height = repl->_height;
+            _form = repl->_form.load();
+            _repainted = repl->_repainted;
             delete[] _rows;
             _rows = repl->_rows;
             repl->_rows = nullptr;
             free (_pixels);
             _pixels = repl->_pixels;
             repl->_pixels = nullptr;
+            _compressed.swap(repl->_compressed);
+            _rowHashes.swap(repl->_rowHashes);
+            updateBytes();
             repl.reset();
         }
 
-        inline void use()
+        /// Returns false if another thread, rendering or cooling it, has it.
+        inline bool use()
         {
-            const bool wasInUse = _inUse.exchange(true); (void)wasInUse;
-            assert(!wasInUse && "Error: delta was already in use by another thread");
+            return !_inUse.exchange(true);
+        }
+
+        bool isInUse() const
+        {
+            return _inUse;
         }
 
         inline void unuse()
@@ -211,51 +344,111 @@ class DeltaGenerator {
 
         TileLocation _loc;
     private:
-        std::atomic<bool> _inUse; // thread debugging check.
-        TileWireId _wid;
+        void updateBytes()
+        {
+            _bytes = sizeof(*this) + _height * sizeof(DeltaBitmapRow) +
+                (_pixels ? (size_t)_width * _height * 4 : 0) +
+                _compressed.capacity() + _rowHashes.capacity() * sizeof(uint64_t);
+        }
+
+        std::atomic<bool> _inUse; // one thread at a time.
+        std::atomic<TileWireId> _wid;
         int _width;
         int _height;
+        std::atomic<Form> _form;
+        bool _repainted;
         uint32_t *_pixels;
         DeltaBitmapRow *_rows;
+        std::vector<char> _compressed;
+        std::vector<uint64_t> _rowHashes;
+        std::atomic<size_t> _bytes;
     };
 
-    struct DeltaHasher {
-        std::size_t operator()(const std::shared_ptr<DeltaData> &t) const
+    struct LocationHasher {
+        std::size_t operator()(const TileLocation &loc) const
         {
-            return t->_loc.hash();
+            return loc.hash();
         }
     };
 
-    struct DeltaCompare {
-        bool operator()(const std::shared_ptr<DeltaData> &a,
-                        const std::shared_ptr<DeltaData> &b) const
-        {
-            return a->_loc == b->_loc;
-        }
+    /// Where an entry is kept, and the bytes we count for it.
+    struct DeltaSlot
+    {
+        std::list<std::shared_ptr<DeltaData>>::iterator _it;
+        bool _cold;
+        size_t _bytes;
     };
 
     std::mutex _deltaGuard;
-    /// The last several bitmap entries as a cache
-    std::unordered_set<std::shared_ptr<DeltaData>, DeltaHasher, DeltaCompare> _deltaEntries;
-    size_t _maxEntries;
-
-    void rebalanceDeltasT(bool bDropAll = false)
+    /// The entries kept as pixels, most recently used first.
+    std::list<std::shared_ptr<DeltaData>> _deltaEntries;
+    /// The entries cooled beyond those, most recently used first.
+    std::list<std::shared_ptr<DeltaData>> _coldEntries;
+    std::unordered_map<TileLocation, DeltaSlot, LocationHasher> _deltaIndex;
+    /// Beyond which we drop the least recently used.
+    size_t _maxBytes;
+    /// The bytes counted for _deltaEntries, kept within half the budget.
+    size_t _hotBytes;
+    /// The bytes counted for all entries: as stored, or estimated while cooling.
+    size_t _totalBytes;
+
+    /// Compressing a tile of text, which is what stays still long enough
+    /// to get cold, takes off about this much, so we estimate with it.
+    static const size_t coldRatio = 4;
+
+    /// Keeps the most recently used half of the budget as pixels, cools the entries
+    /// beyond, and drops those beyond the budget. Works from the least recently used
+    /// ends only, so costs as much as it frees. Those to cool are marked in use and
+    /// appended to @cool, for the caller to cool after unlocking.
+    void rebalanceDeltasT(std::vector<std::shared_ptr<DeltaData>> &cool, bool bDropAll = false)
     {
-        if (_deltaEntries.size() > _maxEntries || bDropAll)
-        {
-            size_t toRemove = _deltaEntries.size();
-            if (!bDropAll)
-                toRemove -= (_maxEntries * 3 / 4);
-            std::vector<std::shared_ptr<DeltaData>> entries;
-            entries.insert(entries.end(), _deltaEntries.begin(), _deltaEntries.end());
-            std::sort(entries.begin(), entries.end(),
-                      [](const std::shared_ptr<DeltaData> &a,
-                         const std::shared_ptr<DeltaData> &b)
-                          {
-                              return a->getWid() < b->getWid();
-                          });
-            for (size_t i = 0; i < toRemove; ++i)
-                _deltaEntries.erase(entries[i]);
+        if (bDropAll)
+        {
+            _deltaEntries.clear();
+            _coldEntries.clear();
+            _deltaIndex.clear();
+            _hotBytes = 0;
+            _totalBytes = 0;
+            return;
+        }
+
+        // Each at most once, not to spin on those in use.
+        for (size_t n = _deltaEntries.size(); n > 0; --n)
+        {
+            const std::shared_ptr<DeltaData> entry = _deltaEntries.back();
+            DeltaSlot &slot = _deltaIndex.at(entry->_loc);
+            if (_hotBytes - slot._bytes < _maxBytes / 2)
+                break;
+
+            if (!entry->use())
+            {
+                // Being rendered against, so recently used after all.
+                _deltaEntries.splice(_deltaEntries.begin(), _deltaEntries, slot._it);
+                continue;
+            }
+
+            cool.push_back(entry);
+            _coldEntries.splice(_coldEntries.begin(), _deltaEntries, slot._it);
+            slot._cold = true;
+            _hotBytes -= slot._bytes;
+            _totalBytes -= slot._bytes - slot._bytes / coldRatio;
+            slot._bytes /= coldRatio;
+        }
+
+        for (auto it = _coldEntries.end(); it != _coldEntries.begin();)
+        {
+            const std::shared_ptr<DeltaData> &entry = *--it;
+            const auto slot = _deltaIndex.find(entry->_loc);
+            if (_totalBytes - slot->second._bytes < _maxBytes)
+                break;
+
+            // Still cooling.
+            if (entry->isInUse())
+                continue;
+
+            _totalBytes -= slot->second._bytes;
+            _deltaIndex.erase(slot);
+            it = _coldEntries.erase(it);
         }
     }
 
@@ -303,9 +496,289 @@ class DeltaGenerator {
         }
     }
 
+    /// Pixels a span must match to be copied from elsewhere, rather than sent:
+    /// by the last moves, or by any, as short matches are common in text.
+    static const int minBlockCopy = 8;
+    static const int minHuntedCopy = 32;
+    /// Pixels in the segments we hash to find moved content.
+    static const int segmentWidth = 16;
+    /// Differing pixels, of the next huntWidth, before we look for where they came from:
+    /// moved content differs all over, edits only in places.
+    static const int minBlockHunt = 12;
+    static const int huntWidth = 2 * segmentWidth;
+    /// Searches per row for the source of a run, to bound the cost on new content.
+    static const int maxBlockHunts = 4;
+    /// Segments of the same hash we check, as text repeats a lot.
+    static const int maxHuntCandidates = 16;
+    /// The moves we try first, as content moves in blocks.
+    static const int recentShiftCount = 4;
+
+    /// A move of content in the old bitmap to the new, by rows and columns.
+    struct BlockShift {
+        int _dy;
+        int _dx;
+
+        bool operator==(const BlockShift &other) const
+        {
+            return _dy == other._dy && _dx == other._dx;
+        }
+    };
+
+    /// An index of the hashes of the segments of a bitmap, at multiples of segmentWidth,
+    /// to find where a run of pixels came from, rsync-style: we roll a hash along the
+    /// run, and one of segmentWidth consecutive positions is aligned in the old bitmap.
+    /// Uniform segments, e.g. of background, match everywhere and are left out.
+    class SegmentIndex {
+        struct Entry {
+            uint32_t _hash;
+            uint16_t _row; // emptyRow if unused.
+            uint16_t _col;
+        };
+
+        static const uint16_t emptyRow = 0xffff;
+        static const uint64_t prime = 0x100000001b3ULL;
+
+        /// Reused: tiles are deltaed on many threads, and it is large enough to not allocate
+        /// per tile; at most half full, with one entry per segment of a 256x256 tile.
+        static std::vector<Entry>& getTable()
+        {
+            static thread_local std::vector<Entry> table(256 * 256 / segmentWidth * 2);
+            return table;
+        }
+
+    public:
+        static uint64_t hash(const uint32_t *pixels)
+        {
+            uint64_t hash = 0;
+            for (int i = 0; i < segmentWidth; ++i)
+                hash = hash * prime + pixels[i];
+            return hash;
+        }
+
+        /// Rolls @hash of the segment at @pixels to the one at @pixels + 1.
+        static uint64_t roll(uint64_t hash, const uint32_t *pixels)
+        {
+            static const uint64_t top = [](){
+                uint64_t power = 1;
+                for (int i = 1; i < segmentWidth; ++i)
+                    power *= prime;
+                return power;
+            }();
+            return (hash - pixels[0] * top) * prime + pixels[segmentWidth];
+        }
+
+        static bool uniform(const uint32_t *pixels)
+        {
+            for (int i = 1; i < segmentWidth; ++i)
+                if (pixels[i] != pixels[0])
+                    return false;
+            return true;
+        }
+
+        explicit SegmentIndex(const DeltaData &data)
+            : _table(getTable())
+            , _mask(_table.size() - 1)
+        {
+            for (Entry &entry : _table)
+                entry._row = emptyRow;
+
+            for (int y = 0; y < data.getHeight(); ++y)
+            {
+                const uint32_t *pixels = data.getRow(y)._pixels;
+                for (int x = 0; x + segmentWidth <= data.getWidth(); x += segmentWidth)
+                {
+                    if (uniform(pixels + x))
+                        continue;
+
+                    // Patterns repeat: we wouldn't look at more than maxHuntCandidates.
+                    const uint32_t key = fold(hash(pixels + x));
+                    size_t slot = key & _mask;
+                    int same = 0;
+                    for (; _table[slot]._row != emptyRow && same < maxHuntCandidates;
+                         slot = (slot + 1) & _mask)
+                        same += _table[slot]._hash == key;
+                    if (same < maxHuntCandidates)
+                        _table[slot] = Entry{ key, uint16_t(y), uint16_t(x) };
+                }
+            }
+        }
+
+        /// Calls @func with the row and column of the first maxHuntCandidates
+        /// segments that may hash to @hash.
+        template <typename Func>
+        void lookup(uint64_t hash, Func func) const
+        {
+            const uint32_t key = fold(hash);
+            int found = 0;
+            for (size_t slot = key & _mask;
+                 _table[slot]._row != emptyRow && found < maxHuntCandidates;
+                 slot = (slot + 1) & _mask)
+            {
+                if (_table[slot]._hash == key)
+                {
+                    func(_table[slot]._row, _table[slot]._col);
+                    ++found;
+                }
+            }
+        }
+
+    private:
+        static uint32_t fold(uint64_t hash) { return hash ^ (hash >> 32); }
+
+        std::vector<Entry> &_table;
+        const size_t _mask;
+    };
+
+    /// The pixels of row @y of @cur from column @x that are those of @prev moved by @shift.
+    static int matchShifted(const DeltaData &prev, const DeltaData &cur,
+                            int y, int x, const BlockShift &shift)
+    {
+        const int srcY = y + shift._dy;
+        const int srcX = x + shift._dx;
+        if (srcY < 0 || srcY >= prev.getHeight() || srcX < 0 || srcX >= prev.getWidth())
+            return 0;
+
+        const uint32_t *from = prev.getRow(srcY)._pixels + srcX;
+        const uint32_t *to = cur.getRow(y)._pixels + x;
+        const int limit = std::min(cur.getWidth() - x, prev.getWidth() - srcX);
+        int len = 0;
+        while (len < limit && from[len] == to[len])
+            ++len;
+        return len;
+    }
+
+    /// Looks for where the pixels [@x, @end) of row @y came from in @prev.
+    /// Returns the length of the longest match, starting at @start, by @shift, or 0.
+    static int huntBlock(const DeltaData &prev, const DeltaData &cur, const SegmentIndex &index,
+                         int y, int x, int end, int &start, BlockShift &shift)
+    {
+        const uint32_t *pixels = cur.getRow(y)._pixels;
+        int best = 0;
+        const int last = std::min(end, cur.getWidth()) - segmentWidth;
+        uint64_t hash = 0;
+        for (int pos = x; pos <= last; ++pos)
+        {
+            hash = pos == x ? SegmentIndex::hash(pixels + pos)
+                            : SegmentIndex::roll(hash, pixels + pos - 1);
+            if (SegmentIndex::uniform(pixels + pos))
+                continue;
+
+            index.lookup(hash, [&](int srcY, int srcX) {
+                const BlockShift candidate{ srcY - y, srcX - pos };
+                if (candidate._dy == 0 && candidate._dx == 0)
+                    return;
+
+                const int len = matchShifted(prev, cur, y, pos, candidate);
+                if (len >= minHuntedCopy && len > best)
+                {
+                    best = len;
+                    start = pos;
+                    shift = candidate;
+                }
+            });
+        }
+        return best;
+    }
+
+    /// Emits a block copy of @len pixels of row @y from column @x, moved by @shift.
+    /// Extends those of the row above, the offsets of which are in @above, where they
+    /// line up, and appends the offsets of the blocks of this row to @blocks.
+    static void copyBlock(std::vector<char> &output, const std::vector<size_t> &above,
+                          std::vector<size_t> &blocks, int y, int x, int len,
+                          const BlockShift &shift)
+    {
+        while (len > 0)
+        {
+            // Width and height are bytes.
+            const int width = std::min(len, 255);
+            bool extended = false;
+            for (size_t offset : above)
+            {
+                char *block = &output[offset];
+                const uint8_t height = block[5];
+                if ((uint8_t)block[0] == x + shift._dx && (uint8_t)block[2] == x &&
+                    (uint8_t)block[4] == width && height < 255 &&
+                    (uint8_t)block[1] + height == y + shift._dy &&
+                    (uint8_t)block[3] + height == y)
+                {
+                    block[5] = height + 1;
+                    blocks.push_back(offset);
+                    extended = true;
+                    break;
+                }
+            }
+
+            if (!extended)
+            {
+                output.push_back('b');   // block copy
+                blocks.push_back(output.size());
+                output.push_back(x + shift._dx); // src
+                output.push_back(y + shift._dy);
+                output.push_back(x);             // dest
+                output.push_back(y);
+                output.push_back(width);
+                output.push_back(1);             // height - updated later.
+            }
+
+            x += width;
+            len -= width;
+        }
+    }
+
+    /// Emits the pixels of [@x, @end) of row @y that changed, as they are, or all of them
+    /// without the pixels of @prevRow. Returns how many.
+    static int sendPixels(std::vector<char> &output, const DeltaBitmapRow &prevRow,
+                          const DeltaBitmapRow &curRow, int y, int x, int end)
+    {
+        int sent = 0;
+        while (x < end)
+        {
+            int same;
+            for (same = 0; same + x < end && prevRow._pixels &&
+                     prevRow._pixels[x+same] == curRow._pixels[x+same];)
+                ++same;
+
+            x += same;
+
+            int diff;
+            for (diff = 0; diff + x < end &&
+                     (!prevRow._pixels || prevRow._pixels[x+diff] != curRow._pixels[x+diff] ||
+                      diff < 3) &&
+                     diff < 254;)
+                ++diff;
+            if (diff > 0)
+            {
+                output.push_back('d');
+                output.push_back(y);
+                output.push_back(x);
+                output.push_back(diff);
+
+                size_t dest = output.size();
+                output.resize(dest + diff * 4);
+
+                unpremult_copy(reinterpret_cast<unsigned char *>(&output[dest]),
+                               (const unsigned char *)(curRow._pixels + x),
+                               diff);
+
+                LOG_TRC("row " << y << " different " << diff << "pixels");
+                x += diff;
+                sent += diff;
+            }
+        }
+        return sent;
+    }
+
+    /// Builds the delta from @prev to @cur: a sequence of operations, applied to a copy
+    /// of @prev, the sources of which are always in @prev:
+    ///   'c' count, src row, dest row: copy whole rows, e.g. scrolling vertically.
+    ///   'b' src x, src y, dest x, dest y, width, height: copy a block, e.g. scrolling
+    ///       sideways, panning, or scrolling part of the tile.
+    ///   'd' row, column, length, then that many RGBA pixels: new pixels.
+    ///   't' terminates the delta.
+    /// Of a @prev with only row hashes, we can only copy rows, and send the rest.
     bool makeDelta(
         const DeltaData &prev,
-        const DeltaData &cur,
+        DeltaData &cur,
         std::vector<char>& outStream)
     {
         // TODO: should we split and compress alpha separately ?
@@ -328,13 +801,38 @@ class DeltaGenerator {
         // column position is a byte.
         assert (prev.getWidth() <= 256);
 
+        // Without the old pixels, we compare stronger hashes.
+        const bool hashed = prev.getForm() == DeltaData::Form::RowHashes;
+        std::vector<uint64_t> curHashes;
+        if (hashed)
+        {
+            curHashes.resize(cur.getHeight());
+            for (int y = 0; y < cur.getHeight(); ++y)
+                curHashes[y] = DeltaData::rowHash(cur.getRow(y)._pixels, cur.getWidth());
+        }
+        const auto sameRow = [&](int prevY, int curY) {
+            return hashed ? prev.getRowHash(prevY) == curHashes[curY]
+                          : prev.getRow(prevY).identical(cur.getRow(curY));
+        };
+
         // How do the rows look against each other ?
+        size_t pixelsSent = 0;
+        int rowsSent = 0;
         size_t lastMatchOffset = 0;
         size_t lastCopy = 0;
+        // Built on the first hunt for moved content, if any.
+        std::unique_ptr<SegmentIndex> index;
+        std::array<BlockShift, recentShiftCount> recentShifts{};
+        // The block copies of the last row and of this one, to extend.
+        std::vector<size_t> blocksAbove;
+        std::vector<size_t> blocks;
         for (int y = 0; y < prev.getHeight(); ++y)
         {
+            blocksAbove.swap(blocks);
+            blocks.clear();
+
             // Life is good where rows match:
-            if (prev.getRow(y).identical(cur.getRow(y)))
+            if (sameRow(y, y))
                 continue;
 
             // Hunt for other rows
@@ -342,7 +840,7 @@ class DeltaGenerator {
             for (int yn = 0; yn < prev.getHeight() && !matched; ++yn)
             {
                 size_t match = (y + lastMatchOffset + yn) % prev.getHeight();
-                if (prev.getRow(match).identical(cur.getRow(y)))
+                if (sameRow(match, y))
                 {
                     // TODO: if offsets are >256 - use 16bits?
                     if (lastCopy > 0)
@@ -371,42 +869,94 @@ class DeltaGenerator {
             if (matched)
                 continue;
 
-            // Our row is just that different:
+            // Our row is just that different, or parts of it moved:
             const DeltaBitmapRow &curRow = cur.getRow(y);
             const DeltaBitmapRow &prevRow = prev.getRow(y);
+            const size_t sentBefore = pixelsSent;
+            if (hashed)
+            {
+                pixelsSent += sendPixels(output, prevRow, curRow, y, 0, prev.getWidth());
+                ++rowsSent;
+                continue;
+            }
+
+            // Where the pixels not copied from elsewhere start.
+            int pending = 0;
+            // Not to hunt for the same pixels twice.
+            int hunted = 0;
+            int hunts = 0;
             for (int x = 0; x < prev.getWidth();)
             {
-                int same;
-                for (same = 0; same + x < prev.getWidth() &&
-                         prevRow._pixels[x+same] == curRow._pixels[x+same];)
-                    ++same;
-
-                x += same;
-
-                int diff;
-                for (diff = 0; diff + x < prev.getWidth() &&
-                         (prevRow._pixels[x+diff] != curRow._pixels[x+diff] || diff < 3) &&
-                         diff < 254;)
-                    ++diff;
-                if (diff > 0)
+                if (prevRow._pixels[x] == curRow._pixels[x])
                 {
-                    output.push_back('d');
-                    output.push_back(y);
-                    output.push_back(x);
-                    output.push_back(diff);
+                    ++x;
+                    continue;
+                }
 
-                    size_t dest = output.size();
-                    output.resize(dest + diff * 4);
+                // Content moves in blocks, so try the last moves first.
+                int start = x;
+                BlockShift shift{ 0, 0 };
+                int moved = 0;
+                for (const BlockShift &recent : recentShifts)
+                {
+                    const int len = (recent._dy || recent._dx) ?
+                        matchShifted(prev, cur, y, x, recent) : 0;
+                    if (len >= minBlockCopy && len > moved)
+                    {
+                        moved = len;
+                        shift = recent;
+                    }
+                }
 
-                    unpremult_copy(reinterpret_cast<unsigned char *>(&output[dest]),
-                                   (const unsigned char *)(curRow._pixels + x),
-                                   diff);
+                if (!moved && x >= hunted && hunts < maxBlockHunts)
+                {
+                    const int huntEnd = std::min(x + huntWidth, prev.getWidth());
+                    int changed = 0;
+                    for (int pos = x; pos < huntEnd; ++pos)
+                        changed += prevRow._pixels[pos] != curRow._pixels[pos];
 
-                    LOG_TRC("row " << y << " different " << diff << "pixels");
-                    x += diff;
+                    if (changed >= minBlockHunt)
+                    {
+                        ++hunts;
+                        hunted = huntEnd;
+                        if (!index)
+                            index.reset(new SegmentIndex(prev));
+                        moved = huntBlock(prev, cur, *index, y, x, huntEnd, start, shift);
+                    }
                 }
+
+                if (!moved)
+                {
+                    ++x;
+                    continue;
+                }
+
+                // Take in what matches before it too, to line up with the blocks above.
+                const uint32_t *src = prev.getRow(y + shift._dy)._pixels + shift._dx;
+                while (start > pending && start - 1 + shift._dx >= 0 &&
+                       src[start - 1] == curRow._pixels[start - 1])
+                {
+                    --start;
+                    ++moved;
+                }
+
+                pixelsSent += sendPixels(output, prevRow, curRow, y, pending, start);
+                copyBlock(output, blocksAbove, blocks, y, start, moved, shift);
+
+                auto it = std::find(recentShifts.begin(), recentShifts.end(), shift);
+                std::rotate(recentShifts.begin(),
+                            it != recentShifts.end() ? it : recentShifts.end() - 1,
+                            it != recentShifts.end() ? it + 1 : recentShifts.end());
+                recentShifts[0] = shift;
+
+                x = pending = start + moved;
             }
+            pixelsSent += sendPixels(output, prevRow, curRow, y, pending, prev.getWidth());
+            rowsSent += pixelsSent > sentBefore;
         }
+
+        // Sending most rows, we'd likely do so again, so needn't keep the pixels.
+        cur.setRepainted(rowsSent * 2 > cur.getHeight());
         LOG_TRC("Created delta of size " << output.size());
         if (output.empty())
         {
@@ -451,34 +1001,90 @@ class DeltaGenerator {
     }
 
   public:
-    DeltaGenerator() {}
+    /// The bytes of a tile, as we keep it uncompressed.
+    static const size_t tileBytes = 256 * 256 * 4;
+
+    DeltaGenerator()
+        : _maxBytes(24 * tileBytes)
+        , _hotBytes(0)
+        , _totalBytes(0)
+    {
+    }
 
-    /// Re-balances the cache size to fit the number of sessions
-    void rebalanceDeltas(ssize_t limit = -1)
+    /// Re-balances the cache to fit its budget
+    void rebalanceDeltas()
     {
+        std::vector<std::shared_ptr<DeltaData>> cool;
+        {
+            std::unique_lock<std::mutex> guard(_deltaGuard);
+            rebalanceDeltasT(cool);
+        }
+
+        if (cool.empty())
+            return;
+
+        // Not to hold up the rendering threads meanwhile.
+        for (const std::shared_ptr<DeltaData> &entry : cool)
+            entry->cool(entry->isRepainted());
+
+        // Count what they take now, unless rendered again or dropped since.
         std::unique_lock<std::mutex> guard(_deltaGuard);
-        if (limit > 0)
-            _maxEntries = limit;
-        rebalanceDeltasT();
+        for (const std::shared_ptr<DeltaData> &entry : cool)
+        {
+            auto it = _deltaIndex.find(entry->_loc);
+            if (it != _deltaIndex.end() && it->second._cold && *it->second._it == entry)
+            {
+                _totalBytes -= it->second._bytes;
+                it->second._bytes = entry->getBytes();
+                _totalBytes += it->second._bytes;
+            }
+            entry->unuse();
+        }
+    }
+
+    /// Sets the memory budget of the cache, in bytes
+    void setMaxBytes(size_t maxBytes)
+    {
+        std::unique_lock<std::mutex> guard(_deltaGuard);
+        _maxBytes = maxBytes;
     }
 
     /// Adapts cache sizing to the number of sessions
     void setSessionCount(size_t count)
     {
-        rebalanceDeltas(std::max(count, size_t(1)) * 24);
+        setMaxBytes(std::max(count, size_t(1)) * 24 * tileBytes);
+        rebalanceDeltas();
     }
 
     void dropCache()
     {
+        std::vector<std::shared_ptr<DeltaData>> cool;
         std::unique_lock<std::mutex> guard(_deltaGuard);
-        rebalanceDeltasT(true);
+        rebalanceDeltasT(cool, true);
+    }
+
+    /// The memory the cache takes, as counted as of the last rebalance
+    size_t getBytes()
+    {
+        std::unique_lock<std::mutex> guard(_deltaGuard);
+        return _totalBytes;
     }
 
     void dumpState(std::ostream& oss)
     {
-        oss << "\tdelta generator with " << _deltaEntries.size() << " entries vs. max " << _maxEntries << "\n";
-        for (auto &it : _deltaEntries)
-            oss << "\t\t" << it->_loc._size << "," << it->_loc._part << "," << it->_loc._left << "," << it->_loc._top << " wid: " << it->getWid() << "\n";
+        std::unique_lock<std::mutex> guard(_deltaGuard);
+        size_t forms[3] = { 0, 0, 0 };
+        for (const auto &entries : { &_deltaEntries, &_coldEntries })
+            for (auto &it : *entries)
+                ++forms[static_cast<int>(it->getForm())];
+        oss << "\tdelta generator with " << _deltaIndex.size() << " entries (" << forms[0]
+            << " pixels, " << forms[1] << " compressed, " << forms[2] << " row hashes) of "
+            << _totalBytes << " bytes vs. max " << _maxBytes << "\n";
+        static const char* const formNames[] = { "pixels", "compressed", "row hashes" };
+        for (const auto &entries : { &_deltaEntries, &_coldEntries })
+            for (auto &it : *entries)
+                oss << "\t\t" << it->_loc._size << "," << it->_loc._part << "," << it->_loc._left << "," << it->_loc._top << " wid: " << it->getWid()
+                    << ' ' << formNames[static_cast<int>(it->getForm())] << ' ' << it->getBytes() << " bytes\n";
     }
 
     /**
@@ -495,12 +1101,6 @@ class DeltaGenerator {
         std::vector<char>& output,
         TileWireId wid, bool forceKeyframe)
     {
-        if ((width & 0x1) != 0) // power of two - RGBA
-        {
-            LOG_TRC("Bad width to create deltas " << width);
-            return false;
-        }
-
         // FIXME: why duplicate this ? we could overwrite
         // as we make the delta into an existing cache entry,
         // and just do this as/when there is no entry.
@@ -509,33 +1109,63 @@ class DeltaGenerator {
                 wid, pixmap, startX, startY, width, height,
                 loc, bufferWidth, bufferHeight));
         std::shared_ptr<DeltaData> cacheEntry;
+        bool overBudget = false;
 
         {
             // protect _deltaEntries
             std::unique_lock<std::mutex> guard(_deltaGuard);
 
-            auto it = _deltaEntries.find(update);
-            if (it == _deltaEntries.end())
+            auto it = _deltaIndex.find(loc);
+            if (it == _deltaIndex.end())
             {
-                _deltaEntries.insert(update);
-                return false;
+                _deltaEntries.push_front(update);
+                it = _deltaIndex.emplace(loc, DeltaSlot{ _deltaEntries.begin(), false, 0 }).first;
+            }
+            else
+            {
+                DeltaSlot &slot = it->second;
+                // Most recently used first, and as pixels again.
+                _deltaEntries.splice(_deltaEntries.begin(),
+                                     slot._cold ? _coldEntries : _deltaEntries, slot._it);
+                if (!slot._cold)
+                    _hotBytes -= slot._bytes;
+                _totalBytes -= slot._bytes;
+                slot._cold = false;
+
+                if (!(*slot._it)->use())
+                {
+                    // Being cooled: we can't delta against it, but have the latest.
+                    *slot._it = update;
+                }
+                else
+                    cacheEntry = *slot._it;
             }
-            cacheEntry = *it;
-            cacheEntry->use();
-        }
 
-        // interestingly cacheEntry may no longer be in the cache by here.
-        // but no other thread can touch the same tile at the same time.
-        assert (cacheEntry);
+            // Either way the entry ends up with our update.
+            it->second._bytes = update->getBytes();
+            _hotBytes += it->second._bytes;
+            _totalBytes += it->second._bytes;
+            overBudget = _hotBytes > _maxBytes / 2 || _totalBytes > _maxBytes;
+        }
 
         bool delta = false;
-        if (!forceKeyframe)
-            delta = makeDelta(*cacheEntry, *update, output);
+        if (cacheEntry)
+        {
+            // interestingly cacheEntry may no longer be in the cache by here.
+            // but no other thread can touch the same tile at the same time.
+            if (!forceKeyframe && cacheEntry->warm())
+                delta = makeDelta(*cacheEntry, *update, output);
+
+            // no two threads can be working on the same DeltaData.
+            cacheEntry->replaceAndFree(update);
 
-        // no two threads can be working on the same DeltaData.
-        cacheEntry->replaceAndFree(update);
+            cacheEntry->unuse();
+        }
+
+        // Cool and drop the least recently used, now that we are done with ours.
+        if (overBudget)
+            rebalanceDeltas();
 
-        cacheEntry->unuse();
         return delta;
     }
 
@@ -632,4 +1262,88 @@ class DeltaGenerator {
     }
 };
 
+/// Encodes the paints of the dialog and sidebar windows of a view as deltas
+/// against the last paint of the same area of the window, as we do for tiles.
+///
+/// DeltaGenerator addresses rows and columns with a byte, so windows are split
+/// into cells of at most 256 pixels square, each a delta, a keyframe, or
+/// nothing when unchanged. The client keeps the last paint of each window,
+/// and applies the cells to it; when a different area is painted, all the
+/// cells are keyframes, as the client has nothing to apply deltas to.
+class WindowDeltaEncoder
+{
+public:
+    static constexpr int CellSize = 256;
+
+    /// An area of a window, in pixels.
+    struct Cell
+    {
+        int _x;
+        int _y;
+        int _width;
+        int _height;
+    };
+
+    /// Splits a paint of @width x @height into @cells, by rows, from left to right.
+    /// The cells are CellSize square, except for the last row and the last column.
+    static void getCells(int width, int height, std::vector<Cell>& cells)
+    {
+        cells.clear();
+        for (int y = 0; y < height; y += CellSize)
+        {
+            for (int x = 0; x < width; x += CellSize)
+                cells.push_back(
+                    Cell{ x, y, std::min(CellSize, width - x), std::min(CellSize, height - y) });
+        }
+    }
+
+    /// Keeps the last paints of cells in the memory of @maxCells uncompressed ones.
+    explicit WindowDeltaEncoder(std::size_t maxCells)
+        : _wid(0)
+    {
+        _deltaGen.setMaxBytes(maxCells * CellSize * CellSize * 4);
+    }
+
+    /// Encodes @pixmap, the @width x @height area at @x, @y of window @winId,
+    /// and appends the data of its cells to @output. The size of each cell's
+    /// data, 0 when unchanged, is appended to @sizes, in the order of getCells().
+    void encode(unsigned winId, int x, int y, int width, int height, unsigned char* pixmap,
+                std::vector<char>& output, std::vector<std::size_t>& sizes)
+    {
+        const std::array<int, 4> area = { x, y, width, height };
+        const auto it = _areas.find(winId);
+        const bool keyframe = (it == _areas.end() || it->second != area);
+        _areas[winId] = area;
+
+        ++_wid;
+        getCells(width, height, _cells);
+        for (const Cell& cell : _cells)
+        {
+            // The size is part of the location, so we never diff mis-sized cells.
+            const TileLocation loc(x + cell._x, y + cell._y, (cell._width << 16) | cell._height,
+                                   winId, 0);
+            const std::size_t before = output.size();
+            _deltaGen.compressOrDelta(pixmap, cell._x, cell._y, cell._width, cell._height, width,
+                                      height, loc, output, _wid, keyframe);
+            sizes.push_back(output.size() - before);
+        }
+
+        _deltaGen.rebalanceDeltas();
+    }
+
+    /// Forgets the last paint of window @winId, e.g. once closed, so the next is keyframes.
+    void forget(unsigned winId) { _areas.erase(winId); }
+
+    /// The memory the last paints take.
+    std::size_t getBytes() { return _deltaGen.getBytes(); }
+
+private:
+    DeltaGenerator _deltaGen;
+    /// The area last painted of each window.
+    std::unordered_map<unsigned, std::array<int, 4>> _areas;
+    /// Reused between paints.
+    std::vector<Cell> _cells;
+    TileWireId _wid;
+};
+
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -11,6 +11,7 @@
 
 #include "DummyLibreOfficeKit.hpp"
 
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <memory>
@@ -210,6 +211,8 @@ static void                    lo_setDocumentPassword(LibreOfficeKit* pThis,
                                                        const char* pURL,
                                                        const char* pPassword);
 static char*                   lo_getVersionInfo(LibreOfficeKit* pThis);
+static int                     lo_joinThreads(LibreOfficeKit* pThis);
+static void                    lo_startThreads(LibreOfficeKit* pThis);
 
 LibLibreOffice_Impl::LibLibreOffice_Impl()
 {
@@ -227,6 +230,8 @@ LibLibreOffice_Impl::LibLibreOffice_Impl()
         m_pOfficeClass->setOptionalFeatures = lo_setOptionalFeatures;
         m_pOfficeClass->setDocumentPassword = lo_setDocumentPassword;
         m_pOfficeClass->getVersionInfo = lo_getVersionInfo;
+        m_pOfficeClass->joinThreads = lo_joinThreads;
+        m_pOfficeClass->startThreads = lo_startThreads;
 
         gOfficeClass = m_pOfficeClass;
     }
@@ -260,11 +265,23 @@ static void lo_registerCallback (LibreOfficeKit* pThis,
 static int doc_saveAs(LibreOfficeKitDocument* pThis, const char* sUrl, const char* pFormat, const char* pFilterOptions)
 {
     (void) pThis;
-    (void) sUrl;
     (void) pFormat;
     (void) pFilterOptions;
 
-    return true;
+    // Write the temporary files of background saves, for their tests to find.
+    static const char prefix[] = "file://";
+    if (!sUrl || strncmp(sUrl, prefix, sizeof(prefix) - 1) != 0 ||
+        !strstr(sUrl, "/.bgsave-"))
+    {
+        return true;
+    }
+
+    FILE* file = fopen(sUrl + sizeof(prefix) - 1, "w");
+    if (!file)
+        return false;
+
+    const bool written = fputs("Dummy document\n", file) >= 0;
+    return fclose(file) == 0 && written;
 }
 
 static int doc_getDocumentType (LibreOfficeKitDocument* pThis)
@@ -631,6 +648,18 @@ static char* lo_getVersionInfo(LibreOfficeKit* /*pThis*/)
     return pVersion;
 }
 
+static int lo_joinThreads(LibreOfficeKit* pThis)
+{
+    (void) pThis;
+
+    return 1;
+}
+
+static void lo_startThreads(LibreOfficeKit* pThis)
+{
+    (void) pThis;
+}
+
 LibreOfficeKit* dummy_lok_init_2(const char *install_path,  const char *user_profile_url)
 {
     (void) install_path;
@@ -717,6 +717,15 @@ int main(int argc, char** argv)
     const auto conf = std::getenv("LOOL_CONFIG");
     config::initialize(std::string(conf ? conf : std::string()));
     EnableExperimental = config::getBool("experimental_features", false);
+
+    // Without bind-mounting, each jail is linked file-by-file. Prepare a filtered
+    // template once on the jails' file-system, so linking never needs to copy.
+    if (!NoCapsForKit && !JailUtil::isBindMountingEnabled()
+        && config::getBool("jail_template", true))
+    {
+        if (!prepareJailTemplate(childRoot, sysTemplate, loTemplate))
+            LOG_WRN("Failed to prepare the jail template, will link jails from the originals.");
+    }
 #endif
 
     Util::setThreadName("forkit");
@@ -58,6 +58,7 @@
 #include <Poco/Net/Socket.h>
 #include <Poco/URI.h>
 
+#include "BackgroundSave.hpp"
 #include "ChildSession.hpp"
 #include <Common.hpp>
 #include <MobileApp.hpp>
@@ -67,6 +68,7 @@
 #include "KitHelper.hpp"
 #include "Kit.hpp"
 #include <Protocol.hpp>
+#include <LatencyHistogram.hpp>
 #include <Log.hpp>
 #include <Png.hpp>
 #include <Rectangle.hpp>
@@ -78,6 +80,7 @@
 #include "RenderTiles.hpp"
 #include "SetupKitEnvironment.hpp"
 #include <common/ConfigUtil.hpp>
+#include <common/SpookyV2.h>
 #include <common/TraceEvent.hpp>
 
 #if !MOBILEAPP
@@ -145,6 +148,8 @@ static std::string JailRoot;
 
 #if !MOBILEAPP
 static void flushTraceEventRecordings();
+static void flushLatencyHistograms();
+static void reportDeltaMemory();
 #endif
 
 
@@ -194,7 +199,8 @@ namespace
     enum class LinkOrCopyType
     {
         All,
-        LO
+        LO,
+        Template ///< All, from the jail template, which is on the same file-system.
     };
     LinkOrCopyType linkOrCopyType;
     std::string sourceForLinkOrCopy;
@@ -202,9 +208,50 @@ namespace
     bool forceInitialCopy; // some stackable file-systems have very slow first hard link creation
     std::string linkableForLinkOrCopy; // Place to stash copies that we can hard-link from
     std::chrono::time_point<std::chrono::steady_clock> linkOrCopyStartTime;
-    bool linkOrCopyVerboseLogging = false;
-    unsigned linkOrCopyFileCount = 0; // Track to help quantify the link-or-copy performance.
+    std::atomic<bool> linkOrCopyVerboseLogging(false);
+    std::atomic<unsigned> linkOrCopyFileCount(0); // Track to help quantify the link-or-copy performance.
+    std::atomic<unsigned> linkOrCopyCopiedCount(0); // Files we failed to link and had to copy.
+    std::atomic<int64_t> linkOrCopyCopyTimeUs(0); // Cumulative time spent copying, across threads.
     constexpr unsigned SlowLinkOrCopyLimitInSecs = 2; // After this many seconds, start spamming the logs.
+    constexpr std::size_t MaxLinkOrCopyThreads = 8;
+    constexpr std::size_t MinFilesPerLinkOrCopyThread = 256; // Not worth a thread for fewer.
+
+    /// Files found by nftw, to be linked or copied in parallel once the tree is created.
+    std::vector<std::pair<std::string, std::string>> linkOrCopyPendingFiles;
+    /// Serializes the creation of directories in linkable/ by the link-or-copy threads.
+    std::mutex linkableDirsMutex;
+
+    /// The pre-linked jail template directory name in childRoot.
+    constexpr const char JailTemplateSubPath[] = "template";
+
+    /// Marks the jail template as complete.
+    constexpr const char JailTemplateReadyMarker[] = ".ready";
+
+    /// The time each phase of the jail setup took, reported to WSD.
+    struct JailSetupTimes
+    {
+        std::chrono::milliseconds _link{};
+        std::chrono::milliseconds _copy{};
+        std::chrono::milliseconds _mount{};
+        std::chrono::milliseconds _chroot{};
+        std::chrono::milliseconds _preinit{};
+
+        /// Returns the phases as a query-string value: link:12,copy:0,...
+        std::string toString() const
+        {
+            std::ostringstream oss;
+            oss << "link:" << _link.count() << ",copy:" << _copy.count()
+                << ",mount:" << _mount.count() << ",chroot:" << _chroot.count()
+                << ",preinit:" << _preinit.count();
+            return oss.str();
+        }
+    };
+
+    template <typename T> std::chrono::milliseconds msSince(const T& start)
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start);
+    }
 
     bool detectSlowStackingFileSystem(const std::string &directory)
     {
@@ -241,6 +288,8 @@ namespace
                 return "LibreOffice";
             case LinkOrCopyType::All:
                 return "all";
+            case LinkOrCopyType::Template:
+                return "template";
             default:
                 assert(!"Unknown LinkOrCopyType.");
                 return "unknown";
@@ -264,7 +313,7 @@ namespace
                 strcmp(path, "share/config/wizard") != 0 &&
                 strcmp(path, "readmes") != 0 &&
                 strcmp(path, "help") != 0;
-        default: // LinkOrCopyType::All
+        default: // LinkOrCopyType::All and Template
             return true;
         }
     }
@@ -318,11 +367,24 @@ namespace
             }
             return true;
         }
-        default: // LinkOrCopyType::All
+        default: // LinkOrCopyType::All and Template
             return true;
         }
     }
 
+    /// Copies a file, accounting the time spent.
+    bool timedCopy(const std::string& fromPath, const std::string& toPath)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        const bool res = FileUtil::copy(fromPath, toPath, /*log=*/false, /*throw_on_error=*/false);
+        linkOrCopyCopyTimeUs += std::chrono::duration_cast<std::chrono::microseconds>(
+                                    std::chrono::steady_clock::now() - start)
+                                    .count();
+        ++linkOrCopyCopiedCount;
+        return res;
+    }
+
+    /// Called concurrently from the link-or-copy threads.
     void linkOrCopyFile(const char* fpath, const std::string& newPath)
     {
         ++linkOrCopyFileCount;
@@ -338,7 +400,7 @@ namespace
         // else always copy before linking to linkable/
 
         // incrementally build our 'linkable/' copy nearby
-        static bool canChown = true; // only if we can get permissions right
+        static std::atomic<bool> canChown(true); // only if we can get permissions right
         if ((forceInitialCopy || errno == EXDEV) && canChown)
         {
             // then copy somewhere closer and hard link from there
@@ -352,8 +414,12 @@ namespace
 
             if (errno == ENOENT)
             {
-                File(Path(linkableCopy).parent()).createDirectories();
-                if (!FileUtil::copy(fpath, linkableCopy, /*log=*/false, /*throw_on_error=*/false))
+                {
+                    std::lock_guard<std::mutex> lock(linkableDirsMutex);
+                    File(Path(linkableCopy).parent()).createDirectories();
+                }
+
+                if (!timedCopy(fpath, linkableCopy))
                     LOG_TRC("Failed to create linkable copy [" << fpath << "] to [" << linkableCopy.c_str() << "]");
                 else {
                     // Match system permissions, so a file we can write is not shared across jails.
@@ -374,16 +440,15 @@ namespace
                     << ". Cannot create linkable copy.");
         }
 
-        static bool warned = false;
-        if (!warned)
+        static std::atomic<bool> warned(false);
+        if (!warned.exchange(true))
         {
             LOG_ERR("link(\"" << fpath << "\", \"" << newPath.c_str() << "\") failed: " << strerror(errno)
                     << ". Very slow copying path triggered.");
-            warned = true;
         } else
             LOG_TRC("link(\"" << fpath << "\", \"" << newPath.c_str() << "\") failed: " << strerror(errno)
                     << ". Will copy.");
-        if (!FileUtil::copy(fpath, newPath.c_str(), /*log=*/false, /*throw_on_error=*/false))
+        if (!timedCopy(fpath, newPath))
         {
             LOG_FTL("Failed to copy or link [" << fpath << "] to [" << newPath << "]. Exiting.");
             Util::forcedExit(EX_SOFTWARE);
@@ -424,8 +489,9 @@ namespace
         case FTW_SLN:
             File(newPath.parent()).createDirectories();
 
+            // The directories are created in the walk, the files are linked in parallel after.
             if (shouldLinkFile(relativeOldPath))
-                linkOrCopyFile(fpath, newPath.toString());
+                linkOrCopyPendingFiles.emplace_back(fpath, newPath.toString());
             break;
         case FTW_D:
             {
@@ -488,6 +554,40 @@ namespace
         return FTW_CONTINUE;
     }
 
+    /// Links or copies the files collected by the tree walk.
+    /// Linking is cheap, but on network and stacking file-systems each link (and certainly
+    /// each copy) is a round-trip, so we spread the work over a few threads.
+    void linkOrCopyPending()
+    {
+        const std::size_t count = linkOrCopyPendingFiles.size();
+        const std::size_t numThreads = std::min<std::size_t>(
+            std::min<std::size_t>(std::max(std::thread::hardware_concurrency(), 1U),
+                                  MaxLinkOrCopyThreads),
+            std::max<std::size_t>(count / MinFilesPerLinkOrCopyThread, 1));
+        LOG_DBG("Linking/Copying " << count << " files with " << numThreads << " thread(s)");
+
+        std::atomic<std::size_t> next(0);
+        const auto worker = [&next, count]()
+        {
+            for (std::size_t i = next++; i < count; i = next++)
+            {
+                linkOrCopyFile(linkOrCopyPendingFiles[i].first.c_str(),
+                               linkOrCopyPendingFiles[i].second);
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for (std::size_t i = 1; i < numThreads; ++i)
+            threads.emplace_back(worker);
+
+        worker();
+
+        for (std::thread& thread : threads)
+            thread.join();
+
+        linkOrCopyPendingFiles.clear();
+    }
+
     void linkOrCopy(std::string source, const Poco::Path& destination, const std::string& linkable,
                     LinkOrCopyType type)
     {
@@ -510,13 +610,18 @@ namespace
         linkableForLinkOrCopy = linkable;
         linkOrCopyFileCount = 0;
         linkOrCopyStartTime = std::chrono::steady_clock::now();
-        forceInitialCopy = detectSlowStackingFileSystem(destination.toString());
+        // The template is already on the destination file-system, linking from it is all we need.
+        forceInitialCopy = type != LinkOrCopyType::Template
+                           && detectSlowStackingFileSystem(destination.toString());
 
+        linkOrCopyPendingFiles.clear();
         if (nftw(source.c_str(), linkOrCopyFunction, 10, FTW_ACTIONRETVAL|FTW_PHYS) == -1)
         {
             LOG_ERR("linkOrCopy: nftw() failed for '" << source << '\'');
         }
 
+        linkOrCopyPending();
+
         if (linkOrCopyVerboseLogging)
         {
             linkOrCopyVerboseLogging = false;
@@ -707,6 +812,7 @@ public:
         _isDocPasswordProtected(false),
         _docPasswordType(PasswordType::ToView),
         _stop(false),
+        _isModified(false),
         _editorId(-1),
         _editorChangeWarning(false),
         _mobileAppDocId(mobileAppDocId),
@@ -751,6 +857,10 @@ public:
     bool postMessage(const char* data, int size, const WSOpCode code) const
     {
         LOG_TRC("postMessage called with: " << getAbbreviatedMessage(data, size));
+#if !MOBILEAPP
+        if (BackgroundSave::isChild())
+            return false; // The kit reports for us.
+#endif
         if (!_websocketHandler)
         {
             LOG_ERR("Child Doc: Bad socket while sending [" << getAbbreviatedMessage(data, size) << "].");
@@ -959,6 +1069,124 @@ public:
         alertAllUsers("errortoall: cmd=" + cmd + " kind=" + kind);
     }
 
+    bool saveInBackground(const std::string& sessionId, const std::string& command) override
+    {
+#if !MOBILEAPP
+        static const bool enabled = std::getenv("LOOL_BACKGROUND_SAVE") != nullptr;
+        const std::string path = Poco::URI(_jailedUrl).getPath();
+        if (!enabled || !_isModified || _bgSave.isSaving() ||
+            !BackgroundSave::isSupportedFormat(path))
+        {
+            return false;
+        }
+
+        const auto it = _sessions.find(sessionId);
+        if (it == _sessions.end())
+            return false;
+
+        if (_bgSave.isReportedUnmodified())
+        {
+            // Nothing changed since we last saved, which Core doesn't know of.
+            LOG_DBG("Not saving in the background, unmodified since the last save");
+            it->second->loKitCallback(LOK_CALLBACK_UNO_COMMAND_RESULT,
+                                      "{\"commandName\":\".uno:Save\",\"success\":false,"
+                                      "\"result\":{\"type\":\"string\",\"value\":\"unmodified\"}}");
+            return true;
+        }
+
+        if (!_bgSave.start(*_loKit, *_loKitDocument, path))
+            return false;
+
+        _bgSaveSessionId = sessionId;
+        _bgSaveCommand = command;
+        return true;
+#else
+        (void)sessionId;
+        (void)command;
+        return false;
+#endif
+    }
+
+    void finishBackgroundSave() override
+    {
+#if !MOBILEAPP
+        if (_bgSave.isSaving())
+        {
+            LOG_DBG("Waiting for the background save to finish");
+            checkBackgroundSave(/*wait=*/true);
+        }
+#endif
+    }
+
+    void noteEditingInput() override
+    {
+#if !MOBILEAPP
+        if (_bgSave.noteModified())
+        {
+            // Core won't tell, as it has had the document modified all along.
+            notifyAll("statechanged: .uno:ModifiedStatus=true");
+        }
+#endif
+    }
+
+#if !MOBILEAPP
+    /// Reports the background save, once done, to the session it was for.
+    void checkBackgroundSave(bool wait = false)
+    {
+        const BackgroundSave::State state = _bgSave.poll(wait);
+        if (state != BackgroundSave::State::Succeeded && state != BackgroundSave::State::Failed)
+            return;
+
+        const auto it = _sessions.find(_bgSaveSessionId);
+        if (it == _sessions.end())
+        {
+            LOG_WRN("Session [" << _bgSaveSessionId << "] that saved in the background is gone");
+            return;
+        }
+
+        if (state == BackgroundSave::State::Failed)
+        {
+            LOG_WRN("Saving in the foreground, as the background save failed: "
+                    << _bgSave.getError());
+            it->second->saveInForeground(_bgSaveCommand);
+            return;
+        }
+
+        // As Core does, report the document unmodified before the result of saving.
+        if (!_bgSave.wasModifiedDuringSave())
+            notifyAll("statechanged: .uno:ModifiedStatus=false");
+
+        it->second->loKitCallback(LOK_CALLBACK_UNO_COMMAND_RESULT,
+                                  "{\"commandName\":\".uno:Save\",\"success\":true,"
+                                  "\"wasModified\":true}");
+    }
+#endif
+
+    /// Tracks whether the document is modified, on the callbacks from Core.
+    void trackModifiedState(int type, const std::string& payload)
+    {
+        if (type == LOK_CALLBACK_STATE_CHANGED &&
+            Util::startsWith(payload, ".uno:ModifiedStatus="))
+        {
+            _isModified = (payload == ".uno:ModifiedStatus=true");
+#if !MOBILEAPP
+            if (_isModified)
+                _bgSave.noteModified();
+            else
+                _bgSave.noteUnmodified();
+#endif
+        }
+    }
+
+    /// The memory of the reference bitmaps of the tile and window deltas.
+    std::size_t getDeltaBytes()
+    {
+        std::size_t bytes = _deltaGen.getBytes();
+        for (const auto& it : _sessions)
+            bytes += it.second->getWindowDeltaBytes();
+        return bytes;
+    }
+
     unsigned getMobileAppDocId() const override
     {
         return _mobileAppDocId;
@@ -1388,11 +1616,15 @@ private:
             return;
         }
         std::shared_ptr<ChildSession> session = it->second;
-        int newCanonicalId = _sessions.createCanonicalId(getViewProps(session));
+        const std::string viewProps = getViewProps(session);
+        int newCanonicalId = _sessions.createCanonicalId(viewProps);
         if (newCanonicalId == session->getCanonicalViewId())
             return;
         session->setCanonicalViewId(newCanonicalId);
-        std::string message = "canonicalidchange: viewid=" + std::to_string(session->getViewId()) + " canonicalid=" + std::to_string(newCanonicalId);
+        // Canonical ids are in order of appearance, the hash of the properties is stable, to store tiles by.
+        const std::string viewPropsHash
+            = Util::encodeId(SpookyHash::Hash64(viewProps.data(), viewProps.size(), 0), 16);
+        std::string message = "canonicalidchange: viewid=" + std::to_string(session->getViewId()) + " canonicalid=" + std::to_string(newCanonicalId) + " viewprops=" + viewPropsHash;
         session->sendTextFrame(message);
     }
 
@@ -1599,6 +1831,14 @@ private:
             // No support for changing them after opening a document.
             _renderOpts = renderOpts;
             spellOnline = session->getSpellOnline();
+
+#if !MOBILEAPP
+            // WSD gives a save 4 times as long as the load took, and at least 5s.
+            // Give up on the background in half of that, to save in the foreground
+            // before WSD gives up on the save altogether.
+            _bgSave.setTimeout(std::max<std::chrono::milliseconds>(
+                elapsed * 2, std::chrono::milliseconds(2500)));
+#endif
         }
         else
         {
@@ -1878,6 +2118,8 @@ public:
                                                    + tokens[2].length() + 3; // + delims
                         const std::string payload(input.data() + offset, input.size() - offset);
 
+                        trackModifiedState(type, payload);
+
                         // Forward the callback to the same view, demultiplexing is done by the LibreOffice core.
                         bool isFound = false;
                         for (const auto& it : _sessions)
@@ -2086,6 +2328,15 @@ private:
     ThreadPool _pngPool;
     DeltaGenerator _deltaGen;
 
+    /// Whether Core has the document as modified.
+    bool _isModified;
+#if !MOBILEAPP
+    BackgroundSave _bgSave;
+    /// The session, and its .uno:Save, that we save in the background for.
+    std::string _bgSaveSessionId;
+    std::string _bgSaveCommand;
+#endif
+
     std::condition_variable _cvLoading;
     int _editorId;
     bool _editorChangeWarning;
@@ -2180,12 +2431,52 @@ void TraceEvent::emitOneRecording(const std::string &recording)
     addRecording(recording, false);
 }
 
+/// Reports the latency histograms observed since the last report to WSD, every few seconds.
+static void flushLatencyHistograms()
+{
+    static std::chrono::steady_clock::time_point lastFlushTime;
+    const auto now = std::chrono::steady_clock::now();
+    if (singletonDocument == nullptr || now - lastFlushTime < std::chrono::seconds(5))
+        return;
+
+    lastFlushTime = now;
+    const std::string histograms = LatencyHistogram::serializeNew();
+    if (!histograms.empty())
+        singletonDocument->sendTextFrame("histograms: \n" + histograms);
+}
+
+/// Reports the memory of the reference bitmaps for deltas to WSD, when it changes.
+static void reportDeltaMemory()
+{
+    static std::chrono::steady_clock::time_point lastReportTime;
+    static std::size_t lastBytes = 0;
+    const auto now = std::chrono::steady_clock::now();
+    if (singletonDocument == nullptr || now - lastReportTime < std::chrono::seconds(5))
+        return;
+
+    lastReportTime = now;
+    const std::size_t bytes = singletonDocument->getDeltaBytes();
+    if (bytes != lastBytes)
+    {
+        lastBytes = bytes;
+        singletonDocument->sendTextFrame("deltamemory: bytes=" + std::to_string(bytes));
+    }
+}
+
 #elif !MOBILEAPP
 
 static void flushTraceEventRecordings()
 {
 }
 
+static void flushLatencyHistograms()
+{
+}
+
+static void reportDeltaMemory()
+{
+}
+
 #endif
 
 #ifdef __ANDROID__
@@ -2333,7 +2624,12 @@ public:
         drainQueue();
 
 #if !MOBILEAPP
+        if (_document)
+            _document->checkBackgroundSave();
+
         flushTraceEventRecordings();
+        flushLatencyHistograms();
+        reportDeltaMemory();
 
         if (_document && _document->purgeSessions() == 0)
         {
@@ -2692,6 +2988,55 @@ void copyCertificateDatabaseToTmp(Poco::Path const& jailPath)
 #endif
 }
 
+#if !MOBILEAPP
+bool prepareJailTemplate(const std::string& childRoot, const std::string& sysTemplate,
+                         const std::string& loTemplate)
+{
+    const auto startTime = std::chrono::steady_clock::now();
+
+    const std::string templatePath = Poco::Path(childRoot, JailTemplateSubPath).toString();
+    const std::string readyMarker = Poco::Path(templatePath, JailTemplateReadyMarker).toString();
+
+    // Start from scratch; a previous run might have left a partial or an outdated template.
+    FileUtil::removeFile(templatePath, true);
+    JailUtil::createJailPath(templatePath);
+
+    LOG_INF("Preparing jail template in [" << templatePath << "].");
+
+    const std::string linkablePath = childRoot + "/linkable";
+    linkOrCopy(sysTemplate, Poco::Path::forDirectory(templatePath), linkablePath,
+               LinkOrCopyType::All);
+
+    Poco::Path loTemplateDest = Poco::Path::forDirectory(templatePath);
+    loTemplateDest.pushDirectory(JailUtil::LO_JAIL_SUBPATH);
+    JailUtil::createJailPath(loTemplateDest.toString());
+    linkOrCopy(loTemplate, loTemplateDest, linkablePath, LinkOrCopyType::LO);
+
+    if (linkOrCopyCopiedCount > 0)
+    {
+        LOG_WRN("Jail template needed " << linkOrCopyCopiedCount
+                                        << " files copied, taking a total of "
+                                        << linkOrCopyCopyTimeUs / 1000
+                                        << "ms. Jails will be linked from the template.");
+    }
+
+    try
+    {
+        Poco::File(readyMarker).createFile();
+    }
+    catch (const std::exception& exc)
+    {
+        LOG_ERR("Failed to create the jail template marker [" << readyMarker
+                                                              << "]: " << exc.what());
+        FileUtil::removeFile(templatePath, true);
+        return false;
+    }
+
+    LOG_INF("Jail template in [" << templatePath << "] is ready in " << msSince(startTime));
+    return true;
+}
+#endif // !MOBILEAPP
+
 void lokit_main(
 #if !MOBILEAPP
                 const std::string& childRoot,
@@ -2773,6 +3118,7 @@ void lokit_main(
         const std::string jailPathStr = jailPath.toString();
         JailUtil::createJailPath(jailPathStr);
 
+        JailSetupTimes jailSetupTimes;
         if (!ChildSession::NoCapsForKit)
         {
             std::chrono::time_point<std::chrono::steady_clock> jailSetupStartTime
@@ -2835,7 +3181,10 @@ void lokit_main(
                 assert(!"Mounting is not compatible with code-coverage.");
 #endif // CODE_COVERAGE
 
-                if (!mountJail())
+                const auto mountStartTime = std::chrono::steady_clock::now();
+                const bool mounted = mountJail();
+                jailSetupTimes._mount = msSince(mountStartTime);
+                if (!mounted)
                 {
                     LOG_INF("Cleaning up jail before linking/copying.");
                     JailUtil::tryRemoveJail(jailPathStr);
@@ -2857,9 +3206,31 @@ void lokit_main(
 
                 const std::string linkablePath = childRoot + "/linkable";
 
-                linkOrCopy(sysTemplate, jailPath, linkablePath, LinkOrCopyType::All);
+                const auto linkStartTime = std::chrono::steady_clock::now();
+                linkOrCopyCopyTimeUs = 0;
 
-                linkOrCopy(loTemplate, loJailDestPath, linkablePath, LinkOrCopyType::LO);
+                // Prefer the pre-linked template, which is on our file-system, so
+                // we only need to hard-link, and the filtering is already done.
+                const std::string templatePath
+                    = Poco::Path(childRoot, JailTemplateSubPath).toString();
+                if (FileUtil::Stat(Poco::Path(templatePath, JailTemplateReadyMarker).toString())
+                        .exists())
+                {
+                    linkOrCopy(templatePath, jailPath, linkablePath, LinkOrCopyType::Template);
+                    FileUtil::removeFile(Poco::Path(jailPath, JailTemplateReadyMarker).toString());
+                }
+                else
+                {
+                    linkOrCopy(sysTemplate, jailPath, linkablePath, LinkOrCopyType::All);
+
+                    linkOrCopy(loTemplate, loJailDestPath, linkablePath, LinkOrCopyType::LO);
+                }
+
+                jailSetupTimes._copy = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::microseconds(linkOrCopyCopyTimeUs));
+                // Copying is accounted across the threads, so it could exceed the wall-clock.
+                jailSetupTimes._link = std::max(msSince(linkStartTime) - jailSetupTimes._copy,
+                                                std::chrono::milliseconds::zero());
 
 #if CODE_COVERAGE
                 // Link the .gcda files.
@@ -2893,11 +3264,15 @@ void lokit_main(
                 std::chrono::steady_clock::now() - jailSetupStartTime);
             LOG_DBG("Initialized jail files in " << ms);
 
-            ProcSMapsFile = open("/proc/self/smaps", O_RDONLY);
+            // WSD samples our memory through this; smaps_rollup is far cheaper to read.
+            ProcSMapsFile = open("/proc/self/smaps_rollup", O_RDONLY);
+            if (ProcSMapsFile < 0)
+                ProcSMapsFile = open("/proc/self/smaps", O_RDONLY);
             if (ProcSMapsFile < 0)
                 LOG_SYS("Failed to open /proc/self/smaps. Memory stats will be missing.");
 
             LOG_INF("chroot(\"" << jailPathStr << "\")");
+            const auto chrootStartTime = std::chrono::steady_clock::now();
             if (chroot(jailPathStr.c_str()) == -1)
             {
                 LOG_SFL("chroot(\"" << jailPathStr << "\") failed");
@@ -2917,6 +3292,7 @@ void lokit_main(
             dropCapability(CAP_CHOWN);
 #endif
 
+            jailSetupTimes._chroot = msSince(chrootStartTime);
             LOG_DBG("Initialized jail nodes, dropped caps.");
         }
         else // noCapabilities set
@@ -2937,6 +3313,7 @@ void lokit_main(
 
         LibreOfficeKit *kit;
         {
+            const auto preinitStartTime = std::chrono::steady_clock::now();
             const char *instdir = instdir_path.c_str();
             const char *userdir = userdir_url.c_str();
 #ifndef KIT_IN_PROCESS
@@ -2956,6 +3333,8 @@ void lokit_main(
                 LOG_FTL("LibreOfficeKit initialization failed. Exiting.");
                 Util::forcedExit(EX_SOFTWARE);
             }
+
+            jailSetupTimes._preinit = msSince(preinitStartTime);
         }
 
         // Lock down the syscalls that can be used
@@ -2997,6 +3376,8 @@ void lokit_main(
         std::string pathAndQuery(NEW_CHILD_URI);
         pathAndQuery.append("?jailid=");
         pathAndQuery.append(jailId);
+        pathAndQuery.append("&timings=");
+        pathAndQuery.append(jailSetupTimes.toString());
         if (queryVersion)
         {
             char* versionInfo = loKit->getVersionInfo();
@@ -47,6 +47,14 @@ void lokit_main(
 void runKitLoopInAThread();
 #endif
 
+#if !MOBILEAPP
+/// Links sysTemplate and loTemplate, filtered, into a jail template in
+/// childRoot, from which jails are then cheaply hard-linked.
+/// Returns false on failure, in which case jails are linked from the originals.
+bool prepareJailTemplate(const std::string& childRoot, const std::string& sysTemplate,
+                         const std::string& loTemplate);
+#endif
+
 bool globalPreinit(const std::string& loTemplate);
 /// Wrapper around private Document::ViewCallback().
 void documentViewCallback(const int type, const char* p, void* data);
@@ -19,6 +19,7 @@
 void ChildSession::loKitCallback(const int /* type */, const std::string& /* payload */) {}
 void ChildSession::disconnect() {}
 bool ChildSession::_handleInput(const char* /*buffer*/, int /*length*/) { return false; }
+bool ChildSession::saveInForeground(const std::string& /*command*/) { return false; }
 ChildSession::~ChildSession() {}
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -23,9 +23,10 @@ class Buffer
 {
     std::size_t _offset;  /// offset into _buffer of data
     std::vector<char> _buffer;
+    std::size_t _eraseCount; /// see getEraseCount()
 
 public:
-    Buffer() : _offset(0)
+    Buffer() : _offset(0), _eraseCount(0)
     {
     }
 
@@ -47,6 +48,10 @@ public:
         return size();
     }
 
+    /// Changes whenever data is removed, which invalidates
+    /// what was learned from the data, e.g. by a parser.
+    std::size_t getEraseCount() const { return _eraseCount; }
+
     void eraseFirst(std::size_t len)
     {
         if (len <= 0)
@@ -56,6 +61,7 @@ public:
         assert(_offset + size() == _buffer.size());
 
         len = std::min(len, size()); // Avoid accidental damage.
+        ++_eraseCount;
 
         // avoid regular shuffling down larger chunks of data
         if (_buffer.size() > 16384 && // lots of queued data
@@ -99,6 +105,7 @@ public:
     {
         _buffer.clear();
         _offset = 0;
+        ++_eraseCount;
     }
 
     iterator begin() { return _buffer.begin() + _offset; }
@@ -124,6 +131,7 @@ public:
             eraseFirst(last - begin());
             return begin();
         }
+        ++_eraseCount;
         iterator ret = _buffer.erase(first, last);
         return ret;
     }
@@ -10,6 +10,7 @@
 #include "HttpHelper.hpp"
 
 #include <algorithm>
+#include <fcntl.h>
 #include <string>
 #include <zlib.h>
 
@@ -135,7 +136,12 @@ void sendFileAndShutdown(const std::shared_ptr<StreamSocket>& socket, const std:
         socket->send(*response);
 
         if (!headerOnly)
-            sendUncompressedFileContent(socket, path, bufferSize);
+        {
+            // Let the kernel move the file to the socket, when we can.
+            const int fd = socket->supportsSendFile() ? open(path.c_str(), O_RDONLY | O_CLOEXEC) : -1;
+            if (fd < 0 || !socket->sendFile(fd, 0, st.size()))
+                sendUncompressedFileContent(socket, path, bufferSize);
+        }
     }
     else
     {
@@ -0,0 +1,295 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <config.h>
+
+#include "HttpParser.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace http
+{
+namespace
+{
+/// The longest line we accept: the request line, or a field.
+constexpr std::size_t MaxLineLen =
+    std::max(RequestParser::MaxMethodLen + RequestParser::MaxUriLen +
+                 RequestParser::MaxVersionLen + 4,
+             RequestParser::MaxNameLen + RequestParser::MaxValueLen + 4);
+
+/// The characters of a token (RFC 7230 section 3.2.6), e.g. a method or a field name.
+struct TokenChars
+{
+    bool _table[256];
+
+    constexpr TokenChars()
+        : _table()
+    {
+        for (int ch = '0'; ch <= '9'; ++ch)
+            _table[ch] = true;
+        for (int ch = 'a'; ch <= 'z'; ++ch)
+            _table[ch] = _table[ch - 'a' + 'A'] = true;
+        for (const char* p = "!#$%&'*+-.^_`|~"; *p; ++p)
+            _table[static_cast<unsigned char>(*p)] = true;
+    }
+};
+
+constexpr TokenChars TokenTable;
+
+bool isTokenChar(char ch) { return TokenTable._table[static_cast<unsigned char>(ch)]; }
+
+bool isToken(const char* p, std::size_t len)
+{
+    for (std::size_t i = 0; i < len; ++i)
+    {
+        if (!isTokenChar(p[i]))
+            return false;
+    }
+
+    return len > 0;
+}
+
+bool isSpace(char ch) { return ch == ' ' || ch == '\t'; }
+
+/// Control characters, other than the tab, have no place in the header.
+bool isControl(char ch) { return (static_cast<unsigned char>(ch) < 0x20 && ch != '\t') || ch == 0x7f; }
+
+char toLower(char ch) { return ch >= 'A' && ch <= 'Z' ? ch - 'A' + 'a' : ch; }
+
+bool iequal(std::string_view lhs, std::string_view rhs)
+{
+    if (lhs.size() != rhs.size())
+        return false;
+
+    for (std::size_t i = 0; i < lhs.size(); ++i)
+    {
+        if (toLower(lhs[i]) != toLower(rhs[i]))
+            return false;
+    }
+
+    return true;
+}
+
+std::string_view trimmed(std::string_view value)
+{
+    while (!value.empty() && isSpace(value.front()))
+        value.remove_prefix(1);
+    while (!value.empty() && isSpace(value.back()))
+        value.remove_suffix(1);
+
+    return value;
+}
+} // namespace
+
+void RequestParser::reset()
+{
+    _data = nullptr;
+    _state = State::Incomplete;
+    _haveRequestLine = false;
+    _lineStart = 0;
+    _scanned = 0;
+    _headerSize = 0;
+    _method = _uri = _version = Span{ 0, 0 };
+    _fields.clear();
+    _contentLength = -1;
+    _chunked = false;
+    _haveTransferEncoding = false;
+}
+
+RequestParser::State RequestParser::invalid()
+{
+    _state = State::Invalid;
+    return _state;
+}
+
+RequestParser::State RequestParser::parse(const char* data, std::size_t len)
+{
+    _data = data;
+    if (_state != State::Incomplete)
+        return _state;
+
+    assert(len >= _scanned && "The data given before must be kept");
+    while (_scanned < len)
+    {
+        const char* lineFeed =
+            static_cast<const char*>(std::memchr(data + _scanned, '\n', len - _scanned));
+        if (!lineFeed)
+        {
+            _scanned = len;
+            break;
+        }
+
+        const std::size_t lineFeedOffset = lineFeed - data;
+        std::size_t end = lineFeedOffset;
+        if (end > _lineStart && data[end - 1] == '\r')
+            --end;
+
+        if (end - _lineStart > MaxLineLen)
+            return invalid();
+
+        if (!(_haveRequestLine ? parseField(_lineStart, end) : parseRequestLine(_lineStart, end)))
+            return invalid();
+
+        _lineStart = _scanned = lineFeedOffset + 1;
+        if (_state == State::Complete)
+        {
+            _headerSize = _lineStart;
+            return _state;
+        }
+    }
+
+    // Don't wait for the end of a line that is too long already.
+    if (len - _lineStart > MaxLineLen + 1)
+        return invalid();
+
+    return _state;
+}
+
+bool RequestParser::parseRequestLine(std::size_t begin, std::size_t end)
+{
+    // Empty lines before the request line are to be ignored (RFC 7230 section 3.5).
+    if (begin == end)
+        return true;
+
+    const char* p = _data;
+
+    std::size_t off = begin;
+    while (off < end && p[off] != ' ')
+        ++off;
+    if (off - begin > MaxMethodLen || !isToken(p + begin, off - begin))
+        return false;
+    _method = Span{ static_cast<uint32_t>(begin), static_cast<uint32_t>(off - begin) };
+
+    while (off < end && p[off] == ' ')
+        ++off;
+    const std::size_t uriBegin = off;
+    while (off < end && p[off] != ' ')
+    {
+        if (isControl(p[off]))
+            return false;
+        ++off;
+    }
+    if (off == uriBegin || off - uriBegin > MaxUriLen)
+        return false;
+    _uri = Span{ static_cast<uint32_t>(uriBegin), static_cast<uint32_t>(off - uriBegin) };
+
+    while (off < end && p[off] == ' ')
+        ++off;
+    std::size_t versionEnd = end;
+    while (versionEnd > off && isSpace(p[versionEnd - 1]))
+        --versionEnd;
+
+    // HTTP/<digit>.<digit>
+    const std::size_t versionLen = versionEnd - off;
+    if (versionLen != MaxVersionLen || std::memcmp(p + off, "HTTP/", 5) != 0 ||
+        p[off + 5] < '0' || p[off + 5] > '9' || p[off + 6] != '.' || p[off + 7] < '0' ||
+        p[off + 7] > '9')
+        return false;
+    _version = Span{ static_cast<uint32_t>(off), static_cast<uint32_t>(versionLen) };
+
+    _haveRequestLine = true;
+    return true;
+}
+
+bool RequestParser::parseField(std::size_t begin, std::size_t end)
+{
+    if (begin == end)
+    {
+        // Both are ways to find the end of the body; having both is an attack (smuggling).
+        if (_haveTransferEncoding && _contentLength >= 0)
+            return false;
+
+        _state = State::Complete;
+        return true;
+    }
+
+    const char* p = _data;
+
+    // Obsolete line folding (RFC 7230 section 3.2.4).
+    if (isSpace(p[begin]))
+        return false;
+
+    const char* colon = static_cast<const char*>(std::memchr(p + begin, ':', end - begin));
+    if (!colon)
+        return false;
+
+    // No whitespace is allowed before the colon either.
+    const std::size_t nameLen = colon - (p + begin);
+    if (nameLen > MaxNameLen || !isToken(p + begin, nameLen))
+        return false;
+
+    const std::size_t valueBegin = nameLen + begin + 1;
+    for (std::size_t i = valueBegin; i < end; ++i)
+    {
+        if (isControl(p[i]))
+            return false;
+    }
+
+    const std::string_view value = trimmed(std::string_view(p + valueBegin, end - valueBegin));
+    if (value.size() > MaxValueLen || _fields.size() >= MaxFields)
+        return false;
+
+    const std::string_view name(p + begin, nameLen);
+    if (iequal(name, "Content-Length"))
+    {
+        if (value.empty() || value.size() > 18)
+            return false;
+
+        int64_t length = 0;
+        for (const char ch : value)
+        {
+            if (ch < '0' || ch > '9')
+                return false;
+            length = length * 10 + (ch - '0');
+        }
+
+        if (_contentLength >= 0 && _contentLength != length)
+            return false;
+        _contentLength = length;
+    }
+    else if (iequal(name, "Transfer-Encoding"))
+    {
+        // The codings are listed in the order they were applied, the last one being outermost.
+        const std::size_t comma = value.rfind(',');
+        const std::string_view last =
+            trimmed(comma == std::string_view::npos ? value : value.substr(comma + 1));
+        _chunked = iequal(last, "chunked");
+        _haveTransferEncoding = true;
+    }
+
+    _fields.emplace_back(Span{ static_cast<uint32_t>(begin), static_cast<uint32_t>(nameLen) },
+                         Span{ static_cast<uint32_t>(value.data() - p),
+                               static_cast<uint32_t>(value.size()) });
+    return true;
+}
+
+std::string_view RequestParser::get(std::string_view name, std::string_view defaultValue) const
+{
+    for (const auto& field : _fields)
+    {
+        if (iequal(view(field.first), name))
+            return view(field.second);
+    }
+
+    return defaultValue;
+}
+
+bool RequestParser::has(std::string_view name) const
+{
+    for (const auto& field : _fields)
+    {
+        if (iequal(view(field.first), name))
+            return true;
+    }
+
+    return false;
+}
+
+} // namespace http
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,138 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <common/StateEnum.hpp>
+
+namespace http
+{
+/// A resumable parser of the request line and header of an HTTP/1.x request.
+///
+/// It neither copies nor allocates per request: it records the offsets of the
+/// tokens in the input, and the accessors return them as views. The input may
+/// grow, and move, between calls, as long as the bytes given before are kept.
+/// Each call only scans the new bytes, so a header that arrives over many reads
+/// is still scanned once. The views are valid until the input is modified.
+///
+/// Obsolete line folding, whitespace before the colon, conflicting lengths
+/// and control characters are rejected, rather than guessed at.
+class RequestParser
+{
+public:
+    /// The limits of Poco::Net::HTTPRequest, which we replace.
+    static constexpr std::size_t MaxMethodLen = 32;
+    static constexpr std::size_t MaxUriLen = 16 * 1024;
+    static constexpr std::size_t MaxVersionLen = 8;
+    static constexpr std::size_t MaxNameLen = 256;
+    static constexpr std::size_t MaxValueLen = 8 * 1024;
+    static constexpr std::size_t MaxFields = 100;
+
+    STATE_ENUM(State,
+               Incomplete, //< Haven't reached the blank line yet.
+               Invalid, //< Malformed or too long.
+               Complete //< The request line and the header are valid.
+    );
+
+    RequestParser() { reset(); }
+
+    /// Forgets the request, to parse a new one.
+    void reset();
+
+    /// Parses the @len bytes at @data, which start with those given before, if any.
+    /// Returns Incomplete until the blank line that ends the header.
+    State parse(const char* data, std::size_t len);
+
+    State getState() const { return _state; }
+
+    /// The accessors below are only meaningful once Complete,
+    /// and refer to the data last given to parse().
+    std::string_view getMethod() const { return view(_method); }
+    std::string_view getUri() const { return view(_uri); }
+    std::string_view getVersion() const { return view(_version); }
+
+    std::size_t getFieldCount() const { return _fields.size(); }
+    std::string_view getFieldName(std::size_t index) const { return view(_fields[index].first); }
+    std::string_view getFieldValue(std::size_t index) const
+    {
+        return view(_fields[index].second);
+    }
+
+    /// Returns the value of the first field named @name, ignoring case, or an empty view.
+    std::string_view get(std::string_view name) const { return get(name, std::string_view()); }
+
+    /// Returns the value of the first field named @name, ignoring case, or @defaultValue.
+    std::string_view get(std::string_view name, std::string_view defaultValue) const;
+
+    bool has(std::string_view name) const;
+
+    /// The size of the request line and of the header, including the blank line.
+    std::size_t getHeaderSize() const { return _headerSize; }
+
+    /// The Content-Length, or -1 without one.
+    int64_t getContentLength() const { return _contentLength; }
+
+    /// True iff the last transfer coding is chunked.
+    bool isChunked() const { return _chunked; }
+
+private:
+    /// A token, as an offset into the data and a length.
+    struct Span
+    {
+        uint32_t _offset;
+        uint32_t _length;
+    };
+
+    std::string_view view(const Span& span) const
+    {
+        return std::string_view(_data + span._offset, span._length);
+    }
+
+    State invalid();
+
+    /// Parse the line [@begin, @end), without its line break.
+    bool parseRequestLine(std::size_t begin, std::size_t end);
+    bool parseField(std::size_t begin, std::size_t end);
+
+private:
+    const char* _data;
+    State _state;
+    bool _haveRequestLine;
+    /// Where the line being parsed starts.
+    std::size_t _lineStart;
+    /// How far we looked for the end of that line.
+    std::size_t _scanned;
+    std::size_t _headerSize;
+
+    Span _method;
+    Span _uri;
+    Span _version;
+    /// Keeps its capacity across requests.
+    std::vector<std::pair<Span, Span>> _fields;
+
+    int64_t _contentLength;
+    bool _chunked;
+    bool _haveTransferEncoding;
+};
+
+} // namespace http
+
+inline std::ostream& operator<<(std::ostream& os, const http::RequestParser::State& state)
+{
+    os << http::RequestParser::name(state);
+    return os;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
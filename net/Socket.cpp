@@ -11,6 +11,7 @@
 
 #include "Socket.hpp"
 
+#include <algorithm>
 #include <cstring>
 #include <ctype.h>
 #include <iomanip>
@@ -25,6 +26,9 @@
 #ifdef __FreeBSD__
 #include <sys/ucred.h>
 #endif
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 
 #include <Poco/MemoryStream.h>
 #include <Poco/Net/HTTPRequest.h>
@@ -541,6 +545,28 @@ void SocketPoll::removeSockets()
     }
 }
 
+void SocketPoll::removeSocket(const std::shared_ptr<Socket>& socket)
+{
+    ASSERT_CORRECT_SOCKET_THREAD(this);
+
+    const auto it = std::find(_pollSockets.begin(), _pollSockets.end(), socket);
+    if (it != _pollSockets.end())
+    {
+        LOG_DBG("Removing socket #" << socket->getFD() << " from " << _name);
+        socket->resetThreadOwner();
+        _pollSockets.erase(it);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    const auto itNew = std::find(_newSockets.begin(), _newSockets.end(), socket);
+    if (itNew != _newSockets.end())
+    {
+        LOG_DBG("Removing socket #" << socket->getFD() << " from newSockets of " << _name);
+        _newSockets.erase(itNew);
+    }
+}
+
 #if !MOBILEAPP
 
 void SocketPoll::insertNewWebSocketSync(const Poco::URI& uri,
@@ -729,7 +755,7 @@ void StreamSocket::dumpState(std::ostream& os)
     const int events = getPollEvents(std::chrono::steady_clock::now(), timeoutMaxMicroS);
     os << '\t' << getFD() << '\t' << events << '\t'
        << (ignoringInput() ? "ignore\t" : "process\t")
-       << _inBuffer.size() << '\t' << _outBuffer.size() << '\t'
+       << _inBuffer.size() << '\t' << _outBuffer.size() + _sendFileRemaining << '\t'
        << " r: " << _bytesRecvd << "\t w: " << _bytesSent << '\t'
        << clientAddress() << '\t';
     _socketHandler->dumpState(os);
@@ -738,6 +764,85 @@ void StreamSocket::dumpState(std::ostream& os)
     _outBuffer.dumpHex(os, "\t\toutBuffer:\n", "\t\t");
 }
 
+#if !MOBILEAPP
+bool StreamSocket::sendFile(int fd, off_t offset, std::size_t size)
+{
+    ASSERT_CORRECT_SOCKET_THREAD(this);
+
+    if (!supportsSendFile() || _sendFileFD >= 0)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    if (size == 0)
+    {
+        ::close(fd);
+        return true;
+    }
+
+    _sendFileFD = fd;
+    _sendFileOffset = offset;
+    _sendFileRemaining = size;
+    _bytesBeforeFile = _outBuffer.size();
+
+    writeOutgoingData();
+    return true;
+}
+
+int StreamSocket::writeFileData()
+{
+    ASSERT_CORRECT_SOCKET_THREAD(this);
+
+    ssize_t len = 0;
+    int last_errno = 0;
+#ifdef __linux__
+    while (_sendFileRemaining > 0)
+    {
+        const std::size_t size = std::min<std::size_t>(_sendFileRemaining, getSendBufferSize());
+        if (size == 0)
+            break;
+
+        len = ::sendfile(getFD(), _sendFileFD, &_sendFileOffset, size);
+        if (len < 0)
+        {
+            last_errno = errno;
+            if (last_errno == EINTR)
+                continue;
+
+            if (last_errno != EAGAIN && last_errno != EWOULDBLOCK)
+                LOG_SYS_ERRNO(last_errno, "sendfile returned " << len);
+            break;
+        }
+
+        if (len == 0)
+        {
+            // The file shrank under us; the peer expects more than we can give.
+            LOG_ERR('#' << getFD() << ": File truncated with " << _sendFileRemaining
+                        << " bytes left to send. Closing.");
+            _sendFileRemaining = 0;
+            setShutdownSignalled();
+            break;
+        }
+
+        LOG_TRC("Sent " << len << " bytes of file, " << _sendFileRemaining - len << " left");
+        _bytesSent += len;
+        _sendFileRemaining -= len;
+    }
+#endif
+
+    if (_sendFileRemaining == 0)
+    {
+        ::close(_sendFileFD);
+        _sendFileFD = -1;
+    }
+
+    // Restore errno from the sendfile call.
+    errno = last_errno;
+    return len;
+}
+#endif
+
 void StreamSocket::send(Poco::Net::HTTPResponse& response)
 {
     response.set("Server", HTTP_SERVER_STRING);
@@ -1099,60 +1204,93 @@ LocalServerSocket::~LocalServerSocket()
 #  define LOG_CHUNK(X)
 #endif
 
+void StreamSocket::setRequest(const http::RequestParser& parser, Poco::Net::HTTPRequest& request)
+{
+    // Copied field by field, without going through iostreams.
+    request.setMethod(std::string(parser.getMethod()));
+    request.setURI(std::string(parser.getUri()));
+    request.setVersion(std::string(parser.getVersion()));
+    for (std::size_t i = 0; i < parser.getFieldCount(); ++i)
+    {
+        request.add(std::string(parser.getFieldName(i)), std::string(parser.getFieldValue(i)));
+    }
+}
+
 bool StreamSocket::parseHeader(const char *clientName,
                                Poco::MemoryInputStream &message,
-                               Poco::Net::HTTPRequest &request,
                                MessageMap *map)
 {
     assert(!map || (map->_headerSize == 0 && map->_messageSize == 0));
 
-    // Find the end of the header, if any.
-    static const std::string marker("\r\n\r\n");
-    auto itBody = std::search(_inBuffer.begin(), _inBuffer.end(),
-                              marker.begin(), marker.end());
-    if (itBody == _inBuffer.end())
+    // Resume where we left off, unless the input was consumed since.
+    if (_requestParserEraseCount != _inBuffer.getEraseCount())
+    {
+        _requestParser.reset();
+        _requestParserEraseCount = _inBuffer.getEraseCount();
+    }
+
+    const http::RequestParser::State state =
+        _requestParser.parse(_inBuffer.data(), _inBuffer.size());
+    if (state == http::RequestParser::State::Incomplete)
     {
         LOG_TRC(clientName << " doesn't have enough data for the header yet.");
         return false;
     }
 
-    // Skip the marker.
-    itBody += marker.size();
+    if (state == http::RequestParser::State::Invalid)
+    {
+        LOG_WRN('#' << getFD() << ": " << clientName << " sent an invalid HTTP request.");
+        if (!isShutdownSignalled())
+        {
+            http::Response response(http::StatusCode::BadRequest);
+            response.set("Content-Length", "0");
+            sendAndShutdown(response);
+        }
+
+        ignoreInput();
+        return false;
+    }
+
+    auto itBody = _inBuffer.begin() + _requestParser.getHeaderSize();
     if (map) // a reasonable guess so far
     {
-        map->_headerSize = static_cast<size_t>(itBody - _inBuffer.begin());
+        map->_headerSize = _requestParser.getHeaderSize();
         map->_messageSize = map->_headerSize;
     }
 
     try
     {
-        request.read(message);
+        // Position the message at the body, as reading the request would.
+        message.seekg(_requestParser.getHeaderSize(), std::ios::beg);
 
-        LOG_INF('#' << getFD() << ": " << clientName << " HTTP Request: " << request.getMethod()
-                    << ' ' << request.getURI() << ' ' << request.getVersion() <<
+        LOG_INF('#' << getFD() << ": " << clientName << " HTTP Request: "
+                    << _requestParser.getMethod() << ' ' << _requestParser.getUri() << ' '
+                    << _requestParser.getVersion() <<
                 [&](auto& log)
                 {
-                    for (const auto& it : request)
+                    for (std::size_t i = 0; i < _requestParser.getFieldCount(); ++i)
                     {
-                        log << " / " << it.first << ": " << it.second;
+                        log << " / " << _requestParser.getFieldName(i) << ": "
+                            << _requestParser.getFieldValue(i);
                     }
                 });
 
-        const std::streamsize contentLength = request.getContentLength();
+        const std::streamsize contentLength = _requestParser.getContentLength();
         const auto offset = itBody - _inBuffer.begin();
         const std::streamsize available = _inBuffer.size() - offset;
 
-        if (contentLength != Poco::Net::HTTPMessage::UNKNOWN_CONTENT_LENGTH && available < contentLength)
+        if (contentLength >= 0 && available < contentLength)
         {
             LOG_DBG("Not enough content yet: ContentLength: " << contentLength
                                                               << ", available: " << available);
             return false;
         }
-        if (map)
+        if (map && contentLength > 0)
             map->_messageSize += contentLength;
 
-        const std::string expect = request.get("Expect", "");
-        const bool getExpectContinue = Util::iequal(expect, "100-continue");
+        const std::string_view expect = _requestParser.get("Expect");
+        const bool getExpectContinue =
+            Util::iequal(expect.data(), expect.size(), "100-continue", sizeof("100-continue") - 1);
         if (getExpectContinue && !_sentHTTPContinue)
         {
             LOG_TRC("Got Expect: 100-continue, sending Continue");
@@ -1162,7 +1300,7 @@ bool StreamSocket::parseHeader(const char *clientName,
             _sentHTTPContinue = true;
         }
 
-        if (request.getChunkedTransferEncoding())
+        if (_requestParser.isChunked())
         {
             // keep the header
             if (map)
@@ -37,6 +37,7 @@
 #include "Util.hpp"
 #include "Protocol.hpp"
 #include "Buffer.hpp"
+#include "HttpParser.hpp"
 #include "SigUtil.hpp"
 
 #ifdef __linux__
@@ -725,6 +726,9 @@ public:
         }
     }
 
+    /// Removes @socket, if we poll it, without closing it. Only in our thread.
+    void removeSocket(const std::shared_ptr<Socket>& socket);
+
 #if !MOBILEAPP
     /// Inserts a new remote websocket to be polled.
     /// NOTE: The DNS lookup is synchronous.
@@ -923,6 +927,11 @@ public:
         _shutdownSignalled(false),
         _incomingFD(-1),
         _readType(readType),
+        _sendFileFD(-1),
+        _sendFileOffset(0),
+        _sendFileRemaining(0),
+        _bytesBeforeFile(0),
+        _requestParserEraseCount(0),
         _inputProcessingEnabled(true)
     {
         LOG_TRC("StreamSocket ctor");
@@ -950,6 +959,9 @@ public:
             _shutdownSignalled = true;
             StreamSocket::closeConnection();
         }
+
+        if (_sendFileFD >= 0)
+            ::close(_sendFileFD);
     }
 
     bool isClosed() const { return _closed; }
@@ -984,16 +996,19 @@ public:
         // cf. SslSocket::getPollEvents
         ASSERT_CORRECT_SOCKET_THREAD(this);
         int events = _socketHandler->getPollEvents(now, timeoutMaxMicroS);
-        if (!_outBuffer.empty() || _shutdownSignalled)
+        if (hasPendingOutput() || _shutdownSignalled)
             events |= POLLOUT;
         return events;
     }
 
     virtual bool hasBuffered() const override
     {
-        return !_outBuffer.empty() || !_inBuffer.empty();
+        return hasPendingOutput() || !_inBuffer.empty();
     }
 
+    /// True if we have buffered data, or a file, still to write.
+    bool hasPendingOutput() const { return !_outBuffer.empty() || _sendFileFD >= 0; }
+
     /// Send data to the socket peer.
     void send(const char* data, const int len, const bool doFlush = true)
     {
@@ -1032,10 +1047,30 @@ public:
     /// Will always shutdown the socket.
     bool sendAndShutdown(http::Response& response);
 
+#if !MOBILEAPP
+    /// Queues @size bytes of the file @fd, starting at @offset, to be
+    /// sent after what is already buffered, with sendfile(2), such that
+    /// the content never passes through user-space. Takes ownership of @fd.
+    /// Returns false, having closed @fd, if the socket can't send files,
+    /// see supportsSendFile(), or is already sending one.
+    bool sendFile(int fd, off_t offset, std::size_t size);
+#endif
+
+    /// False when the data we write is transformed (e.g. encrypted)
+    /// before it hits the wire, so sendFile() can't be used.
+    virtual bool supportsSendFile() const
+    {
+#if !MOBILEAPP && defined(__linux__)
+        return true;
+#else
+        return false;
+#endif
+    }
+
     /// Safely flush any outgoing data.
     inline void flush()
     {
-        if (!_outBuffer.empty())
+        if (hasPendingOutput())
             writeOutgoingData();
     }
 
@@ -1231,12 +1266,18 @@ public:
     bool compactChunks(MessageMap *map);
 
     /// Detects if we have an HTTP header in the provided message and
-    /// populates a request for that.
+    /// parses it, into getRequest().
     bool parseHeader(const char *clientLoggingName,
                      Poco::MemoryInputStream &message,
-                     Poco::Net::HTTPRequest &request,
                      MessageMap *map = nullptr);
 
+    /// The request parseHeader() parsed. Its views are valid until the input is consumed.
+    const http::RequestParser& getRequest() const { return _requestParser; }
+
+    /// Fills @request from the request @parser parsed, for the handlers
+    /// that still take Poco requests.
+    static void setRequest(const http::RequestParser& parser, Poco::Net::HTTPRequest& request);
+
     /// Get input/output statistics on this stream
     void getIOStats(uint64_t &sent, uint64_t &recv)
     {
@@ -1359,7 +1400,7 @@ protected:
             }
 
             // perform the shutdown if we have sent everything.
-            if (_shutdownSignalled && _outBuffer.empty())
+            if (_shutdownSignalled && !hasPendingOutput())
             {
                 LOG_TRC("Shutdown Signaled. Close Connection.");
                 closeConnection();
@@ -1367,10 +1408,10 @@ protected:
                 break;
             }
 
-            oldSize = _outBuffer.size();
+            oldSize = _outBuffer.size() + _sendFileRemaining;
 
             // Write if we can and have data to write.
-            if ((events & POLLOUT) && !_outBuffer.empty())
+            if ((events & POLLOUT) && hasPendingOutput())
             {
                 if (writeOutgoingData() < 0)
                 {
@@ -1386,7 +1427,7 @@ protected:
                 }
             }
         }
-        while (oldSize != _outBuffer.size());
+        while (oldSize != _outBuffer.size() + _sendFileRemaining);
 
         if (closed)
         {
@@ -1405,15 +1446,29 @@ public:
     virtual int writeOutgoingData()
     {
         ASSERT_CORRECT_SOCKET_THREAD(this);
-        assert(!_outBuffer.empty());
+        assert(hasPendingOutput());
         ssize_t len = 0;
         int last_errno = 0;
         do
         {
+            // What was buffered before a queued file must go out before it.
+            const std::size_t available = _sendFileFD >= 0 ? _bytesBeforeFile : _outBuffer.size();
+            if (available == 0)
+            {
+#if !MOBILEAPP
+                len = writeFileData();
+                last_errno = errno;
+                if (len > 0 && _sendFileFD < 0)
+                    continue; // Done with the file, now what was buffered after it.
+#endif
+                break;
+            }
+
             do
             {
                 // Writing much more than we can absorb in the kernel causes wastage.
-                const int size = std::min((int)_outBuffer.getBlockSize(), getSendBufferSize());
+                const int size = std::min<std::size_t>(
+                    std::min((int)_outBuffer.getBlockSize(), getSendBufferSize()), available);
                 if (size == 0)
                     break;
 
@@ -1444,6 +1499,8 @@ public:
                                "Consumed more data than available");
                 _bytesSent += len;
                 _outBuffer.eraseFirst(len);
+                if (_sendFileFD >= 0)
+                    _bytesBeforeFile -= len;
             }
             else
             {
@@ -1451,7 +1508,7 @@ public:
                 break;
             }
         }
-        while (!_outBuffer.empty());
+        while (hasPendingOutput());
 
         // Restore errno from the write call.
         errno = last_errno;
@@ -1562,6 +1619,12 @@ protected:
     bool simulateSocketError(bool read);
 #endif
 
+#if !MOBILEAPP
+    /// Writes the file queued with sendFile() to the socket.
+    /// Returns the last return from sendfile(2).
+    int writeFileData();
+#endif
+
 private:
     /// The hostname (or IP) of the peer we are connecting to.
     const std::string _hostname;
@@ -1588,6 +1651,18 @@ private:
     int _incomingFD;
     ReadType _readType;
     std::atomic_bool _inputProcessingEnabled;
+
+    /// The file being sent with sendFile(), if any, and what's left of it.
+    int _sendFileFD;
+    off_t _sendFileOffset;
+    std::size_t _sendFileRemaining;
+    /// The buffered bytes that precede the file.
+    std::size_t _bytesBeforeFile;
+
+    /// Parses the request at the start of _inBuffer, across reads.
+    http::RequestParser _requestParser;
+    /// The _inBuffer erase count the parser state is for.
+    std::size_t _requestParserEraseCount;
 };
 
 enum class WSOpCode : unsigned char {
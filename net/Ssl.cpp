@@ -18,6 +18,7 @@
 #endif
 
 #include <sys/syscall.h>
+#include <Log.hpp>
 #include <Util.hpp>
 
 extern "C"
@@ -81,10 +82,12 @@ static inline void lock(int mode, int n, const char* /*file*/, int /*line*/)
 
 std::unique_ptr<SslContext> ssl::Manager::ServerInstance(nullptr);
 std::unique_ptr<SslContext> ssl::Manager::ClientInstance(nullptr);
+std::atomic<std::uint64_t> ssl::Manager::KernelTlsCount(0);
 
 SslContext::SslContext(const std::string& certFilePath, const std::string& keyFilePath,
                        const std::string& caFilePath, const std::string& cipherList,
-                       ssl::CertificateVerification verification)
+                       ssl::CertificateVerification verification,
+                       const ssl::SessionSettings& sessionSettings)
     : _ctx(nullptr)
     , _verification(verification)
 {
@@ -166,7 +169,7 @@ SslContext::SslContext(const std::string& certFilePath, const std::string& keyFi
         // The write buffer may re-allocate, and we don't mind partial writes.
         SSL_CTX_set_mode(_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE |
                                SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
-        SSL_CTX_set_session_cache_mode(_ctx, SSL_SESS_CACHE_OFF);
+        initSessions(sessionSettings);
 
         initDH();
         initECDH();
@@ -354,6 +357,47 @@ void SslContext::initECDH()
 #endif
 }
 
+void SslContext::initSessions(const ssl::SessionSettings& settings)
+{
+    // Reconnecting clients (e.g. after a network change) resume their session
+    // with an abbreviated handshake, which saves the key exchange and the
+    // certificate signature. Resumed sessions must come from the same context.
+    static const unsigned char sessionIdContext[] = "loolwsd";
+    SSL_CTX_set_session_id_context(_ctx, sessionIdContext, sizeof(sessionIdContext) - 1);
+
+    if (settings._cacheSize > 0)
+    {
+        SSL_CTX_set_session_cache_mode(_ctx, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_sess_set_cache_size(_ctx, settings._cacheSize);
+    }
+    else
+        SSL_CTX_set_session_cache_mode(_ctx, SSL_SESS_CACHE_OFF);
+
+    if (settings._timeout.count() > 0)
+        SSL_CTX_set_timeout(_ctx, settings._timeout.count());
+
+    if (!settings._tickets)
+    {
+        // In TLS 1.3 the tickets then merely refer to our cache, if any.
+        SSL_CTX_set_options(_ctx, SSL_OP_NO_TICKET);
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+        if (settings._cacheSize == 0)
+            SSL_CTX_set_num_tickets(_ctx, 0);
+#endif
+    }
+
+    if (settings._kernelTls)
+    {
+#ifdef SSL_OP_ENABLE_KTLS
+        // Only effective when the kernel supports the negotiated cipher;
+        // OpenSSL falls back to encrypting itself otherwise.
+        SSL_CTX_set_options(_ctx, SSL_OP_ENABLE_KTLS);
+#else
+        LOG_WRN("Kernel TLS is not supported by this OpenSSL (" OPENSSL_VERSION_TEXT ").");
+#endif
+    }
+}
+
 std::string SslContext::getLastErrorMsg()
 {
     const unsigned long errCode = ERR_get_error();
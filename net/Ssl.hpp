@@ -13,6 +13,9 @@
 
 #include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <memory>
 #include <mutex>
 #include <string>
@@ -35,6 +38,27 @@ enum class CertificateVerification
     IfProvided, //< Verified if an optional certificate is provided.
     Required //< Certificate must be provided and will be verified.
 };
+
+/// How the TLS sessions of a context are resumed, and who encrypts the records.
+struct SessionSettings
+{
+    SessionSettings()
+        : _cacheSize(0)
+        , _timeout(0)
+        , _tickets(true)
+        , _kernelTls(false)
+    {
+    }
+
+    /// The number of sessions cached to resume by id. 0 disables the cache.
+    std::size_t _cacheSize;
+    /// How long a session may be resumed, by id or by ticket. 0 for the OpenSSL default.
+    std::chrono::seconds _timeout;
+    /// Whether to issue session tickets, with which clients resume without our cache.
+    bool _tickets;
+    /// Whether to let the kernel encrypt and decrypt the records (kTLS), when it can.
+    bool _kernelTls;
+};
 } // namespace ssl
 
 class SslContext final
@@ -42,7 +66,8 @@ class SslContext final
 public:
     SslContext(const std::string& certFilePath, const std::string& keyFilePath,
                const std::string& caFilePath, const std::string& cipherList,
-               ssl::CertificateVerification verification);
+               ssl::CertificateVerification verification,
+               const ssl::SessionSettings& sessionSettings = ssl::SessionSettings());
 
     /// Returns a new SSL Context to be used with raw API.
     SSL* newSsl() { return SSL_new(_ctx); }
@@ -51,9 +76,16 @@ public:
 
     ssl::CertificateVerification verification() const { return _verification; }
 
+    /// The number of handshakes completed as a server.
+    long getAcceptCount() const { return SSL_CTX_sess_accept_good(_ctx); }
+
+    /// The number of those handshakes that resumed a session, by id or by ticket.
+    long getResumedCount() const { return SSL_CTX_sess_hits(_ctx); }
+
 private:
     void initDH();
     void initECDH();
+    void initSessions(const ssl::SessionSettings& settings);
     void shutdown();
 
     std::string getLastErrorMsg();
@@ -79,12 +111,14 @@ public:
                                         const std::string& keyFilePath,
                                         const std::string& caFilePath,
                                         const std::string& cipherList,
-                                        ssl::CertificateVerification verification)
+                                        ssl::CertificateVerification verification,
+                                        const ssl::SessionSettings& sessionSettings =
+                                            ssl::SessionSettings())
     {
         assert(!isServerContextInitialized() &&
                "Cannot initialize the server context more than once");
-        ServerInstance.reset(
-            new SslContext(certFilePath, keyFilePath, caFilePath, cipherList, verification));
+        ServerInstance.reset(new SslContext(certFilePath, keyFilePath, caFilePath, cipherList,
+                                            verification, sessionSettings));
     }
 
     static void uninitializeServerContext() { ServerInstance.reset(); }
@@ -99,6 +133,22 @@ public:
         return ServerInstance->newSsl();
     }
 
+    /// The number of handshakes the server completed, and how many of them resumed a session.
+    static long getServerAcceptCount()
+    {
+        return ServerInstance ? ServerInstance->getAcceptCount() : 0;
+    }
+
+    static long getServerResumedCount()
+    {
+        return ServerInstance ? ServerInstance->getResumedCount() : 0;
+    }
+
+    /// Counts the server connections whose records the kernel encrypts.
+    static void countKernelTls() { ++KernelTlsCount; }
+
+    static std::uint64_t getKernelTlsCount() { return KernelTlsCount; }
+
     static void initializeClientContext(const std::string& certFilePath,
                                         const std::string& keyFilePath,
                                         const std::string& caFilePath,
@@ -126,6 +176,7 @@ public:
 private:
     static std::unique_ptr<SslContext> ServerInstance;
     static std::unique_ptr<SslContext> ClientInstance;
+    static std::atomic<std::uint64_t> KernelTlsCount;
 };
 
 } // namespace ssl
@@ -30,6 +30,7 @@ public:
         , _ssl(nullptr)
         , _sslWantsTo(SslWantsTo::Neither)
         , _doHandshake(true)
+        , _kernelTlsSend(false)
     {
         LOG_TRC("SslStreamSocket ctor #" << fd);
 
@@ -134,6 +135,13 @@ public:
         return StreamSocket::readIncomingData();
     }
 
+    /// When we encrypt in user-space, sendfile(2) would bypass SSL.
+    /// With kTLS the kernel encrypts whatever we send, files included.
+    bool supportsSendFile() const override
+    {
+        return _kernelTlsSend && StreamSocket::supportsSendFile();
+    }
+
     int writeOutgoingData() override
     {
         ASSERT_CORRECT_SOCKET_THREAD(this);
@@ -245,10 +253,18 @@ private:
             if (rc == 1)
             {
                 // Successful handshake; TLS/SSL connection established.
-                LOG_TRC("SSL handshake completed successfully");
                 _doHandshake = false;
                 _sslWantsTo = SslWantsTo::Neither; // Reset until we are told otherwise.
 
+#ifdef SSL_OP_ENABLE_KTLS
+                _kernelTlsSend = BIO_get_ktls_send(SSL_get_wbio(_ssl));
+                if (_kernelTlsSend && SSL_is_server(_ssl))
+                    ssl::Manager::countKernelTls();
+#endif
+                LOG_TRC("SSL handshake completed successfully"
+                        << (SSL_session_reused(_ssl) ? ", resumed" : "")
+                        << (_kernelTlsSend ? ", kernel TLS" : ""));
+
                 if (!verifyCertificate())
                 {
                     LOG_WRN("Failed to verify the certificate of [" << hostname() << ']');
@@ -469,6 +485,8 @@ private:
     /// We must do the handshake during the first
     /// read or write in non-blocking.
     bool _doHandshake;
+    /// The kernel encrypts what we send (kTLS).
+    bool _kernelTlsSend;
 };
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
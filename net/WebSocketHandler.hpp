@@ -684,6 +684,13 @@ public:
         return sendFrame(socket, data, len, WSFrameMask::Fin | static_cast<unsigned char>(code), flush);
     }
 
+    /// Returns the number of bytes written but not yet sent to the peer.
+    std::size_t getOutBufferSize() const
+    {
+        std::shared_ptr<StreamSocket> socket = _socket.lock();
+        return socket ? socket->getOutBuffer().size() : 0;
+    }
+
 protected:
 
 #if !MOBILEAPP
@@ -931,9 +938,10 @@ protected:
 
 #if !MOBILEAPP
         // create our websocket goodness ...
-        const int wsVersion = std::stoi(req.get("Sec-WebSocket-Version", "13"));
-        const std::string wsKey = req.get("Sec-WebSocket-Key", "");
-        const std::string wsProtocol = req.get("Sec-WebSocket-Protocol", "chat");
+        // Either a Poco request or an http::RequestParser, whose values are views.
+        const int wsVersion = std::stoi(std::string(req.get("Sec-WebSocket-Version", "13")));
+        const std::string wsKey(req.get("Sec-WebSocket-Key", ""));
+        const std::string wsProtocol(req.get("Sec-WebSocket-Protocol", "chat"));
         // FIXME: other sanity checks ...
         LOG_INF("WebSocket version: " << wsVersion << ", key: [" << wsKey << "], protocol: ["
                                       << wsProtocol << ']');
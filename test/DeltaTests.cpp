@@ -25,12 +25,18 @@ class DeltaTests : public CPPUNIT_NS::TestFixture
 #if ENABLE_DELTAS
     CPPUNIT_TEST(testDeltaSequence);
     CPPUNIT_TEST(testRandomDeltas);
+    CPPUNIT_TEST(testWindowDeltas);
+    CPPUNIT_TEST(testBlockDeltas);
+    CPPUNIT_TEST(testColdDeltas);
 #endif
 
     CPPUNIT_TEST_SUITE_END();
 
     void testDeltaSequence();
     void testRandomDeltas();
+    void testWindowDeltas();
+    void testBlockDeltas();
+    void testColdDeltas();
 
     std::vector<char> loadPng(const char *relpath,
                               png_uint_32& height,
@@ -60,6 +66,11 @@ class DeltaTests : public CPPUNIT_NS::TestFixture
         const std::vector<char> &delta,
         const std::string& testname);
 
+    /// Draws lines of glyph-like text, as seen scrolled to @scrollX, @scrollY.
+    /// The colors are opaque and gray or green, so native and RGBA byte orders agree.
+    static void drawText(std::vector<uint32_t> &pixmap, int width, int height,
+                         int scrollX, int scrollY);
+
     void assertEqual(const std::vector<char> &a,
                      const std::vector<char> &b,
                      int width, int height,
@@ -112,6 +123,28 @@ std::vector<char> DeltaTests::applyDelta(
             i += 4;
             break;
         }
+        case 'b': // block copy.
+        {
+            int srcCol = (uint8_t)(delta[i+1]);
+            int srcRow = (uint8_t)(delta[i+2]);
+            int destCol = (uint8_t)(delta[i+3]);
+            int destRow = (uint8_t)(delta[i+4]);
+            size_t length = (uint8_t)(delta[i+5]);
+            int count = (uint8_t)(delta[i+6]);
+
+            LOK_ASSERT(length <= width - srcCol);
+            LOK_ASSERT(length <= width - destCol);
+            LOK_ASSERT(srcRow + count <= (int)height);
+            LOK_ASSERT(destRow + count <= (int)height);
+            for (int cnt = 0; cnt < count; ++cnt)
+            {
+                const char *src = &pixmap[(width * (srcRow + cnt) + srcCol) * 4];
+                char *dest = &output[(width * (destRow + cnt) + destCol) * 4];
+                std::memcpy(dest, src, length * 4);
+            }
+            i += 7;
+            break;
+        }
         case 'd': // new run
         {
             int destRow = (uint8_t)(delta[i+1]);
@@ -224,6 +257,277 @@ void DeltaTests::testRandomDeltas()
 {
 }
 
+void DeltaTests::testWindowDeltas()
+{
+    constexpr auto testname = __func__;
+
+    // An odd width, whose rows aren't aligned.
+    constexpr int width = 601;
+    constexpr int height = 300;
+    std::vector<WindowDeltaEncoder::Cell> cells;
+    WindowDeltaEncoder::getCells(width, height, cells);
+    LOK_ASSERT_EQUAL(size_t(6), cells.size());
+    LOK_ASSERT_EQUAL(512, cells[2]._x);
+    LOK_ASSERT_EQUAL(89, cells[2]._width);
+    LOK_ASSERT_EQUAL(256, cells[3]._y);
+    LOK_ASSERT_EQUAL(44, cells[3]._height);
+
+    // Opaque grey, so the native and RGBA byte orders agree.
+    std::vector<uint32_t> pixmap(width * height, 0xffc0c0c0);
+    unsigned char* pixels = reinterpret_cast<unsigned char*>(pixmap.data());
+
+    WindowDeltaEncoder encoder(100);
+    std::vector<char> output;
+    std::vector<size_t> sizes;
+    encoder.encode(7, 0, 0, width, height, pixels, output, sizes);
+    LOK_ASSERT_EQUAL(cells.size(), sizes.size());
+    size_t offset = 0;
+    for (const size_t size : sizes)
+    {
+        LOK_ASSERT(size > 0);
+        LOK_ASSERT_EQUAL('Z', output[offset]);
+        offset += size;
+    }
+    LOK_ASSERT_EQUAL(output.size(), offset);
+
+    // What the client has of the second cell.
+    std::vector<char> keyframe(256 * 256 * 4);
+    const size_t keyframeSize = ZSTD_decompress(keyframe.data(), keyframe.size(),
+                                                output.data() + sizes[0] + 1, sizes[1] - 1);
+    LOK_ASSERT_EQUAL(keyframe.size(), keyframeSize);
+
+    // Nothing changed, nothing to send.
+    output.clear();
+    sizes.clear();
+    encoder.encode(7, 0, 0, width, height, pixels, output, sizes);
+    LOK_ASSERT(output.empty());
+    LOK_ASSERT_EQUAL(cells.size(), sizes.size());
+    for (const size_t size : sizes)
+        LOK_ASSERT_EQUAL(size_t(0), size);
+
+    // Type a character into a field of the second cell.
+    std::vector<char> expected = keyframe;
+    for (int y = 20; y < 30; ++y)
+    {
+        for (int x = 300; x < 310; ++x)
+        {
+            pixmap[y * width + x] = 0xff000000;
+            const size_t pos = (y * 256 + x - 256) * 4;
+            expected[pos] = expected[pos + 1] = expected[pos + 2] = 0;
+        }
+    }
+
+    output.clear();
+    sizes.clear();
+    encoder.encode(7, 0, 0, width, height, pixels, output, sizes);
+    LOK_ASSERT_EQUAL(sizes[1], output.size());
+    LOK_ASSERT_EQUAL('D', output[0]);
+    assertEqual(applyDelta(keyframe, 256, 256, output, testname), expected, 256, 256, testname);
+
+    // Another area, or a closed window, has nothing to apply deltas to.
+    output.clear();
+    sizes.clear();
+    encoder.encode(7, 10, 0, width, height, pixels, output, sizes);
+    LOK_ASSERT_EQUAL('Z', output[0]);
+    LOK_ASSERT(sizes[1] > 0);
+
+    encoder.forget(7);
+    output.clear();
+    sizes.clear();
+    encoder.encode(7, 10, 0, width, height, pixels, output, sizes);
+    LOK_ASSERT_EQUAL('Z', output[0]);
+    LOK_ASSERT(sizes[1] > 0);
+}
+
+void DeltaTests::drawText(std::vector<uint32_t> &pixmap, int width, int height,
+                          int scrollX, int scrollY)
+{
+    pixmap.assign(width * height, 0xffffffff);
+    for (int y = 0; y < height; ++y)
+    {
+        const int docY = y + scrollY;
+        if (docY % 18 >= 12)
+            continue; // between the lines.
+
+        for (int x = 0; x < width; ++x)
+        {
+            const int docX = x + scrollX;
+            const uint32_t glyph = (docY / 18) * 1009 + docX / 8;
+            const uint32_t pixel = (docY % 18) * 8 + docX % 8;
+            const uint32_t hash = ((glyph * 73856093u) ^ (pixel * 19349663u)) * 2654435761u;
+            if (docX % 8 < 7 && (hash >> 16) % 5 < 2)
+                pixmap[y * width + x] = glyph % 7 ? 0xff202020 : 0xff40a040;
+        }
+    }
+}
+
+void DeltaTests::testBlockDeltas()
+{
+    constexpr auto testname = __func__;
+
+    constexpr int width = 256;
+    constexpr int height = 256;
+    const TileLocation loc(1, 2, 3, 0, 1);
+
+    std::vector<uint32_t> pixmap;
+    drawText(pixmap, width, height, 100, 100);
+    std::vector<char> previous(reinterpret_cast<char*>(pixmap.data()),
+                               reinterpret_cast<char*>(pixmap.data() + pixmap.size()));
+
+    DeltaGenerator gen;
+    std::vector<char> delta;
+    TileWireId wid = 1;
+    LOK_ASSERT(!gen.createDelta(reinterpret_cast<unsigned char*>(pixmap.data()), 0, 0, width,
+                                height, width, height, loc, delta, wid, false));
+
+    // Scroll sideways, diagonally, and back; each uncovers only a strip of new text.
+    const std::vector<std::pair<int, int>> scrolls = {
+        { 113, 100 }, { 90, 100 }, { 97, 109 }, { 60, 80 }, { 100, 100 }
+    };
+    int scrollX = 100;
+    int scrollY = 100;
+    for (const auto& scroll : scrolls)
+    {
+        drawText(pixmap, width, height, scroll.first, scroll.second);
+        std::vector<char> expected(reinterpret_cast<char*>(pixmap.data()),
+                                   reinterpret_cast<char*>(pixmap.data() + pixmap.size()));
+
+        delta.clear();
+        LOK_ASSERT(gen.createDelta(reinterpret_cast<unsigned char*>(pixmap.data()), 0, 0, width,
+                                   height, width, height, loc, delta, ++wid, false));
+        assertEqual(applyDelta(previous, width, height, delta, testname), expected, width,
+                    height, testname);
+
+        // Only the uncovered pixels are sent, not the rows that moved sideways.
+        const int uncovered = std::abs(scroll.first - scrollX) * height
+                              + std::abs(scroll.second - scrollY) * width;
+        LOK_ASSERT_MESSAGE("Delta of " + std::to_string(delta.size()) + " bytes for "
+                               + std::to_string(uncovered) + " new pixels",
+                           delta.size() < size_t(uncovered));
+        previous = expected;
+        scrollX = scroll.first;
+        scrollY = scroll.second;
+    }
+
+    // Scroll a list box in the middle of the tile, leaving the rest.
+    std::vector<uint32_t> list;
+    drawText(list, width, height, 0, 40);
+    for (int y = 64; y < 192; ++y)
+        std::copy_n(&list[y * width + 32], 160, &pixmap[y * width + 32]);
+    previous.assign(reinterpret_cast<char*>(pixmap.data()),
+                    reinterpret_cast<char*>(pixmap.data() + pixmap.size()));
+    delta.clear();
+    gen.createDelta(reinterpret_cast<unsigned char*>(pixmap.data()), 0, 0, width, height, width,
+                    height, loc, delta, ++wid, false);
+
+    drawText(list, width, height, 0, 58);
+    for (int y = 64; y < 192; ++y)
+        std::copy_n(&list[y * width + 32], 160, &pixmap[y * width + 32]);
+    std::vector<char> expected(reinterpret_cast<char*>(pixmap.data()),
+                               reinterpret_cast<char*>(pixmap.data() + pixmap.size()));
+    delta.clear();
+    LOK_ASSERT(gen.createDelta(reinterpret_cast<unsigned char*>(pixmap.data()), 0, 0, width,
+                               height, width, height, loc, delta, ++wid, false));
+    assertEqual(applyDelta(previous, width, height, delta, testname), expected, width, height,
+                testname);
+    LOK_ASSERT_MESSAGE("Delta of " + std::to_string(delta.size()) + " bytes",
+                       delta.size() < 18 * 160);
+}
+
+void DeltaTests::testColdDeltas()
+{
+    constexpr auto testname = __func__;
+
+    constexpr int width = 256;
+    constexpr int height = 256;
+    const auto asChars = [](const std::vector<uint32_t>& pixmap) {
+        return std::vector<char>(reinterpret_cast<const char*>(pixmap.data()),
+                                 reinterpret_cast<const char*>(pixmap.data() + pixmap.size()));
+    };
+    const auto getState = [](DeltaGenerator& gen) {
+        std::ostringstream oss;
+        gen.dumpState(oss);
+        return oss.str();
+    };
+
+    // Room for two tiles as pixels, and the rest compressed.
+    DeltaGenerator gen;
+    gen.setMaxBytes(4 * DeltaGenerator::tileBytes);
+
+    std::vector<std::vector<uint32_t>> tiles(5);
+    std::vector<char> delta;
+    TileWireId wid = 0;
+    for (size_t i = 0; i < tiles.size(); ++i)
+    {
+        drawText(tiles[i], width, height, 0, i * 256);
+        LOK_ASSERT(!gen.createDelta(reinterpret_cast<unsigned char*>(tiles[i].data()), 0, 0,
+                                    width, height, width, height, TileLocation(i, 0, 3, 0, 1),
+                                    delta, ++wid, false));
+    }
+    gen.rebalanceDeltas();
+    gen.rebalanceDeltas();
+    LOK_ASSERT(getState(gen).find("5 entries (2 pixels, 3 compressed, 0 row hashes)")
+               != std::string::npos);
+    LOK_ASSERT(gen.getBytes() < 3 * DeltaGenerator::tileBytes);
+
+    // The least recently used is compressed, but still gives a delta.
+    std::vector<char> previous = asChars(tiles[0]);
+    std::fill_n(&tiles[0][20 * width + 30], 8, 0xff000000);
+    delta.clear();
+    LOK_ASSERT(gen.createDelta(reinterpret_cast<unsigned char*>(tiles[0].data()), 0, 0, width,
+                               height, width, height, TileLocation(0, 0, 3, 0, 1), delta, ++wid,
+                               false));
+    assertEqual(applyDelta(previous, width, height, delta, testname), asChars(tiles[0]), width,
+                height, testname);
+
+    // Repaint the second tile entirely, then let it go cold.
+    previous = asChars(tiles[1]);
+    drawText(tiles[1], width, height, 0, 5000);
+    delta.clear();
+    LOK_ASSERT(gen.createDelta(reinterpret_cast<unsigned char*>(tiles[1].data()), 0, 0, width,
+                               height, width, height, TileLocation(1, 0, 3, 0, 1), delta, ++wid,
+                               false));
+    assertEqual(applyDelta(previous, width, height, delta, testname), asChars(tiles[1]), width,
+                height, testname);
+    for (size_t i = 2; i < 4; ++i)
+    {
+        delta.clear();
+        gen.createDelta(reinterpret_cast<unsigned char*>(tiles[i].data()), 0, 0, width, height,
+                        width, height, TileLocation(i, 0, 3, 0, 1), delta, ++wid, false);
+    }
+    gen.rebalanceDeltas();
+    LOK_ASSERT(getState(gen).find("1 row hashes") != std::string::npos);
+
+    // Of its row hashes we still tell it is unchanged, or that its rows moved.
+    delta.clear();
+    LOK_ASSERT(gen.createDelta(reinterpret_cast<unsigned char*>(tiles[1].data()), 0, 0, width,
+                               height, width, height, TileLocation(1, 0, 3, 0, 1), delta, ++wid,
+                               false));
+    LOK_ASSERT(delta.empty());
+
+    gen.rebalanceDeltas();
+    previous = asChars(tiles[1]);
+    drawText(tiles[1], width, height, 0, 5000 + 36);
+    delta.clear();
+    LOK_ASSERT(gen.createDelta(reinterpret_cast<unsigned char*>(tiles[1].data()), 0, 0, width,
+                               height, width, height, TileLocation(1, 0, 3, 0, 1), delta, ++wid,
+                               false));
+    assertEqual(applyDelta(previous, width, height, delta, testname), asChars(tiles[1]), width,
+                height, testname);
+
+    // Beyond the budget, the least recently used go.
+    gen.setMaxBytes(DeltaGenerator::tileBytes);
+    gen.rebalanceDeltas();
+    LOK_ASSERT(getState(gen).find("5 entries") == std::string::npos);
+    delta.clear();
+    LOK_ASSERT(!gen.createDelta(reinterpret_cast<unsigned char*>(tiles[4].data()), 0, 0, width,
+                                height, width, height, TileLocation(4, 0, 3, 0, 1), delta, ++wid,
+                                false));
+
+    gen.dropCache();
+    LOK_ASSERT_EQUAL(size_t(0), gen.getBytes());
+}
+
 CPPUNIT_TEST_SUITE_REGISTRATION(DeltaTests);
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -11,7 +11,9 @@
 
 #include <Common.hpp>
 #include <common/Authorization.hpp>
+#include <Exceptions.hpp>
 #include <RequestDetails.hpp>
+#include <net/HttpParser.hpp>
 
 #include <cppunit/extensions/HelperMacros.h>
 
@@ -25,6 +27,7 @@ class RequestDetailsTests : public CPPUNIT_NS::TestFixture
     CPPUNIT_TEST(testLocal);
     CPPUNIT_TEST(testLocalHexified);
     CPPUNIT_TEST(testRequestDetails);
+    CPPUNIT_TEST(testParsedRequest);
     CPPUNIT_TEST(testAuthorization);
 
     CPPUNIT_TEST_SUITE_END();
@@ -34,6 +37,7 @@ class RequestDetailsTests : public CPPUNIT_NS::TestFixture
     void testLocal();
     void testLocalHexified();
     void testRequestDetails();
+    void testParsedRequest();
     void testAuthorization();
 };
 
@@ -757,6 +761,60 @@ void RequestDetailsTests::testRequestDetails()
     }
 }
 
+void RequestDetailsTests::testParsedRequest()
+{
+    constexpr auto testname = __func__;
+
+    static const std::string Root = "localhost:9980";
+    static const std::string ServiceRoot = "/root";
+    static const std::string URI = "/lool/http%3A%2F%2Flocalhost%2Fnextcloud%2Findex.php%2Fapps%2F"
+                                   "richdocuments%2Fwopi%2Ffiles%2F593_ocqiesh0cngs/ws?WOPISrc="
+                                   "http%3A%2F%2Flocalhost%2Fnextcloud%2Findex.php%2Fapps%2F"
+                                   "richdocuments%2Fwopi%2Ffiles%2F593_ocqiesh0cngs&compat=/ws";
+
+    // What the dispatcher routes on, parsed rather than read into a Poco request.
+    const std::string data = "GET " + ServiceRoot + URI + " HTTP/1.1\r\n"
+                             "Host: " + Root + "\r\n"
+                             "Upgrade: WebSocket\r\n"
+                             "\r\n";
+    http::RequestParser parser;
+    LOK_ASSERT_EQUAL(http::RequestParser::State::Complete, parser.parse(data.data(), data.size()));
+
+    Poco::Net::HTTPRequest request(Poco::Net::HTTPRequest::HTTP_GET, ServiceRoot + URI,
+                                   Poco::Net::HTTPMessage::HTTP_1_1);
+    request.setHost(Root);
+    request.set("Upgrade", "WebSocket");
+
+    const RequestDetails parsed(parser, ServiceRoot);
+    const RequestDetails details(request, ServiceRoot);
+    LOK_ASSERT_EQUAL(details.getURI(), parsed.getURI());
+    LOK_ASSERT_EQUAL(Root, parsed.getHostUntrusted());
+    LOK_ASSERT(parsed.isGet());
+    LOK_ASSERT(parsed.isWebSocket());
+    LOK_ASSERT(!parsed.isProxy());
+    LOK_ASSERT_EQUAL(details.size(), parsed.size());
+    LOK_ASSERT_EQUAL(details.getDocumentURI(), parsed.getDocumentURI());
+    LOK_ASSERT_EQUAL(details.getField(RequestDetails::Field::WOPISrc),
+                     parsed.getField(RequestDetails::Field::WOPISrc));
+    LOK_ASSERT(parsed.equals(2, "ws"));
+
+    // Outside the service root.
+    const std::string other = "GET " + URI + " HTTP/1.1\r\nHost: " + Root + "\r\n\r\n";
+    parser.reset();
+    LOK_ASSERT_EQUAL(http::RequestParser::State::Complete,
+                     parser.parse(other.data(), other.size()));
+    bool thrown = false;
+    try
+    {
+        RequestDetails outside(parser, ServiceRoot);
+    }
+    catch (const BadRequestException&)
+    {
+        thrown = true;
+    }
+    LOK_ASSERT(thrown);
+}
+
 void RequestDetailsTests::testAuthorization()
 {
     constexpr auto testname = __func__;
@@ -18,10 +18,12 @@
 #include <cppunit/extensions/HelperMacros.h>
 
 #include <Common.hpp>
+#include <FileUtil.hpp>
 #include <Protocol.hpp>
 #include <MessageQueue.hpp>
 #include <Png.hpp>
 #include <TileCache.hpp>
+#include <TileStore.hpp>
 #include <kit/Delta.hpp>
 #include <Unit.hpp>
 #include <Util.hpp>
@@ -70,6 +72,7 @@ class TileCacheTests : public CPPUNIT_NS::TestFixture
 
     CPPUNIT_TEST(testDesc);
     CPPUNIT_TEST(testSimple);
+    CPPUNIT_TEST(testPersistTiles);
     CPPUNIT_TEST(testSimpleCombine);
     CPPUNIT_TEST(testSize);
     CPPUNIT_TEST(testCancelTiles);
@@ -110,6 +113,7 @@ class TileCacheTests : public CPPUNIT_NS::TestFixture
 
     void testDesc();
     void testSimple();
+    void testPersistTiles();
     void testSimpleCombine();
     void testSize();
     void testCancelTiles();
@@ -269,6 +273,51 @@ void TileCacheTests::testSimple()
     LOK_ASSERT_MESSAGE("found tile when none was expected", !tileData || !tileData->isValid());
 }
 
+void TileCacheTests::testPersistTiles()
+{
+    constexpr auto testname = __func__;
+
+    if (isStandalone())
+    {
+        if (!UnitWSD::init(UnitWSD::UnitType::Wsd, ""))
+            throw std::runtime_error("Failed to load wsd unit test library.");
+    }
+
+    const std::string dir = FileUtil::createRandomTmpDir();
+    TileStore::initialize(dir, 1024 * 1024);
+    const std::string hash = "persisttiles0123456789abcdef0123";
+
+    TileDesc tile(0, 0, 0, 256, 256, 0, 0, 3840, 3840, -1, 0, -1, false);
+    TileDesc other(0, 0, 0, 256, 256, 3840, 0, 3840, 3840, -1, 0, -1, false);
+    std::vector<char> data = genRandomData(1024);
+    data[0] = 'Z'; // compressed pixels.
+    {
+        TileCache tc("doc.ods", std::chrono::system_clock::time_point());
+        tc.setViewProps(0, "props");
+        tc.saveTileAndNotify(tile, data.data(), data.size());
+        tc.saveTileAndNotify(other, data.data(), data.size());
+
+        // Invalid tiles are not worth keeping.
+        tc.invalidateTiles("invalidatetiles: part=0 mode=0 x=4000 y=0 width=1000 height=1000", 0);
+        LOK_ASSERT_EQUAL(static_cast<std::size_t>(1), tc.persistTiles(hash));
+    }
+
+    // Served when the document is loaded again.
+    TileCache tc("doc.ods", std::chrono::system_clock::time_point());
+    tc.setViewProps(0, "props");
+    tc.setStore(TileStore::open(hash));
+
+    Tile tileData = tc.lookupTile(tile);
+    LOK_ASSERT_MESSAGE("persisted tile not found", tileData && tileData->isValid());
+    LOK_ASSERT_EQUAL(data.size() - 1 /* dropped Z */, tileData->data().size());
+    LOK_ASSERT(std::equal(data.begin() + 1, data.end(), tileData->data().begin()));
+    tileData = tc.lookupTile(other);
+    LOK_ASSERT_MESSAGE("found tile when none was expected", !tileData || !tileData->isValid());
+
+    tc.clear();
+    FileUtil::removeFile(dir, /*recursive=*/true);
+}
+
 void TileCacheTests::testSimpleCombine()
 {
     const std::string testname = "simpleCombine-";
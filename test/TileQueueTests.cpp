@@ -16,6 +16,7 @@
 #include <Message.hpp>
 #include <MessageQueue.hpp>
 #include <SenderQueue.hpp>
+#include <TileDesc.hpp>
 #include <Util.hpp>
 
 #include <cppunit/extensions/HelperMacros.h>
@@ -30,6 +31,9 @@ class TileQueueTests : public CPPUNIT_NS::TestFixture
     CPPUNIT_TEST(testTileRecombining);
     CPPUNIT_TEST(testViewOrder);
     CPPUNIT_TEST(testPreviewsDeprioritization);
+    CPPUNIT_TEST(testInputBeforeTileBacklog);
+    CPPUNIT_TEST(testLaneAging);
+    CPPUNIT_TEST(testOffscreenTiles);
     CPPUNIT_TEST(testSenderQueue);
     CPPUNIT_TEST(testSenderQueueTileDeduplication);
     CPPUNIT_TEST(testInvalidateViewCursorDeduplication);
@@ -45,6 +49,9 @@ class TileQueueTests : public CPPUNIT_NS::TestFixture
     void testTileRecombining();
     void testViewOrder();
     void testPreviewsDeprioritization();
+    void testInputBeforeTileBacklog();
+    void testLaneAging();
+    void testOffscreenTiles();
     void testSenderQueue();
     void testSenderQueueTileDeduplication();
     void testInvalidateViewCursorDeduplication();
@@ -146,7 +153,7 @@ void TileQueueTests::testTileRecombining()
     queue.put("tilecombine nviewid=0 part=0 width=256 height=256 tileposx=0,3840 tileposy=0,0 tilewidth=3840 tileheight=3840");
 
     // the tilecombine's get merged, resulting in 3 "tile" messages
-    LOK_ASSERT_EQUAL(3, static_cast<int>(queue.getQueue().size()));
+    LOK_ASSERT_EQUAL(3, static_cast<int>(queue.size()));
 
     // but when we later extract that, it is just one "tilecombine" message
     LOK_ASSERT_EQUAL_STR(
@@ -155,7 +162,7 @@ void TileQueueTests::testTileRecombining()
         queue.get());
 
     // and nothing remains in the queue
-    LOK_ASSERT_EQUAL(0, static_cast<int>(queue.getQueue().size()));
+    LOK_ASSERT_EQUAL(0, static_cast<int>(queue.size()));
 }
 
 void TileQueueTests::testViewOrder()
@@ -183,7 +190,7 @@ void TileQueueTests::testViewOrder()
     for (auto &tile : tiles)
         queue.put(tile);
 
-    LOK_ASSERT_EQUAL(4, static_cast<int>(queue.getQueue().size()));
+    LOK_ASSERT_EQUAL(4, static_cast<int>(queue.size()));
 
     // should result in the 3, 2, 1, 0 order of the tiles thanks to the cursor
     // positions
@@ -217,11 +224,11 @@ void TileQueueTests::testPreviewsDeprioritization()
     }
 
     // stays empty after all is done
-    LOK_ASSERT_EQUAL(0, static_cast<int>(queue.getQueue().size()));
+    LOK_ASSERT_EQUAL(0, static_cast<int>(queue.size()));
 
     // re-ordering case - put previews and normal tiles to the queue and get
-    // everything back again but this time the tiles have to interleave with
-    // the previews
+    // everything back again but this time the tiles have to come before the
+    // previews queued ahead of them
     const std::vector<std::string> tiles =
     {
         "tile nviewid=0 part=0 width=256 height=256 tileposx=0 tileposy=0 tilewidth=3840 tileheight=3840 oldwid=0 wid=0 ver=-1",
@@ -233,18 +240,18 @@ void TileQueueTests::testPreviewsDeprioritization()
 
     queue.put(tiles[0]);
 
-    LOK_ASSERT_EQUAL_STR(previews[0], queue.get());
     LOK_ASSERT_EQUAL_STR(tiles[0], queue.get());
+    LOK_ASSERT_EQUAL_STR(previews[0], queue.get());
     LOK_ASSERT_EQUAL_STR(previews[1], queue.get());
 
     queue.put(tiles[1]);
 
-    LOK_ASSERT_EQUAL_STR(previews[2], queue.get());
     LOK_ASSERT_EQUAL_STR(tiles[1], queue.get());
+    LOK_ASSERT_EQUAL_STR(previews[2], queue.get());
     LOK_ASSERT_EQUAL_STR(previews[3], queue.get());
 
     // stays empty after all is done
-    LOK_ASSERT_EQUAL(0, static_cast<int>(queue.getQueue().size()));
+    LOK_ASSERT_EQUAL(0, static_cast<int>(queue.size()));
 
     // cursor positioning case - the cursor position should not prioritize the
     // previews
@@ -257,7 +264,157 @@ void TileQueueTests::testPreviewsDeprioritization()
     LOK_ASSERT_EQUAL_STR(previews[0], queue.get());
 
     // stays empty after all is done
-    LOK_ASSERT_EQUAL(0, static_cast<int>(queue.getQueue().size()));
+    LOK_ASSERT_EQUAL(0, static_cast<int>(queue.size()));
+}
+
+void TileQueueTests::testInputBeforeTileBacklog()
+{
+    constexpr auto testname = __func__;
+
+    TileQueue queue;
+
+    // The burst of tile requests after zooming: 500 tiles, in 25 rows.
+    for (int row = 0; row < 25; ++row)
+    {
+        std::string tileposx;
+        std::string tileposy;
+        for (int col = 0; col < 20; ++col)
+        {
+            tileposx += (col ? "," : "") + std::to_string(col * 3840);
+            tileposy += (col ? "," : "") + std::to_string(row * 3840);
+        }
+
+        queue.put("tilecombine nviewid=0 part=0 width=256 height=256 tileposx=" + tileposx +
+                  " tileposy=" + tileposy + " tilewidth=3840 tileheight=3840");
+    }
+
+    queue.put("callback all 0 0, 0, 76800, 96000, 0");
+
+    LOK_ASSERT_EQUAL(501, static_cast<int>(queue.size()));
+
+    // Then a keystroke, and a mouse click.
+    const std::string key = "child-0001 key type=input char=97 key=0";
+    const std::string mouse = "child-0001 mouse type=buttondown x=500 y=500 count=1 buttons=1 modifier=0";
+    queue.put(key);
+    queue.put(mouse);
+
+    // They are handled first, in order, with none of the backlog ahead of them.
+    LOK_ASSERT_EQUAL_STR(key, queue.get());
+    LOK_ASSERT_EQUAL_STR(mouse, queue.get());
+
+    // Then the callback, before the tiles.
+    LOK_ASSERT_EQUAL_STR("callback all 0 0, 0, 76800, 96000, 0", queue.get());
+
+    // Then the tiles, combined along their rows.
+    std::size_t tiles = 0;
+    std::size_t renders = 0;
+    while (!queue.isEmpty())
+    {
+        const TileQueue::Payload payload = queue.get();
+        LOK_ASSERT(LOOLProtocol::matchPrefix("tilecombine", payload));
+        tiles += TileCombined::parse(std::string(payload.data(), payload.size())).getTiles().size();
+        ++renders;
+    }
+
+    LOK_ASSERT_EQUAL(static_cast<std::size_t>(500), tiles);
+
+    std::ostringstream oss;
+    queue.dumpState(oss);
+    LOK_ASSERT_MESSAGE(oss.str(), oss.str().find("Input depth: 0 served: 2 aged: 0") != std::string::npos);
+    LOK_ASSERT_MESSAGE(oss.str(), oss.str().find("Tile depth: 0 served: " + std::to_string(renders)) != std::string::npos);
+}
+
+void TileQueueTests::testLaneAging()
+{
+    constexpr auto testname = __func__;
+
+    auto now = std::chrono::steady_clock::now();
+    TileQueue queue([&now]() { return now; });
+
+    const std::string tile = "tile nviewid=0 part=0 width=256 height=256 tileposx=0 tileposy=0 tilewidth=3840 tileheight=3840 oldwid=0 wid=0 ver=-1";
+    const std::string key = "child-0001 key type=input char=97 key=0";
+
+    queue.put(tile);
+    queue.put(key);
+    queue.put(key);
+
+    // Input is first.
+    LOK_ASSERT_EQUAL_STR(key, queue.get());
+
+    // But not when the tiles waited too long behind it.
+    now += std::chrono::seconds(1);
+    LOK_ASSERT_EQUAL_STR(tile, queue.get());
+    LOK_ASSERT_EQUAL_STR(key, queue.get());
+    LOK_ASSERT_EQUAL(0, static_cast<int>(queue.size()));
+
+    std::ostringstream oss;
+    queue.dumpState(oss);
+    LOK_ASSERT_MESSAGE(oss.str(), oss.str().find("Tile depth: 0 served: 1 aged: 1") != std::string::npos);
+}
+
+void TileQueueTests::testOffscreenTiles()
+{
+    constexpr auto testname = __func__;
+
+    TileQueue queue;
+
+    const std::string above = "tile nviewid=0 part=0 width=256 height=256 tileposx=0 tileposy=0 tilewidth=3840 tileheight=3840 oldwid=0 wid=0 ver=-1";
+    const std::string visible = "tile nviewid=0 part=0 width=256 height=256 tileposx=0 tileposy=15360 tilewidth=3840 tileheight=3840 oldwid=0 wid=0 ver=-1";
+    const std::string below = "tile nviewid=0 part=0 width=256 height=256 tileposx=0 tileposy=30720 tilewidth=3840 tileheight=3840 oldwid=0 wid=0 ver=-1";
+
+    // Until we know what the client sees, in order.
+    queue.put(above);
+    queue.put(visible);
+    LOK_ASSERT_EQUAL_STR(above, queue.get());
+    LOK_ASSERT_EQUAL_STR(visible, queue.get());
+
+    // The tiles it requested ahead of scrolling come after those it sees.
+    queue.put("child-0001 clientvisiblearea x=0 y=12000 width=20000 height=10000");
+    queue.get();
+
+    queue.put(below);
+    queue.put(above);
+    queue.put(visible);
+    LOK_ASSERT_EQUAL_STR(visible, queue.get());
+    LOK_ASSERT_EQUAL_STR(below, queue.get());
+    LOK_ASSERT_EQUAL_STR(above, queue.get());
+
+    // Scrolling brings the queued ones into view.
+    queue.put(above);
+    queue.put(visible);
+    queue.put("child-0001 clientvisiblearea x=0 y=0 width=20000 height=10000");
+    queue.get();
+    LOK_ASSERT_EQUAL_STR(above, queue.get());
+    LOK_ASSERT_EQUAL_STR(visible, queue.get());
+
+    // Once it's gone, all may be seen again, those it saw first.
+    queue.put(below);
+    queue.put(above);
+    queue.put("child-0001 disconnect");
+    queue.get();
+    LOK_ASSERT_EQUAL_STR(above, queue.get());
+    LOK_ASSERT_EQUAL_STR(below, queue.get());
+    LOK_ASSERT_EQUAL(0, static_cast<int>(queue.size()));
+
+    // In Calc and Impress, the tiles of the other sheets or slides are not in view.
+    const std::string otherPart = "tile nviewid=0 part=1 width=256 height=256 tileposx=0 tileposy=0 tilewidth=3840 tileheight=3840 oldwid=0 wid=0 ver=-1";
+    queue.put("child-0001 clientvisiblearea x=0 y=0 width=20000 height=10000");
+    queue.put("child-0001 setclientpart part=1");
+    queue.get();
+    queue.get();
+    queue.put(above);
+    queue.put(otherPart);
+    LOK_ASSERT_EQUAL_STR(otherPart, queue.get());
+    LOK_ASSERT_EQUAL_STR(above, queue.get());
+
+    // Switching back brings them into view.
+    queue.put(otherPart);
+    queue.put(above);
+    queue.put("child-0001 setclientpart part=0");
+    queue.get();
+    LOK_ASSERT_EQUAL_STR(above, queue.get());
+    LOK_ASSERT_EQUAL_STR(otherPart, queue.get());
+    LOK_ASSERT_EQUAL(0, static_cast<int>(queue.size()));
 }
 
 void TileQueueTests::testSenderQueue()
@@ -424,7 +581,7 @@ void TileQueueTests::testCallbackInvalidation()
     queue.put("callback all 0 284, 1418, 11105, 275, 0");
     queue.put("callback all 0 4299, 1418, 7090, 275, 0");
 
-    LOK_ASSERT_EQUAL(1, static_cast<int>(queue.getQueue().size()));
+    LOK_ASSERT_EQUAL(1, static_cast<int>(queue.size()));
 
     LOK_ASSERT_EQUAL_STR("callback all 0 284, 1418, 11105, 275, 0", queue.get());
 
@@ -434,11 +591,11 @@ void TileQueueTests::testCallbackInvalidation()
     queue.put("callback all 0 4299, 10418, 7090, 275, 0");
     queue.put("callback all 0 4299, 20418, 7090, 275, 0");
 
-    LOK_ASSERT_EQUAL(4, static_cast<int>(queue.getQueue().size()));
+    LOK_ASSERT_EQUAL(4, static_cast<int>(queue.size()));
 
     queue.put("callback all 0 EMPTY, 0");
 
-    LOK_ASSERT_EQUAL(2, static_cast<int>(queue.getQueue().size()));
+    LOK_ASSERT_EQUAL(2, static_cast<int>(queue.size()));
     LOK_ASSERT_EQUAL_STR("callback all 0 4299, 1418, 7090, 275, 1", queue.get());
     LOK_ASSERT_EQUAL_STR("callback all 0 EMPTY, 0", queue.get());
 }
@@ -453,7 +610,7 @@ void TileQueueTests::testCallbackIndicatorValue()
     queue.put("callback all 10 25");
     queue.put("callback all 10 50");
 
-    LOK_ASSERT_EQUAL(1, static_cast<int>(queue.getQueue().size()));
+    LOK_ASSERT_EQUAL(1, static_cast<int>(queue.size()));
     LOK_ASSERT_EQUAL_STR("callback all 10 50", queue.get());
 }
 
@@ -467,7 +624,7 @@ void TileQueueTests::testCallbackPageSize()
     queue.put("callback all 13 12474, 188626");
     queue.put("callback all 13 12474, 205748");
 
-    LOK_ASSERT_EQUAL(1, static_cast<int>(queue.getQueue().size()));
+    LOK_ASSERT_EQUAL(1, static_cast<int>(queue.size()));
     LOK_ASSERT_EQUAL_STR("callback all 13 12474, 205748", queue.get());
 }
 
@@ -492,7 +649,7 @@ void TileQueueTests::testCallbackModifiedStatusIsSkipped()
         queue.put(msg);
     }
 
-    LOK_ASSERT_EQUAL(static_cast<size_t>(4), queue.getQueue().size());
+    LOK_ASSERT_EQUAL(static_cast<size_t>(4), queue.size());
 
     LOK_ASSERT_EQUAL_STR(messages[0], queue.get());
     LOK_ASSERT_EQUAL_STR(messages[1], queue.get());
@@ -21,9 +21,11 @@
 #include <Poco/Net/HTTPSClientSession.h>
 #include <Poco/StreamCopier.h>
 
+#include <HttpRequest.hpp>
 #include <Log.hpp>
 #include <Util.hpp>
 #include <Unit.hpp>
+#include <wsd/LOOLWSD.hpp>
 
 class UnitHTTP : public UnitWSD
 {
@@ -229,10 +231,59 @@ public:
         }
     }
 
+    std::shared_ptr<const http::Response> getStaticFile(const std::string& acceptEncoding,
+                                                       const std::string& ifNoneMatch)
+    {
+        http::Request request("/browser/" LOOLWSD_VERSION_HASH "/bundle.js");
+        if (!acceptEncoding.empty())
+            request.set("Accept-Encoding", acceptEncoding);
+        if (!ifNoneMatch.empty())
+            request.set("If-None-Match", ifNoneMatch);
+
+        // We close the connection after each file.
+        auto httpSession = http::Session::create(helpers::getTestServerURI());
+        return httpSession->syncRequest(request);
+    }
+
+    void testStaticFiles()
+    {
+        LOG_TST("testStaticFiles");
+
+        // Debug builds don't let browsers cache, unless forced to.
+        LOOLWSD::ForceCaching = true;
+
+        const std::shared_ptr<const http::Response> gzip = getStaticFile("gzip, deflate", "");
+        LOK_ASSERT_EQUAL(http::StatusCode::OK, gzip->statusLine().statusCode());
+        LOK_ASSERT_EQUAL(std::string("gzip"), gzip->get("Content-Encoding"));
+        LOK_ASSERT_EQUAL(std::string("Accept-Encoding"), gzip->get("Vary"));
+        LOK_ASSERT_EQUAL(static_cast<int64_t>(gzip->getBody().size()),
+                         gzip->header().getContentLength());
+        const std::string etag = gzip->get("ETag");
+        LOK_ASSERT(!etag.empty());
+
+        LOG_TST("Revalidating with ETag " << etag);
+        const std::shared_ptr<const http::Response> notModified = getStaticFile("gzip", etag);
+        LOK_ASSERT_EQUAL(http::StatusCode::NotModified, notModified->statusLine().statusCode());
+        LOK_ASSERT_EQUAL(etag, notModified->get("ETag"));
+        LOK_ASSERT(notModified->getBody().empty());
+
+        // The uncompressed representation doesn't match the gzip ETag.
+        const std::shared_ptr<const http::Response> identity = getStaticFile("", etag);
+        LOK_ASSERT_EQUAL(http::StatusCode::OK, identity->statusLine().statusCode());
+        LOK_ASSERT(!identity->header().has("Content-Encoding"));
+        LOK_ASSERT(identity->get("ETag") != etag);
+        LOK_ASSERT(identity->getBody().size() > gzip->getBody().size());
+        LOK_ASSERT_EQUAL(static_cast<int64_t>(identity->getBody().size()),
+                         identity->header().getContentLength());
+
+        LOOLWSD::ForceCaching = false;
+    }
+
     void invokeWSDTest() override
     {
         testChunks();
         testContinue();
+        testStaticFiles();
         LOG_TST("All tests passed.");
         exitTest(TestResult::Ok);
     }
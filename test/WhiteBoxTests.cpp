@@ -12,8 +12,12 @@
 #include <test/lokassert.hpp>
 #include <cppunit/TestAssert.h>
 #include <cstddef>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <Auth.hpp>
+#include <BackgroundSave.hpp>
 #include <ChildSession.hpp>
 #include <Common.hpp>
 #include <FileUtil.hpp>
@@ -23,14 +27,33 @@
 #include <TileDesc.hpp>
 #include <Util.hpp>
 #include <JsonUtil.hpp>
+#include <LatencyHistogram.hpp>
 
 #include <common/Message.hpp>
+#include <common/SpookyV2.h>
+#include <kit/DummyLibreOfficeKit.hpp>
+#include <wsd/AdminNotificationQueue.hpp>
 #include <wsd/FileServer.hpp>
+#include <wsd/PageTemplate.hpp>
+#include <wsd/PreSpawnController.hpp>
+#include <wsd/ProxyProtocol.hpp>
+#include <wsd/ShardedRegistry.hpp>
+#include <wsd/TileStore.hpp>
+#include <wsd/TraceFile.hpp>
+#include <wsd/UploadScheduler.hpp>
 #include <net/Buffer.hpp>
+#include <net/HttpParser.hpp>
 #include <net/NetUtil.hpp>
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <fstream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <thread>
+#include <vector>
 
 #include <cppunit/extensions/HelperMacros.h>
 
@@ -66,6 +89,22 @@ class WhiteBoxTests : public CPPUNIT_NS::TestFixture
     CPPUNIT_TEST(testSafeAtoi);
     CPPUNIT_TEST(testBytesToHex);
     CPPUNIT_TEST(testJsonUtilEscapeJSONValue);
+    CPPUNIT_TEST(testPreSpawnController);
+    CPPUNIT_TEST(testLatencyHistogram);
+    CPPUNIT_TEST(testProcSampling);
+    CPPUNIT_TEST(testFileCopy);
+    CPPUNIT_TEST(testFileHash);
+    CPPUNIT_TEST(testUploadScheduler);
+    CPPUNIT_TEST(testStaticFileIndex);
+    CPPUNIT_TEST(testContentNegotiation);
+    CPPUNIT_TEST(testPageTemplate);
+    CPPUNIT_TEST(testShardedRegistry);
+    CPPUNIT_TEST(testProxyFraming);
+    CPPUNIT_TEST(testRequestParser);
+    CPPUNIT_TEST(testAdminNotificationQueue);
+    CPPUNIT_TEST(testBackgroundSave);
+    CPPUNIT_TEST(testTileStore);
+    CPPUNIT_TEST(testTraceFileChunked);
 #if ENABLE_DEBUG
     CPPUNIT_TEST(testUtf8);
 #endif
@@ -99,6 +138,22 @@ class WhiteBoxTests : public CPPUNIT_NS::TestFixture
     void testSafeAtoi();
     void testBytesToHex();
     void testJsonUtilEscapeJSONValue();
+    void testPreSpawnController();
+    void testLatencyHistogram();
+    void testProcSampling();
+    void testFileCopy();
+    void testFileHash();
+    void testUploadScheduler();
+    void testStaticFileIndex();
+    void testContentNegotiation();
+    void testPageTemplate();
+    void testShardedRegistry();
+    void testProxyFraming();
+    void testRequestParser();
+    void testAdminNotificationQueue();
+    void testBackgroundSave();
+    void testTileStore();
+    void testTraceFileChunked();
     void testUtf8();
 };
 
@@ -614,6 +669,19 @@ public:
     void trimIfInactive() override
     {
     }
+
+    bool saveInBackground(const std::string& /*sessionId*/, const std::string& /*command*/) override
+    {
+        return false;
+    }
+
+    void finishBackgroundSave() override
+    {
+    }
+
+    void noteEditingInput() override
+    {
+    }
 };
 
 void WhiteBoxTests::testEmptyCellCursor()
@@ -1361,6 +1429,1042 @@ void WhiteBoxTests::testJsonUtilEscapeJSONValue()
     LOK_ASSERT_EQUAL(JsonUtil::escapeJSONValue(in), expected);
 }
 
+void WhiteBoxTests::testPreSpawnController()
+{
+    constexpr auto testname = __func__;
+
+    LOK_ASSERT_EQUAL(std::size_t(0), PreSpawnController::poissonQuantile(0, 0.05, 10));
+    // Poisson(1): P(X > 2) = 0.080, P(X > 3) = 0.019.
+    LOK_ASSERT_EQUAL(std::size_t(3), PreSpawnController::poissonQuantile(1, 0.05, 10));
+    LOK_ASSERT_EQUAL(std::size_t(5), PreSpawnController::poissonQuantile(1000, 0.01, 5));
+
+    PreSpawnController controller;
+    controller.configure(false, 3, 1, 8, 0.05, std::chrono::seconds(10), 0, 0);
+    LOK_ASSERT_EQUAL(std::size_t(3), controller.getTarget(std::chrono::steady_clock::now(), 0));
+
+    controller.configure(true, 3, 1, 8, 0.05, std::chrono::seconds(10), 0, 0);
+
+    // Two opens per second for a minute, each child taking a second to spawn.
+    auto now = std::chrono::steady_clock::now();
+    for (int i = 0; i < 120; ++i)
+    {
+        controller.recordArrival(now, true);
+        controller.recordForkRequest(now, 1);
+        controller.recordChildSpawned(now + std::chrono::milliseconds(1000));
+        now += std::chrono::milliseconds(500);
+    }
+
+    LOK_ASSERT_EQUAL(std::size_t(1024), controller.getSpawnLatencyMs(0.9));
+    LOK_ASSERT(controller.getArrivalRate(now) > 1.8 && controller.getArrivalRate(now) < 2.1);
+
+    // ~2 arrivals per spawn; Poisson(2): P(X > 4) = 0.053, P(X > 5) = 0.017.
+    LOK_ASSERT_EQUAL(std::size_t(5), controller.getTarget(now, 0));
+
+    // Only 20% of 1 GB for spares at 100 MB each.
+    controller.configure(true, 3, 1, 8, 0.05, std::chrono::seconds(10), 100 * 1024, 20);
+    LOK_ASSERT_EQUAL(std::size_t(2), controller.getTarget(now, 1024 * 1024));
+
+    // Overnight, we shrink back to the minimum.
+    now += std::chrono::hours(1);
+    LOK_ASSERT_EQUAL(std::size_t(1), controller.getTarget(now, 1024 * 1024));
+}
+
+void WhiteBoxTests::testLatencyHistogram()
+{
+    constexpr auto testname = __func__;
+
+    LOK_ASSERT_EQUAL(std::size_t(0), LatencyHistogram::getBucketIndex(0));
+    LOK_ASSERT_EQUAL(std::size_t(0), LatencyHistogram::getBucketIndex(100));
+    LOK_ASSERT_EQUAL(std::size_t(1), LatencyHistogram::getBucketIndex(101));
+    LOK_ASSERT_EQUAL(LatencyHistogram::NumBuckets - 1,
+                     LatencyHistogram::getBucketIndex(std::uint64_t(1) << 40));
+
+    LatencyHistogram& histogram
+        = LatencyHistogram::get("test_duration_seconds", "op=\"Test\"", "For testing.");
+    LOK_ASSERT_EQUAL(&histogram,
+                     &LatencyHistogram::get("test_duration_seconds", "op=\"Test\"", "Ignored."));
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i)
+    {
+        threads.emplace_back([&histogram]() {
+            for (int j = 0; j < 1000; ++j)
+                histogram.observe(std::chrono::microseconds(j < 900 ? 150 : 3000));
+        });
+    }
+
+    for (std::thread& thread : threads)
+        thread.join();
+
+    LatencyHistogram::Snapshot snapshot = histogram.snapshot();
+    LOK_ASSERT_EQUAL(std::uint64_t(4000), snapshot.getCount());
+    LOK_ASSERT_EQUAL(std::uint64_t(4 * (900 * 150 + 100 * 3000)), snapshot._sumUs);
+    LOK_ASSERT_EQUAL(std::uint64_t(200), snapshot.getPercentileUs(0.5));
+    LOK_ASSERT_EQUAL(std::uint64_t(3200), snapshot.getPercentileUs(0.99));
+
+    std::ostringstream oss;
+    histogram.print(oss, "test_duration_seconds", "op=\"Test\"");
+    const std::string printed = oss.str();
+    LOK_ASSERT(printed.find("test_duration_seconds_bucket{op=\"Test\",le=\"0.0002\"} 3600\n")
+               != std::string::npos);
+    LOK_ASSERT(printed.find("test_duration_seconds_bucket{op=\"Test\",le=\"+Inf\"} 4000\n")
+               != std::string::npos);
+    LOK_ASSERT(printed.find("test_duration_seconds_sum{op=\"Test\"} 1.74\n") != std::string::npos);
+    LOK_ASSERT(printed.find("test_duration_seconds_count{op=\"Test\"} 4000\n")
+               != std::string::npos);
+
+    // Only new observations are serialized; merging them (here into ourselves) adds them up.
+    const std::string serialized = LatencyHistogram::serializeNew();
+    LOK_ASSERT(serialized.find("test_duration_seconds\top=\"Test\"\tFor testing.\t") == 0
+               || serialized.find("\ntest_duration_seconds\top=\"Test\"\t") != std::string::npos);
+    LOK_ASSERT(LatencyHistogram::serializeNew().find("test_duration_seconds") == std::string::npos);
+
+    const std::vector<LatencyHistogram::Description> allowed = {
+        { "test_duration_seconds", "op=\"Test\"", "For testing." }
+    };
+    LOK_ASSERT_EQUAL(std::size_t(1), LatencyHistogram::mergeSerialized(serialized, allowed));
+    LOK_ASSERT_EQUAL(std::uint64_t(8000), histogram.snapshot().getCount());
+    LOK_ASSERT_EQUAL(std::size_t(0),
+                     LatencyHistogram::mergeSerialized("garbage\tline\n", allowed));
+
+    // Only the allowed names and labels are merged.
+    const std::string buckets = "1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0";
+    LOK_ASSERT_EQUAL(std::size_t(0),
+                     LatencyHistogram::mergeSerialized(
+                         "other_duration_seconds\top=\"Test\"\tBogus.\t100\t" + buckets + '\n',
+                         allowed));
+    LOK_ASSERT_EQUAL(std::size_t(0),
+                     LatencyHistogram::mergeSerialized(
+                         "test_duration_seconds\top=\"Other\"\tBogus.\t100\t" + buckets + '\n',
+                         allowed));
+    LOK_ASSERT_EQUAL(std::uint64_t(8000), histogram.snapshot().getCount());
+}
+
+void WhiteBoxTests::testProcSampling()
+{
+    constexpr auto testname = __func__;
+
+    int smapsFD = open("/proc/self/smaps_rollup", O_RDONLY);
+    if (smapsFD < 0)
+        smapsFD = open("/proc/self/smaps", O_RDONLY);
+    LOK_ASSERT(smapsFD >= 0);
+
+    // The FD is re-read from the start each time, without seeking.
+    const std::pair<size_t, size_t> first = Util::getPssAndDirtyFromSMaps(smapsFD);
+    const std::pair<size_t, size_t> second = Util::getPssAndDirtyFromSMaps(smapsFD);
+    LOK_ASSERT(first.first > 0);
+    LOK_ASSERT(first.second > 0);
+    LOK_ASSERT(second.first > 0);
+    close(smapsFD);
+
+    LOK_ASSERT_EQUAL(std::make_pair(size_t(0), size_t(0)), Util::getPssAndDirtyFromSMaps(-1));
+
+    const int statFD = open("/proc/self/stat", O_RDONLY);
+    LOK_ASSERT(statFD >= 0);
+    const size_t jiffies = Util::getCpuUsageFromStat(statFD);
+    LOK_ASSERT(jiffies <= Util::getCpuUsage(getpid()));
+    LOK_ASSERT(Util::getCpuUsageFromStat(statFD) >= jiffies);
+    close(statFD);
+
+    // Field 19 is the number of threads.
+    LOK_ASSERT(Util::getStatFromPid(getpid(), 19) >= 1);
+}
+
+void WhiteBoxTests::testFileCopy()
+{
+    constexpr auto testname = __func__;
+
+    const std::string dir = FileUtil::createRandomTmpDir();
+    const std::string source = dir + "/source";
+    std::string data;
+    for (int i = 0; i < 300 * 1024; ++i)
+        data += static_cast<char>(i * 7);
+    std::ofstream(source) << data;
+
+    const auto getTotalCount = []() {
+        std::uint64_t total = 0;
+        for (int i = 0; i < FileUtil::CopyMethodCount; ++i)
+            total += FileUtil::getCopyCount(static_cast<FileUtil::CopyMethod>(i));
+        return total;
+    };
+
+    // Whatever the filesystem supports, each method falls back to a slower one.
+    for (int i = 0; i < FileUtil::CopyMethodCount; ++i)
+    {
+        const auto method = static_cast<FileUtil::CopyMethod>(i);
+        FileUtil::setFastestCopyMethod(method);
+
+        const std::uint64_t countBefore = getTotalCount();
+        const std::uint64_t readWriteBefore = FileUtil::getCopyCount(FileUtil::CopyMethod::ReadWrite);
+
+        const std::string target = dir + '/' + FileUtil::nameOf(method);
+        LOK_ASSERT(FileUtil::copy(source, target, /*log=*/false, /*throw_on_error=*/false));
+        std::ifstream copied(target);
+        std::ostringstream oss;
+        oss << copied.rdbuf();
+        LOK_ASSERT(oss.str() == data);
+
+        LOK_ASSERT_EQUAL(countBefore + 1, getTotalCount());
+        if (method == FileUtil::CopyMethod::ReadWrite)
+            LOK_ASSERT_EQUAL(readWriteBefore + 1,
+                             FileUtil::getCopyCount(FileUtil::CopyMethod::ReadWrite));
+    }
+
+    FileUtil::setFastestCopyMethod(FileUtil::CopyMethod::Reflink);
+
+    // Pseudo-files report a size of 0, yet have content.
+    LOK_ASSERT(FileUtil::copy("/proc/self/status", dir + "/status", false, false));
+    LOK_ASSERT(FileUtil::Stat(dir + "/status").size() > 0);
+
+    FileUtil::removeFile(dir, /*recursive=*/true);
+}
+
+void WhiteBoxTests::testFileHash()
+{
+    constexpr auto testname = __func__;
+
+    const std::string dir = FileUtil::createRandomTmpDir();
+
+    // Larger than the chunks we read, and not a multiple of them.
+    std::string content;
+    for (int i = 0; content.size() < 200 * 1024; ++i)
+        content += std::to_string(i) + ' ';
+    std::ofstream(dir + "/a") << content;
+    std::ofstream(dir + "/b") << content;
+
+    const std::string hash = FileUtil::hashFile(dir + "/a");
+    LOK_ASSERT_EQUAL(static_cast<std::size_t>(32), hash.size());
+    LOK_ASSERT_EQUAL(hash, FileUtil::hashFile(dir + "/b"));
+
+    // The same as hashing it all at once.
+    uint64_t hash1 = 0;
+    uint64_t hash2 = 0;
+    SpookyHash::Hash128(content.data(), content.size(), &hash1, &hash2);
+    std::ostringstream oss;
+    oss << std::hex << std::setfill('0') << std::setw(16) << hash1 << std::setw(16) << hash2;
+    LOK_ASSERT_EQUAL(oss.str(), hash);
+
+    // A single byte changes it.
+    content[100 * 1024] ^= 1;
+    std::ofstream(dir + "/b") << content;
+    LOK_ASSERT(hash != FileUtil::hashFile(dir + "/b"));
+
+    std::ofstream(dir + "/empty");
+    LOK_ASSERT_EQUAL(static_cast<std::size_t>(32), FileUtil::hashFile(dir + "/empty").size());
+    LOK_ASSERT_EQUAL(std::string(), FileUtil::hashFile(dir + "/missing"));
+
+    FileUtil::removeFile(dir, /*recursive=*/true);
+}
+
+void WhiteBoxTests::testUploadScheduler()
+{
+    constexpr auto testname = __func__;
+
+    using Priority = UploadScheduler::Priority;
+    UploadScheduler scheduler;
+    scheduler.configure(3, 2);
+
+    // Records the order of the grants, keeping the slots until we finish them.
+    std::string started;
+    std::map<std::string, std::shared_ptr<UploadScheduler::Slot>> slots;
+    const auto enqueue = [&](const std::string& name, const std::string& host, Priority priority)
+    {
+        return scheduler.enqueue(
+            host, priority,
+            [&started, &slots, name](const std::shared_ptr<UploadScheduler::Slot>& slot)
+            {
+                started += (started.empty() ? "" : " ") + name;
+                slots[name] = slot;
+            });
+    };
+
+    // Releasing a slot grants the next, which adds to the slots.
+    const auto finish = [&slots](const std::string& name)
+    {
+        std::shared_ptr<UploadScheduler::Slot> slot = std::move(slots[name]);
+        slots.erase(name);
+        slot.reset();
+    };
+
+    // Two per host at most.
+    enqueue("a1", "a", Priority::Autosave);
+    enqueue("a2", "a", Priority::Autosave);
+    enqueue("a3", "a", Priority::User);
+    LOK_ASSERT_EQUAL(std::string("a1 a2"), started);
+    LOK_ASSERT_EQUAL(static_cast<std::size_t>(2), scheduler.getActiveCount());
+    LOK_ASSERT_EQUAL(static_cast<std::size_t>(1), scheduler.getQueueLength());
+
+    // Another host isn't held up by the busy one.
+    enqueue("b1", "b", Priority::Drain);
+    LOK_ASSERT_EQUAL(std::string("a1 a2 b1"), started);
+
+    // Now we are at the limit, so everything waits.
+    const std::uint64_t c1 = enqueue("c1", "c", Priority::Drain);
+    enqueue("c2", "c", Priority::Autosave);
+    enqueue("b2", "b", Priority::Autosave);
+    enqueue("c3", "c", Priority::User);
+    LOK_ASSERT_EQUAL(static_cast<std::size_t>(3), scheduler.getActiveCount());
+    LOK_ASSERT_EQUAL(static_cast<std::size_t>(5), scheduler.getQueueLength());
+
+    // Finishing one of a's starts a user save; a3 arrived first, but host c is idle.
+    finish("a1");
+    LOK_ASSERT_EQUAL(std::string("a1 a2 b1 c3"), started);
+
+    // Finishing another one of a's lets a3 go, being a user save.
+    finish("a2");
+    LOK_ASSERT_EQUAL(std::string("a1 a2 b1 c3 a3"), started);
+
+    // Then the autosaves, in order of arrival, b being as busy as c.
+    LOK_ASSERT(scheduler.cancel(c1));
+    LOK_ASSERT(!scheduler.cancel(c1));
+    finish("a3");
+    LOK_ASSERT_EQUAL(std::string("a1 a2 b1 c3 a3 c2"), started);
+    finish("b1");
+    LOK_ASSERT_EQUAL(std::string("a1 a2 b1 c3 a3 c2 b2"), started);
+    LOK_ASSERT_EQUAL(static_cast<std::size_t>(0), scheduler.getQueueLength());
+
+    slots.clear();
+    LOK_ASSERT_EQUAL(static_cast<std::size_t>(0), scheduler.getActiveCount());
+
+    // Without limits, everything starts right away.
+    scheduler.configure(0, 0);
+    for (int i = 0; i < 10; ++i)
+        enqueue("d" + std::to_string(i), "d", Priority::Drain);
+    LOK_ASSERT_EQUAL(static_cast<std::size_t>(10), scheduler.getActiveCount());
+    slots.clear();
+
+    scheduler.addSentBytes(1000);
+    scheduler.addSentBytes(24);
+    LOK_ASSERT_EQUAL(static_cast<std::uint64_t>(1024), scheduler.getSentBytes());
+}
+
+void WhiteBoxTests::testStaticFileIndex()
+{
+    constexpr auto testname = __func__;
+
+    const std::string root = FileUtil::createRandomTmpDir();
+    mkdir((root + "/dist").c_str(), S_IRWXU);
+    mkdir((root + "/dist/images").c_str(), S_IRWXU);
+
+    std::string script;
+    for (int i = 0; i < 1000; ++i)
+        script += "console.log(" + std::to_string(i) + ");\n";
+    std::ofstream(root + "/dist/bundle.js") << script;
+    std::ofstream(root + "/dist/bundle.js.br") << "not really brotli";
+    std::ofstream(root + "/dist/lool.html") << "<html>%VERSION%</html>";
+    std::ofstream(root + "/dist/images/logo.png") << "\x89PNG";
+
+    FileServerRequestHandler::CompressedCacheDir = FileUtil::createRandomTmpDir();
+    FileServerRequestHandler::indexDir(root, "/dist");
+
+    // The precompressed file is a variant, not a file of its own.
+    LOK_ASSERT(!FileServerRequestHandler::findFile("/dist/bundle.js.br"));
+
+    const FileServerRequestHandler::StaticFile* bundle =
+        FileServerRequestHandler::findFile("/dist/bundle.js");
+    LOK_ASSERT(bundle);
+    LOK_ASSERT_EQUAL(root + "/dist/bundle.js", bundle->_identity._path);
+    LOK_ASSERT_EQUAL(script.size(), bundle->_identity._size);
+    LOK_ASSERT(!bundle->_template); // Served from disk.
+    LOK_ASSERT_EQUAL(static_cast<std::size_t>(2), bundle->_encodings.size());
+
+    const FileServerRequestHandler::StaticFile::Variant& br = bundle->_encodings.at("br");
+    LOK_ASSERT_EQUAL(root + "/dist/bundle.js.br", br._path);
+    LOK_ASSERT_EQUAL(std::string("not really brotli").size(), br._size);
+
+    // We compressed it at startup, to disk.
+    const FileServerRequestHandler::StaticFile::Variant& gzip = bundle->_encodings.at("gzip");
+    LOK_ASSERT(gzip._size > 0 && gzip._size < script.size());
+    LOK_ASSERT_EQUAL(gzip._size, FileUtil::Stat(gzip._path).size());
+
+    // Strong and distinct per representation.
+    LOK_ASSERT(Util::startsWith(bundle->_identity._etag, "\""));
+    LOK_ASSERT(bundle->_identity._etag != br._etag);
+    LOK_ASSERT(bundle->_identity._etag != gzip._etag);
+    LOK_ASSERT(br._etag != gzip._etag);
+
+    const FileServerRequestHandler::StaticFile* logo =
+        FileServerRequestHandler::findFile("/dist/images/logo.png");
+    LOK_ASSERT(logo);
+    LOK_ASSERT(logo->_encodings.empty());
+    LOK_ASSERT(logo->_identity._etag != bundle->_identity._etag);
+
+    // Templates are kept in memory.
+    LOK_ASSERT_EQUAL(std::string("<html>%VERSION%</html>"),
+                     *FileServerRequestHandler::getUncompressedFile("/dist/lool.html"));
+
+    // The ETag changes with the content.
+    const std::string oldETag = bundle->_identity._etag;
+    FileServerRequestHandler::FileIndex.clear();
+    std::ofstream(root + "/dist/bundle.js") << script << "// changed\n";
+    FileServerRequestHandler::indexDir(root, "/dist");
+    LOK_ASSERT(FileServerRequestHandler::findFile("/dist/bundle.js")->_identity._etag != oldETag);
+
+    const std::string cacheDir = FileServerRequestHandler::CompressedCacheDir;
+    FileServerRequestHandler::uninitialize();
+    LOK_ASSERT(!FileServerRequestHandler::findFile("/dist/bundle.js"));
+    LOK_ASSERT(!FileUtil::Stat(cacheDir).exists());
+
+    FileUtil::removeFile(root, /*recursive=*/true);
+}
+
+void WhiteBoxTests::testContentNegotiation()
+{
+    constexpr auto testname = __func__;
+
+    std::map<std::string, FileServerRequestHandler::StaticFile::Variant> encodings;
+    encodings["gzip"] = { "/a.js.gz", 1, "\"1-gzip\"" };
+    encodings["br"] = { "/a.js.br", 1, "\"1-br\"" };
+
+    const auto negotiate = [&encodings](const std::string& acceptEncoding) {
+        return FileServerRequestHandler::negotiateEncoding(acceptEncoding, encodings);
+    };
+
+    LOK_ASSERT_EQUAL(std::string("br"), negotiate("gzip, deflate, br"));
+    LOK_ASSERT_EQUAL(std::string("br"), negotiate("gzip, deflate, br, zstd"));
+    LOK_ASSERT_EQUAL(std::string("gzip"), negotiate("gzip"));
+    LOK_ASSERT_EQUAL(std::string("gzip"), negotiate(" GZIP ;q=1"));
+    LOK_ASSERT_EQUAL(std::string("gzip"), negotiate("br;q=0, gzip"));
+    LOK_ASSERT_EQUAL(std::string("gzip"), negotiate("gzip;q=0.5, br;q=0.4"));
+    LOK_ASSERT_EQUAL(std::string("br"), negotiate("*"));
+    LOK_ASSERT_EQUAL(std::string("gzip"), negotiate("br;q=0, *;q=0.1"));
+    LOK_ASSERT_EQUAL(std::string(), negotiate(""));
+    LOK_ASSERT_EQUAL(std::string(), negotiate("identity"));
+    LOK_ASSERT_EQUAL(std::string(), negotiate("deflate, zstd"));
+    LOK_ASSERT_EQUAL(std::string(), negotiate("gzip;q=0"));
+
+    encodings["zstd"] = { "/a.js.zst", 1, "\"1-zstd\"" };
+    LOK_ASSERT_EQUAL(std::string("zstd"), negotiate("gzip, deflate, br, zstd"));
+    LOK_ASSERT_EQUAL(std::string(), FileServerRequestHandler::negotiateEncoding(
+                                        "gzip, br", FileServerRequestHandler::StaticFile()._encodings));
+
+    LOK_ASSERT(FileServerRequestHandler::isETagMatch("\"abc\"", "\"abc\""));
+    LOK_ASSERT(FileServerRequestHandler::isETagMatch("W/\"abc\"", "\"abc\""));
+    LOK_ASSERT(FileServerRequestHandler::isETagMatch("\"xyz\", \"abc\"", "\"abc\""));
+    LOK_ASSERT(FileServerRequestHandler::isETagMatch("*", "\"abc\""));
+    LOK_ASSERT(!FileServerRequestHandler::isETagMatch("\"abcd\"", "\"abc\""));
+    LOK_ASSERT(!FileServerRequestHandler::isETagMatch("\"abc-gzip\"", "\"abc\""));
+    LOK_ASSERT(!FileServerRequestHandler::isETagMatch("", "\"abc\""));
+}
+
+void WhiteBoxTests::testPageTemplate()
+{
+    constexpr auto testname = __func__;
+
+    const PageTemplate page("%HOST%<head><!--%BRANDING_CSS%--></head> 100% <!-- %HOST% -->"
+                            "%20 %lower% %UNSET% %E2%80% %ACCESS_TOKEN%");
+    // HOST, BRANDING_CSS, UNSET, E2 and ACCESS_TOKEN.
+    LOK_ASSERT_EQUAL(static_cast<std::size_t>(5), page.getPlaceholderCount());
+
+    // Without values, we get the page back.
+    LOK_ASSERT_EQUAL(page.getContent(), page.render(PageTemplate::Values(page)));
+
+    PageTemplate::Values values(page);
+    values.set("%HOST%", "wss://host");
+    values.set("<!--%BRANDING_CSS%-->", "<link>");
+    values.set("%NOT_IN_PAGE%", "ignored");
+    // Values aren't expanded further, unlike with a replace per placeholder.
+    values.set("%ACCESS_TOKEN%", "%HOST%");
+    LOK_ASSERT_EQUAL(std::string("wss://host<head><link></head> 100% <!-- wss://host -->"
+                                 "%20 %lower% %UNSET% %E2%80% %HOST%"),
+                     page.render(values));
+
+    // The comment form is a placeholder of its own.
+    PageTemplate::Values bare(page);
+    bare.set("%BRANDING_CSS%", "<link>");
+    LOK_ASSERT_EQUAL(page.getContent(), page.render(bare));
+
+    const PageTemplate empty("");
+    LOK_ASSERT_EQUAL(std::string(), empty.render(PageTemplate::Values(empty)));
+
+    const PageTemplate only("%A%%B%");
+    PageTemplate::Values onlyValues(only);
+    onlyValues.set("%A%", "1");
+    onlyValues.set("%B%", "2");
+    LOK_ASSERT_EQUAL(std::string("12"), only.render(onlyValues));
+}
+
+void WhiteBoxTests::testShardedRegistry()
+{
+    constexpr auto testname = __func__;
+
+    ShardedRegistry<int> registry;
+    LOK_ASSERT(registry.empty());
+    LOK_ASSERT(!registry.find("doc"));
+
+    for (int i = 0; i < 100; ++i)
+        LOK_ASSERT(registry.insert("doc" + std::to_string(i), std::make_shared<int>(i)));
+    LOK_ASSERT_EQUAL(static_cast<std::size_t>(100), registry.size());
+
+    // Keys are unique.
+    LOK_ASSERT(!registry.insert("doc7", std::make_shared<int>(-1)));
+    LOK_ASSERT_EQUAL(7, *registry.find("doc7"));
+
+    // findOrCreate only creates when missing.
+    int created = 0;
+    const auto create = [&created]() { ++created; return std::make_shared<int>(1000); };
+    LOK_ASSERT_EQUAL(42, *registry.findOrCreate("doc42", create));
+    LOK_ASSERT_EQUAL(1000, *registry.findOrCreate("new", create));
+    LOK_ASSERT_EQUAL(1000, *registry.findOrCreate("new", create));
+    LOK_ASSERT_EQUAL(1, created);
+
+    // A nullptr from the creator isn't added.
+    LOK_ASSERT(!registry.findOrCreate("none", []() { return std::shared_ptr<int>(); }));
+    LOK_ASSERT(!registry.find("none"));
+    LOK_ASSERT_EQUAL(static_cast<std::size_t>(101), registry.size());
+
+    // Snapshots taken before a removal stay valid.
+    const std::shared_ptr<int> kept = registry.find("doc3");
+    const auto removed = registry.removeIf([](const std::string&, const std::shared_ptr<int>& value)
+                                           { return *value % 2 == 1; });
+    LOK_ASSERT_EQUAL(static_cast<std::size_t>(50), removed.size());
+    LOK_ASSERT_EQUAL(static_cast<std::size_t>(51), registry.size());
+    LOK_ASSERT(!registry.find("doc3"));
+    LOK_ASSERT_EQUAL(3, *kept);
+
+    int sum = 0;
+    registry.forEach([&sum](const std::string&, const std::shared_ptr<int>& value) { sum += *value; });
+    LOK_ASSERT_EQUAL(2450 + 1000, sum);
+    LOK_ASSERT_EQUAL(static_cast<std::size_t>(51), registry.getAll().size());
+
+    // Concurrent creators of the same keys get the same entries.
+    ShardedRegistry<int> concurrent;
+    std::atomic<int> creations(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back(
+            [&concurrent, &creations]()
+            {
+                for (int i = 0; i < 200; ++i)
+                {
+                    concurrent.findOrCreate("doc" + std::to_string(i), [&creations, i]()
+                                            { ++creations; return std::make_shared<int>(i); });
+                    concurrent.find("doc" + std::to_string(i / 2));
+                }
+            });
+    }
+
+    for (std::thread& thread : threads)
+        thread.join();
+
+    LOK_ASSERT_EQUAL(200, creations.load());
+    LOK_ASSERT_EQUAL(static_cast<std::size_t>(200), concurrent.size());
+
+    // Concurrent creators of distinct keys never exceed the maximum size.
+    ShardedRegistry<int> limited;
+    creations = 0;
+    threads.clear();
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back(
+            [&limited, &creations, t]()
+            {
+                for (int i = 0; i < 100; ++i)
+                {
+                    limited.findOrCreate(
+                        "doc" + std::to_string(t * 100 + i),
+                        [&creations, i]() { ++creations; return std::make_shared<int>(i); }, 50);
+                }
+            });
+    }
+
+    for (std::thread& thread : threads)
+        thread.join();
+
+    LOK_ASSERT_EQUAL(50, creations.load());
+    LOK_ASSERT_EQUAL(static_cast<std::size_t>(50), limited.size());
+    LOK_ASSERT(!limited.findOrCreate("more", []() { return std::make_shared<int>(0); }, 50));
+
+    concurrent.clear();
+    LOK_ASSERT(concurrent.empty());
+    LOK_ASSERT(!concurrent.find("doc0"));
+}
+
+void WhiteBoxTests::testProxyFraming()
+{
+    constexpr auto testname = __func__;
+
+    std::vector<char> out;
+    ProxyProtocolHandler::appendFrame(out, "hello", 5, true, 0x1f);
+    ProxyProtocolHandler::appendFrame(out, "", 0, false, 0);
+    LOK_ASSERT_EQUAL(std::string("T0x1f\n0x5\nhello\nB0x0\n0x0\n\n"),
+                     std::string(out.data(), out.size()));
+
+    // Frames are parsed in place.
+    ProxyProtocolHandler::Frame frame;
+    int taken = ProxyProtocolHandler::parseFrame(out.data(), out.size(), frame);
+    LOK_ASSERT_EQUAL(16, taken);
+    LOK_ASSERT(frame._text);
+    LOK_ASSERT_EQUAL(static_cast<uint64_t>(0x1f), frame._serial);
+    LOK_ASSERT_EQUAL(static_cast<const char*>(out.data() + 10), frame._data);
+    LOK_ASSERT_EQUAL(std::string("hello"), std::string(frame._data, frame._size));
+
+    taken = ProxyProtocolHandler::parseFrame(out.data() + 16, out.size() - 16, frame);
+    LOK_ASSERT_EQUAL(static_cast<int>(out.size()) - 16, taken);
+    LOK_ASSERT(!frame._text);
+    LOK_ASSERT_EQUAL(static_cast<std::size_t>(0), frame._size);
+
+    // As the client sends them, with upper-case hex and no prefix too.
+    const std::string client = "B0xA\n0x3\nkey\nTff\n2\nab\n";
+    taken = ProxyProtocolHandler::parseFrame(client.data(), client.size(), frame);
+    LOK_ASSERT_EQUAL(13, taken);
+    LOK_ASSERT_EQUAL(static_cast<uint64_t>(10), frame._serial);
+    taken = ProxyProtocolHandler::parseFrame(client.data() + 13, client.size() - 13, frame);
+    LOK_ASSERT_EQUAL(static_cast<uint64_t>(255), frame._serial);
+    LOK_ASSERT_EQUAL(std::string("ab"), std::string(frame._data, frame._size));
+
+    // Every truncation of a frame is incomplete.
+    for (std::size_t i = 0; i < 16; ++i)
+        LOK_ASSERT_EQUAL(0, ProxyProtocolHandler::parseFrame(out.data(), i, frame));
+
+    const auto parse = [&frame](const std::string& data)
+    { return ProxyProtocolHandler::parseFrame(data.data(), data.size(), frame); };
+    LOK_ASSERT_EQUAL(-1, parse("X0x1\n0x1\na\n")); // Bad type.
+    LOK_ASSERT_EQUAL(-1, parse("T0x\n0x1\na\n")); // No digits.
+    LOK_ASSERT_EQUAL(-1, parse("T0xg\n0x1\na\n")); // Not hex.
+    LOK_ASSERT_EQUAL(-1, parse("T0x1\n0x1\nab\n")); // Longer than said.
+    LOK_ASSERT_EQUAL(-1, parse("T0x1\n0x12345678901234567\n")); // Overflow.
+    LOK_ASSERT_EQUAL(-1, parse("T0x1\n0xffffffffffffffff\n")); // Too large.
+    LOK_ASSERT_EQUAL(0, parse("T0x1\n0x10\nshort\n"));
+}
+
+void WhiteBoxTests::testRequestParser()
+{
+    constexpr auto testname = __func__;
+
+    using State = http::RequestParser::State;
+
+    const std::string request = "GET /browser/dist/bundle.js?v=1 HTTP/1.1\r\n"
+                                "Host: localhost:9980\r\n"
+                                "Accept-Encoding:gzip, br  \r\n"
+                                "X-Empty:\r\n"
+                                "\r\n"
+                                "next request";
+    const std::size_t headerSize = request.find("next");
+
+    // Byte by byte, as well as all at once, in a copy that moves as it grows.
+    for (std::size_t step : { std::size_t(1), std::size_t(7), request.size() })
+    {
+        http::RequestParser parser;
+        std::string data;
+        State state = State::Incomplete;
+        for (std::size_t i = 0; i < request.size() && state == State::Incomplete; i += step)
+        {
+            data = request.substr(0, i + step);
+            state = parser.parse(data.data(), data.size());
+        }
+
+        LOK_ASSERT_EQUAL(State::Complete, state);
+        LOK_ASSERT_EQUAL(headerSize, parser.getHeaderSize());
+        LOK_ASSERT_EQUAL(std::string("GET"), std::string(parser.getMethod()));
+        LOK_ASSERT_EQUAL(std::string("/browser/dist/bundle.js?v=1"), std::string(parser.getUri()));
+        LOK_ASSERT_EQUAL(std::string("HTTP/1.1"), std::string(parser.getVersion()));
+        LOK_ASSERT_EQUAL(static_cast<std::size_t>(3), parser.getFieldCount());
+        LOK_ASSERT_EQUAL(std::string("Accept-Encoding"), std::string(parser.getFieldName(1)));
+        LOK_ASSERT_EQUAL(std::string("gzip, br"), std::string(parser.get("accept-encoding")));
+        LOK_ASSERT(parser.has("X-Empty"));
+        LOK_ASSERT(parser.get("X-Empty").empty());
+        LOK_ASSERT(!parser.has("Cookie"));
+        LOK_ASSERT_EQUAL(static_cast<int64_t>(-1), parser.getContentLength());
+        LOK_ASSERT(!parser.isChunked());
+    }
+
+    const auto parse = [](const std::string& data)
+    {
+        http::RequestParser parser;
+        return parser.parse(data.data(), data.size());
+    };
+
+    // Bodies.
+    {
+        const std::string data = "\r\nPOST /lool/convert-to HTTP/1.0\nContent-Length: 42\n"
+                                 "content-length: 42\n\n";
+        http::RequestParser parser;
+        LOK_ASSERT_EQUAL(State::Complete, parser.parse(data.data(), data.size()));
+        LOK_ASSERT_EQUAL(data.size(), parser.getHeaderSize());
+        LOK_ASSERT_EQUAL(std::string("POST"), std::string(parser.getMethod()));
+        LOK_ASSERT_EQUAL(static_cast<int64_t>(42), parser.getContentLength());
+    }
+    {
+        const std::string data = "POST / HTTP/1.1\r\nTransfer-Encoding: gzip, Chunked\r\n\r\n";
+        http::RequestParser parser;
+        LOK_ASSERT_EQUAL(State::Complete, parser.parse(data.data(), data.size()));
+        LOK_ASSERT(parser.isChunked());
+    }
+
+    // Reset for the next request.
+    {
+        http::RequestParser parser;
+        LOK_ASSERT_EQUAL(State::Complete, parser.parse(request.data(), request.size()));
+        parser.reset();
+        const std::string next = "GET /hosting/discovery HTTP/1.1\r\n\r\n";
+        LOK_ASSERT_EQUAL(State::Complete, parser.parse(next.data(), next.size()));
+        LOK_ASSERT_EQUAL(std::string("/hosting/discovery"), std::string(parser.getUri()));
+        LOK_ASSERT_EQUAL(static_cast<std::size_t>(0), parser.getFieldCount());
+    }
+
+    LOK_ASSERT_EQUAL(State::Incomplete, parse(""));
+    LOK_ASSERT_EQUAL(State::Incomplete, parse("GET / HTTP/1.1\r\nHost: x\r\n"));
+
+    // Malformed.
+    LOK_ASSERT_EQUAL(State::Invalid, parse("GET /\r\n\r\n"));
+    LOK_ASSERT_EQUAL(State::Invalid, parse("GET / HTTP/1.1 x\r\n\r\n"));
+    LOK_ASSERT_EQUAL(State::Invalid, parse("GET / FTP/1.1\r\n\r\n"));
+    LOK_ASSERT_EQUAL(State::Invalid, parse("G(T / HTTP/1.1\r\n\r\n"));
+    LOK_ASSERT_EQUAL(State::Invalid, parse("GET / HTTP/1.1\r\nHost : x\r\n\r\n"));
+    LOK_ASSERT_EQUAL(State::Invalid, parse("GET / HTTP/1.1\r\nHost x\r\n\r\n"));
+    LOK_ASSERT_EQUAL(State::Invalid, parse("GET / HTTP/1.1\r\nA: b\r\n c\r\n\r\n"));
+    LOK_ASSERT_EQUAL(State::Invalid, parse(std::string("GET / HTTP/1.1\r\nA: \0\r\n\r\n", 24)));
+    LOK_ASSERT_EQUAL(State::Invalid, parse("POST / HTTP/1.1\r\nContent-Length: -1\r\n\r\n"));
+    LOK_ASSERT_EQUAL(State::Invalid,
+                     parse("POST / HTTP/1.1\r\nContent-Length: 1\r\nContent-Length: 2\r\n\r\n"));
+    LOK_ASSERT_EQUAL(
+        State::Invalid,
+        parse("POST / HTTP/1.1\r\nContent-Length: 1\r\nTransfer-Encoding: chunked\r\n\r\n"));
+
+    // Too long, even before the end of the line.
+    LOK_ASSERT_EQUAL(State::Invalid,
+                     parse("GET /" + std::string(http::RequestParser::MaxUriLen, 'a') + " HTTP/1.1\r\n\r\n"));
+    LOK_ASSERT_EQUAL(State::Invalid, parse("GET / HTTP/1.1\r\nA: " + std::string(20000, 'a')));
+
+    std::string manyFields = "GET / HTTP/1.1\r\n";
+    for (std::size_t i = 0; i <= http::RequestParser::MaxFields; ++i)
+        manyFields += "X-" + std::to_string(i) + ": y\r\n";
+    LOK_ASSERT_EQUAL(State::Invalid, parse(manyFields + "\r\n"));
+}
+
+void WhiteBoxTests::testAdminNotificationQueue()
+{
+    constexpr auto testname = __func__;
+
+    LOK_ASSERT_EQUAL(std::string("propchange 12 mem"),
+                     AdminNotificationQueue::getUpdateKey("propchange 12 mem 1024"));
+    LOK_ASSERT_EQUAL(std::string(), AdminNotificationQueue::getUpdateKey("propchange 12"));
+    LOK_ASSERT_EQUAL(std::string(), AdminNotificationQueue::getUpdateKey("adddoc 12 a.odt"));
+    LOK_ASSERT(AdminNotificationQueue::isDroppable("mem_stats 1"));
+    LOK_ASSERT(!AdminNotificationQueue::isDroppable("rmdoc 12 1"));
+
+    // Updates of the same property are coalesced, in place.
+    AdminNotificationQueue queue;
+    LOK_ASSERT(queue.push("propchange 12 mem 1024"));
+    LOK_ASSERT(queue.push("adddoc 13 a.odt"));
+    LOK_ASSERT(queue.push("propchange 12 mem 2048"));
+    LOK_ASSERT_EQUAL(static_cast<std::size_t>(2), queue.size());
+    LOK_ASSERT(queue.isUnchanged("propchange 12 mem 2048"));
+    LOK_ASSERT(!queue.isUnchanged("propchange 12 mem 1024"));
+    LOK_ASSERT(!queue.isUnchanged("adddoc 13 a.odt"));
+
+    LOK_ASSERT_EQUAL(std::string("batch\npropchange 12 mem 2048\nadddoc 13 a.odt"),
+                     queue.takeFrame());
+    LOK_ASSERT(queue.empty());
+    LOK_ASSERT_EQUAL(static_cast<std::size_t>(0), queue.getPendingBytes());
+
+    // What was sent is remembered, until the document goes away.
+    LOK_ASSERT(queue.isUnchanged("propchange 12 mem 2048"));
+    LOK_ASSERT(!queue.isUnchanged("propchange 12 mem 4096"));
+    queue.markSent("propchange 1 mem 1");
+    queue.forget("12");
+    LOK_ASSERT(!queue.isUnchanged("propchange 12 mem 2048"));
+    LOK_ASSERT(queue.isUnchanged("propchange 1 mem 1"));
+
+    // Over budget, the samples are dropped, oldest first, but nothing else.
+    const std::string sample = "mem_stats " + std::string(1023, '1');
+    const std::string event = "rmdoc 1 " + std::string(1023, '2');
+    const std::size_t count = AdminNotificationQueue::MaxPendingBytes / (sample.size() + 1);
+    for (std::size_t i = 0; i < count; ++i)
+        LOK_ASSERT(queue.push(sample));
+    LOK_ASSERT(queue.push(event));
+    LOK_ASSERT_EQUAL(count, queue.size());
+    LOK_ASSERT_EQUAL(static_cast<uint64_t>(1), queue.getDroppedTotal());
+
+    const std::string frame = queue.takeFrame();
+    LOK_ASSERT(Util::startsWith(frame, "batch\ndropped 1\nmem_stats "));
+    LOK_ASSERT(Util::endsWith(frame, '\n' + event));
+
+    // Events alone can exceed the budget.
+    bool pushed = true;
+    for (std::size_t i = 0; i < 2 * count && pushed; ++i)
+        pushed = queue.push(event);
+    LOK_ASSERT(!pushed);
+}
+
+void WhiteBoxTests::testBackgroundSave()
+{
+    constexpr auto testname = __func__;
+
+    const std::string dir = FileUtil::createRandomTmpDir();
+    const std::string path = dir + "/document.odt";
+
+    LOK_ASSERT(BackgroundSave::isSupportedFormat(path));
+    LOK_ASSERT(BackgroundSave::isSupportedFormat(dir + "/Document.DOCX"));
+    LOK_ASSERT(!BackgroundSave::isSupportedFormat(dir + "/document.csv"));
+    LOK_ASSERT(!BackgroundSave::isSupportedFormat(dir + ".odt/document"));
+
+    lok::Office office(dummy_lok_init_2(nullptr, nullptr));
+    std::unique_ptr<lok::Document> document(office.documentLoad(("file://" + path).c_str()));
+    LOK_ASSERT(document);
+
+    BackgroundSave bgSave;
+    LOK_ASSERT_EQUAL(BackgroundSave::State::None, bgSave.poll());
+
+    // Changed while saving, so still modified once saved.
+    LOK_ASSERT(bgSave.start(office, *document, path));
+    LOK_ASSERT(bgSave.isSaving());
+    LOK_ASSERT(!bgSave.noteModified());
+    LOK_ASSERT_EQUAL(BackgroundSave::State::Succeeded, bgSave.poll(/*wait=*/true));
+    LOK_ASSERT(!bgSave.isSaving());
+    LOK_ASSERT(FileUtil::Stat(path).isFile());
+    LOK_ASSERT(FileUtil::Stat(dir + "/.bgsave-document.odt").bad());
+    LOK_ASSERT(bgSave.wasModifiedDuringSave());
+    LOK_ASSERT(!bgSave.isReportedUnmodified());
+    LOK_ASSERT_EQUAL(BackgroundSave::State::None, bgSave.poll());
+
+    // Unchanged while saving, so reported unmodified, until the next change.
+    FileUtil::removeFile(path);
+    LOK_ASSERT(bgSave.start(office, *document, path));
+    LOK_ASSERT_EQUAL(BackgroundSave::State::Succeeded, bgSave.poll(/*wait=*/true));
+    LOK_ASSERT(FileUtil::Stat(path).isFile());
+    LOK_ASSERT(!bgSave.wasModifiedDuringSave());
+    LOK_ASSERT(bgSave.isReportedUnmodified());
+    LOK_ASSERT(bgSave.noteModified());
+    LOK_ASSERT(!bgSave.noteModified());
+
+    // Core saving it reports it unmodified itself.
+    LOK_ASSERT(bgSave.start(office, *document, path));
+    LOK_ASSERT_EQUAL(BackgroundSave::State::Succeeded, bgSave.poll(/*wait=*/true));
+    LOK_ASSERT(bgSave.isReportedUnmodified());
+    bgSave.noteUnmodified();
+    LOK_ASSERT(!bgSave.noteModified());
+
+    // Failing, the caller is to save in the foreground.
+    LOK_ASSERT(bgSave.start(office, *document, dir + "/missing/document.odt"));
+    LOK_ASSERT_EQUAL(BackgroundSave::State::Failed, bgSave.poll(/*wait=*/true));
+    LOK_ASSERT(!bgSave.getError().empty());
+    LOK_ASSERT(!bgSave.isSaving());
+
+    document.reset();
+    FileUtil::removeFile(dir, /*recursive=*/true);
+}
+
+void WhiteBoxTests::testTileStore()
+{
+    constexpr auto testname = __func__;
+
+    const std::string dir = FileUtil::createRandomTmpDir();
+    TileStore::initialize(dir, 4096);
+
+    const std::string hash = "0123456789abcdef0123456789abcdef";
+    const std::string path = dir + '/' + hash + ".tiles";
+    const char* data = nullptr;
+    std::size_t size = 0;
+    {
+        std::unique_ptr<TileStore> store = TileStore::open(hash);
+        LOK_ASSERT(store);
+        LOK_ASSERT(!store->contains("a"));
+
+        // One document at a time.
+        LOK_ASSERT(!TileStore::open(hash));
+
+        LOK_ASSERT(store->append("a", "Zfoo", 4));
+        LOK_ASSERT(store->append("b", "Zbar", 4));
+        LOK_ASSERT(store->contains("a"));
+
+        // A later tile supersedes.
+        LOK_ASSERT(store->append("a", "Zbaz", 4));
+        LOK_ASSERT_EQUAL(static_cast<std::size_t>(2), store->count());
+        LOK_ASSERT(store->lookup("a", data, size));
+        LOK_ASSERT_EQUAL(std::string("Zbaz"), std::string(data, size));
+        LOK_ASSERT(!store->lookup("c", data, size));
+    }
+
+    // Indexed again when opened.
+    const std::size_t segmentSize = FileUtil::Stat(path).size();
+    {
+        std::unique_ptr<TileStore> store = TileStore::open(hash);
+        LOK_ASSERT(store);
+        LOK_ASSERT_EQUAL(static_cast<std::size_t>(2), store->count());
+        LOK_ASSERT_EQUAL(segmentSize, store->size());
+        LOK_ASSERT(store->lookup("a", data, size));
+        LOK_ASSERT_EQUAL(std::string("Zbaz"), std::string(data, size));
+        LOK_ASSERT(store->lookup("b", data, size));
+        LOK_ASSERT_EQUAL(std::string("Zbar"), std::string(data, size));
+    }
+
+    // A torn tile at the end is dropped, and appended over.
+    std::ofstream(path, std::ios::app) << "torn";
+    {
+        std::unique_ptr<TileStore> store = TileStore::open(hash);
+        LOK_ASSERT_EQUAL(segmentSize, store->size());
+        LOK_ASSERT(store->append("c", "Zqux", 4));
+    }
+
+    // A corrupt tile is not served.
+    {
+        std::ifstream segment(path, std::ios::binary);
+        std::string content((std::istreambuf_iterator<char>(segment)),
+                            std::istreambuf_iterator<char>());
+        content[content.rfind("Zqux") + 1] = '!';
+        std::ofstream(path, std::ios::binary) << content;
+    }
+    {
+        std::unique_ptr<TileStore> store = TileStore::open(hash);
+        LOK_ASSERT_EQUAL(static_cast<std::size_t>(3), store->count());
+        LOK_ASSERT(!store->lookup("c", data, size));
+        LOK_ASSERT(store->lookup("b", data, size));
+    }
+
+    FileUtil::removeFile(dir, /*recursive=*/true);
+
+    // The least recently opened segments are removed, but not open ones.
+    const std::string lruDir = FileUtil::createRandomTmpDir();
+    TileStore::initialize(lruDir, 4096);
+
+    const std::string tile = 'Z' + std::string(999, 'x');
+    const auto fill = [&](const std::string& name, int count)
+    {
+        std::unique_ptr<TileStore> store = TileStore::open(name);
+        for (int i = 0; i < count; ++i)
+            LOK_ASSERT(store->append(std::to_string(i), tile.data(), tile.size()));
+        return store;
+    };
+    const auto age = [&](const std::string& name, int secs)
+    {
+        const timespec times[2] = { { time(nullptr) - secs, 0 }, { time(nullptr) - secs, 0 } };
+        LOK_ASSERT_EQUAL(0, utimensat(AT_FDCWD, (lruDir + '/' + name + ".tiles").c_str(), times, 0));
+    };
+    const auto exists = [&](const std::string& name)
+    { return FileUtil::Stat(lruDir + '/' + name + ".tiles").exists(); };
+
+    fill("one", 2);
+    age("one", 200);
+    fill("two", 2);
+    age("two", 100);
+    LOK_ASSERT(exists("one"));
+
+    // Over the limit, the oldest goes.
+    fill("three", 1);
+    LOK_ASSERT(!exists("one"));
+    LOK_ASSERT(exists("two"));
+    LOK_ASSERT(exists("three"));
+
+    {
+        std::unique_ptr<TileStore> two = TileStore::open("two");
+        age("two", 100);
+        age("three", 50);
+
+        // A segment never outgrows the store.
+        std::unique_ptr<TileStore> four = fill("four", 4);
+        LOK_ASSERT(!four->append("4", tile.data(), tile.size()));
+        four.reset();
+
+        LOK_ASSERT(exists("two"));
+        LOK_ASSERT(!exists("three"));
+    }
+
+    FileUtil::removeFile(lruDir, /*recursive=*/true);
+}
+
+void WhiteBoxTests::testTraceFileChunked()
+{
+    constexpr auto testname = __func__;
+
+    const std::string dir = FileUtil::createRandomTmpDir();
+    const std::string path = dir + "/trace.ltr";
+    {
+        TraceFileWriter writer(path, true, false, /*chunked=*/true, false,
+                               std::vector<std::string>());
+        writer.newSession("1", "s1", "file:///doc.odt", std::string());
+        writer.newSession("1", "s2", "file:///doc.odt", std::string());
+
+        // Each thread fills its own blocks.
+        std::vector<std::thread> threads;
+        for (int session = 1; session <= 2; ++session)
+        {
+            threads.emplace_back([&writer, session]() {
+                const std::string sessionId = 's' + std::to_string(session);
+                for (int i = 0; i < 10000; ++i)
+                    writer.writeIncoming("1", sessionId, "key type=input char=97 key=" + std::to_string(i));
+            });
+        }
+
+        for (std::thread& thread : threads)
+            thread.join();
+
+        // The threads wrote out their blocks as they ended.
+        {
+            TraceFileReader reader(path);
+            std::size_t count = 0;
+            for (TraceFileRecord rec = reader.getNextRecord();
+                 rec.getDir() != TraceFileRecord::Direction::Invalid; rec = reader.getNextRecord())
+            {
+                ++count;
+            }
+
+            LOK_ASSERT_EQUAL(static_cast<std::size_t>(20002), count);
+        }
+
+        writer.writeOutgoing("1", "s2", "invalidatetiles: EMPTY");
+    }
+
+    // All the records, merged in order.
+    std::vector<int64_t> times;
+    {
+        TraceFileReader reader(path);
+        TraceFileRecord rec = reader.getNextRecord();
+        LOK_ASSERT(rec.getDir() == TraceFileRecord::Direction::Event);
+        LOK_ASSERT(Util::startsWith(rec.getPayload(), "NewSession: "));
+        LOK_ASSERT_EQUAL(rec.getTimestampUs(), reader.getEpochStart());
+        for (; rec.getDir() != TraceFileRecord::Direction::Invalid; rec = reader.getNextRecord())
+        {
+            LOK_ASSERT(times.empty() || rec.getTimestampUs() >= times.back());
+            times.push_back(rec.getTimestampUs());
+        }
+
+        LOK_ASSERT_EQUAL(static_cast<std::size_t>(20003), times.size());
+    }
+
+    // One session.
+    {
+        TraceFileFilter filter;
+        filter._sessionId = "s2";
+        TraceFileReader reader(path, filter);
+        std::size_t count = 0;
+        for (TraceFileRecord rec = reader.getNextRecord();
+             rec.getDir() != TraceFileRecord::Direction::Invalid; rec = reader.getNextRecord())
+        {
+            LOK_ASSERT_EQUAL(std::string("s2"), rec.getSessionId());
+            ++count;
+        }
+
+        LOK_ASSERT_EQUAL(static_cast<std::size_t>(10002), count);
+    }
+
+    // A time range.
+    {
+        TraceFileFilter filter;
+        filter._fromUs = times[5000];
+        filter._toUs = times[15000];
+        TraceFileReader reader(path, filter);
+        LOK_ASSERT_EQUAL(filter._fromUs, reader.getEpochStart());
+        const std::size_t expected
+            = std::upper_bound(times.begin(), times.end(), filter._toUs)
+              - std::lower_bound(times.begin(), times.end(), filter._fromUs);
+        std::size_t count = 0;
+        for (TraceFileRecord rec = reader.getNextRecord();
+             rec.getDir() != TraceFileRecord::Direction::Invalid; rec = reader.getNextRecord())
+        {
+            LOK_ASSERT(rec.getTimestampUs() >= filter._fromUs);
+            LOK_ASSERT(rec.getTimestampUs() <= filter._toUs);
+            ++count;
+        }
+
+        LOK_ASSERT_EQUAL(expected, count);
+    }
+
+    FileUtil::removeFile(dir, /*recursive=*/true);
+}
+
 void WhiteBoxTests::testUtf8()
 {
 #if ENABLE_DEBUG
@@ -45,6 +45,7 @@ class HTTPServerTest : public CPPUNIT_NS::TestFixture
     CPPUNIT_TEST(testScriptsAndLinksPost);
     CPPUNIT_TEST(testConvertTo);
     CPPUNIT_TEST(testConvertTo2);
+    CPPUNIT_TEST(testConvertBatch);
     CPPUNIT_TEST(testConvertToWithForwardedIP_Deny);
     CPPUNIT_TEST(testConvertToWithForwardedIP_Allow);
     CPPUNIT_TEST(testConvertToWithForwardedIP_DenyMulti);
@@ -58,6 +59,7 @@ class HTTPServerTest : public CPPUNIT_NS::TestFixture
     void testScriptsAndLinksPost();
     void testConvertTo();
     void testConvertTo2();
+    void testConvertBatch();
     void testConvertToWithForwardedIP_Deny();
     void testConvertToWithForwardedIP_Allow();
     void testConvertToWithForwardedIP_DenyMulti();
@@ -338,6 +340,65 @@ void HTTPServerTest::testConvertTo2()
     LOK_ASSERT_EQUAL(actualString[3], 'G');
 }
 
+void HTTPServerTest::testConvertBatch()
+{
+    const char *testname = "testConvertBatch";
+    const std::string srcPath = FileUtil::getTempFileCopyPath(TDOC, "hello.odt", "convertBatch_");
+    std::unique_ptr<Poco::Net::HTTPClientSession> session(helpers::createSession(_uri));
+    session->setTimeout(Poco::Timespan(COMMAND_TIMEOUT_SECS * 2, 0)); // 10 seconds.
+
+    // The invalid format fails alone, not the batch.
+    TST_LOG("Convert-batch odt -> txt, invalid, png");
+
+    Poco::Net::HTTPRequest request(Poco::Net::HTTPRequest::HTTP_POST, "/lool/convert-batch");
+    Poco::Net::HTMLForm form;
+    form.setEncoding(Poco::Net::HTMLForm::ENCODING_MULTIPART);
+    form.set("outputs", "txt,nosuchformat,thumbnail-320x180");
+    form.addPart("data", new Poco::Net::FilePartSource(srcPath));
+    form.prepareSubmit(request);
+    try
+    {
+        form.write(session->sendRequest(request));
+    }
+    catch (const std::exception& ex)
+    {
+        // In case the server is still starting up.
+        sleep(COMMAND_TIMEOUT_SECS);
+        form.write(session->sendRequest(request));
+    }
+
+    Poco::Net::HTTPResponse response;
+    std::stringstream actualStream;
+    std::istream& responseStream = session->receiveResponse(response);
+    Poco::StreamCopier::copyStream(responseStream, actualStream);
+
+    // Remove the temp files.
+    FileUtil::removeFile(srcPath);
+
+    LOK_ASSERT_EQUAL(Poco::Net::HTTPResponse::HTTP_OK, response.getStatus());
+    LOK_ASSERT(Util::startsWith(response.getContentType(), "multipart/mixed; boundary="));
+
+    // The load, and each output, in order.
+    const std::string timing = response.get("Server-Timing", "");
+    LOK_ASSERT(Util::startsWith(timing, "load;dur="));
+    LOK_ASSERT(timing.find(", txt;dur=") != std::string::npos);
+    LOK_ASSERT(timing.find(", nosuchformat;dur=") != std::string::npos);
+    LOK_ASSERT(timing.find(", thumbnail-320x180;dur=") != std::string::npos);
+
+    const std::string actualString = actualStream.str();
+    const std::size_t txt = actualString.find("name=\"txt\"");
+    const std::size_t invalid = actualString.find("name=\"nosuchformat\"");
+    const std::size_t png = actualString.find("name=\"thumbnail-320x180\"");
+    LOK_ASSERT(txt != std::string::npos);
+    LOK_ASSERT(invalid != std::string::npos);
+    LOK_ASSERT(png != std::string::npos);
+    LOK_ASSERT(txt < invalid);
+    LOK_ASSERT(invalid < png);
+    LOK_ASSERT(actualString.find("Hello world", txt) < invalid);
+    LOK_ASSERT(actualString.find("X-ERROR-KIND: savefailed", invalid) < png);
+    LOK_ASSERT(actualString.find("\x89PNG", png) != std::string::npos);
+}
+
 void HTTPServerTest::testConvertToWithForwardedIP_Deny()
 {
     const std::string testname = "convertToWithForwardedClientIP-Deny";
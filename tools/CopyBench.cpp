@@ -0,0 +1,132 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Benchmarks FileUtil::copy with each of its copy methods, by copying a
+ * tree of files, typically a LibreOffice installation, as we do when we
+ * can't hard-link the jail files.
+ */
+
+#include <config.h>
+
+#include <ftw.h>
+#include <sys/stat.h>
+#include <sysexits.h>
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <common/FileUtil.hpp>
+#include <common/Log.hpp>
+
+namespace
+{
+std::string SourceRoot;
+std::vector<std::string> Dirs;
+std::vector<std::string> Files;
+
+int collect(const char* fpath, const struct stat* /*sb*/, int typeflag, struct FTW* /*ftwbuf*/)
+{
+    const std::string relative = std::string(fpath).substr(SourceRoot.size());
+    if (typeflag == FTW_D)
+        Dirs.push_back(relative);
+    else if (typeflag == FTW_F)
+        Files.push_back(relative);
+
+    // Symlinks and the rest we don't copy.
+    return FTW_CONTINUE;
+}
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        std::cerr << "Usage: loolcopybench <source-tree> [<destination-dir>]\n"
+                  << "       Copies the source tree with each copy method in turn.\n"
+                  << "       Reflink needs the destination on the same Btrfs or XFS filesystem.\n";
+        return EX_USAGE;
+    }
+
+    Log::initialize("loolcopybench", "warning", false, false, std::map<std::string, std::string>());
+
+    SourceRoot = argv[1];
+    const std::string destRoot = argc > 2 ? argv[2] : FileUtil::createRandomTmpDir();
+
+    if (nftw(SourceRoot.c_str(), collect, 64, FTW_ACTIONRETVAL | FTW_PHYS) != 0)
+    {
+        std::cerr << "Failed to walk " << SourceRoot << '\n';
+        return EX_NOINPUT;
+    }
+
+    std::cout << "Copying " << Files.size() << " files in " << Dirs.size() << " directories from "
+              << SourceRoot << " to " << destRoot << '\n';
+    std::cout << std::setw(16) << "method" << std::setw(10) << "seconds" << std::setw(10)
+              << "MB/s" << std::setw(10) << "failed" << "  used\n";
+
+    for (int i = 0; i < FileUtil::CopyMethodCount; ++i)
+    {
+        const auto method = static_cast<FileUtil::CopyMethod>(i);
+        FileUtil::setFastestCopyMethod(method);
+
+        const std::string dest = destRoot + '/' + FileUtil::nameOf(method);
+        for (const std::string& dir : Dirs)
+            mkdir((dest + dir).c_str(), S_IRWXU);
+
+        std::uint64_t countsBefore[FileUtil::CopyMethodCount];
+        std::uint64_t bytesBefore = 0;
+        for (int j = 0; j < FileUtil::CopyMethodCount; ++j)
+        {
+            countsBefore[j] = FileUtil::getCopyCount(static_cast<FileUtil::CopyMethod>(j));
+            bytesBefore += FileUtil::getCopyBytes(static_cast<FileUtil::CopyMethod>(j));
+        }
+
+        std::size_t failed = 0;
+        const auto start = std::chrono::steady_clock::now();
+        for (const std::string& file : Files)
+        {
+            if (!FileUtil::copy(SourceRoot + file, dest + file, /*log=*/false,
+                                /*throw_on_error=*/false))
+                ++failed;
+        }
+        const double secs =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        // Which methods did the copies end up using, after falling back?
+        std::uint64_t bytes = 0;
+        std::string used;
+        for (int j = 0; j < FileUtil::CopyMethodCount; ++j)
+        {
+            const auto usedMethod = static_cast<FileUtil::CopyMethod>(j);
+            bytes += FileUtil::getCopyBytes(usedMethod);
+            const std::uint64_t count = FileUtil::getCopyCount(usedMethod) - countsBefore[j];
+            if (count)
+                used += std::string(FileUtil::nameOf(usedMethod)) + ':' + std::to_string(count) + ' ';
+        }
+        bytes -= bytesBefore;
+
+        std::cout << std::setw(16) << FileUtil::nameOf(method) << std::setw(10) << std::fixed
+                  << std::setprecision(3) << secs << std::setw(10) << std::setprecision(1)
+                  << (secs > 0 ? bytes / secs / (1024 * 1024) : 0) << std::setw(10) << failed
+                  << "  " << used << '\n';
+
+        FileUtil::removeFile(dest, /*recursive=*/true);
+    }
+
+    if (argc <= 2)
+        FileUtil::removeFile(destRoot, /*recursive=*/true);
+
+    return EX_OK;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
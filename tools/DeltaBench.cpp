@@ -0,0 +1,171 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Benchmarks the deltas of a tile whose content moves: typing in the middle
+ * of a line, which pushes the rest of it along, scrolling sideways, panning
+ * diagonally, and scrolling a list in part of the tile. Reports the bytes of
+ * each delta against those of a keyframe, and the time to make it.
+ */
+
+#include <config.h>
+
+#include <sysexits.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <common/Log.hpp>
+#include <kit/Delta.hpp>
+
+namespace
+{
+constexpr int TileSize = 256;
+constexpr int LineHeight = 18;
+constexpr int GlyphWidth = 8;
+
+constexpr uint32_t Paper = 0xffffffff;
+constexpr uint32_t Ink = 0xff202020;
+
+/// Whether the pixel at @col, @row of glyph @glyph is inked.
+bool isInked(uint32_t glyph, int col, int row)
+{
+    if (col >= GlyphWidth - 1 || row >= 12)
+        return false;
+    const uint32_t hash = ((glyph * 73856093u) ^ ((row * GlyphWidth + col) * 19349663u)) * 2654435761u;
+    return (hash >> 16) % 5 < 2;
+}
+
+/// Draws @width x @height of lines of text into @pixels at @x, @y, scrolled to
+/// @scrollX, @scrollY. @glyphAt gives the glyph at a line and column.
+void drawText(std::vector<uint32_t>& pixels, int x, int y, int width, int height, int scrollX,
+              int scrollY, const std::function<uint32_t(int, int)>& glyphAt)
+{
+    for (int row = 0; row < height; ++row)
+    {
+        const int docY = row + scrollY;
+        for (int col = 0; col < width; ++col)
+        {
+            const int docX = col + scrollX;
+            const uint32_t glyph = glyphAt(docY / LineHeight, docX / GlyphWidth);
+            pixels[(y + row) * TileSize + x + col] =
+                isInked(glyph, docX % GlyphWidth, docY % LineHeight) ? Ink : Paper;
+        }
+    }
+}
+
+uint32_t plainText(int line, int column) { return line * 1009 + column; }
+
+struct Result
+{
+    std::size_t _bytes = 0;
+    double _secs = 0;
+};
+
+/// Draws the tile with @draw for each of the @steps of an interaction, and encodes each.
+void run(const std::string& name, int steps, const std::function<void(std::vector<uint32_t>&, int)>& draw)
+{
+    std::vector<uint32_t> pixels(TileSize * TileSize, Paper);
+    unsigned char* pixmap = reinterpret_cast<unsigned char*>(pixels.data());
+    const TileLocation loc(0, 0, TileSize, 0, 0);
+
+    DeltaGenerator deltas;
+    DeltaGenerator keyframes;
+    Result delta;
+    Result keyframe;
+    std::vector<char> output;
+    for (int step = 0; step <= steps; ++step)
+    {
+        draw(pixels, step);
+
+        output.clear();
+        auto start = std::chrono::steady_clock::now();
+        const std::size_t size = deltas.compressOrDelta(pixmap, 0, 0, TileSize, TileSize, TileSize,
+                                                        TileSize, loc, output, step + 1, false);
+        const double secs =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        // The first has nothing to delta against.
+        if (step == 0)
+            continue;
+
+        delta._bytes += size;
+        delta._secs += secs;
+
+        output.clear();
+        start = std::chrono::steady_clock::now();
+        keyframe._bytes += keyframes.compressOrDelta(pixmap, 0, 0, TileSize, TileSize, TileSize,
+                                                     TileSize, loc, output, step + 1, true);
+        keyframe._secs +=
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    for (const auto& pair :
+         { std::make_pair("keyframe", keyframe), std::make_pair("delta", delta) })
+    {
+        std::cout << std::setw(16) << name << std::setw(10) << pair.first << std::setw(14)
+                  << pair.second._bytes / steps << std::setw(14) << std::fixed
+                  << std::setprecision(1) << pair.second._secs * 1e6 / steps << '\n';
+    }
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+    if (argc > 1 && argv[1][0] == '-')
+    {
+        std::cerr << "Usage: looldeltabench [<steps>]\n"
+                  << "       Encodes a tile as its content moves, as keyframes and as deltas.\n";
+        return EX_USAGE;
+    }
+
+    Log::initialize("looldeltabench", "warning", false, false,
+                    std::map<std::string, std::string>());
+
+    const int steps = argc > 1 ? std::max(1, std::atoi(argv[1])) : 40;
+
+    std::cout << std::setw(16) << "interaction" << std::setw(10) << "method" << std::setw(14)
+              << "bytes/step" << std::setw(14) << "us/step" << '\n';
+
+    // Each character typed pushes the rest of the line along.
+    run("typing", steps, [](std::vector<uint32_t>& pixels, int step) {
+        drawText(pixels, 0, 0, TileSize, TileSize, 0, 0, [step](int line, int column) {
+            constexpr int Cursor = 5;
+            if (line != 6 || column < Cursor)
+                return plainText(line, column);
+            return column < Cursor + step ? 50000 + column : plainText(line, column - step);
+        });
+    });
+
+    run("scroll sideways", steps, [](std::vector<uint32_t>& pixels, int step) {
+        drawText(pixels, 0, 0, TileSize, TileSize, step * 16, 0, plainText);
+    });
+
+    run("pan", steps, [](std::vector<uint32_t>& pixels, int step) {
+        drawText(pixels, 0, 0, TileSize, TileSize, step * 5, step * 3, plainText);
+    });
+
+    // A list box, scrolled a line at a time, in a dialog that stays.
+    run("scroll list", steps, [](std::vector<uint32_t>& pixels, int step) {
+        drawText(pixels, 0, 0, TileSize, TileSize, 0, 0, plainText);
+        drawText(pixels, 40, 60, 160, 150, 0, step * LineHeight,
+                 [](int line, int column) { return 90000 + plainText(line, column); });
+    });
+
+    return EX_OK;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,207 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Benchmarks parsing the requests we get, e.g. WebSocket upgrades and
+ * file server requests, with http::RequestParser against what we used to
+ * do: search for the end of the header, then Poco::Net::HTTPRequest::read.
+ * All are run on whole requests, and on requests arriving in small reads.
+ *
+ * "parser" is the parser alone, which is what the server does for WebSocket
+ * upgrades and the requests routed without a Poco request. The file server,
+ * admin, clipboard, proxy and POST handlers still take one, copied from the
+ * parser: "parser+poco" is what the server does for those.
+ */
+
+#include <config.h>
+
+#include <sysexits.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <Poco/MemoryStream.h>
+#include <Poco/Net/HTTPRequest.h>
+
+#include <net/HttpParser.hpp>
+#include <net/Socket.hpp>
+
+namespace
+{
+/// Typical requests, as browsers send them.
+std::vector<std::string> getRequests()
+{
+    const std::string common = "Host: office.example.com\r\n"
+                               "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:109.0) "
+                               "Gecko/20100101 Firefox/115.0\r\n"
+                               "Accept-Language: en-US,en;q=0.5\r\n"
+                               "Accept-Encoding: gzip, deflate, br\r\n"
+                               "Origin: https://cloud.example.com\r\n"
+                               "Cookie: oc_sessionPassphrase=ZmFrZXBhc3NwaHJhc2U; nc_sameSiteCookielax=true\r\n"
+                               "Connection: keep-alive, Upgrade\r\n";
+    return {
+        "GET /lool/https%3A%2F%2Fcloud.example.com%2Findex.php%2Fapps%2Frichdocuments%2Fwopi"
+        "%2Ffiles%2F1234_ocabcdef%3Faccess_token%3DeyJhbGciOiJIUzI1NiJ9/ws?WOPISrc="
+        "https%3A%2F%2Fcloud.example.com%2Findex.php%2Fapps%2Frichdocuments%2Fwopi%2Ffiles"
+        "%2F1234_ocabcdef&compat=/ws HTTP/1.1\r\n"
+            + common
+            + "Sec-WebSocket-Version: 13\r\n"
+              "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+              "Sec-WebSocket-Extensions: permessage-deflate\r\n"
+              "Pragma: no-cache\r\n"
+              "Cache-Control: no-cache\r\n"
+              "Upgrade: websocket\r\n"
+              "\r\n",
+        "GET /browser/0123abcd/images/lc_save.svg HTTP/1.1\r\n" + common
+            + "Accept: image/avif,image/webp,*/*\r\n"
+              "Referer: https://office.example.com/browser/0123abcd/lool.html\r\n"
+              "If-None-Match: \"0123abcd\"\r\n"
+              "\r\n",
+        "POST /browser/0123abcd/lool.html?WOPISrc=https%3A%2F%2Fcloud.example.com%2Fwopi"
+        "%2Ffiles%2F1234 HTTP/1.1\r\n"
+            + common
+            + "Content-Type: application/x-www-form-urlencoded\r\n"
+              "Content-Length: 0\r\n"
+              "\r\n",
+    };
+}
+
+/// Runs @parse on each request @iterations times, and reports the rate.
+/// @parse returns the size of the header, which must be that of the request.
+template <typename Parse>
+bool run(const char* name, const std::vector<std::string>& requests, int iterations, Parse parse)
+{
+    std::size_t count = 0;
+    std::size_t bytes = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+    {
+        for (const std::string& request : requests)
+        {
+            if (parse(request) != request.size())
+            {
+                std::cerr << name << " failed to parse:\n" << request << '\n';
+                return false;
+            }
+
+            ++count;
+            bytes += request.size();
+        }
+    }
+    const double secs =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << std::setw(16) << name << std::setw(14) << std::fixed << std::setprecision(0)
+              << count / secs << std::setw(12) << std::setprecision(2) << secs * 1e9 / count
+              << std::setw(12) << std::setprecision(1) << bytes / secs / (1024 * 1024) << '\n';
+    return true;
+}
+
+/// What StreamSocket::parseHeader used to do on each read, given the first @len bytes.
+std::size_t parsePoco(const std::string& request, std::size_t len)
+{
+    static const std::string marker("\r\n\r\n");
+    const auto end = request.begin() + len;
+    const auto itBody = std::search(request.begin(), end, marker.begin(), marker.end());
+    if (itBody == end)
+        return 0;
+
+    Poco::MemoryInputStream message(request.data(), len);
+    Poco::Net::HTTPRequest poco;
+    poco.read(message);
+    return itBody - request.begin() + marker.size();
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+    if (argc > 1 && argv[1][0] == '-')
+    {
+        std::cerr << "Usage: loolhttpparserbench [<iterations> [<read size>]]\n"
+                  << "       Parses typical requests, whole and in reads of the given size"
+                     " (default 256).\n";
+        return EX_USAGE;
+    }
+
+    const int iterations = argc > 1 ? std::max(1, std::atoi(argv[1])) : 100000;
+    const std::size_t readSize = argc > 2 ? std::max(1, std::atoi(argv[2])) : 256;
+    const std::vector<std::string> requests = getRequests();
+
+    std::cout << std::setw(16) << "method" << std::setw(14) << "requests/s" << std::setw(12)
+              << "ns/request" << std::setw(12) << "MB/s" << '\n';
+
+    bool success = run("poco", requests, iterations,
+                       [](const std::string& request) { return parsePoco(request, request.size()); });
+
+    http::RequestParser parser;
+    success &= run("parser", requests, iterations, [&parser](const std::string& request) {
+        parser.reset();
+        parser.parse(request.data(), request.size());
+        return parser.getHeaderSize();
+    });
+
+    success &= run("parser+poco", requests, iterations, [&parser](const std::string& request) {
+        parser.reset();
+        parser.parse(request.data(), request.size());
+        Poco::Net::HTTPRequest poco;
+        StreamSocket::setRequest(parser, poco);
+        return parser.getHeaderSize();
+    });
+
+    const std::string readName = std::to_string(readSize);
+    success &= run(("poco/" + readName).c_str(), requests, iterations,
+                   [readSize](const std::string& request) {
+                       std::size_t len = 0;
+                       std::size_t headerSize = 0;
+                       while (!headerSize && len < request.size())
+                       {
+                           len = std::min(len + readSize, request.size());
+                           headerSize = parsePoco(request, len);
+                       }
+                       return headerSize;
+                   });
+
+    success &= run(("parser/" + readName).c_str(), requests, iterations,
+                   [&parser, readSize](const std::string& request) {
+                       parser.reset();
+                       std::size_t len = 0;
+                       while (parser.getState() == http::RequestParser::State::Incomplete
+                              && len < request.size())
+                       {
+                           len = std::min(len + readSize, request.size());
+                           parser.parse(request.data(), len);
+                       }
+                       return parser.getHeaderSize();
+                   });
+
+    success &= run(("parser+poco/" + readName).c_str(), requests, iterations,
+                   [&parser, readSize](const std::string& request) {
+                       parser.reset();
+                       std::size_t len = 0;
+                       while (parser.getState() == http::RequestParser::State::Incomplete
+                              && len < request.size())
+                       {
+                           len = std::min(len + readSize, request.size());
+                           parser.parse(request.data(), len);
+                       }
+
+                       Poco::Net::HTTPRequest poco;
+                       StreamSocket::setRequest(parser, poco);
+                       return parser.getHeaderSize();
+                   });
+
+    return success ? EX_OK : EX_SOFTWARE;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,359 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Benchmarks polling many documents as DocumentBroker does: each in its own
+ * thread, or multiplexed on a few shared threads, as per_document.poll_threads
+ * configures. Each document has a socket that echoes what a client writes, and
+ * does its housekeeping after each poll. Clients write timestamps to random
+ * documents at a steady rate, and we report the round-trip latencies, along
+ * with the threads, RSS, CPU time and context switches of the process.
+ */
+
+#include <config.h>
+
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <common/Log.hpp>
+#include <net/Socket.hpp>
+
+namespace
+{
+/// Echoes whatever it reads, as a session would answer a client.
+class EchoHandler final : public SimpleSocketHandler
+{
+    void onConnect(const std::shared_ptr<StreamSocket>& socket) override { _socket = socket; }
+
+    void handleIncomingMessage(SocketDisposition&) override
+    {
+        std::shared_ptr<StreamSocket> socket = _socket.lock();
+        if (!socket)
+            return;
+
+        Buffer& data = socket->getInBuffer();
+        socket->send(data.data(), data.size());
+        data.eraseFirst(data.size());
+    }
+
+    int getPollEvents(std::chrono::steady_clock::time_point, int64_t&) override { return POLLIN; }
+
+    void performWrites(std::size_t) override
+    {
+        std::shared_ptr<StreamSocket> socket = _socket.lock();
+        if (socket)
+            socket->flush();
+    }
+
+    std::weak_ptr<StreamSocket> _socket;
+};
+
+/// A document: the server end of its socket, and its housekeeping.
+class Document
+{
+public:
+    Document()
+        : _lastCheck(std::chrono::steady_clock::now())
+        , _checks(0)
+    {
+    }
+
+    /// Stands in for DocumentBroker::stepPolling, which checks its timers after each poll.
+    void step()
+    {
+        const auto now = std::chrono::steady_clock::now();
+        if (now - _lastCheck >= std::chrono::seconds(1))
+        {
+            _lastCheck = now;
+            ++_checks;
+        }
+    }
+
+private:
+    std::chrono::steady_clock::time_point _lastCheck;
+    std::size_t _checks;
+};
+
+/// Polls one document, as DocumentBrokerPoll does.
+class DocumentPoll final : public TerminatingPoll
+{
+public:
+    DocumentPoll(const std::string& name, Document& document)
+        : TerminatingPoll(name)
+        , _document(document)
+    {
+    }
+
+    void pollingThread() override
+    {
+        while (continuePolling())
+        {
+            poll(SocketPoll::DefaultPollTimeoutMicroS);
+            _document.step();
+        }
+    }
+
+private:
+    Document& _document;
+};
+
+/// Polls many documents, as SharedBrokerPoll does.
+class SharedPoll final : public TerminatingPoll
+{
+public:
+    explicit SharedPoll(const std::string& name)
+        : TerminatingPoll(name)
+    {
+    }
+
+    /// Only before starting the thread.
+    void addDocument(Document& document) { _documents.push_back(&document); }
+
+    void pollingThread() override
+    {
+        while (continuePolling())
+        {
+            poll(SocketPoll::DefaultPollTimeoutMicroS);
+            for (Document* document : _documents)
+                document->step();
+        }
+    }
+
+private:
+    std::vector<Document*> _documents;
+};
+
+/// Returns the value of the @field line in /proc/self/status, e.g. "Threads".
+std::string procStatus(const std::string& field)
+{
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line))
+    {
+        if (line.compare(0, field.size() + 1, field + ':') == 0)
+        {
+            const std::size_t start = line.find_first_not_of(" \t", field.size() + 1);
+            return start == std::string::npos ? std::string() : line.substr(start);
+        }
+    }
+
+    return std::string();
+}
+
+std::int64_t nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+/// Reads the echoed timestamps from all @fds, until @stop, into @latencies.
+void receive(const std::vector<int>& fds, const std::atomic<bool>& stop,
+             std::vector<std::int64_t>& latencies)
+{
+    const int epollFd = epoll_create1(EPOLL_CLOEXEC);
+    for (const int fd : fds)
+    {
+        epoll_event event;
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+    }
+
+    std::vector<epoll_event> events(256);
+    std::int64_t stamps[64];
+    while (!stop)
+    {
+        const int count = epoll_wait(epollFd, events.data(), events.size(), 100);
+        for (int i = 0; i < count; ++i)
+        {
+            // The echoes of a document arrive in order, in whole timestamps on a stream socket
+            // as we never write more than the socket buffer.
+            const ssize_t len = read(events[i].data.fd, stamps, sizeof(stamps));
+            const std::int64_t now = nowNs();
+            for (ssize_t j = 0; j < len / static_cast<ssize_t>(sizeof(stamps[0])); ++j)
+                latencies.push_back(now - stamps[j]);
+        }
+    }
+
+    close(epollFd);
+}
+
+double percentileUs(const std::vector<std::int64_t>& sorted, double percentile)
+{
+    if (sorted.empty())
+        return 0;
+
+    const std::size_t index = std::min(sorted.size() - 1,
+                                       static_cast<std::size_t>(sorted.size() * percentile / 100));
+    return sorted[index] / 1000.;
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+    if (argc > 1 && argv[1][0] == '-')
+    {
+        std::cerr << "Usage: loolpollbench [<documents> [<poll-threads> [<messages/sec> [<secs>]]]]\n"
+                  << "       Polls the documents on a thread each, when poll-threads is 0 (default),\n"
+                  << "       or on that many shared threads. Defaults to 2000 documents and\n"
+                  << "       2000 messages/sec for 10 secs.\n";
+        return EX_USAGE;
+    }
+
+    Log::initialize("loolpollbench", "warning", false, false,
+                    std::map<std::string, std::string>());
+
+    const int documentCount = argc > 1 ? std::max(1, std::atoi(argv[1])) : 2000;
+    const int pollThreads = argc > 2 ? std::max(0, std::atoi(argv[2])) : 0;
+    const int rate = argc > 3 ? std::max(1, std::atoi(argv[3])) : 2000;
+    const int secs = argc > 4 ? std::max(1, std::atoi(argv[4])) : 10;
+
+    // Each document takes two sockets, and each poll a wakeup pipe.
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    const std::string rssBefore = procStatus("VmRSS");
+
+    std::vector<std::unique_ptr<Document>> documents;
+    std::vector<std::unique_ptr<TerminatingPoll>> polls;
+    std::vector<int> clientFds;
+    for (int i = 0; i < pollThreads; ++i)
+        polls.emplace_back(new SharedPoll("docbroker_p" + std::to_string(i)));
+
+    for (int i = 0; i < documentCount; ++i)
+    {
+        int pair[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, pair) != 0)
+        {
+            std::cerr << "Failed to create the socket of document " << i << ": "
+                      << strerror(errno) << '\n';
+            return EX_OSERR;
+        }
+
+        documents.emplace_back(new Document());
+        TerminatingPoll* poll;
+        if (pollThreads > 0)
+        {
+            auto shared = static_cast<SharedPoll*>(polls[i % pollThreads].get());
+            shared->addDocument(*documents.back());
+            poll = shared;
+        }
+        else
+        {
+            polls.emplace_back(new DocumentPoll("docbroker_" + std::to_string(i), *documents.back()));
+            poll = polls.back().get();
+        }
+
+        poll->insertNewSocket(StreamSocket::create<StreamSocket>(
+            std::string(), pair[0], false, std::make_shared<EchoHandler>()));
+        clientFds.push_back(pair[1]);
+    }
+
+    for (const auto& poll : polls)
+        poll->startThread();
+
+    std::atomic<bool> stop(false);
+    std::vector<std::int64_t> latencies;
+    latencies.reserve(static_cast<std::size_t>(rate) * secs);
+    std::thread receiver(receive, std::cref(clientFds), std::cref(stop), std::ref(latencies));
+
+    rusage usageBefore;
+    getrusage(RUSAGE_SELF, &usageBefore);
+
+    // Write at a steady rate to random documents, as users typing would.
+    std::mt19937 random(42);
+    std::uniform_int_distribution<int> pick(0, documentCount - 1);
+    const auto interval = std::chrono::nanoseconds(1000000000 / rate);
+    const auto start = std::chrono::steady_clock::now();
+    std::string threads;
+    std::string rss;
+    std::size_t sent = 0;
+    for (auto next = start; next < start + std::chrono::seconds(secs); next += interval)
+    {
+        std::this_thread::sleep_until(next);
+        const std::int64_t stamp = nowNs();
+        if (write(clientFds[pick(random)], &stamp, sizeof(stamp)) == sizeof(stamp))
+            ++sent;
+
+        // Sample midway, when everything is running.
+        if (threads.empty() && std::chrono::steady_clock::now() >= start + std::chrono::seconds(secs) / 2)
+        {
+            threads = procStatus("Threads");
+            rss = procStatus("VmRSS");
+        }
+    }
+
+    // Let the last echoes arrive.
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    rusage usageAfter;
+    getrusage(RUSAGE_SELF, &usageAfter);
+
+    stop = true;
+    receiver.join();
+
+    for (const auto& poll : polls)
+        poll->joinThread();
+
+    for (const int fd : clientFds)
+        close(fd);
+
+    std::sort(latencies.begin(), latencies.end());
+
+    const auto cpuUs = [](const rusage& usage) {
+        return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000LL +
+               usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+    };
+
+    std::cout << documentCount << " documents on "
+              << (pollThreads > 0 ? std::to_string(pollThreads) + " shared poll threads"
+                                  : std::string("a poll thread each"))
+              << ", " << rate << " messages/sec for " << secs << " secs\n";
+    std::cout << "  threads: " << threads << '\n';
+    std::cout << "  RSS: " << rss << " (" << rssBefore << " before creating the documents)\n";
+    std::cout << "  CPU: " << std::fixed << std::setprecision(2)
+              << (cpuUs(usageAfter) - cpuUs(usageBefore)) / 1e6 << " secs\n";
+    std::cout << "  context switches: "
+              << (usageAfter.ru_nvcsw - usageBefore.ru_nvcsw) +
+                     (usageAfter.ru_nivcsw - usageBefore.ru_nivcsw)
+              << '\n';
+    std::cout << "  echoed: " << latencies.size() << " of " << sent << '\n';
+    std::cout << "  latency us: p50 " << std::setprecision(1) << percentileUs(latencies, 50)
+              << ", p99 " << percentileUs(latencies, 99) << ", p99.9 "
+              << percentileUs(latencies, 99.9) << ", max " << percentileUs(latencies, 100)
+              << '\n';
+
+    return EX_OK;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -10,8 +10,13 @@
 #pragma once
 
 #include <math.h>
+#include <algorithm>
 #include <chrono>
+#include <cstdint>
 #include <cstring>
+#include <deque>
+#include <limits>
+#include <ostream>
 #include <unordered_map>
 
 #include "Socket.hpp"
@@ -43,7 +48,7 @@ struct Histogram {
         if (ms < maxLowMs)
             _buckets[ms/incLowMs]++;
         else if (ms < maxHighMs)
-            _buckets[(ms - maxLowMs) / maxHighMs]++;
+            _buckets[maxLowMs / incLowMs + (ms - maxLowMs) / incHighMs]++;
         else
             _tooLong++;
         _items++;
@@ -80,13 +85,124 @@ struct Histogram {
     }
 };
 
+/// An HDR-style latency recorder: log-scale buckets, each split into
+/// linear sub-buckets, so every recorded value is kept with a bounded
+/// relative error (~3%) from microseconds to hours, in constant memory.
+struct LatencyRecorder {
+    /// Sub-buckets per power of two; the upper half of these is used
+    /// for each exponent above the linear range.
+    static constexpr size_t SubBucketBits = 6;
+    static constexpr size_t SubBucketCount = size_t(1) << SubBucketBits;
+    static constexpr size_t SubBucketHalf = SubBucketCount / 2;
+    static constexpr size_t NumBuckets = (64 - SubBucketBits + 1) * SubBucketHalf + SubBucketHalf;
+
+    std::vector<uint64_t> _counts;
+    uint64_t _count;
+    uint64_t _minUs;
+    uint64_t _maxUs;
+    double _sumUs;
+
+    LatencyRecorder() :
+        _counts(NumBuckets),
+        _count(0),
+        _minUs(std::numeric_limits<uint64_t>::max()),
+        _maxUs(0),
+        _sumUs(0)
+    {
+    }
+
+    static size_t getIndex(uint64_t us)
+    {
+        if (us < SubBucketCount)
+            return us;
+
+        const size_t msb = 63 - __builtin_clzll(us);
+        const size_t exponent = msb - SubBucketBits + 1;
+        return exponent * SubBucketHalf + (us >> exponent);
+    }
+
+    /// The highest value that is recorded in the same bucket as @index.
+    static uint64_t getUpperBoundUs(size_t index)
+    {
+        if (index < SubBucketCount)
+            return index;
+
+        const size_t exponent = index / SubBucketHalf - 1;
+        const uint64_t sub = index % SubBucketHalf + SubBucketHalf;
+        return ((sub + 1) << exponent) - 1;
+    }
+
+    void addTimeUs(uint64_t us)
+    {
+        _counts[getIndex(us)]++;
+        _count++;
+        _minUs = std::min(_minUs, us);
+        _maxUs = std::max(_maxUs, us);
+        _sumUs += us;
+    }
+
+    template <typename Rep, typename Period>
+    void addTime(const std::chrono::duration<Rep, Period>& duration)
+    {
+        const auto us = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+        addTimeUs(us > 0 ? us : 0);
+    }
+
+    /// Returns the value below which @percentile (0-100) of the recordings fall.
+    uint64_t getPercentileUs(double percentile) const
+    {
+        if (_count == 0)
+            return 0;
+
+        const uint64_t wanted = std::max<uint64_t>(1, ::ceil(percentile / 100 * _count));
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i < NumBuckets; ++i)
+        {
+            cumulative += _counts[i];
+            if (cumulative >= wanted)
+                return std::min(getUpperBoundUs(i), _maxUs);
+        }
+
+        return _maxUs;
+    }
+
+    void dumpJSON(std::ostream& os) const
+    {
+        const auto ms = [](double us) { return us / 1000; };
+        os << "{ \"count\": " << _count;
+        if (_count > 0)
+        {
+            os << ", \"min\": " << ms(_minUs)
+               << ", \"mean\": " << ms(_sumUs / _count)
+               << ", \"p50\": " << ms(getPercentileUs(50))
+               << ", \"p90\": " << ms(getPercentileUs(90))
+               << ", \"p99\": " << ms(getPercentileUs(99))
+               << ", \"p999\": " << ms(getPercentileUs(99.9))
+               << ", \"max\": " << ms(_maxUs);
+        }
+        os << " }";
+    }
+
+    void dump(const char *legend) const
+    {
+        if (_count == 0)
+            return;
+
+        std::cout << legend << " " << _count << " items, ms p50: " << getPercentileUs(50) / 1000.0
+                  << " p90: " << getPercentileUs(90) / 1000.0
+                  << " p99: " << getPercentileUs(99) / 1000.0
+                  << " max: " << _maxUs / 1000.0 << "\n";
+    }
+};
+
 struct Stats {
     Stats() :
         _start(std::chrono::steady_clock::now()),
         _bytesSent(0),
         _bytesRecvd(0),
         _tileCount(0),
-        _connections(0)
+        _connections(0),
+        _reconnects(0)
     {
     }
     std::chrono::steady_clock::time_point _start;
@@ -94,9 +210,17 @@ struct Stats {
     size_t _bytesRecvd;
     size_t _tileCount;
     size_t _connections;
+    size_t _reconnects;
     Histogram _pingLatency;
     Histogram _tileLatency;
 
+    /// From sending tile or tilecombine to receiving that tile.
+    LatencyRecorder _tileRoundTrip;
+    /// From sending a key to the next invalidatetiles.
+    LatencyRecorder _keyToInvalidate;
+    /// From sending load to the first status.
+    LatencyRecorder _loadTime;
+
     // message size breakdown
     struct MessageStat {
         size_t size;
@@ -164,6 +288,9 @@ struct Stats {
         std::cout << "  tiles: " << _tileCount << " => TPS: " << ((_tileCount * 1000.0)/runMs) << "\n";
         _pingLatency.dump("ping latency:");
         _tileLatency.dump("tile latency:");
+        _tileRoundTrip.dump("tile round trip:");
+        _keyToInvalidate.dump("keystroke to invalidate:");
+        _loadTime.dump("load time:");
         size_t recvKbps = (_bytesRecvd * 1000) / (_connections * runMs * 1024);
         size_t sentKbps = (_bytesSent * 1000) / (_connections * runMs * 1024);
         std::cout << "  we sent " << Util::getHumanizedBytes(_bytesSent) <<
@@ -177,6 +304,30 @@ struct Stats {
         std::cout << "server sent us:\n";
         dumpMap(_recvd);
     }
+
+    /// Writes a machine-readable report, for comparing runs. @config is
+    /// a JSON object describing the run parameters.
+    void dumpJSON(std::ostream& os, const std::string& config) const
+    {
+        const auto now = std::chrono::steady_clock::now();
+        const size_t runMs = std::chrono::duration_cast<std::chrono::milliseconds>(now - _start).count();
+        os << "{\n  \"config\": " << config << ",\n"
+           << "  \"durationMs\": " << runMs << ",\n"
+           << "  \"connections\": " << _connections << ",\n"
+           << "  \"reconnects\": " << _reconnects << ",\n"
+           << "  \"tiles\": " << _tileCount << ",\n"
+           << "  \"tilesPerSecond\": " << (runMs ? (_tileCount * 1000.0) / runMs : 0) << ",\n"
+           << "  \"bytesSent\": " << _bytesSent << ",\n"
+           << "  \"bytesReceived\": " << _bytesRecvd << ",\n"
+           << "  \"latencyMs\": {\n"
+           << "    \"tileRoundTrip\": ";
+        _tileRoundTrip.dumpJSON(os);
+        os << ",\n    \"keystrokeToInvalidate\": ";
+        _keyToInvalidate.dumpJSON(os);
+        os << ",\n    \"load\": ";
+        _loadTime.dumpJSON(os);
+        os << "\n  }\n}\n";
+    }
 };
 
 // Avoid a MessageHandler for now.
@@ -195,18 +346,34 @@ class StressSocketHandler : public WebSocketHandler
     std::shared_ptr<Stats> _stats;
     std::chrono::steady_clock::time_point _lastTile;
 
+    /// Scales the time between trace events, ie. the think-time.
+    double _thinkScale;
+    /// The part of the trace to replay.
+    TraceFileFilter _filter;
+    /// When we requested each outstanding tile, by tile ID.
+    std::unordered_map<std::string, std::chrono::steady_clock::time_point> _tileRequests;
+    /// When we sent each key not yet followed by an invalidation.
+    std::deque<std::chrono::steady_clock::time_point> _keysSent;
+    /// When we sent load, if we didn't get a status yet.
+    std::chrono::steady_clock::time_point _loadSent;
+    bool _loading;
+
 public:
     StressSocketHandler(SocketPoll &poll, /* bad style */
                         const std::shared_ptr<Stats> stats,
                         const std::string &uri, const std::string &trace,
-                        const int delayMs = 0) :
+                        const int delayMs = 0, const double thinkScale = 1.0,
+                        const TraceFileFilter& filter = TraceFileFilter()) :
         WebSocketHandler(true, true),
         _poll(poll),
-        _reader(trace),
+        _reader(trace, filter),
         _connecting(true),
         _uri(uri),
         _trace(trace),
-        _stats(stats)
+        _stats(stats),
+        _thinkScale(thinkScale),
+        _filter(filter),
+        _loading(false)
     {
         static std::atomic<int> number;
         _logPre = "[" + std::to_string(++number) + "] ";
@@ -245,7 +412,7 @@ public:
         int64_t nextTime = -1;
         while (nextTime <= 0) {
             nextTime = std::chrono::duration_cast<std::chrono::microseconds>(
-                std::chrono::microseconds((_next.getTimestampUs() - _reader.getEpochStart()) * TRACE_MULTIPLIER)
+                std::chrono::microseconds((int64_t)((_next.getTimestampUs() - _reader.getEpochStart()) * TRACE_MULTIPLIER * _thinkScale))
                 + _start - now).count();
             if (nextTime <= 0)
             {
@@ -306,6 +473,7 @@ public:
         if (!msg.empty())
         {
             std::cerr << _logPre << "Send: '" << msg << "'\n";
+            trackRequest(msg);
             sendMessage(msg);
         }
 
@@ -316,6 +484,32 @@ public:
         }
     }
 
+    /// Note the time of requests whose latency we measure.
+    void trackRequest(const std::string &msg)
+    {
+        if (!_stats)
+            return;
+
+        const auto now = std::chrono::steady_clock::now();
+        const std::string firstLine = LOOLProtocol::getFirstLine(msg);
+        StringVector tokens = StringVector::tokenize(firstLine);
+
+        if (tokens.equals(0, "tile"))
+            _tileRequests.emplace(TileDesc::parse(tokens).generateID(), now);
+        else if (tokens.equals(0, "tilecombine"))
+        {
+            for (const TileDesc& desc : TileCombined::parse(tokens).getTiles())
+                _tileRequests.emplace(desc.generateID(), now);
+        }
+        else if (tokens.equals(0, "key"))
+            _keysSent.push_back(now);
+        else if (tokens.equals(0, "load"))
+        {
+            _loadSent = now;
+            _loading = true;
+        }
+    }
+
     std::string rewriteMessage(const std::string &msg)
     {
         const std::string firstLine = LOOLProtocol::getFirstLine(msg);
@@ -353,19 +547,38 @@ public:
         _stats->accumulateRecv(tokens[0], data.size());
 
         if (tokens.equals(0, "tile:")) {
+            // eg. tileprocessed tile=0:9216:0:3072:3072:0
+            TileDesc desc = TileDesc::parse(tokens);
+
             // accumulate latencies
             if (_stats) {
                 _stats->_tileLatency.addTime(std::chrono::duration_cast<std::chrono::milliseconds>(now - _lastTile).count());
                 _stats->_tileCount++;
+
+                auto it = _tileRequests.find(desc.generateID());
+                if (it != _tileRequests.end())
+                {
+                    _stats->_tileRoundTrip.addTime(now - it->second);
+                    _tileRequests.erase(it);
+                }
             }
             _lastTile = now;
 
-            // eg. tileprocessed tile=0:9216:0:3072:3072:0
-            TileDesc desc = TileDesc::parse(tokens);
-
             sendMessage("tileprocessed tile=" + desc.generateID());
             std::cerr << _logPre << "Sent tileprocessed tile= " + desc.generateID() << "\n";
-        } if (tokens.equals(0, "error:")) {
+        } else if (tokens.equals(0, "invalidatetiles:")) {
+            // One invalidation may well cover several keystrokes.
+            if (_stats)
+            {
+                for (const auto& sent : _keysSent)
+                    _stats->_keyToInvalidate.addTime(now - sent);
+            }
+            _keysSent.clear();
+        } else if (tokens.equals(0, "status:")) {
+            if (_stats && _loading)
+                _stats->_loadTime.addTime(now - _loadSent);
+            _loading = false;
+        } else if (tokens.equals(0, "error:")) {
 
             bool reconnect = false;
             if (firstLine == "error: cmd=load kind=docunloading")
@@ -389,8 +602,10 @@ public:
             if (reconnect)
             {
                 shutdown(true, "bye");
+                if (_stats)
+                    _stats->_reconnects++;
                 auto handler = std::make_shared<StressSocketHandler>(
-                    _poll, _stats, _uri, _trace, 1000 /* delay 1 second */);
+                    _poll, _stats, _uri, _trace, 1000 /* delay 1 second */, _thinkScale, _filter);
                 _poll.insertNewWebSocketSync(Poco::URI(_uri), handler);
                 return;
             }
@@ -411,7 +626,9 @@ public:
 
     static void addPollFor(SocketPoll &poll, const std::string &server,
                            const std::string &filePath, const std::string &tracePath,
-                           const std::shared_ptr<Stats> &optStats = nullptr)
+                           const std::shared_ptr<Stats> &optStats = nullptr,
+                           const double thinkScale = 1.0,
+                           const TraceFileFilter& filter = TraceFileFilter())
     {
         std::string file, wrap;
         std::string fileabs = Poco::Path(filePath).makeAbsolute().toString();
@@ -419,7 +636,8 @@ public:
         Poco::URI::encode(file, ":/?", wrap); // double encode.
         std::string uri = server + "/lool/" + wrap + "/ws";
 
-        auto handler = std::make_shared<StressSocketHandler>(poll, optStats, file, tracePath);
+        auto handler = std::make_shared<StressSocketHandler>(poll, optStats, file, tracePath,
+                                                             0, thinkScale, filter);
         poll.insertNewWebSocketSync(Poco::URI(uri), handler);
 
         if (optStats)
@@ -0,0 +1,307 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Benchmarks our server SslContext over loopback: the handshakes per second,
+ * full and resumed with tickets or from the session cache, and the
+ * throughput of sending tile-sized writes, encrypted by OpenSSL or the kernel.
+ */
+
+#include <config.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <common/Log.hpp>
+#include <net/Ssl.hpp>
+
+namespace
+{
+constexpr const char* CipherList = "ALL:!ADH:!LOW:!EXP:!MD5:@STRENGTH";
+constexpr std::size_t FrameSize = 64 * 1024;
+constexpr std::size_t BulkBytes = 512 * 1024 * 1024;
+
+/// Whether the server connections had the kernel encrypt.
+std::atomic<bool> ServerKernelTls(false);
+
+/// Serves the connections one at a time until @listenFd is shut down.
+/// Each connection sends a command byte: 'b' for bulk data, anything else for an ack.
+void serve(int listenFd, SslContext& context)
+{
+    const std::vector<char> frame(FrameSize, 'x');
+    for (;;)
+    {
+        const int fd = accept(listenFd, nullptr, nullptr);
+        if (fd < 0)
+            return;
+
+        SSL* ssl = context.newSsl();
+        SSL_set_fd(ssl, fd);
+        char command = 0;
+        if (SSL_accept(ssl) == 1 && SSL_read(ssl, &command, 1) == 1)
+        {
+#ifdef SSL_OP_ENABLE_KTLS
+            ServerKernelTls = BIO_get_ktls_send(SSL_get_wbio(ssl));
+#endif
+            if (command == 'b')
+            {
+                for (std::size_t sent = 0; sent < BulkBytes;)
+                {
+                    const int len = SSL_write(ssl, frame.data(), frame.size());
+                    if (len <= 0)
+                        break;
+                    sent += len;
+                }
+            }
+            else
+                SSL_write(ssl, "k", 1);
+        }
+
+        SSL_shutdown(ssl);
+        SSL_free(ssl);
+        close(fd);
+    }
+}
+
+/// Connects to @port and completes a handshake, resuming @session if given.
+/// Returns nullptr on failure.
+SSL* connectTo(int port, SslContext& context, SSL_SESSION* session)
+{
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    const int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0)
+    {
+        close(fd);
+        return nullptr;
+    }
+
+    SSL* ssl = context.newSsl();
+    SSL_set_fd(ssl, fd);
+    if (session)
+        SSL_set_session(ssl, session);
+
+    if (SSL_connect(ssl) != 1)
+    {
+        SSL_free(ssl);
+        close(fd);
+        return nullptr;
+    }
+
+    return ssl;
+}
+
+void disconnect(SSL* ssl)
+{
+    const int fd = SSL_get_fd(ssl);
+    SSL_shutdown(ssl);
+    SSL_free(ssl);
+    close(fd);
+}
+
+/// Runs the server with @settings for the duration of the object.
+class Server
+{
+public:
+    Server(const std::string& certFile, const std::string& keyFile,
+           const ssl::SessionSettings& settings)
+        : _context(certFile, keyFile, "", CipherList, ssl::CertificateVerification::Disabled,
+                   settings)
+        , _listenFd(socket(AF_INET, SOCK_STREAM, 0))
+        , _port(0)
+    {
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(addr);
+        if (bind(_listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+            listen(_listenFd, 64) != 0 ||
+            getsockname(_listenFd, reinterpret_cast<sockaddr*>(&addr), &len) != 0)
+            throw std::runtime_error("Failed to listen on the loopback");
+
+        _port = ntohs(addr.sin_port);
+        _thread = std::thread([this]() { serve(_listenFd, _context); });
+    }
+
+    ~Server()
+    {
+        // Wakes up accept().
+        shutdown(_listenFd, SHUT_RDWR);
+        _thread.join();
+        close(_listenFd);
+    }
+
+    int getPort() const { return _port; }
+
+    const SslContext& getContext() const { return _context; }
+
+private:
+    SslContext _context;
+    const int _listenFd;
+    int _port;
+    std::thread _thread;
+};
+
+/// Handshakes repeatedly for @seconds, resuming the last session if @resume.
+void benchHandshakes(const std::string& name, const std::string& certFile,
+                     const std::string& keyFile, const ssl::SessionSettings& settings,
+                     bool resume, double seconds)
+{
+    Server server(certFile, keyFile, settings);
+    SslContext client("", "", "", CipherList, ssl::CertificateVerification::Disabled);
+
+    SSL_SESSION* session = nullptr;
+    std::size_t count = 0;
+    std::size_t failed = 0;
+    const auto start = std::chrono::steady_clock::now();
+    double secs = 0;
+    while (secs < seconds)
+    {
+        SSL* ssl = connectTo(server.getPort(), client, session);
+        char ack = 0;
+        if (ssl && SSL_write(ssl, "h", 1) == 1 && SSL_read(ssl, &ack, 1) == 1)
+        {
+            // With TLS 1.3 the tickets only come after the handshake, hence the ack.
+            ++count;
+            if (resume)
+            {
+                SSL_SESSION_free(session);
+                session = SSL_get1_session(ssl);
+            }
+        }
+        else
+            ++failed;
+
+        if (ssl)
+            disconnect(ssl);
+
+        secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    SSL_SESSION_free(session);
+
+    const long accepted = server.getContext().getAcceptCount();
+    std::cout << std::setw(16) << name << std::setw(14) << std::fixed << std::setprecision(0)
+              << count / secs << std::setw(10) << std::setprecision(1)
+              << (accepted ? 100.0 * server.getContext().getResumedCount() / accepted : 0)
+              << std::setw(10) << failed << '\n';
+}
+
+/// Receives BulkBytes sent in tile-sized writes.
+void benchThroughput(const std::string& name, const std::string& certFile,
+                     const std::string& keyFile, const ssl::SessionSettings& settings)
+{
+    Server server(certFile, keyFile, settings);
+    SslContext client("", "", "", CipherList, ssl::CertificateVerification::Disabled);
+
+    ServerKernelTls = false;
+    SSL* ssl = connectTo(server.getPort(), client, nullptr);
+    if (!ssl || SSL_write(ssl, "b", 1) != 1)
+    {
+        std::cout << std::setw(16) << name << "  failed to connect\n";
+        if (ssl)
+            disconnect(ssl);
+        return;
+    }
+
+    std::vector<char> buf(FrameSize);
+    std::size_t received = 0;
+    const auto start = std::chrono::steady_clock::now();
+    while (received < BulkBytes)
+    {
+        const int len = SSL_read(ssl, buf.data(), buf.size());
+        if (len <= 0)
+            break;
+        received += len;
+    }
+    const double secs =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    disconnect(ssl);
+
+    std::cout << std::setw(16) << name << std::setw(14) << std::fixed << std::setprecision(1)
+              << (secs > 0 ? received / secs / (1024 * 1024) : 0) << std::setw(10)
+              << (ServerKernelTls ? "yes" : "no") << '\n';
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        std::cerr << "Usage: loolsslbench <cert.pem> <key.pem> [<seconds>]\n"
+                  << "       Runs each handshake benchmark for the given seconds (default 5).\n"
+                  << "       kTLS needs OpenSSL 3 and the tls kernel module (modprobe tls).\n";
+        return EX_USAGE;
+    }
+
+    Log::initialize("loolsslbench", "warning", false, false, std::map<std::string, std::string>());
+
+    const std::string certFile = argv[1];
+    const std::string keyFile = argv[2];
+    const double seconds = argc > 3 ? std::atof(argv[3]) : 5;
+
+    try
+    {
+        std::cout << std::setw(16) << "handshakes" << std::setw(14) << "per second"
+                  << std::setw(10) << "resumed %" << std::setw(10) << "failed" << '\n';
+
+        ssl::SessionSettings full;
+        full._tickets = false;
+        benchHandshakes("full", certFile, keyFile, full, false, seconds);
+
+        ssl::SessionSettings tickets;
+        benchHandshakes("tickets", certFile, keyFile, tickets, true, seconds);
+
+        ssl::SessionSettings cache;
+        cache._cacheSize = 20480;
+        cache._tickets = false;
+        benchHandshakes("session cache", certFile, keyFile, cache, true, seconds);
+
+        std::cout << '\n'
+                  << std::setw(16) << "throughput" << std::setw(14) << "MB/s" << std::setw(10)
+                  << "kTLS" << '\n';
+
+        ssl::SessionSettings userSpace;
+        benchThroughput("openssl", certFile, keyFile, userSpace);
+
+        ssl::SessionSettings kernel;
+        kernel._kernelTls = true;
+        benchThroughput("kernel", certFile, keyFile, kernel);
+    }
+    catch (const std::exception& exc)
+    {
+        std::cerr << "Failed: " << exc.what() << '\n';
+        return EX_SOFTWARE;
+    }
+
+    return EX_OK;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
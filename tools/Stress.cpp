@@ -10,11 +10,17 @@
 
 #include <sysexits.h>
 
+#include <algorithm>
+#include <fstream>
+#include <random>
+#include <sstream>
+
 #include <Poco/Util/Application.h>
 #include <Poco/Util/Option.h>
 #include <Poco/Util/OptionSet.h>
 
 #include "Replay.hpp"
+#include <common/FileUtil.hpp>
 // #include <test/helpers.hpp>
 
 int ClientPortNumber = DEFAULT_CLIENT_PORT_NUMBER;
@@ -23,12 +29,47 @@ int ClientPortNumber = DEFAULT_CLIENT_PORT_NUMBER;
 class Stress: public Poco::Util::Application
 {
 public:
-    Stress() {}
+    Stress() :
+        _docCount(0),
+        _userCount(1),
+        _rampUpSecs(0),
+        _arrivalRate(0),
+        _thinkScale(1.0),
+        _seed(1)
+    {
+    }
 protected:
     void defineOptions(Poco::Util::OptionSet& options) override;
     void printHelp();
     void handleOption(const std::string& name, const std::string& value) override;
     int  main(const std::vector<std::string>& args) override;
+
+private:
+    /// One user replaying a trace against a document.
+    struct Session
+    {
+        std::chrono::milliseconds _start;
+        std::string _doc;
+        std::string _trace;
+    };
+
+    std::vector<Session> createSessions(const std::vector<std::string>& args,
+                                        const std::string& docDir);
+    std::string getConfigJSON(const std::vector<std::string>& args) const;
+
+    /// Documents to load, as copies of the given ones; 0 to use them directly.
+    size_t _docCount;
+    /// Concurrent users per document.
+    size_t _userCount;
+    /// Seconds over which to spread the session starts.
+    double _rampUpSecs;
+    /// Session arrivals per second, as a Poisson process; 0 for ramp-up.
+    double _arrivalRate;
+    double _thinkScale;
+    unsigned _seed;
+    std::string _reportPath;
+    /// The part of the traces to replay.
+    TraceFileFilter _traceFilter;
 };
 
 void Stress::defineOptions(Poco::Util::OptionSet& optionSet)
@@ -37,6 +78,36 @@ void Stress::defineOptions(Poco::Util::OptionSet& optionSet)
 
     optionSet.addOption(Poco::Util::Option("help", "", "Display help information on command line arguments.")
                         .required(false).repeatable(false));
+    optionSet.addOption(Poco::Util::Option("docs", "", "Number of documents to load, as copies of the given ones.")
+                        .required(false).repeatable(false)
+                        .argument("count"));
+    optionSet.addOption(Poco::Util::Option("users", "", "Number of concurrent users per document.")
+                        .required(false).repeatable(false)
+                        .argument("count"));
+    optionSet.addOption(Poco::Util::Option("ramp-up", "", "Seconds over which to start the users evenly.")
+                        .required(false).repeatable(false)
+                        .argument("seconds"));
+    optionSet.addOption(Poco::Util::Option("arrival-rate", "", "Start users at this mean rate per second, open-loop.")
+                        .required(false).repeatable(false)
+                        .argument("rate"));
+    optionSet.addOption(Poco::Util::Option("think-scale", "", "Scale the time between trace events by this factor.")
+                        .required(false).repeatable(false)
+                        .argument("factor"));
+    optionSet.addOption(Poco::Util::Option("seed", "", "Seed for the arrival times.")
+                        .required(false).repeatable(false)
+                        .argument("number"));
+    optionSet.addOption(Poco::Util::Option("report", "", "Write a JSON report to this file, - for stdout.")
+                        .required(false).repeatable(false)
+                        .argument("path"));
+    optionSet.addOption(Poco::Util::Option("trace-from", "", "Replay the traces from this many seconds in.")
+                        .required(false).repeatable(false)
+                        .argument("seconds"));
+    optionSet.addOption(Poco::Util::Option("trace-to", "", "Replay the traces up to this many seconds in.")
+                        .required(false).repeatable(false)
+                        .argument("seconds"));
+    optionSet.addOption(Poco::Util::Option("trace-session", "", "Replay only this session of the traces.")
+                        .required(false).repeatable(false)
+                        .argument("id"));
 }
 
 void Stress::handleOption(const std::string& optionName,
@@ -49,6 +120,26 @@ void Stress::handleOption(const std::string& optionName,
         printHelp();
         Util::forcedExit(EX_OK);
     }
+    else if (optionName == "docs")
+        _docCount = std::stoul(value);
+    else if (optionName == "users")
+        _userCount = std::max<size_t>(1, std::stoul(value));
+    else if (optionName == "ramp-up")
+        _rampUpSecs = std::max(0.0, std::stod(value));
+    else if (optionName == "arrival-rate")
+        _arrivalRate = std::max(0.0, std::stod(value));
+    else if (optionName == "think-scale")
+        _thinkScale = std::max(0.0, std::stod(value));
+    else if (optionName == "seed")
+        _seed = std::stoul(value);
+    else if (optionName == "report")
+        _reportPath = value;
+    else if (optionName == "trace-from")
+        _traceFilter._fromUs = static_cast<int64_t>(std::stod(value) * 1000000);
+    else if (optionName == "trace-to")
+        _traceFilter._toUs = static_cast<int64_t>(std::stod(value) * 1000000);
+    else if (optionName == "trace-session")
+        _traceFilter._sessionId = value;
     else
     {
         std::cout << "Unknown option: " << optionName << std::endl;
@@ -59,10 +150,83 @@ void Stress::handleOption(const std::string& optionName,
 void Stress::printHelp()
 {
     std::cerr << "Usage: loolstress wss://localhost:9980 <test-document-path> <trace-path> " << std::endl;
-    std::cerr << "       Trace files may be plain text or gzipped (with .gz extension)." << std::endl;
+    std::cerr << "       Trace files may be plain text, gzipped (with .gz extension), or chunked." << std::endl;
+    std::cerr << "       --docs=<M>         load M copies of the documents, round-robin." << std::endl;
+    std::cerr << "       --users=<K>        replay K concurrent users per document." << std::endl;
+    std::cerr << "       --ramp-up=<secs>   start the users evenly over this time." << std::endl;
+    std::cerr << "       --arrival-rate=<r> start users at r per second (Poisson), open-loop." << std::endl;
+    std::cerr << "       --think-scale=<f>  scale the time between trace events, eg. 0.5 is twice as fast." << std::endl;
+    std::cerr << "       --seed=<n>         seed for the arrival times." << std::endl;
+    std::cerr << "       --report=<path>    write a JSON report with latency percentiles, - for stdout." << std::endl;
+    std::cerr << "       --trace-from=<secs>, --trace-to=<secs>" << std::endl;
+    std::cerr << "                          replay the part of the traces in this time range." << std::endl;
+    std::cerr << "       --trace-session=<id> replay only this session of the traces." << std::endl;
+    std::cerr << "       Chunked traces only read the parts replayed, text ones are read whole." << std::endl;
     std::cerr << "       --help for full arguments list." << std::endl;
 }
 
+std::vector<Stress::Session> Stress::createSessions(const std::vector<std::string>& args,
+                                                    const std::string& docDir)
+{
+    // The document and trace pairs.
+    std::vector<std::pair<std::string, std::string>> pairs;
+    for (size_t i = 1; i < args.size() - 1; i += 2)
+        pairs.emplace_back(args[i], args[i + 1]);
+
+    if (pairs.empty())
+        return std::vector<Session>();
+
+    // Each user of a document replays the trace of the pair it was copied from,
+    // so the trace always matches the document type.
+    std::vector<Session> sessions;
+    const size_t docCount = _docCount ? _docCount : pairs.size();
+    for (size_t i = 0; i < docCount; ++i)
+    {
+        const auto& pair = pairs[i % pairs.size()];
+        std::string doc = pair.first;
+        if (_docCount)
+        {
+            doc = docDir + "/stress-" + std::to_string(i) + '-' + Poco::Path(pair.first).getFileName();
+            FileUtil::copyFileTo(pair.first, doc);
+        }
+
+        for (size_t user = 0; user < _userCount; ++user)
+            sessions.push_back({ std::chrono::milliseconds(0), doc, pair.second });
+    }
+
+    // Interleave the users of different documents, then schedule the starts.
+    std::mt19937 rng(_seed);
+    std::shuffle(sessions.begin(), sessions.end(), rng);
+
+    std::exponential_distribution<double> interArrival(_arrivalRate > 0 ? _arrivalRate : 1);
+    double startSecs = 0;
+    for (size_t i = 0; i < sessions.size(); ++i)
+    {
+        if (_arrivalRate > 0)
+            startSecs += interArrival(rng);
+        else
+            startSecs = _rampUpSecs * i / sessions.size();
+
+        sessions[i]._start = std::chrono::milliseconds(static_cast<int64_t>(startSecs * 1000));
+    }
+
+    return sessions;
+}
+
+std::string Stress::getConfigJSON(const std::vector<std::string>& args) const
+{
+    std::ostringstream oss;
+    oss << "{ \"server\": \"" << args[0] << "\""
+        << ", \"traces\": " << (args.size() - 1) / 2
+        << ", \"docs\": " << _docCount
+        << ", \"users\": " << _userCount
+        << ", \"rampUpSecs\": " << _rampUpSecs
+        << ", \"arrivalRate\": " << _arrivalRate
+        << ", \"thinkScale\": " << _thinkScale
+        << ", \"seed\": " << _seed << " }";
+    return oss.str();
+}
+
 int Stress::main(const std::vector<std::string>& args)
 {
     if (args.empty())
@@ -94,18 +258,54 @@ int Stress::main(const std::vector<std::string>& args)
         return -1;
     }
 
-    auto stats = std::make_shared<Stats>();
+    const std::string docDir = _docCount ? FileUtil::createRandomTmpDir() : std::string();
+    const std::vector<Session> sessions = createSessions(args, docDir);
 
-    std::cerr << "Connect to " << server << "\n";
-    for (size_t i = 1; i < args.size() - 1; i += 2)
-        StressSocketHandler::addPollFor(poll, server, args[i], args[i+1], stats);
+    auto stats = std::make_shared<Stats>();
 
+    std::cerr << "Connect to " << server << " with " << sessions.size() << " users\n";
+    const auto start = std::chrono::steady_clock::now();
+    size_t nextSession = 0;
     do {
-        poll.poll(TerminatingPoll::DefaultPollTimeoutMicroS);
-    } while (poll.continuePolling() && poll.getSocketCount() > 0);
+        const auto now = std::chrono::steady_clock::now();
+        for (; nextSession < sessions.size() && start + sessions[nextSession]._start <= now;
+             ++nextSession)
+        {
+            const Session& session = sessions[nextSession];
+            StressSocketHandler::addPollFor(poll, server, session._doc, session._trace, stats,
+                                            _thinkScale, _traceFilter);
+        }
+
+        std::chrono::microseconds timeout = TerminatingPoll::DefaultPollTimeoutMicroS;
+        if (nextSession < sessions.size())
+        {
+            const auto untilNext = std::chrono::duration_cast<std::chrono::microseconds>(
+                start + sessions[nextSession]._start - now);
+            timeout = std::max(std::chrono::microseconds(0), std::min(timeout, untilNext));
+        }
+
+        poll.poll(timeout);
+    } while (poll.continuePolling() && (poll.getSocketCount() > 0 || nextSession < sessions.size()));
 
     stats->dump();
 
+    if (!_reportPath.empty())
+    {
+        const std::string config = getConfigJSON(args);
+        if (_reportPath == "-")
+            stats->dumpJSON(std::cout, config);
+        else
+        {
+            std::ofstream report(_reportPath);
+            stats->dumpJSON(report, config);
+            if (!report)
+                std::cerr << "Failed to write report to " << _reportPath << "\n";
+        }
+    }
+
+    if (!docDir.empty())
+        FileUtil::removeFile(docDir, true);
+
     return EX_OK;
 }
 
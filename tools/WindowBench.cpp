@@ -0,0 +1,231 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Benchmarks encoding dialog and sidebar window paints, as ChildSession::renderWindow
+ * does on every interaction, with WindowDeltaEncoder against a PNG of the whole window.
+ * The windows are drawn here, standing in for paintWindow: typing into a dialog
+ * field, hovering over the buttons of a sidebar, and scrolling a list box.
+ */
+
+#include <config.h>
+
+#include <sysexits.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#define LOK_USE_UNSTABLE_API
+#include <LibreOfficeKit/LibreOfficeKitEnums.h>
+
+#include <common/Log.hpp>
+#include <common/Png.hpp>
+#include <kit/Delta.hpp>
+
+namespace
+{
+constexpr uint32_t Background = 0xffefefef;
+constexpr uint32_t Frame = 0xff8c8c8c;
+constexpr uint32_t Field = 0xffffffff;
+constexpr uint32_t Text = 0xff202020;
+constexpr uint32_t Highlight = 0xffcde8ff;
+
+/// A window bitmap, premultiplied BGRA as paintWindow gives us.
+class Window
+{
+public:
+    Window(int width, int height)
+        : _width(width)
+        , _height(height)
+        , _pixels(width * height, Background)
+    {
+    }
+
+    int getWidth() const { return _width; }
+    int getHeight() const { return _height; }
+    unsigned char* data() { return reinterpret_cast<unsigned char*>(_pixels.data()); }
+
+    void fill(int x, int y, int width, int height, uint32_t color)
+    {
+        for (int row = std::max(0, y); row < std::min(_height, y + height); ++row)
+        {
+            for (int col = std::max(0, x); col < std::min(_width, x + width); ++col)
+                _pixels[row * _width + col] = color;
+        }
+    }
+
+    void frame(int x, int y, int width, int height)
+    {
+        fill(x, y, width, 1, Frame);
+        fill(x, y + height - 1, width, 1, Frame);
+        fill(x, y, 1, height, Frame);
+        fill(x + width - 1, y, 1, height, Frame);
+    }
+
+    /// A glyph-like pattern, different for each @seed.
+    void glyph(int x, int y, int seed)
+    {
+        for (int row = 0; row < 12; ++row)
+        {
+            for (int col = 0; col < 7; ++col)
+            {
+                if (((row * 7 + col) * 2654435761u + seed * 40503u) % 5 < 2)
+                    fill(x + col, y + row, 1, 1, Text);
+            }
+        }
+    }
+
+    /// A line of text of @length glyphs.
+    void text(int x, int y, int length, int seed)
+    {
+        for (int i = 0; i < length; ++i)
+            glyph(x + i * 8, y, seed + i);
+    }
+
+private:
+    const int _width;
+    const int _height;
+    std::vector<uint32_t> _pixels;
+};
+
+/// Draws a dialog with a few fields, @typed characters into the first one.
+void drawDialog(Window& window, int typed)
+{
+    window.fill(0, 0, window.getWidth(), window.getHeight(), Background);
+    for (int i = 0; i < 8; ++i)
+    {
+        const int y = 40 + i * 56;
+        window.text(24, y + 6, 10, i * 31);
+        window.fill(180, y, 420, 24, Field);
+        window.frame(180, y, 420, 24);
+        if (i > 0)
+            window.text(186, y + 6, 20, i * 57);
+    }
+
+    window.text(186, 46, typed, 1000);
+    window.fill(186 + typed * 8, 44, 1, 16, Text); // The cursor.
+
+    for (int i = 0; i < 3; ++i)
+    {
+        window.frame(window.getWidth() - 3 * 110 + i * 100, window.getHeight() - 44, 90, 28);
+        window.text(window.getWidth() - 3 * 110 + i * 100 + 12, window.getHeight() - 36, 8, i);
+    }
+}
+
+/// Draws a sidebar with buttons, the mouse over @hovered.
+void drawSidebar(Window& window, int hovered)
+{
+    window.fill(0, 0, window.getWidth(), window.getHeight(), Background);
+    for (int i = 0; i < 24; ++i)
+    {
+        const int y = 12 + i * 36;
+        if (i == hovered)
+            window.fill(8, y, window.getWidth() - 16, 30, Highlight);
+        window.fill(16, y + 7, 16, 16, Frame); // The icon.
+        window.text(44, y + 9, 24, i * 13);
+    }
+}
+
+/// Draws a list box scrolled by @scrolled lines.
+void drawList(Window& window, int scrolled)
+{
+    window.fill(0, 0, window.getWidth(), window.getHeight(), Field);
+    for (int i = 0; i < window.getHeight() / 18 + 1; ++i)
+        window.text(8, i * 18 + 3, 40, (i + scrolled) * 7);
+    window.frame(0, 0, window.getWidth(), window.getHeight());
+}
+
+struct Result
+{
+    std::size_t _bytes = 0;
+    double _secs = 0;
+};
+
+/// Paints the window with @draw for each of the @steps of an interaction, and encodes each paint.
+void run(const std::string& name, Window& window, int steps,
+         const std::function<void(Window&, int)>& draw)
+{
+    Result png;
+    Result delta;
+    WindowDeltaEncoder encoder(100);
+    std::vector<char> output;
+    std::vector<std::size_t> sizes;
+    for (int step = 0; step < steps; ++step)
+    {
+        draw(window, step);
+
+        output.clear();
+        auto start = std::chrono::steady_clock::now();
+        Png::encodeSubBufferToPNG(window.data(), 0, 0, window.getWidth(), window.getHeight(),
+                                  window.getWidth(), window.getHeight(), output,
+                                  LOK_TILEMODE_BGRA);
+        png._secs +=
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        png._bytes += output.size();
+
+        output.clear();
+        sizes.clear();
+        start = std::chrono::steady_clock::now();
+        encoder.encode(1, 0, 0, window.getWidth(), window.getHeight(), window.data(), output,
+                       sizes);
+        delta._secs +=
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        // The sizes of the cells go in the message.
+        delta._bytes += output.size() + sizes.size() * 4;
+    }
+
+    for (const auto& pair : { std::make_pair("png", png), std::make_pair("delta", delta) })
+    {
+        std::cout << std::setw(16) << name << std::setw(8) << pair.first << std::setw(14)
+                  << pair.second._bytes / steps << std::setw(14) << std::fixed
+                  << std::setprecision(1) << pair.second._secs * 1e6 / steps << '\n';
+    }
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+    if (argc > 1 && argv[1][0] == '-')
+    {
+        std::cerr << "Usage: loolwindowbench [<steps>]\n"
+                  << "       Encodes the paints of each interaction, as PNGs and as deltas.\n";
+        return EX_USAGE;
+    }
+
+    Log::initialize("loolwindowbench", "warning", false, false,
+                    std::map<std::string, std::string>());
+
+    const int steps = argc > 1 ? std::max(2, std::atoi(argv[1])) : 40;
+
+    std::cout << std::setw(16) << "interaction" << std::setw(8) << "method" << std::setw(14)
+              << "bytes/paint" << std::setw(14) << "us/paint" << '\n';
+
+    Window dialog(800, 600);
+    run("dialog typing", dialog, steps, drawDialog);
+
+    Window sidebar(320, 900);
+    run("sidebar hover", sidebar, steps, [](Window& window, int step) {
+        drawSidebar(window, step % 24);
+    });
+
+    Window list(400, 300);
+    run("list scroll", list, steps, drawList);
+
+    return EX_OK;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -10,7 +10,10 @@
 #include <chrono>
 #include <config.h>
 
+#include <algorithm>
 #include <cassert>
+#include <cstdlib>
+#include <limits>
 #include <sys/poll.h>
 #include <unistd.h>
 
@@ -136,6 +139,13 @@ void AdminSocketHandler::handleMessage(const std::vector<char> &payload)
             model.subscribe(_sessionId, tokens[i + 1]);
         }
     }
+    else if (tokens.equals(0, "batch") && tokens.size() > 1)
+    {
+        // Batch the notifications every given ms, 0 to stop.
+        const int intervalMs = std::atoi(tokens[1].c_str());
+        const int clampedMs = intervalMs > 0 ? std::min(std::max(intervalMs, 100), 60000) : 0;
+        model.setBatchInterval(_sessionId, std::chrono::milliseconds(clampedMs));
+    }
     else if (tokens.equals(0, "unsubscribe") && tokens.size() > 1)
     {
         for (std::size_t i = 0; i < tokens.size() - 1; i++)
@@ -161,6 +171,9 @@ void AdminSocketHandler::handleMessage(const std::vector<char> &payload)
     else if (tokens.equals(0, "log_lines"))
         sendTextFrame("log_lines " + _admin->getLogLines());
 
+    else if (tokens.equals(0, "prespawn_stats"))
+        sendTextFrame("prespawn_stats " + LOOLWSD::getPreSpawnStats());
+
     else if (tokens.equals(0, "kill") && tokens.size() == 2)
     {
         try
@@ -436,6 +449,8 @@ Admin::Admin() :
 
     LOG_TRC("Total available memory: " << _totalAvailMemKb << " KB (memproportion: " << memLimit << "%).");
 
+    _model.setUseCgroupStats(LOOLWSD::getConfigValue<bool>("admin_console.cgroup_stats", false));
+
     const size_t totalMem = getTotalMemoryUsage();
     LOG_TRC("Total memory used: " << totalMem << " KB.");
     _model.addMemStats(totalMem);
@@ -542,9 +557,17 @@ void Admin::pollingThread()
             }
         }
 
+        // Send the batched notifications that are due.
+        int flushWait = std::numeric_limits<int>::max();
+        const auto nextFlush = _model.flushSubscribers(now);
+        if (nextFlush != std::chrono::steady_clock::time_point::max())
+            flushWait = static_cast<int>(
+                std::chrono::duration_cast<std::chrono::milliseconds>(nextFlush - now).count());
+
         // Handle websockets & other work.
-        const auto timeout = std::chrono::milliseconds(capAndRoundInterval(
-            std::min(std::min(std::min(cpuWait, memWait), netWait), cleanupWait)));
+        const auto timeout = std::chrono::milliseconds(capAndRoundInterval(std::max(
+            0, std::min(std::min(std::min(std::min(cpuWait, memWait), netWait), cleanupWait),
+                        flushWait))));
         LOG_TRC("Admin poll for " << timeout);
         poll(timeout); // continue with ms for admin, settings etc.
     }
@@ -748,11 +771,26 @@ void Admin::setDocWopiUploadDuration(const std::string& docKey, const std::chron
     addCallback([=]{ _model.setDocWopiUploadDuration(docKey, uploadDuration); });
 }
 
+void Admin::setDocDeltaBytes(const std::string& docKey, uint64_t deltaBytes)
+{
+    addCallback([=]{ _model.setDocDeltaBytes(docKey, deltaBytes); });
+}
+
 void Admin::addSegFaultCount(unsigned segFaultCount)
 {
     addCallback([=]{ _model.addSegFaultCount(segFaultCount); });
 }
 
+void Admin::addSkippedUpload(std::uint64_t bytes)
+{
+    addCallback([=]{ _model.addSkippedUpload(bytes); });
+}
+
+void Admin::addKitJailSetupTimes(const std::string& timings)
+{
+    addCallback([=]{ _model.addKitJailSetupTimes(timings); });
+}
+
 void Admin::addLostKitsTerminated(unsigned lostKitsTerminated)
 {
     addCallback([=]{ _model.addLostKitsTerminated(lostKitsTerminated); });
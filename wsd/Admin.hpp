@@ -165,8 +165,13 @@ public:
     void setViewLoadDuration(const std::string& docKey, const std::string& sessionId, std::chrono::milliseconds viewLoadDuration);
     void setDocWopiDownloadDuration(const std::string& docKey, std::chrono::milliseconds wopiDownloadDuration);
     void setDocWopiUploadDuration(const std::string& docKey, const std::chrono::milliseconds uploadDuration);
+    void setDocDeltaBytes(const std::string& docKey, uint64_t deltaBytes);
     void addSegFaultCount(unsigned segFaultCount);
     void addLostKitsTerminated(unsigned lostKitsTerminated);
+    /// An upload skipped because the document saved is identical to the last one uploaded.
+    void addSkippedUpload(std::uint64_t bytes);
+    /// The per-phase jail setup times of a new kit, as "phase:ms,phase:ms,...".
+    void addKitJailSetupTimes(const std::string& timings);
 
     void getMetrics(std::ostringstream &metrics);
 
@@ -11,22 +11,61 @@
 
 #include "AdminModel.hpp"
 
+#include <algorithm>
+#include <cctype>
 #include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <memory>
 #include <set>
 #include <sstream>
 #include <string>
 
+#include <FileUtil.hpp>
+#include <LatencyHistogram.hpp>
 #include <Protocol.hpp>
 #include <net/WebSocketHandler.hpp>
 #include <Log.hpp>
 #include <Unit.hpp>
 #include <Util.hpp>
+#include <wsd/DocumentBroker.hpp>
 #include <wsd/LOOLWSD.hpp>
+#include <wsd/UploadScheduler.hpp>
 #include <wsd/Exceptions.hpp>
+#if ENABLE_SSL
+#  include <Ssl.hpp>
+#endif
 
 #include <fnmatch.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace
+{
+/// Returns the cgroup v2 path of @pid ("self" for us), or empty if not in a v2 hierarchy.
+std::string getCgroupPath(const std::string& pid)
+{
+    std::ifstream cgroup("/proc/" + pid + "/cgroup");
+    std::string line;
+    while (std::getline(cgroup, line))
+    {
+        // The unified hierarchy is "0::/path".
+        if (line.compare(0, 3, "0::") == 0)
+            return line.substr(3);
+    }
+
+    return std::string();
+}
+
+void closeFD(int& fd)
+{
+    if (fd >= 0)
+        ::close(fd);
+    fd = -1;
+}
+}
 
 void Document::addView(const std::string& sessionId, const std::string& userName, const std::string& userId)
 {
@@ -133,18 +172,92 @@ std::string Document::to_string() const
     return oss.str();
 }
 
-void Document::updateMemoryDirty()
+Document::~Document()
+{
+    closeFD(_procSMapsFD);
+    closeFD(_procStatFD);
+    closeFD(_cgroupMemoryFD);
+    closeFD(_cgroupCpuFD);
+}
+
+void Document::setProcSMapsFD(const int smapsFD)
+{
+    closeFD(_procSMapsFD);
+    if (smapsFD >= 0)
+        _procSMapsFD = ::fcntl(smapsFD, F_DUPFD_CLOEXEC, 0);
+}
+
+void Document::openStatFiles(bool useCgroup)
+{
+    if (_pid <= 0)
+        return;
+
+    const std::string pid = std::to_string(_pid);
+    closeFD(_procStatFD);
+    _procStatFD = ::open(("/proc/" + pid + "/stat").c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (!useCgroup)
+        return;
+
+    // Only a cgroup of its own tells us about the Kit alone.
+    const std::string cgroup = getCgroupPath(pid);
+    if (cgroup.empty() || cgroup == getCgroupPath("self"))
+    {
+        LOG_DBG("Kit [" << _pid << "] has no cgroup of its own, sampling /proc instead.");
+        return;
+    }
+
+    const std::string path = "/sys/fs/cgroup" + cgroup;
+    closeFD(_cgroupMemoryFD);
+    closeFD(_cgroupCpuFD);
+    _cgroupMemoryFD = ::open((path + "/memory.current").c_str(), O_RDONLY | O_CLOEXEC);
+    _cgroupCpuFD = ::open((path + "/cpu.stat").c_str(), O_RDONLY | O_CLOEXEC);
+    LOG_DBG("Sampling Kit [" << _pid << "] from cgroup " << path << ": memory "
+                             << (_cgroupMemoryFD >= 0 ? "yes" : "no") << ", cpu "
+                             << (_cgroupCpuFD >= 0 ? "yes" : "no"));
+}
+
+bool Document::updateMemoryDirty()
 {
     // Avoid accessing smaps too often
     const time_t now = std::time(nullptr);
-    if (now - _lastTimeSMapsRead >= 5)
+    if (now - _lastTimeSMapsRead < 5)
+        return false;
+
+    const size_t lastMemDirty = _memoryDirty;
+    static thread_local std::string buffer;
+    if (_cgroupMemoryFD >= 0 && Util::readProcFile(_cgroupMemoryFD, buffer))
+    {
+        // Shared pages are charged to the forkit's cgroup, so this is mostly un-shared.
+        _memoryDirty = std::strtoull(buffer.c_str(), nullptr, 10) / 1024;
+    }
+    else
+        _memoryDirty = Util::getPssAndDirtyFromSMaps(_procSMapsFD).second;
+
+    _lastTimeSMapsRead = now;
+    if (lastMemDirty != _memoryDirty)
+        _hasMemDirtyChanged = true;
+
+    return true;
+}
+
+size_t Document::getJiffies() const
+{
+    static thread_local std::string buffer;
+    if (_cgroupCpuFD >= 0 && Util::readProcFile(_cgroupCpuFD, buffer))
     {
-        size_t lastMemDirty = _memoryDirty;
-        _memoryDirty = _procSMaps  ? Util::getPssAndDirtyFromSMaps(_procSMaps).second : 0;
-        _lastTimeSMapsRead = now;
-        if (lastMemDirty != _memoryDirty)
-            _hasMemDirtyChanged = true;
+        const char* usage = std::strstr(buffer.c_str(), "usage_usec ");
+        if (usage)
+        {
+            const uint64_t usec = std::strtoull(usage + 11, nullptr, 10);
+            return usec * ::sysconf(_SC_CLK_TCK) / 1000000;
+        }
     }
+
+    if (_procStatFD >= 0)
+        return Util::getCpuUsageFromStat(_procStatFD);
+
+    return Util::getCpuUsage(_pid);
 }
 
 void Document::setLastJiffies(size_t newJ)
@@ -162,30 +275,102 @@ bool Subscriber::notify(const std::string& message)
     // If there is no socket, then return false to
     // signify we're disconnected.
     std::shared_ptr<WebSocketHandler> webSocket = _ws.lock();
-    if (webSocket)
+    if (!webSocket)
+        return false;
+
+    const std::string command = LOOLProtocol::getFirstToken(message);
+    if (command == "rmdoc" && message.size() > command.size())
+        _queue.forget(LOOLProtocol::getFirstToken(message.substr(command.size() + 1)));
+
+    if (!isSubscribed(command))
     {
-        if (_subscriptions.find(LOOLProtocol::getFirstToken(message)) == _subscriptions.end())
-        {
-            // No subscribers for the given message.
-            return true;
-        }
+        // No subscribers for the given message.
+        return true;
+    }
 
-        try
-        {
-            UnitWSD::get().onAdminNotifyMessage(message);
-            webSocket->sendMessage(message);
-            return true;
-        }
-        catch (const std::exception& ex)
+    if (_queue.isUnchanged(message))
+        return true;
+
+    // Messages of more than one line can't be batched; flush and send them on their own.
+    if (_batchInterval.count() > 0 && message.find('\n') == std::string::npos)
+    {
+        if (_queue.empty())
+            _nextFlush = std::chrono::steady_clock::now() + _batchInterval;
+
+        if (!_queue.push(message))
         {
-            LOG_ERR("Failed to notify Admin subscriber with message [" <<
-                    message << "] due to [" << ex.what() << "].");
+            LOG_WRN("Admin subscriber can't keep up, with " << _queue.getPendingBytes()
+                                                             << " bytes pending. Disconnecting.");
+            webSocket->shutdown();
+            return false;
         }
+
+        return true;
+    }
+
+    if (!_queue.empty() && !send(webSocket, _queue.takeFrame()))
+        return false;
+
+    if (AdminNotificationQueue::isDroppable(message) &&
+        getBufferedBytes(webSocket) > MaxBufferedBytes)
+    {
+        ++_droppedTotal;
+        return true;
+    }
+
+    _queue.markSent(message);
+    return send(webSocket, message);
+}
+
+bool Subscriber::flush(std::chrono::steady_clock::time_point now)
+{
+    if (_queue.empty() || now < _nextFlush)
+        return true;
+
+    std::shared_ptr<WebSocketHandler> webSocket = _ws.lock();
+    if (!webSocket)
+        return false;
+
+    // Hold back while the client is slow; we shed samples if it falls too far behind.
+    if (getBufferedBytes(webSocket) > MaxBufferedBytes)
+    {
+        LOG_TRC("Admin subscriber is slow, holding back " << _queue.size() << " notifications.");
+        _nextFlush = now + _batchInterval;
+        return true;
+    }
+
+    return send(webSocket, _queue.takeFrame());
+}
+
+bool Subscriber::send(const std::shared_ptr<WebSocketHandler>& webSocket,
+                      const std::string& message)
+{
+    try
+    {
+        UnitWSD::get().onAdminNotifyMessage(message);
+        webSocket->sendMessage(message);
+        return true;
+    }
+    catch (const std::exception& ex)
+    {
+        LOG_ERR("Failed to notify Admin subscriber with message [" <<
+                message << "] due to [" << ex.what() << "].");
     }
 
     return false;
 }
 
+std::size_t Subscriber::getBufferedBytes(const std::shared_ptr<WebSocketHandler>& webSocket)
+{
+    return webSocket->getOutBufferSize();
+}
+
+void Subscriber::setBatchInterval(std::chrono::milliseconds interval)
+{
+    _batchInterval = interval;
+    _nextFlush = std::chrono::steady_clock::now();
+}
+
 bool Subscriber::subscribe(const std::string& command)
 {
     auto ret = _subscriptions.insert(command);
@@ -308,6 +493,11 @@ size_t AdminModel::getKitsJiffies()
 {
     ASSERT_CORRECT_THREAD_OWNER(_owner);
 
+    static LatencyHistogram& samplingDuration = LatencyHistogram::get(
+        "admin_sampling_duration_seconds", "kind=\"cpu\"",
+        "Time spent sampling the memory and CPU usage of all Kits per interval.");
+    const auto start = std::chrono::steady_clock::now();
+
     size_t totalJ = 0;
     for (auto& it : _documents)
     {
@@ -316,7 +506,8 @@ size_t AdminModel::getKitsJiffies()
             const int pid = it.second->getPid();
             if (pid > 0)
             {
-                unsigned newJ = Util::getCpuUsage(pid);
+                ++_cpuSampleCount;
+                unsigned newJ = it.second->getJiffies();
                 unsigned prevJ = it.second->getLastJiffies();
                 if(newJ >= prevJ)
                 {
@@ -326,6 +517,8 @@ size_t AdminModel::getKitsJiffies()
             }
         }
     }
+
+    samplingDuration.observe(std::chrono::steady_clock::now() - start);
     return totalJ;
 }
 
@@ -453,6 +646,7 @@ void AdminModel::notify(const std::string& message)
         {
             if (!it->second.notify(message))
             {
+                _droppedNotifications += it->second.getDroppedTotal();
                 it = _subscribers.erase(it);
             }
             else
@@ -511,7 +705,11 @@ void AdminModel::addDocument(const std::string& docKey, pid_t pid,
 {
     ASSERT_CORRECT_THREAD_OWNER(_owner);
     const auto ret = _documents.emplace(docKey, std::unique_ptr<Document>(new Document(docKey, pid, filename, wopiSrc)));
-    ret.first->second->setProcSMapsFD(smapsFD);
+    if (ret.second)
+    {
+        ret.first->second->setProcSMapsFD(smapsFD);
+        ret.first->second->openStatFiles(_useCgroupStats);
+    }
     ret.first->second->takeSnapshot();
     ret.first->second->addView(sessionId, userName, userId);
     LOG_DBG("Added admin document [" << docKey << "].");
@@ -861,16 +1059,47 @@ void AdminModel::setDocWopiUploadDuration(const std::string& docKey, const std::
         it->second->setWopiUploadDuration(wopiUploadDuration);
 }
 
+void AdminModel::setDocDeltaBytes(const std::string& docKey, uint64_t deltaBytes)
+{
+    auto it = _documents.find(docKey);
+    if (it != _documents.end())
+        it->second->setDeltaBytes(deltaBytes);
+}
+
 void AdminModel::addSegFaultCount(unsigned segFaultCount)
 {
     _segFaultCount += segFaultCount;
 }
 
+void AdminModel::addKitJailSetupTimes(const std::string& timings)
+{
+    ++_kitJailSetupCount;
+    for (const auto& timing : StringVector::tokenize(timings, ','))
+    {
+        const auto pair = Util::split(timing, ':');
+        if (pair.first.empty() || pair.second.empty())
+            continue;
+
+        // Only accept the names of phases, they become metric names.
+        if (!std::all_of(pair.first.begin(), pair.first.end(),
+                         [](char c) { return std::islower(c) || c == '_'; }))
+            continue;
+
+        _kitJailSetupMs[pair.first] += std::strtoull(pair.second.c_str(), nullptr, 10);
+    }
+}
+
 void AdminModel::addLostKitsTerminated(unsigned lostKitsTerminated)
 {
     _lostKitsTerminatedCount += lostKitsTerminated;
 }
 
+void AdminModel::addSkippedUpload(uint64_t bytes)
+{
+    ++_skippedUploadCount;
+    _skippedUploadBytes += bytes;
+}
+
 int filterNumberName(const struct dirent *dir)
 {
     return !fnmatch("[0-9]*", dir->d_name, 0);
@@ -1018,6 +1247,7 @@ struct DocumentAggregateStats
     void Update(const Document &d, bool active)
     {
         _kitUsedMemory.Update(d.getMemoryDirty() * 1024, active);
+        _kitDeltaMemory.Update(d.getDeltaBytes(), active);
         _viewsCount.Update(d.getViews().size(), active);
         _activeViewsCount.Update(d.getActiveViews(), active);
         _expiredViewsCount.Update(d.getViews().size() - d.getActiveViews(), active);
@@ -1046,6 +1276,7 @@ struct DocumentAggregateStats
     }
 
     ActiveExpiredStats _kitUsedMemory;
+    ActiveExpiredStats _kitDeltaMemory;
     ActiveExpiredStats _viewsCount;
     ActiveExpiredStats _activeViewsCount;
     ActiveExpiredStats _expiredViewsCount;
@@ -1112,6 +1343,24 @@ void AdminModel::getMetrics(std::ostringstream &oss)
     oss << "loolwsd_thread_count " << Util::getStatFromPid(getpid(), 19) << std::endl;
     oss << "loolwsd_cpu_time_seconds " << Util::getCpuUsage(getpid()) / sysconf (_SC_CLK_TCK) << std::endl;
     oss << "loolwsd_memory_used_bytes " << Util::getMemoryUsagePSS(getpid()) * 1024 << std::endl;
+    for (int i = 0; i < FileUtil::CopyMethodCount; ++i)
+    {
+        const auto method = static_cast<FileUtil::CopyMethod>(i);
+        oss << "loolwsd_file_copy_" << FileUtil::nameOf(method) << "_count "
+            << FileUtil::getCopyCount(method) << std::endl;
+        oss << "loolwsd_file_copy_" << FileUtil::nameOf(method) << "_bytes_total "
+            << FileUtil::getCopyBytes(method) << std::endl;
+    }
+    uint64_t droppedNotifications = _droppedNotifications;
+    for (const auto& it : _subscribers)
+        droppedNotifications += it.second.getDroppedTotal();
+    oss << "loolwsd_admin_subscribers_count " << _subscribers.size() << std::endl;
+    oss << "loolwsd_admin_notifications_dropped_total " << droppedNotifications << std::endl;
+#if ENABLE_SSL
+    oss << "loolwsd_ssl_handshake_count " << ssl::Manager::getServerAcceptCount() << std::endl;
+    oss << "loolwsd_ssl_resumed_handshake_count " << ssl::Manager::getServerResumedCount() << std::endl;
+    oss << "loolwsd_ssl_kernel_tls_count " << ssl::Manager::getKernelTlsCount() << std::endl;
+#endif
     oss << std::endl;
 
     oss << "forkit_count " << getPidsFromProcName(std::regex("forkit"), nullptr) << std::endl;
@@ -1131,14 +1380,26 @@ void AdminModel::getMetrics(std::ostringstream &oss)
     oss << "kit_assigned_count " << kitStats.assignedCount << std::endl;
     oss << "kit_segfault_count " << _segFaultCount << std::endl;
     oss << "kit_lost_terminated_count " << _lostKitsTerminatedCount << std::endl;
+    oss << "kit_jail_setup_count " << _kitJailSetupCount << std::endl;
+    for (const auto& it : _kitJailSetupMs)
+        oss << "kit_jail_setup_" << it.first << "_milliseconds_total " << it.second << std::endl;
+    oss << "kit_memory_samples_total " << _memorySampleCount << std::endl;
+    oss << "kit_cpu_samples_total " << _cpuSampleCount << std::endl;
     PrintKitAggregateMetrics(oss, "thread_count", "", kitStats._threadCount);
     PrintKitAggregateMetrics(oss, "memory_used", "bytes", docStats._kitUsedMemory._active);
+    PrintKitAggregateMetrics(oss, "delta_memory_used", "bytes", docStats._kitDeltaMemory._active);
     PrintKitAggregateMetrics(oss, "cpu_time", "seconds", kitStats._cpuTime);
     oss << std::endl;
 
     oss << "document_resource_consuming_count " << docStats._resConsCount << std::endl;
     oss << "document_resource_consuming_abort_started_count " << docStats._resConsAbortPendingCount << std::endl;
     oss << "document_resource_consuming_aborted_count " << docStats._resConsAbortCount << std::endl;
+    oss << "document_upload_skipped_count " << _skippedUploadCount << std::endl;
+    oss << "document_upload_skipped_bytes_total " << _skippedUploadBytes << std::endl;
+    oss << "document_upload_queue_length " << UploadScheduler::instance().getQueueLength() << std::endl;
+    oss << "document_upload_active_count " << UploadScheduler::instance().getActiveCount() << std::endl;
+    oss << "document_upload_sent_bytes_total " << UploadScheduler::instance().getSentBytes() << std::endl;
+    oss << "document_hibernated_count " << DocumentBroker::getHibernatedCount() << std::endl;
     oss << std::endl;
 
     PrintDocActExpMetrics(oss, "views_all_count", "", docStats._viewsCount);
@@ -1168,6 +1429,9 @@ void AdminModel::getMetrics(std::ostringstream &oss)
     oss << "error_parse_error " << ParseError::count << "\n";
     oss << std::endl;
 
+    LatencyHistogram::printAll(oss);
+    oss << std::endl;
+
     int tick_per_sec = sysconf(_SC_CLK_TCK);
     // dump document data
     for (const auto& it : _documents)
@@ -1207,23 +1471,83 @@ std::set<pid_t> AdminModel::getDocumentPids() const
 
 void AdminModel::UpdateMemoryDirty()
 {
+    static LatencyHistogram& samplingDuration = LatencyHistogram::get(
+        "admin_sampling_duration_seconds", "kind=\"memory\"",
+        "Time spent sampling the memory and CPU usage of all Kits per interval.");
+    const auto start = std::chrono::steady_clock::now();
+
     for (const auto& it: _documents)
     {
-        it.second->updateMemoryDirty();
+        if (it.second->updateMemoryDirty())
+        {
+            ++_memorySampleCount;
+            if (it.second->hasMemDirtyChanged())
+                _memDirtyChangedDocs.push_back(it.first);
+        }
     }
+
+    samplingDuration.observe(std::chrono::steady_clock::now() - start);
 }
 
 void AdminModel::notifyDocsMemDirtyChanged()
 {
-    for (const auto& it: _documents)
+    // Only those that changed since we sampled, rather than walk all the documents again.
+    const bool subscribed = hasSubscribers("propchange");
+    for (const std::string& docKey : _memDirtyChangedDocs)
     {
-        int memoryDirty = it.second->getMemoryDirty();
-        if (it.second->hasMemDirtyChanged())
+        const auto it = _documents.find(docKey);
+        if (it == _documents.end() || !it->second->hasMemDirtyChanged())
+            continue;
+
+        if (subscribed)
+            notify("propchange " + std::to_string(it->second->getPid()) + " mem " +
+                   std::to_string(it->second->getMemoryDirty()));
+        it->second->setMemDirtyChanged(false);
+    }
+
+    _memDirtyChangedDocs.clear();
+}
+
+bool AdminModel::hasSubscribers(const std::string& command) const
+{
+    for (const auto& it : _subscribers)
+    {
+        if (it.second.isSubscribed(command))
+            return true;
+    }
+
+    return false;
+}
+
+void AdminModel::setBatchInterval(int sessionId, std::chrono::milliseconds interval)
+{
+    ASSERT_CORRECT_THREAD_OWNER(_owner);
+
+    auto subscriber = _subscribers.find(sessionId);
+    if (subscriber != _subscribers.end())
+        subscriber->second.setBatchInterval(interval);
+}
+
+std::chrono::steady_clock::time_point
+AdminModel::flushSubscribers(std::chrono::steady_clock::time_point now)
+{
+    ASSERT_CORRECT_THREAD_OWNER(_owner);
+
+    auto next = std::chrono::steady_clock::time_point::max();
+    for (auto it = _subscribers.begin(); it != _subscribers.end();)
+    {
+        if (!it->second.flush(now))
         {
-            notify("propchange " + std::to_string(it.second->getPid()) + " mem " + std::to_string(memoryDirty));
-            it.second->setMemDirtyChanged(false);
+            _droppedNotifications += it->second.getDroppedTotal();
+            it = _subscribers.erase(it);
+            continue;
         }
+
+        next = std::min(next, it->second.getNextFlush());
+        ++it;
     }
+
+    return next;
 }
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
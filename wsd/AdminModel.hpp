@@ -9,19 +9,23 @@
 
 #pragma once
 
+#include <chrono>
 #include <cmath>
 #include <ctime>
 #include <list>
+#include <map>
 #include <memory>
 #include <set>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include <Poco/URI.h>
 
 #include <common/Log.hpp>
 #include "Util.hpp"
 #include "net/WebSocketHandler.hpp"
+#include "AdminNotificationQueue.hpp"
 
 struct DocumentAggregateStats;
 
@@ -133,7 +137,7 @@ public:
 /// A document in Admin controller.
 class Document
 {
-    // cf. FILE* member.
+    // cf. file descriptor members.
     Document(const Document &) = delete;
     Document& operator = (const Document &) = delete;
 
@@ -154,7 +158,11 @@ public:
         , _recvBytes(0)
         , _wopiDownloadDuration(0)
         , _wopiUploadDuration(0)
-        , _procSMaps(nullptr)
+        , _deltaBytes(0)
+        , _procSMapsFD(-1)
+        , _procStatFD(-1)
+        , _cgroupMemoryFD(-1)
+        , _cgroupCpuFD(-1)
         , _lastTimeSMapsRead(0)
         , _isModified(false)
         , _hasMemDirtyChanged(true)
@@ -164,11 +172,7 @@ public:
     {
     }
 
-    ~Document()
-    {
-        if (_procSMaps)
-            fclose(_procSMaps);
-    }
+    ~Document();
 
     std::string getDocKey() const { return _docKey; }
 
@@ -199,9 +203,13 @@ public:
     const std::map<std::string, View>& getViews() const { return _views; }
 
     void updateLastActivityTime() { _lastActivity = std::time(nullptr); }
-    void updateMemoryDirty();
+    /// Re-reads the memory usage, if it's time to. Returns true if it was read.
+    bool updateMemoryDirty();
     size_t getMemoryDirty() const { return _memoryDirty; }
 
+    /// Returns the CPU time used by the Kit process so far, in jiffies.
+    size_t getJiffies() const;
+
     std::pair<std::time_t, std::string> getSnapshot() const;
     const std::string getHistory() const;
     void takeSnapshot();
@@ -226,7 +234,13 @@ public:
     std::chrono::milliseconds getWopiDownloadDuration() const { return _wopiDownloadDuration; }
     void setWopiUploadDuration(const std::chrono::milliseconds wopiUploadDuration) { _wopiUploadDuration = wopiUploadDuration; }
     std::chrono::milliseconds getWopiUploadDuration() const { return _wopiUploadDuration; }
-    void setProcSMapsFD(const int smapsFD) { _procSMaps = fdopen(smapsFD, "r"); }
+    void setDeltaBytes(uint64_t deltaBytes) { _deltaBytes = deltaBytes; }
+    uint64_t getDeltaBytes() const { return _deltaBytes; }
+    /// The smaps FD is owned by the ChildProcess, which may go away before us, so we dup it.
+    void setProcSMapsFD(const int smapsFD);
+    /// Opens the /proc and, if @useCgroup and the Kit has a cgroup of its own,
+    /// the cgroup v2 files we sample, and keeps them open.
+    void openStatFiles(bool useCgroup);
     bool hasMemDirtyChanged() const { return _hasMemDirtyChanged; }
     void setMemDirtyChanged(bool changeStatus) { _hasMemDirtyChanged = changeStatus; }
     time_t getBadBehaviorDetectionTime() const { return _badBehaviorDetectionTime; }
@@ -266,7 +280,15 @@ private:
     std::chrono::milliseconds _wopiDownloadDuration;
     std::chrono::milliseconds _wopiUploadDuration;
 
-    FILE* _procSMaps;
+    /// The memory the Kit's reference bitmaps for deltas take, as it last reported.
+    uint64_t _deltaBytes;
+
+    /// Kept open and read with pread, to avoid re-opening them on each sample.
+    int _procSMapsFD;
+    int _procStatFD;
+    /// memory.current and cpu.stat of the Kit's own cgroup, if enabled.
+    int _cgroupMemoryFD;
+    int _cgroupCpuFD;
     std::time_t _lastTimeSMapsRead;
 
     bool _isModified;
@@ -282,9 +304,14 @@ private:
 class Subscriber
 {
 public:
+    /// With this much unsent in the socket, the subscriber is
+    /// slow, and we hold back (batching) or drop samples.
+    static constexpr std::size_t MaxBufferedBytes = 256 * 1024;
+
     explicit Subscriber(std::weak_ptr<WebSocketHandler> ws)
         : _ws(std::move(ws))
         , _start(std::time(nullptr))
+        , _batchInterval(0)
     {
         LOG_INF("Subscriber ctor.");
     }
@@ -296,14 +323,40 @@ public:
 
     bool notify(const std::string& message);
 
+    /// Sends the pending notifications, if it's time to.
+    /// @returns false if we are disconnected.
+    bool flush(std::chrono::steady_clock::time_point now);
+
+    /// The next time we have pending notifications to flush, if any.
+    std::chrono::steady_clock::time_point getNextFlush() const
+    {
+        return _queue.empty() ? std::chrono::steady_clock::time_point::max() : _nextFlush;
+    }
+
     bool subscribe(const std::string& command);
 
     void unsubscribe(const std::string& command);
 
+    bool isSubscribed(const std::string& command) const
+    {
+        return _subscriptions.find(command) != _subscriptions.end();
+    }
+
+    /// Batch the notifications, sending them every @interval, 0 to disable.
+    void setBatchInterval(std::chrono::milliseconds interval);
+
     void expire() { _end = std::time(nullptr); }
 
     bool isExpired() const { return _end != 0 && std::time(nullptr) >= _end; }
 
+    uint64_t getDroppedTotal() const { return _droppedTotal + _queue.getDroppedTotal(); }
+
+private:
+    /// The number of bytes not yet sent on the socket of @webSocket.
+    static std::size_t getBufferedBytes(const std::shared_ptr<WebSocketHandler>& webSocket);
+
+    bool send(const std::shared_ptr<WebSocketHandler>& webSocket, const std::string& message);
+
 private:
     /// The underlying AdminRequestHandler
     std::weak_ptr<WebSocketHandler> _ws;
@@ -312,6 +365,12 @@ private:
 
     std::time_t _start;
     std::time_t _end = 0;
+
+    std::chrono::milliseconds _batchInterval;
+    std::chrono::steady_clock::time_point _nextFlush;
+    AdminNotificationQueue _queue;
+    /// Samples dropped when not batching.
+    uint64_t _droppedTotal = 0;
 };
 
 /// The Admin controller implementation.
@@ -366,6 +425,17 @@ public:
 
     void notify(const std::string& message);
 
+    /// True if any subscriber wants @command notifications,
+    /// so we can avoid formatting them otherwise.
+    bool hasSubscribers(const std::string& command) const;
+
+    /// Have the subscriber batch its notifications, see Subscriber::setBatchInterval.
+    void setBatchInterval(int sessionId, std::chrono::milliseconds interval);
+
+    /// Sends the batches that are due.
+    /// @returns when the next one is, or time_point::max() if none.
+    std::chrono::steady_clock::time_point flushSubscribers(std::chrono::steady_clock::time_point now);
+
     void addDocument(const std::string& docKey, pid_t pid, const std::string& filename,
                      const std::string& sessionId, const std::string& userName, const std::string& userId,
                      const int smapsFD, const Poco::URI& wopiSrc);
@@ -389,9 +459,14 @@ public:
     void setViewLoadDuration(const std::string& docKey, const std::string& sessionId, std::chrono::milliseconds viewLoadDuration);
     void setDocWopiDownloadDuration(const std::string& docKey, std::chrono::milliseconds wopiDownloadDuration);
     void setDocWopiUploadDuration(const std::string& docKey, const std::chrono::milliseconds wopiUploadDuration);
+    void setDocDeltaBytes(const std::string& docKey, uint64_t deltaBytes);
     void addSegFaultCount(unsigned segFaultCount);
     void setForKitPid(pid_t pid) { _forKitPid = pid; }
     void addLostKitsTerminated(unsigned lostKitsTerminated);
+    void addSkippedUpload(uint64_t bytes);
+    void addKitJailSetupTimes(const std::string& timings);
+    /// Sample the memory and CPU of Kits in their own cgroup v2 from the cgroup files.
+    void setUseCgroupStats(bool useCgroupStats) { _useCgroupStats = useCgroupStats; }
 
     void getMetrics(std::ostringstream &oss);
 
@@ -428,6 +503,8 @@ private:
     std::map<int, Subscriber> _subscribers;
     std::map<std::string, std::unique_ptr<Document>> _documents;
     std::map<std::string, std::unique_ptr<Document>> _expiredDocuments;
+    /// The documents whose memory changed in the last UpdateMemoryDirty().
+    std::vector<std::string> _memDirtyChangedDocs;
 
     /// The last N total memory Dirty size.
     std::list<unsigned> _memStats;
@@ -446,7 +523,21 @@ private:
     uint64_t _recvBytesTotal = 0;
 
     uint64_t _segFaultCount = 0;
+    /// Notifications dropped for the subscribers that are gone.
+    uint64_t _droppedNotifications = 0;
     uint64_t _lostKitsTerminatedCount = 0;
+    /// Uploads skipped because the saved document was identical, and their bytes.
+    uint64_t _skippedUploadCount = 0;
+    uint64_t _skippedUploadBytes = 0;
+
+    /// Cumulative milliseconds spent in each jail setup phase, by phase name.
+    std::map<std::string, uint64_t> _kitJailSetupMs;
+    uint64_t _kitJailSetupCount = 0;
+
+    bool _useCgroupStats = false;
+    /// Number of per-Kit reads by the memory and CPU samplers.
+    uint64_t _memorySampleCount = 0;
+    uint64_t _cpuSampleCount = 0;
 
     pid_t _forKitPid = 0;
 
@@ -0,0 +1,147 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <config.h>
+
+#include "AdminNotificationQueue.hpp"
+
+#include <Util.hpp>
+
+std::string AdminNotificationQueue::getUpdateKey(const std::string& message)
+{
+    // propchange <pid> <property> <value>
+    if (!Util::startsWith(message, "propchange "))
+        return std::string();
+
+    const std::size_t pidEnd = message.find(' ', sizeof("propchange ") - 1);
+    if (pidEnd == std::string::npos)
+        return std::string();
+
+    const std::size_t propertyEnd = message.find(' ', pidEnd + 1);
+    if (propertyEnd == std::string::npos)
+        return std::string();
+
+    return message.substr(0, propertyEnd);
+}
+
+bool AdminNotificationQueue::isDroppable(const std::string& message)
+{
+    return Util::startsWith(message, "mem_stats ") || Util::startsWith(message, "cpu_stats ") ||
+           Util::startsWith(message, "sent_activity ") ||
+           Util::startsWith(message, "recv_activity ");
+}
+
+bool AdminNotificationQueue::isUnchanged(const std::string& message) const
+{
+    const std::string key = getUpdateKey(message);
+    if (key.empty())
+        return false;
+
+    // What the subscriber will get is what is pending, if anything.
+    const auto pendingIt = _pendingKeys.find(key);
+    if (pendingIt != _pendingKeys.end())
+        return _pending[pendingIt->second] == message;
+
+    const auto it = _lastSent.find(key);
+    return it != _lastSent.end() && message.compare(key.size(), std::string::npos, it->second) == 0;
+}
+
+void AdminNotificationQueue::markSent(const std::string& message)
+{
+    const std::string key = getUpdateKey(message);
+    if (!key.empty())
+        _lastSent[key] = message.substr(key.size());
+}
+
+void AdminNotificationQueue::forget(const std::string& pid)
+{
+    const std::string prefix = "propchange " + pid + ' ';
+    for (auto it = _lastSent.lower_bound(prefix);
+         it != _lastSent.end() && Util::startsWith(it->first, prefix);)
+    {
+        it = _lastSent.erase(it);
+    }
+}
+
+bool AdminNotificationQueue::push(const std::string& message)
+{
+    const std::string key = getUpdateKey(message);
+    if (!key.empty())
+    {
+        const auto it = _pendingKeys.find(key);
+        if (it != _pendingKeys.end())
+        {
+            // Only the latest value matters.
+            std::string& pending = _pending[it->second];
+            _pendingBytes = _pendingBytes - pending.size() + message.size();
+            pending = message;
+            return true;
+        }
+
+        _pendingKeys.emplace(key, _pending.size());
+    }
+
+    _pending.push_back(message);
+    _pendingBytes += message.size() + 1;
+    if (_pendingBytes > MaxPendingBytes)
+        shed();
+
+    return _pendingBytes <= MaxPendingBytes;
+}
+
+void AdminNotificationQueue::shed()
+{
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < _pending.size(); ++i)
+    {
+        if (_pendingBytes > MaxPendingBytes && isDroppable(_pending[i]))
+        {
+            _pendingBytes -= _pending[i].size() + 1;
+            ++_dropped;
+            ++_droppedTotal;
+            continue;
+        }
+
+        if (kept != i)
+            _pending[kept] = std::move(_pending[i]);
+        ++kept;
+    }
+
+    _pending.resize(kept);
+
+    // The updates have moved.
+    _pendingKeys.clear();
+    for (std::size_t i = 0; i < _pending.size(); ++i)
+    {
+        const std::string key = getUpdateKey(_pending[i]);
+        if (!key.empty())
+            _pendingKeys.emplace(key, i);
+    }
+}
+
+std::string AdminNotificationQueue::takeFrame()
+{
+    std::string frame = "batch";
+    frame.reserve(_pendingBytes + 32);
+    if (_dropped)
+        frame += "\ndropped " + std::to_string(_dropped);
+
+    for (const std::string& message : _pending)
+    {
+        frame += '\n';
+        frame += message;
+        markSent(message);
+    }
+
+    _pending.clear();
+    _pendingKeys.clear();
+    _pendingBytes = 0;
+    _dropped = 0;
+    return frame;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,80 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+/// The notifications pending for a batching Admin subscriber.
+///
+/// Property updates (propchange) are sent as deltas: an update that doesn't
+/// change what the subscriber last got is skipped, and a newer update replaces
+/// a pending one of the same pid and property. When the pending notifications
+/// exceed the budget, i.e. the subscriber can't keep up, we drop the oldest
+/// samples (mem_stats, cpu_stats, etc.) first.
+class AdminNotificationQueue
+{
+public:
+    /// Over this many bytes pending, we start dropping.
+    static constexpr std::size_t MaxPendingBytes = 512 * 1024;
+
+    AdminNotificationQueue()
+        : _pendingBytes(0)
+        , _dropped(0)
+        , _droppedTotal(0)
+    {
+    }
+
+    /// Returns the key of a property update, e.g. "propchange 123 mem",
+    /// or an empty string if @message isn't one.
+    static std::string getUpdateKey(const std::string& message);
+
+    /// Samples can be dropped when the subscriber can't keep up.
+    static bool isDroppable(const std::string& message);
+
+    /// True if @message is a property update the subscriber has already got.
+    bool isUnchanged(const std::string& message) const;
+
+    /// Remember what the subscriber has got, if @message is a property update.
+    void markSent(const std::string& message);
+
+    /// Forget the properties of @pid, e.g. when it is gone.
+    void forget(const std::string& pid);
+
+    /// Queues @message. Returns false if we are over budget even after dropping samples.
+    bool push(const std::string& message);
+
+    /// Returns a frame with all the pending notifications, one per line, after
+    /// a "batch" line and a "dropped <count>" line if we had to drop any, and clears them.
+    std::string takeFrame();
+
+    bool empty() const { return _pending.empty(); }
+    std::size_t size() const { return _pending.size(); }
+    std::size_t getPendingBytes() const { return _pendingBytes; }
+    uint64_t getDroppedTotal() const { return _droppedTotal; }
+
+private:
+    /// Drops samples, oldest first, until we are within budget.
+    void shed();
+
+private:
+    std::vector<std::string> _pending;
+    std::size_t _pendingBytes;
+    /// Where in _pending the update of each key is.
+    std::map<std::string, std::size_t> _pendingKeys;
+    /// The last value the subscriber got, by key.
+    std::map<std::string, std::string> _lastSent;
+    /// Dropped since the last frame.
+    uint64_t _dropped;
+    uint64_t _droppedTotal;
+};
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
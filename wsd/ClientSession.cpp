@@ -1610,6 +1610,18 @@ bool ClientSession::handleKitToClientMessage(const std::shared_ptr<Message>& pay
             {
                 LOG_ERR(errorCommand << " error failure: " << errorKind);
             }
+
+#if !MOBILEAPP
+            // A failed output of a batch, the batch goes on with the next ones.
+            auto batch = dynamic_cast<ConvertBatchBroker*>(docBroker.get());
+            if (batch && (errorCommand == "saveas" || errorCommand == "extractlinktargets" ||
+                          errorCommand == "getthumbnail"))
+            {
+                batch->outputDone(std::string(), "application/octet-stream", std::string(),
+                                  errorKind);
+                return true;
+            }
+#endif
         }
     }
     else if (tokens.equals(0, "curpart:") && tokens.size() == 2)
@@ -1722,6 +1734,21 @@ bool ClientSession::handleKitToClientMessage(const std::shared_ptr<Message>& pay
             else
                 sendTextFrameAndLogError("error: cmd=storage kind=savefailed");
         }
+        else if (auto batch = dynamic_cast<ConvertBatchBroker*>(docBroker.get()))
+        {
+            // One of the outputs of the convert-batch REST API.
+            const std::string fileName = Poco::Path(resultURL.getPath()).getFileName();
+            if (resultURL.getPath().empty())
+            {
+                batch->outputDone(std::string(), "application/octet-stream", fileName,
+                                  "savefailed");
+            }
+            else
+            {
+                // Read as the response is sent, rather than held until then.
+                batch->outputFileDone(resultURL.getPath(), "application/octet-stream", fileName);
+            }
+        }
         else
         {
             // using the convert-to REST API
@@ -1933,6 +1960,18 @@ bool ClientSession::handleKitToClientMessage(const std::shared_ptr<Message>& pay
             getTokenInteger(tokens[2], "canonicalid", canonicalId))
         {
             _canonicalViewId = canonicalId;
+
+#if !MOBILEAPP
+            std::string viewProps;
+            if (docBroker->hasTileCache() && getTokenString(tokens[3], "viewprops", viewProps))
+            {
+                // Never store the tiles of password protected documents on disk.
+                if (getHaveDocPassword())
+                    docBroker->tileCache().closeStore();
+                else
+                    docBroker->tileCache().setViewProps(canonicalId, viewProps);
+            }
+#endif
         }
     }
 
@@ -1959,6 +1998,7 @@ bool ClientSession::handleKitToClientMessage(const std::shared_ptr<Message>& pay
 
 #if !MOBILEAPP
             Admin::instance().setViewLoadDuration(docBroker->getDocKey(), getId(), std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - _viewLoadStart));
+            DocumentBroker::observeLoadPhase("view", std::chrono::steady_clock::now() - _viewLoadStart);
 #endif
 
             // position cursor for thumbnail rendering
@@ -2149,6 +2189,14 @@ bool ClientSession::handleKitToClientMessage(const std::shared_ptr<Message>& pay
 
             const std::string stringJSON = payload->jsonString();
 
+#if !MOBILEAPP
+            if (auto batch = dynamic_cast<ConvertBatchBroker*>(docBroker.get()))
+            {
+                batch->outputDone(stringJSON, "application/json", std::string());
+                return true;
+            }
+#endif
+
             http::Response httpResponse(http::StatusCode::OK);
             httpResponse.set("Last-Modified", Util::getHttpTimeNow());
             httpResponse.set("X-Content-Type-Options", "nosniff");
@@ -2167,6 +2215,20 @@ bool ClientSession::handleKitToClientMessage(const std::shared_ptr<Message>& pay
             if (firstLine.find("error") != std::string::npos)
                 error = true;
 
+#if !MOBILEAPP
+            if (auto batch = dynamic_cast<ConvertBatchBroker*>(docBroker.get()))
+            {
+                const int firstLineSize = firstLine.size() + 1;
+                if (error)
+                    batch->outputDone(std::string(), "image/png", std::string(), "failed");
+                else
+                    batch->outputDone(std::string(payload->data().data() + firstLineSize,
+                                                  payload->data().size() - firstLineSize),
+                                      "image/png", std::string());
+                return true;
+            }
+#endif
+
             if (!error)
             {
                 int firstLineSize = firstLine.size() + 1;
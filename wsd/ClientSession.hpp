@@ -152,6 +152,8 @@ public:
         _saveAsSocket = socket;
     }
 
+    const std::shared_ptr<StreamSocket>& getSaveAsSocket() const { return _saveAsSocket; }
+
     std::shared_ptr<DocumentBroker> getDocumentBroker() const { return _docBroker.lock(); }
 
     /// Exact URI (including query params - access tokens etc.) with which
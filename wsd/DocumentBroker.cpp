@@ -11,15 +11,20 @@
 
 #include "DocumentBroker.hpp"
 
+#include <algorithm>
 #include <atomic>
 #include <cassert>
+#include <cctype>
 #include <chrono>
+#include <cstdio>
 #include <ctime>
+#include <functional>
 #include <ios>
 #include <fstream>
 #include <memory>
 #include <string>
 #include <sstream>
+#include <vector>
 
 #include <Poco/DigestStream.h>
 #include <Poco/Exception.h>
@@ -37,10 +42,12 @@
 #include "Socket.hpp"
 #include "Storage.hpp"
 #include "TileCache.hpp"
+#include "TileStore.hpp"
 #include "ProxyProtocol.hpp"
 #include "Util.hpp"
 #include "QuarantineUtil.hpp"
 #include <common/JsonUtil.hpp>
+#include <common/LatencyHistogram.hpp>
 #include <common/Log.hpp>
 #include <common/Message.hpp>
 #include <common/Clipboard.hpp>
@@ -61,6 +68,17 @@ using namespace LOOLProtocol;
 
 using Poco::JSON::Object;
 
+/// The SHA1 of the contents of the file at @path, in hex.
+static std::string getFileSha1(const std::string& path)
+{
+    std::ifstream istr(path, std::ios::binary);
+    Poco::SHA1Engine sha1;
+    Poco::DigestOutputStream dos(sha1);
+    Poco::StreamCopier::copyStream(istr, dos);
+    dos.close();
+    return Poco::DigestEngine::digestToHex(sha1.digest());
+}
+
 void ChildProcess::setDocumentBroker(const std::shared_ptr<DocumentBroker>& docBroker)
 {
     assert(docBroker && "Invalid DocumentBroker instance.");
@@ -113,8 +131,150 @@ public:
     }
 };
 
+/// The Shared Broker Poll - polls many documents in one thread, when
+/// per_document.poll_threads is set. A document polls on the same one
+/// for all of its life, so its thread checks hold as with its own thread.
+class DocumentBroker::SharedBrokerPoll final : public TerminatingPoll
+{
+    /// The documents polling here, only touched in our thread.
+    std::vector<std::shared_ptr<DocumentBroker>> _docBrokers;
+
+public:
+    explicit SharedBrokerPoll(const std::string& threadName)
+        : TerminatingPoll(threadName)
+    {
+    }
+
+    /// Starts polling @docBroker along with the others, in our thread.
+    void addDocBroker(const std::shared_ptr<DocumentBroker>& docBroker)
+    {
+        if (docBroker->startPolling())
+            _docBrokers.emplace_back(docBroker);
+
+        // Whether we poll or failed to, what waited for our child finds out now.
+        std::vector<SocketPoll::CallbackFn> callbacks;
+        callbacks.swap(docBroker->_queuedCallbacks);
+        for (const SocketPoll::CallbackFn& callback : callbacks)
+            callback();
+    }
+
+    void pollingThread() override
+    {
+        while (continuePolling())
+        {
+            std::chrono::microseconds timeout = SocketPoll::DefaultPollTimeoutMicroS;
+            for (const auto& docBroker : _docBrokers)
+                timeout = std::min(timeout, docBroker->getPollTimeout());
+
+            poll(timeout);
+
+            // Do what each document's own thread does after its poll.
+            for (auto it = _docBrokers.begin(); it != _docBrokers.end();)
+            {
+                if (step(**it))
+                    ++it;
+                else
+                {
+                    finish(**it);
+                    it = _docBrokers.erase(it);
+                }
+            }
+        }
+
+        LOG_INF("Finished shared polling thread " << name() << " with " << _docBrokers.size()
+                                                  << " documents left");
+        for (const auto& docBroker : _docBrokers)
+            finish(*docBroker);
+
+        _docBrokers.clear();
+    }
+
+private:
+    /// A document failing mustn't take the others down with it.
+    static bool step(DocumentBroker& docBroker)
+    {
+        try
+        {
+            return docBroker.stepPolling() && !docBroker._stop;
+        }
+        catch (const std::exception& exc)
+        {
+            LOG_ERR("Error while polling doc [" << docBroker.getDocKey() << "]: " << exc.what());
+        }
+
+        return false;
+    }
+
+    static void finish(DocumentBroker& docBroker)
+    {
+        try
+        {
+            docBroker.finishPolling();
+        }
+        catch (const std::exception& exc)
+        {
+            LOG_ERR("Error while finishing doc [" << docBroker.getDocKey() << "]: " << exc.what());
+        }
+
+        docBroker._pollState = PollState::Finished;
+    }
+};
+
+std::vector<std::shared_ptr<DocumentBroker::SharedBrokerPoll>> DocumentBroker::SharedPolls;
+
+void DocumentBroker::startPollThreads(int count)
+{
+    assert(SharedPolls.empty() && "Poll threads already started.");
+
+    if (count <= 0)
+    {
+        LOG_INF("Polling each document in its own thread");
+        return;
+    }
+
+    LOG_INF("Polling the documents in " << count << " shared threads");
+    for (int i = 0; i < count; ++i)
+    {
+        SharedPolls.emplace_back(
+            std::make_shared<SharedBrokerPoll>("docbroker_p" + std::to_string(i)));
+        SharedPolls.back()->startThread();
+    }
+}
+
+void DocumentBroker::stopPollThreads()
+{
+    for (const auto& poll : SharedPolls)
+        poll->joinThread();
+
+    SharedPolls.clear();
+}
+
 std::atomic<unsigned> DocumentBroker::DocBrokerId(1);
 
+#if !MOBILEAPP
+std::map<std::string, std::chrono::steady_clock::time_point> DocumentBroker::HibernatedDocs;
+std::mutex DocumentBroker::HibernatedDocsMutex;
+
+std::size_t DocumentBroker::getHibernatedCount()
+{
+    // By then, the users are not coming back to this hibernation.
+    static const std::chrono::seconds IdleDocTimeoutSecs(
+        LOOLWSD::getConfigValue<int>("per_document.idle_timeout_secs", 3600));
+
+    const auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(HibernatedDocsMutex);
+    for (auto it = HibernatedDocs.begin(); it != HibernatedDocs.end();)
+    {
+        if (now - it->second >= IdleDocTimeoutSecs)
+            it = HibernatedDocs.erase(it);
+        else
+            ++it;
+    }
+
+    return HibernatedDocs.size();
+}
+#endif
+
 DocumentBroker::DocumentBroker(ChildType type, const std::string& uri, const Poco::URI& uriPublic,
                                const std::string& docKey, unsigned mobileAppDocId)
     : _limitLifeSeconds(std::chrono::seconds::zero())
@@ -135,6 +295,7 @@ DocumentBroker::DocumentBroker(ChildType type, const std::string& uri, const Poc
                                                   "per_document.autosave_duration_secs", 300)),
                    std::chrono::milliseconds(LOOLWSD::getConfigValueNonZero<int>(
                        "per_document.min_time_between_saves_ms", 500)))
+    , _uploadHashing(false)
     , _storageManager(std::chrono::milliseconds(
           LOOLWSD::getConfigValueNonZero<int>("per_document.min_time_between_uploads_ms", 5000)))
     , _isModified(false)
@@ -142,13 +303,21 @@ DocumentBroker::DocumentBroker(ChildType type, const std::string& uri, const Poc
     , _cursorPosY(0)
     , _cursorWidth(0)
     , _cursorHeight(0)
-    , _poll(
-          Util::make_unique<DocumentBrokerPoll>("doc" SHARED_DOC_THREADNAME_SUFFIX + _docId, *this))
+    , _poll(SharedPolls.empty()
+                ? std::shared_ptr<TerminatingPoll>(std::make_shared<DocumentBrokerPoll>(
+                      "doc" SHARED_DOC_THREADNAME_SUFFIX + _docId, *this))
+                : SharedPolls[std::hash<std::string>()(docKey) % SharedPolls.size()])
+    , _sharedPoll(!SharedPolls.empty())
+    , _pollState(PollState::None)
     , _stop(false)
     , _lockCtx(Util::make_unique<LockContext>())
     , _tileVersion(0)
     , _debugRenderedTileCount(0)
     , _wopiDownloadDuration(0)
+    , _adminSent(0)
+    , _adminRecv(0)
+    , _limitLoadSecs(0)
+    , _limitStoreFailures(0)
     , _mobileAppDocId(mobileAppDocId)
     , _alwaysSaveOnExit(LOOLWSD::getConfigValue<bool>("per_document.always_save_on_exit", false))
 #ifdef ENABLE_DEBUG
@@ -184,32 +353,289 @@ void DocumentBroker::setupPriorities()
 }
 
 void DocumentBroker::setupTransfer(SocketDisposition &disposition,
-                                   SocketDisposition::MoveFunction transferFn)
+                                   SocketDisposition::MoveFunction transferFn,
+                                   const std::shared_ptr<ClientSession>& session)
+{
+    if (!_sharedPoll)
+    {
+        disposition.setTransfer(*_poll, std::move(transferFn));
+        return;
+    }
+
+    // Our own thread would start polling before taking the socket.
+    startSharedPolling();
+
+    // The socket isn't polled until we take it, lest it be read for no handler.
+    std::shared_ptr<DocumentBroker> docBroker = shared_from_this();
+    disposition.setMove(
+        [docBroker, session, transferFn = std::move(transferFn)](
+            const std::shared_ptr<Socket>& moveSocket)
+        {
+            docBroker->_poll->addCallback(
+                [docBroker, session, transferFn, moveSocket]()
+                {
+                    if (docBroker->_pollState != PollState::Queued)
+                    {
+                        docBroker->transferSocket(moveSocket, transferFn, session);
+                        return;
+                    }
+
+                    // Still getting our child: the socket waits for it, in order.
+                    docBroker->_queuedCallbacks.emplace_back(
+                        [docBroker, session, transferFn, moveSocket]()
+                        { docBroker->transferSocket(moveSocket, transferFn, session); });
+                });
+        });
+}
+
+void DocumentBroker::transferSocket(const std::shared_ptr<Socket>& moveSocket,
+                                    const SocketDisposition::MoveFunction& transferFn,
+                                    const std::shared_ptr<ClientSession>& session)
+{
+    if (_pollState != PollState::Polling)
+    {
+        LOG_WRN("Doc [" << _docKey << "] is not polling, closing socket #" << moveSocket->getFD());
+        _poll->insertNewSocket(moveSocket);
+        moveSocket->shutdown();
+        return;
+    }
+
+#if !MOBILEAPP
+    if (session)
+    {
+        fetchStorage(moveSocket, transferFn, session);
+        return;
+    }
+#endif
+
+    addSocketToPoll(moveSocket);
+    transferFn(moveSocket);
+}
+
+#if !MOBILEAPP
+void DocumentBroker::fetchStorage(const std::shared_ptr<Socket>& moveSocket,
+                                  const SocketDisposition::MoveFunction& transferFn,
+                                  const std::shared_ptr<ClientSession>& session)
+{
+    ASSERT_CORRECT_THREAD();
+
+    std::shared_ptr<DocumentBroker> docBroker = shared_from_this();
+    _storageFetchQueue.emplace_back(
+        [docBroker, moveSocket, transferFn, session]()
+        {
+            // One at a time, so only the first session downloads, and later ones see its storage.
+            const bool download = docBroker->_storage == nullptr;
+            const std::string jailId = docBroker->_childProcess->getJailId();
+            const std::string jailPath = Poco::Path(JAILED_DOCUMENT_ROOT, jailId).toString();
+            const std::string jailRoot = Poco::Path(LOOLWSD::ChildRoot, jailId).toString();
+            const bool takeOwnership = docBroker->isConvertTo();
+
+            // Slow storage would stall all the documents of the shared thread.
+            std::thread(
+                [=]()
+                {
+                    Util::setThreadName("docstore_" + docBroker->_docId);
+                    std::shared_ptr<StorageFetch> fetch =
+                        getFromStorage(session->getPublicUri(), session->getAuthorization(),
+                                       jailRoot, jailPath, takeOwnership, download);
+
+                    docBroker->_poll->addCallback(
+                        [docBroker, moveSocket, transferFn, session, fetch]()
+                        {
+                            if (docBroker->_pollState == PollState::Polling)
+                                docBroker->_storageFetches[session->getId()] = fetch;
+
+                            docBroker->transferSocket(moveSocket, transferFn, nullptr);
+                            docBroker->_storageFetches.erase(session->getId());
+
+                            // On to the next session, unless we finished and dropped them.
+                            std::deque<SocketPoll::CallbackFn>& queue =
+                                docBroker->_storageFetchQueue;
+                            if (!queue.empty())
+                                queue.pop_front();
+                            if (!queue.empty())
+                                queue.front()();
+                        });
+                })
+                .detach();
+        });
+
+    if (_storageFetchQueue.size() == 1)
+        _storageFetchQueue.front()();
+}
+
+std::shared_ptr<DocumentBroker::StorageFetch>
+DocumentBroker::getFromStorage(const Poco::URI& uriPublic, const Authorization& auth,
+                               const std::string& jailRoot, const std::string& jailPath,
+                               bool takeOwnership, bool download)
+{
+    auto fetch = std::make_shared<StorageFetch>();
+    try
+    {
+        fetch->_lockCtx = Util::make_unique<LockContext>();
+        fetch->_storage = StorageBase::create(uriPublic, jailRoot, jailPath, takeOwnership);
+
+        // Other storage is local, and is left to download() in the poll thread.
+        WopiStorage* wopiStorage = dynamic_cast<WopiStorage*>(fetch->_storage.get());
+        if (wopiStorage == nullptr)
+            return fetch;
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        fetch->_wopiFileInfo = wopiStorage->getWOPIFileInfo(auth, *fetch->_lockCtx);
+        fetch->_checkFileInfoDuration = std::chrono::steady_clock::now() - start;
+
+        if (!download)
+            return fetch;
+
+        start = std::chrono::steady_clock::now();
+        fetch->_localPath = wopiStorage->downloadStorageFileToLocal(
+            auth, *fetch->_lockCtx, fetch->_wopiFileInfo->getTemplateSource());
+        fetch->_getFileDuration = std::chrono::steady_clock::now() - start;
+
+        if (!fetch->_localPath.empty())
+        {
+            const std::string localFilePath = Poco::Path(jailRoot, fetch->_localPath).toString();
+            fetch->_sha1 = getFileSha1(localFilePath);
+            if (TileStore::isEnabled())
+                fetch->_fileHash = FileUtil::hashFile(localFilePath);
+        }
+    }
+    catch (...)
+    {
+        fetch->_error = std::current_exception();
+    }
+
+    return fetch;
+}
+#endif
+
+#if !MOBILEAPP
+void DocumentBroker::setTileStore(const std::string& fileHash, std::unique_ptr<TileStore> store)
+{
+    // Edited meanwhile, the tiles are no longer of this hash.
+    if (!_tileCache || !_tileCache->setStore(std::move(store)))
+    {
+        LOG_DBG("Not storing the tiles of [" << _docKey << "], changed since loading");
+        return;
+    }
+
+    // To persist the tiles under, should we close the store before we upload.
+    _storageManager.setDownloadedFileHash(fileHash);
+}
+#endif
+
+void DocumentBroker::startSharedPolling()
 {
-    disposition.setTransfer(*_poll, std::move(transferFn));
+    assert(_sharedPoll);
+
+    PollState expected = PollState::None;
+    if (!_pollState.compare_exchange_strong(expected, PollState::Queued))
+        return;
+
+    LOG_DBG("Queuing doc [" << _docKey << "] to poll on " << _poll->name());
+    std::shared_ptr<DocumentBroker> docBroker = shared_from_this();
+    auto poll = std::static_pointer_cast<SharedBrokerPoll>(_poll);
+#if !MOBILEAPP
+    // Waiting for a child would stall all the documents of the shared thread.
+    std::thread(
+        [poll, docBroker]()
+        {
+            Util::setThreadName("docchild_" + docBroker->_docId);
+            docBroker->_sharedPollChild = docBroker->getNewChild();
+            poll->addCallback([poll, docBroker]() { poll->addDocBroker(docBroker); });
+        })
+        .detach();
+#else
+    _poll->addCallback([poll, docBroker]() { poll->addDocBroker(docBroker); });
+#endif
 }
 
 void DocumentBroker::assertCorrectThread(const char* filename, int line) const
 {
-    _poll->assertCorrectThread(filename, line);
+    // A shared poll thread outlives us polling on it, like our own thread never does.
+    if (!_sharedPoll || _pollState == PollState::Polling)
+        _poll->assertCorrectThread(filename, line);
+    else if (_pollState == PollState::Finished &&
+             _poll->getThreadOwner() == std::this_thread::get_id())
+    {
+        // Our sockets left the shared poll as we finished, so it mustn't call us any more.
+        LOG_ERR("Doc [" << _docKey << "] called from its shared poll thread after polling. ("
+                        << filename << ':' << line << ')');
+        assert(!"Finished doc called from its shared poll thread");
+    }
+}
+
+void DocumentBroker::trackPolledSocket(const std::shared_ptr<Socket>& socket)
+{
+    if (!_sharedPoll)
+        return;
+
+    std::lock_guard<std::mutex> lock(_polledSocketsMutex);
+    _polledSockets.erase(std::remove_if(_polledSockets.begin(), _polledSockets.end(),
+                                        [](const std::weak_ptr<Socket>& polled)
+                                        { return polled.expired(); }),
+                         _polledSockets.end());
+    _polledSockets.emplace_back(socket);
+}
+
+void DocumentBroker::removePolledSockets()
+{
+    assert(_sharedPoll);
+
+    std::vector<std::weak_ptr<Socket>> sockets;
+    {
+        std::lock_guard<std::mutex> lock(_polledSocketsMutex);
+        sockets.swap(_polledSockets);
+    }
+
+    LOG_DBG("Removing the sockets of doc [" << _docKey << "] from " << _poll->name());
+    for (const std::weak_ptr<Socket>& polled : sockets)
+    {
+        const std::shared_ptr<Socket> socket = polled.lock();
+        if (!socket)
+            continue;
+
+        // What can't be written at once is lost, as when our own thread gives up flushing.
+        const auto streamSocket = std::dynamic_pointer_cast<StreamSocket>(socket);
+        if (streamSocket)
+            streamSocket->flush();
+
+        _poll->removeSocket(socket);
+        if (streamSocket)
+            streamSocket->closeConnection();
+    }
 }
 
 // The inner heart of the DocumentBroker - our poll loop.
 void DocumentBroker::pollThread()
 {
-    _threadStart = std::chrono::steady_clock::now();
+    if (!startPolling())
+        return;
 
-    LOG_INF("Starting docBroker polling thread for docKey [" << _docKey << ']');
+    // Main polling loop goodness.
+    while (!_stop && _poll->continuePolling() && !SigUtil::getTerminationFlag())
+    {
+        _poll->poll(getPollTimeout());
+
+        if (!stepPolling())
+            break;
+    }
 
-    // Request a kit process for this doc.
+    finishPolling();
+}
+
+std::shared_ptr<ChildProcess> DocumentBroker::getNewChild()
+{
 #if !MOBILEAPP
+    std::shared_ptr<ChildProcess> child;
+    const auto startTime = std::chrono::steady_clock::now();
     do
     {
         static constexpr std::chrono::milliseconds timeoutMs(COMMAND_TIMEOUT_MS * 5);
-        _childProcess = getNewChild_Blocks();
-        if (_childProcess
+        child = getNewChild_Blocks();
+        if (child
             || std::chrono::duration_cast<std::chrono::milliseconds>(
-                   std::chrono::steady_clock::now() - _threadStart)
+                   std::chrono::steady_clock::now() - startTime)
                    > timeoutMs)
             break;
 
@@ -217,12 +643,33 @@ void DocumentBroker::pollThread()
         std::this_thread::sleep_for(std::chrono::milliseconds(CHILD_REBALANCE_INTERVAL_MS / 10));
     }
     while (!_stop && _poll->continuePolling() && !SigUtil::getTerminationFlag() && !SigUtil::getShutdownRequestFlag());
+
+    return child;
 #else
 #ifdef IOS
     assert(_mobileAppDocId > 0);
 #endif
-    _childProcess = getNewChild_Blocks(_mobileAppDocId);
+    return getNewChild_Blocks(_mobileAppDocId);
 #endif
+}
+
+std::chrono::microseconds DocumentBroker::getPollTimeout() const
+{
+    // Poll more frequently while unloading to cleanup sooner.
+    const bool unloading = isMarkedToDestroy() || _docState.isUnloadRequested();
+    return unloading ? SocketPoll::DefaultPollTimeoutMicroS / 16
+                     : SocketPoll::DefaultPollTimeoutMicroS;
+}
+
+bool DocumentBroker::startPolling()
+{
+    _pollState = PollState::Polling;
+    _threadStart = std::chrono::steady_clock::now();
+
+    LOG_INF("Starting docBroker polling thread for docKey [" << _docKey << ']');
+
+    // Request a kit process for this doc, unless we have one already.
+    _childProcess = _sharedPollChild ? std::move(_sharedPollChild) : getNewChild();
 
     if (!_childProcess)
     {
@@ -239,14 +686,16 @@ void DocumentBroker::pollThread()
 #endif
         stop("Failed to get new child.");
 
-        // Stop to mark it done and cleanup.
-        _poll->stop();
+        // Stop to mark it done and cleanup, unless others poll there too.
+        if (!_sharedPoll)
+            _poll->stop();
 
         // Async cleanup.
         LOOLWSD::doHousekeeping();
 
         LOG_INF("Finished docBroker polling thread for docKey [" << _docKey << "].");
-        return;
+        _pollState = PollState::Finished;
+        return false;
     }
 
     // We have a child process.
@@ -256,16 +705,12 @@ void DocumentBroker::pollThread()
     setupPriorities();
 
 #if !MOBILEAPP
-    static const std::size_t IdleDocTimeoutSecs
-        = LOOLWSD::getConfigValue<int>("per_document.idle_timeout_secs", 3600);
-
-    // Used to accumulate B/W deltas.
-    uint64_t adminSent = 0;
-    uint64_t adminRecv = 0;
-    auto lastBWUpdateTime = std::chrono::steady_clock::now();
-    auto lastClipboardHashUpdateTime = std::chrono::steady_clock::now();
+    _adminSent = 0;
+    _adminRecv = 0;
+    _lastBWUpdateTime = std::chrono::steady_clock::now();
+    _lastClipboardHashUpdateTime = std::chrono::steady_clock::now();
 
-    const int limit_load_secs =
+    _limitLoadSecs =
 #if ENABLE_DEBUG
         // paused waiting for a debugger to attach
         // ignore load time out
@@ -273,258 +718,273 @@ void DocumentBroker::pollThread()
 #endif
         LOOLWSD::getConfigValue<int>("per_document.limit_load_secs", 100);
 
-    auto loadDeadline = std::chrono::steady_clock::now() + std::chrono::seconds(limit_load_secs);
+    _loadDeadline = std::chrono::steady_clock::now() + std::chrono::seconds(_limitLoadSecs);
 #endif
 
-    const auto limStoreFailures =
-        LOOLWSD::getConfigValue<int>("per_document.limit_store_failures", 5);
+    _limitStoreFailures = LOOLWSD::getConfigValue<int>("per_document.limit_store_failures", 5);
 
-    // Main polling loop goodness.
-    while (!_stop && _poll->continuePolling() && !SigUtil::getTerminationFlag())
-    {
-        // Poll more frequently while unloading to cleanup sooner.
-        const bool unloading = isMarkedToDestroy() || _docState.isUnloadRequested();
-        _poll->poll(unloading ? SocketPoll::DefaultPollTimeoutMicroS / 16
-                              : SocketPoll::DefaultPollTimeoutMicroS);
+    return true;
+}
 
-        // Consolidate updates across multiple processed events.
-        processBatchUpdates();
+bool DocumentBroker::stepPolling()
+{
+#if !MOBILEAPP
+    static const std::size_t IdleDocTimeoutSecs
+        = LOOLWSD::getConfigValue<int>("per_document.idle_timeout_secs", 3600);
+    static const std::size_t HibernateSecs
+        = LOOLWSD::getConfigValue<int>("per_document.hibernate_secs", 0);
+#endif
 
-        if (_stop)
-        {
-            LOG_DBG("Doc [" << _docKey << "] is flagged to stop after returning from poll.");
-            break;
-        }
+    // Consolidate updates across multiple processed events.
+    processBatchUpdates();
 
-        if (UnitWSD::isUnitTesting() && _unitWsd.isFinished())
-        {
-            stop("UnitTestFinished");
-            break;
-        }
+    if (_stop)
+    {
+        LOG_DBG("Doc [" << _docKey << "] is flagged to stop after returning from poll.");
+        return false;
+    }
+
+    if (UnitWSD::isUnitTesting() && _unitWsd.isFinished())
+    {
+        stop("UnitTestFinished");
+        return false;
+    }
 
 #if !MOBILEAPP
-        const auto now = std::chrono::steady_clock::now();
+    const auto now = std::chrono::steady_clock::now();
 
-        // a tile's data is ~8k, a 4k screen is ~256 256x256 tiles
-        if (_tileCache)
-            _tileCache->setMaxCacheSize(8 * 1024 * 256 * _sessions.size());
+    // a tile's data is ~8k, a 4k screen is ~256 256x256 tiles
+    if (_tileCache)
+        _tileCache->setMaxCacheSize(8 * 1024 * 256 * _sessions.size());
 
-        if (isInteractive())
+    if (isInteractive())
+    {
+        // It is possible to dismiss the interactive dialog,
+        // exit the Kit process, or even crash. We would deadlock.
+        if (isUnloading())
         {
-            // It is possible to dismiss the interactive dialog,
-            // exit the Kit process, or even crash. We would deadlock.
-            if (isUnloading())
-            {
-                // We expect to have either isMarkedToDestroy() or
-                // isCloseRequested() in that case.
-                stop("abortedinteractive");
-            }
-
-            // Extend the deadline while we are interactiving with the user.
-            loadDeadline = now + std::chrono::seconds(limit_load_secs);
-            continue;
+            // We expect to have either isMarkedToDestroy() or
+            // isCloseRequested() in that case.
+            stop("abortedinteractive");
         }
 
-        if (!isLoaded() && (limit_load_secs > 0) && (now > loadDeadline))
-        {
-            LOG_ERR("Doc [" << _docKey << "] is taking too long to load. Will kill process ["
-                    << _childProcess->getPid() << "]. per_document.limit_load_secs set to "
-                    << limit_load_secs << " secs.");
-            broadcastMessage("error: cmd=load kind=docloadtimeout");
+        // Extend the deadline while we are interactiving with the user.
+        _loadDeadline = now + std::chrono::seconds(_limitLoadSecs);
+        return true;
+    }
 
-            // Brutal but effective.
-            if (_childProcess)
-                _childProcess->terminate();
+    if (!isLoaded() && (_limitLoadSecs > 0) && (now > _loadDeadline))
+    {
+        LOG_ERR("Doc [" << _docKey << "] is taking too long to load. Will kill process ["
+                << _childProcess->getPid() << "]. per_document.limit_load_secs set to "
+                << _limitLoadSecs << " secs.");
+        broadcastMessage("error: cmd=load kind=docloadtimeout");
 
-            stop("Doc lifetime expired");
-            continue;
-        }
+        // Brutal but effective.
+        if (_childProcess)
+            _childProcess->terminate();
 
-        // Check if we had a sunset time and expired.
-        if (_limitLifeSeconds > std::chrono::seconds::zero()
-            && std::chrono::duration_cast<std::chrono::seconds>(now - _threadStart)
-                   > _limitLifeSeconds)
-        {
-            LOG_WRN("Doc [" << _docKey << "] is taking too long to convert. Will kill process ["
-                            << _childProcess->getPid()
-                            << "]. per_document.limit_convert_secs set to "
-                            << _limitLifeSeconds.count() << " secs.");
-            broadcastMessage("error: cmd=load kind=docexpired");
+        stop("Doc lifetime expired");
+        return true;
+    }
 
-            // Brutal but effective.
-            if (_childProcess)
-                _childProcess->terminate();
+    // Check if we had a sunset time and expired.
+    if (_limitLifeSeconds > std::chrono::seconds::zero()
+        && std::chrono::duration_cast<std::chrono::seconds>(now - _threadStart)
+               > _limitLifeSeconds)
+    {
+        LOG_WRN("Doc [" << _docKey << "] is taking too long to convert. Will kill process ["
+                        << _childProcess->getPid()
+                        << "]. per_document.limit_convert_secs set to "
+                        << _limitLifeSeconds.count() << " secs.");
+        broadcastMessage("error: cmd=load kind=docexpired");
 
-            stop("Convert-to timed out");
-            continue;
-        }
+        // Brutal but effective.
+        if (_childProcess)
+            _childProcess->terminate();
 
-        if (std::chrono::duration_cast<std::chrono::milliseconds>
-                    (now - lastBWUpdateTime).count() >= COMMAND_TIMEOUT_MS)
-        {
-            lastBWUpdateTime = now;
-            uint64_t sent = 0, recv = 0;
-            getIOStats(sent, recv);
+        stop("Convert-to timed out");
+        return true;
+    }
 
-            uint64_t deltaSent = 0, deltaRecv = 0;
+    if (std::chrono::duration_cast<std::chrono::milliseconds>
+                (now - _lastBWUpdateTime).count() >= COMMAND_TIMEOUT_MS)
+    {
+        _lastBWUpdateTime = now;
+        uint64_t sent = 0, recv = 0;
+        getIOStats(sent, recv);
 
-            // connection drop transiently reduces this.
-            if (sent > adminSent)
-            {
-                deltaSent = sent - adminSent;
-                adminSent = sent;
-            }
-            if (recv > deltaRecv)
-            {
-                deltaRecv = recv - adminRecv;
-                adminRecv = recv;
-            }
-            LOG_TRC("Doc [" << _docKey << "] added stats sent: +" << deltaSent << ", recv: +" << deltaRecv << " bytes to totals.");
+        uint64_t deltaSent = 0, deltaRecv = 0;
 
-            // send change since last notification.
-            Admin::instance().addBytes(getDocKey(), deltaSent, deltaRecv);
+        // connection drop transiently reduces this.
+        if (sent > _adminSent)
+        {
+            deltaSent = sent - _adminSent;
+            _adminSent = sent;
+        }
+        if (recv > deltaRecv)
+        {
+            deltaRecv = recv - _adminRecv;
+            _adminRecv = recv;
         }
+        LOG_TRC("Doc [" << _docKey << "] added stats sent: +" << deltaSent << ", recv: +" << deltaRecv << " bytes to totals.");
 
-        if (_storage && _lockCtx->needsRefresh(now))
-            refreshLock();
+        // send change since last notification.
+        Admin::instance().addBytes(getDocKey(), deltaSent, deltaRecv);
+    }
+
+    if (_storage && _lockCtx->needsRefresh(now))
+        refreshLock();
 #endif
 
-        LOG_TRC("Poll: current activity: " << DocumentState::toString(_docState.activity()));
-        switch (_docState.activity())
+    LOG_TRC("Poll: current activity: " << DocumentState::toString(_docState.activity()));
+    switch (_docState.activity())
+    {
+        case DocumentState::Activity::None:
         {
-            case DocumentState::Activity::None:
+            // Check if there are queued activities.
+            if (!_renameFilename.empty() && !_renameSessionId.empty())
             {
-                // Check if there are queued activities.
-                if (!_renameFilename.empty() && !_renameSessionId.empty())
-                {
-                    startRenameFileCommand();
-                    // Nothing more to do until the save is complete.
-                    continue;
-                }
+                startRenameFileCommand();
+                // Nothing more to do until the save is complete.
+                return true;
+            }
 
 #if !MOBILEAPP
-                // Remove idle documents after 1 hour.
-                if (isLoaded() && getIdleTimeSecs() >= IdleDocTimeoutSecs)
-                {
-                    autoSaveAndStop("idle");
-                }
-                else
+            // Remove idle documents after 1 hour.
+            if (isLoaded() && getIdleTimeSecs() >= IdleDocTimeoutSecs)
+            {
+                autoSaveAndStop("idle");
+            }
+            else
 #endif
-                if (_sessions.empty() && (isLoaded() || _docState.isMarkedToDestroy()))
-                {
-                    if (!isLoaded())
-                    {
-                        // Nothing to do; no sessions, not loaded, marked to destroy.
-                        stop("dead");
-                    }
-                    else if (_saveManager.isSaving() || isAsyncUploading())
-                    {
-                        LOG_DBG("Don't terminate dead DocumentBroker: async saving in progress for "
-                                "docKey ["
-                                << getDocKey() << "].");
-                        continue;
-                    }
-
-                    autoSaveAndStop("dead");
-                }
-                else if (_docState.isUnloadRequested() || SigUtil::getShutdownRequestFlag() ||
-                         _docState.isCloseRequested())
+            if (_sessions.empty() && (isLoaded() || _docState.isMarkedToDestroy()))
+            {
+                if (!isLoaded())
                 {
-                    if (limStoreFailures > 0 && (_saveManager.saveFailureCount() >=
-                                                     static_cast<std::size_t>(limStoreFailures) ||
-                                                 _storageManager.uploadFailureCount() >=
-                                                     static_cast<std::size_t>(limStoreFailures)))
-                    {
-                        LOG_ERR("Failed to store the document and reached maximum retry count of "
-                                << limStoreFailures
-                                << ". Giving up. The document should be recoverable from the "
-                                   "quarantine. Save failures: "
-                                << _saveManager.saveFailureCount()
-                                << ", Upload failures: " << _storageManager.uploadFailureCount());
-                        stop("storefailed");
-                        continue;
-                    }
-
-                    const std::string reason =
-                        SigUtil::getShutdownRequestFlag()
-                            ? "recycling"
-                            : (!_closeReason.empty() ? _closeReason : "unloading");
-                    autoSaveAndStop(reason);
+                    // Nothing to do; no sessions, not loaded, marked to destroy.
+                    stop("dead");
                 }
-                else if (!_stop && _saveManager.needAutoSaveCheck())
+                else if (_saveManager.isSaving() || isAsyncUploading())
                 {
-                    LOG_TRC("Triggering an autosave.");
-                    autoSave(false);
+                    LOG_DBG("Don't terminate dead DocumentBroker: async saving in progress for "
+                            "docKey ["
+                            << getDocKey() << "].");
+                    return true;
                 }
-                else if (!isAsyncUploading() && !_storageManager.lastUploadSuccessful() &&
-                         needToUploadToStorage() != NeedToUpload::No)
+
+                autoSaveAndStop("dead");
+            }
+            else if (_docState.isUnloadRequested() || SigUtil::getShutdownRequestFlag() ||
+                     _docState.isCloseRequested())
+            {
+                if (_limitStoreFailures > 0 &&
+                    (_saveManager.saveFailureCount() >=
+                         static_cast<std::size_t>(_limitStoreFailures) ||
+                     _storageManager.uploadFailureCount() >=
+                         static_cast<std::size_t>(_limitStoreFailures)))
                 {
-                    // Retry uploading, if the last one failed and we can try again.
-                    const auto session = getWriteableSession();
-                    if (session && !session->getAuthorization().isExpired())
-                    {
-                        checkAndUploadToStorage(session);
-                    }
+                    LOG_ERR("Failed to store the document and reached maximum retry count of "
+                            << _limitStoreFailures
+                            << ". Giving up. The document should be recoverable from the "
+                               "quarantine. Save failures: "
+                            << _saveManager.saveFailureCount()
+                            << ", Upload failures: " << _storageManager.uploadFailureCount());
+                    stop("storefailed");
+                    return true;
                 }
+
+                const std::string reason =
+                    SigUtil::getShutdownRequestFlag()
+                        ? "recycling"
+                        : (!_closeReason.empty() ? _closeReason : "unloading");
+                autoSaveAndStop(reason);
+            }
+#if !MOBILEAPP
+            else if (HibernateSecs > 0 && isLoaded() && getIdleTimeSecs() >= HibernateSecs)
+            {
+                // Free the kit while the users are away, they load it again when back.
+                autoSaveAndStop("hibernated");
+            }
+#endif
+            else if (!_stop && _saveManager.needAutoSaveCheck())
+            {
+                LOG_TRC("Triggering an autosave.");
+                autoSave(false);
             }
-            break;
-
-            case DocumentState::Activity::Save:
-            case DocumentState::Activity::SaveAs:
+            else if (!isAsyncUploading() && !_storageManager.lastUploadSuccessful() &&
+                     needToUploadToStorage() != NeedToUpload::No)
             {
-                if (_docState.isDisconnected())
+                // Retry uploading, if the last one failed and we can try again.
+                const auto session = getWriteableSession();
+                if (session && !session->getAuthorization().isExpired())
                 {
-                    // We will never save. No need to wait for timeout.
-                    LOG_DBG("Doc disconnected while saving. Ending save activity.");
-                    _saveManager.setLastSaveResult(false);
-                    endActivity();
-                }
-                else
-                if (_saveManager.hasSavingTimedOut())
-                {
-                    LOG_DBG("Saving timedout. Ending save activity.");
-                    _saveManager.setLastSaveResult(false);
-                    endActivity();
+                    checkAndUploadToStorage(session);
                 }
             }
-            break;
+        }
+        break;
 
-            // We have some activity ongoing.
-            default:
+        case DocumentState::Activity::Save:
+        case DocumentState::Activity::SaveAs:
+        {
+            if (_docState.isDisconnected())
             {
-                constexpr std::chrono::seconds postponeAutosaveDuration(30);
-                LOG_TRC("Postponing autosave check by " << postponeAutosaveDuration);
-                _saveManager.postponeAutosave(postponeAutosaveDuration);
+                // We will never save. No need to wait for timeout.
+                LOG_DBG("Doc disconnected while saving. Ending save activity.");
+                _saveManager.setLastSaveResult(false);
+                endActivity();
             }
-            break;
+            else
+            if (_saveManager.hasSavingTimedOut())
+            {
+                LOG_DBG("Saving timedout. Ending save activity.");
+                _saveManager.setLastSaveResult(false);
+                endActivity();
+            }
+        }
+        break;
+
+        // We have some activity ongoing.
+        default:
+        {
+            constexpr std::chrono::seconds postponeAutosaveDuration(30);
+            LOG_TRC("Postponing autosave check by " << postponeAutosaveDuration);
+            _saveManager.postponeAutosave(postponeAutosaveDuration);
         }
+        break;
+    }
 
 #if !MOBILEAPP
-        if (std::chrono::duration_cast<std::chrono::minutes>(now - lastClipboardHashUpdateTime).count() >= 2)
+    if (std::chrono::duration_cast<std::chrono::minutes>(now - _lastClipboardHashUpdateTime).count() >= 2)
+    {
+        for (auto &it : _sessions)
         {
-            for (auto &it : _sessions)
+            if (it.second->staleWaitDisconnect(now))
             {
-                if (it.second->staleWaitDisconnect(now))
-                {
-                    std::string id = it.second->getId();
-                    LOG_WRN("Unusual, Kit session " + id + " failed its disconnect handshake, killing");
-                    finalRemoveSession(it.second);
-                    break; // it invalid.
-                }
+                std::string id = it.second->getId();
+                LOG_WRN("Unusual, Kit session " + id + " failed its disconnect handshake, killing");
+                finalRemoveSession(it.second);
+                break; // it invalid.
             }
         }
+    }
 
-        if (std::chrono::duration_cast<std::chrono::minutes>(now - lastClipboardHashUpdateTime).count() >= 5)
-        {
-            LOG_TRC("Rotating clipboard keys");
-            for (auto &it : _sessions)
-                it.second->rotateClipboardKey(true);
+    if (std::chrono::duration_cast<std::chrono::minutes>(now - _lastClipboardHashUpdateTime).count() >= 5)
+    {
+        LOG_TRC("Rotating clipboard keys");
+        for (auto &it : _sessions)
+            it.second->rotateClipboardKey(true);
 
-            lastClipboardHashUpdateTime = now;
-        }
-#endif
+        _lastClipboardHashUpdateTime = now;
     }
+#endif
+
+    return true;
+}
 
+void DocumentBroker::finishPolling()
+{
     LOG_INF("Finished polling doc ["
             << _docKey << "]. stop: " << _stop << ", continuePolling: " << _poll->continuePolling()
             << ", CloseReason: [" << _closeReason << ']'
@@ -565,8 +1025,9 @@ void DocumentBroker::pollThread()
         LOG_WRN(state.str());
     }
 
-    // Flush socket data first, if any.
-    if (_poll->getSocketCount())
+    // Flush socket data first, if any. A shared poll has the sockets of other
+    // documents too, so we flush ours there once done, and remove them.
+    if (!_sharedPoll && _poll->getSocketCount())
     {
         constexpr auto flushTimeoutMicroS =
             std::chrono::microseconds(POLL_TIMEOUT_MICRO_S * 2); // ~2000ms
@@ -597,12 +1058,36 @@ void DocumentBroker::pollThread()
         LOG_INF("Finished flushing socket for doc [" << _docKey << ']');
     }
 
+#if !MOBILEAPP
+    if (_closeReason == "hibernated" && !dataLoss)
+    {
+        // Keep the tiles to show when the users return, before they can.
+        if (_tileCache)
+        {
+            _tileCache->persistTiles(_storageManager.getFileHash());
+            _tileCache->closeStore();
+        }
+
+        std::lock_guard<std::mutex> lock(HibernatedDocsMutex);
+        HibernatedDocs[_docKey] = std::chrono::steady_clock::now();
+    }
+#endif
+
     // Terminate properly while we can.
     LOG_DBG("Terminating child with reason: [" << _closeReason << ']');
     terminateChild(_closeReason);
 
-    // Stop to mark it done and cleanup.
-    _poll->stop();
+    // Stop to mark it done and cleanup, unless others poll there too.
+    if (!_sharedPoll)
+        _poll->stop();
+    else
+    {
+        removePolledSockets();
+#if !MOBILEAPP
+        // The sessions still waiting for the storage are dropped with their sockets.
+        _storageFetchQueue.clear();
+#endif
+    }
 
 #if !MOBILEAPP
     if (dataLoss)
@@ -650,11 +1135,15 @@ void DocumentBroker::pollThread()
         _tileCache->clear();
 
     LOG_INF("Finished docBroker polling thread for docKey [" << _docKey << ']');
+    _pollState = PollState::Finished;
 }
 
 bool DocumentBroker::isAlive() const
 {
-    if (!_stop || _poll->isAlive())
+    const bool polling = _sharedPoll ? (_pollState == PollState::Queued ||
+                                        _pollState == PollState::Polling)
+                                     : _poll->isAlive();
+    if (!_stop || polling)
         return true; // Polling thread not started or still running.
 
     // Shouldn't have live child process outside of the polling thread.
@@ -669,7 +1158,7 @@ DocumentBroker::~DocumentBroker()
             "] destroyed with " << _sessions.size() << " sessions left.");
 
     // Do this early - to avoid operating on _childProcess from two threads.
-    _poll->joinThread();
+    joinThread();
 
     if (!_sessions.empty())
         LOG_WRN("Destroying DocumentBroker [" << _docKey << "] while having " << _sessions.size()
@@ -692,7 +1181,29 @@ DocumentBroker::~DocumentBroker()
 
 void DocumentBroker::joinThread()
 {
-    _poll->joinThread();
+    if (!_sharedPoll)
+    {
+        _poll->joinThread();
+        return;
+    }
+
+    // Stop polling, as joining our own thread would, and wait for the shared one to finish us.
+    if (_pollState != PollState::Queued && _pollState != PollState::Polling)
+        return;
+
+    if (_poll->getThreadOwner() == std::this_thread::get_id())
+    {
+        LOG_ERR("DEADLOCK PREVENTED: joining own thread!");
+        return;
+    }
+
+    _stop = true;
+    _poll->wakeup();
+    while ((_pollState == PollState::Queued || _pollState == PollState::Polling) &&
+           _poll->isAlive())
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
 }
 
 void DocumentBroker::stop(const std::string& reason)
@@ -728,6 +1239,17 @@ bool DocumentBroker::download(const std::shared_ptr<ClientSession>& session, con
             return result;
     }
 
+#if !MOBILEAPP
+    // What we got from the storage off our shared poll thread, if anything.
+    std::shared_ptr<StorageFetch> fetch;
+    const auto fetchIt = _storageFetches.find(sessionId);
+    if (fetchIt != _storageFetches.end())
+    {
+        fetch = fetchIt->second;
+        _storageFetches.erase(fetchIt);
+    }
+#endif
+
     if (_docState.isMarkedToDestroy())
     {
         // Tearing down.
@@ -760,6 +1282,17 @@ bool DocumentBroker::download(const std::shared_ptr<ClientSession>& session, con
 
         try
         {
+#if !MOBILEAPP
+            if (fetch && fetch->_error && !fetch->_storage)
+                std::rethrow_exception(fetch->_error);
+
+            if (fetch)
+            {
+                _storage = std::move(fetch->_storage);
+                _lockCtx = std::move(fetch->_lockCtx);
+            }
+            else
+#endif
             _storage = StorageBase::create(uriPublic, jailRoot, jailPath.toString(),
                                            /*takeOwnership=*/isConvertTo());
         }
@@ -792,13 +1325,32 @@ bool DocumentBroker::download(const std::shared_ptr<ClientSession>& session, con
     WopiStorage* wopiStorage = dynamic_cast<WopiStorage*>(_storage.get());
     if (wopiStorage != nullptr)
     {
-        LOG_DBG("CheckFileInfo for docKey [" << _docKey << ']');
-        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
-        std::unique_ptr<WopiStorage::WOPIFileInfo> wopiFileInfo =
-            wopiStorage->getWOPIFileInfo(session->getAuthorization(), *_lockCtx);
+        std::unique_ptr<WopiStorage::WOPIFileInfo> wopiFileInfo;
+        std::chrono::steady_clock::duration checkFileInfoDuration;
+        if (fetch && fetch->_wopiFileInfo)
+        {
+            LOG_DBG("CheckFileInfo for docKey [" << _docKey << "] was called off the poll thread");
+            wopiFileInfo = std::move(fetch->_wopiFileInfo);
+            checkFileInfoDuration = fetch->_checkFileInfoDuration;
+
+            // Called on a storage of its own, which learned what ours would have.
+            if (fetch->_storage)
+                _storage->setFileInfo(fetch->_storage->getFileInfo());
+        }
+        else
+        {
+            if (fetch && fetch->_error)
+                std::rethrow_exception(fetch->_error);
+
+            LOG_DBG("CheckFileInfo for docKey [" << _docKey << ']');
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            wopiFileInfo = wopiStorage->getWOPIFileInfo(session->getAuthorization(), *_lockCtx);
+            checkFileInfoDuration = std::chrono::steady_clock::now() - start;
+        }
 
-        checkFileInfoCallDurationMs = std::chrono::duration_cast<std::chrono::milliseconds>(
-            std::chrono::steady_clock::now() - start);
+        checkFileInfoCallDurationMs =
+            std::chrono::duration_cast<std::chrono::milliseconds>(checkFileInfoDuration);
+        observeLoadPhase("checkfileinfo", checkFileInfoDuration);
 
         userId = wopiFileInfo->getUserId();
         username = wopiFileInfo->getUsername();
@@ -1041,19 +1593,45 @@ bool DocumentBroker::download(const std::shared_ptr<ClientSession>& session, con
 
     // Let's download the document now, if not downloaded.
     std::chrono::milliseconds getFileCallDurationMs = std::chrono::milliseconds::zero();
-    if (!_storage->isDownloaded())
+#if !MOBILEAPP
+    const bool fetchedFile = fetch && !fetch->_localPath.empty();
+#else
+    const bool fetchedFile = false;
+#endif
+    if (!_storage->isDownloaded() || fetchedFile)
     {
-        LOG_DBG("Download file for docKey [" << _docKey << ']');
-        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
-        std::string localPath = _storage->downloadStorageFileToLocal(session->getAuthorization(),
-                                                                     *_lockCtx, templateSource);
+        std::string localPath;
+        std::chrono::steady_clock::duration getFileDuration;
+#if !MOBILEAPP
+        if (fetchedFile)
+        {
+            LOG_DBG("Downloaded file for docKey [" << _docKey << "] off the poll thread");
+            localPath = fetch->_localPath;
+            getFileDuration = fetch->_getFileDuration;
+        }
+        else
+#endif
+        {
+#if !MOBILEAPP
+            if (fetch && fetch->_error)
+                std::rethrow_exception(fetch->_error);
+#endif
+
+            LOG_DBG("Download file for docKey [" << _docKey << ']');
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            localPath = _storage->downloadStorageFileToLocal(session->getAuthorization(),
+                                                             *_lockCtx, templateSource);
+            getFileDuration = std::chrono::steady_clock::now() - start;
+        }
+
         if (localPath.empty())
         {
             throw std::runtime_error("Failed to retrieve document from storage");
         }
 
-        getFileCallDurationMs = std::chrono::duration_cast<std::chrono::milliseconds>(
-            std::chrono::steady_clock::now() - start);
+        getFileCallDurationMs =
+            std::chrono::duration_cast<std::chrono::milliseconds>(getFileDuration);
+        observeLoadPhase("download", getFileDuration);
 
         _docState.setStatus(DocumentState::Status::Loading); // Done downloading.
 
@@ -1140,13 +1718,20 @@ bool DocumentBroker::download(const std::shared_ptr<ClientSession>& session, con
 #endif
 
         const std::string localFilePath = Poco::Path(getJailRoot(), localPath).toString();
-        std::ifstream istr(localFilePath, std::ios::binary);
-        Poco::SHA1Engine sha1;
-        Poco::DigestOutputStream dos(sha1);
-        Poco::StreamCopier::copyStream(istr, dos);
-        dos.close();
-        LOG_INF("SHA1 for DocKey [" << _docKey << "] of [" << LOOLWSD::anonymizeUrl(localPath) << "]: " <<
-                Poco::DigestEngine::digestToHex(sha1.digest()));
+        std::string sha1;
+        std::string fileHash;
+#if !MOBILEAPP
+        // Hashed off the poll thread, unless a prefilter replaced the file since.
+        if (fetchedFile && localPath == fetch->_localPath)
+        {
+            sha1 = fetch->_sha1;
+            fileHash = fetch->_fileHash;
+        }
+        else
+#endif
+            sha1 = getFileSha1(localFilePath);
+
+        LOG_INF("SHA1 for DocKey [" << _docKey << "] of [" << LOOLWSD::anonymizeUrl(localPath) << "]: " << sha1);
 
         std::string localPathEncoded;
         Poco::URI::encode(localPath, "#?", localPathEncoded);
@@ -1183,6 +1768,27 @@ bool DocumentBroker::download(const std::shared_ptr<ClientSession>& session, con
         _tileCache = Util::make_unique<TileCache>(_storage->getUri().toString(),
                                                   _saveManager.getLastModifiedTime(), dontUseCache);
         _tileCache->setThreadOwner(std::this_thread::get_id());
+
+#if !MOBILEAPP
+        // By contents, so the tiles are valid for any copy of the document, and only for it.
+        if (TileStore::isEnabled() && !dontUseCache)
+        {
+            // Hashing a large document, and indexing its segment, would stall the poll thread.
+            std::shared_ptr<DocumentBroker> docBroker = shared_from_this();
+            std::thread(
+                [=]()
+                {
+                    Util::setThreadName("dochash_" + docBroker->_docId);
+                    const std::string hash =
+                        fileHash.empty() ? FileUtil::hashFile(localFilePath) : fileHash;
+                    // Shared, as callbacks are copied.
+                    auto store = std::make_shared<std::unique_ptr<TileStore>>(TileStore::open(hash));
+                    docBroker->addCallback([=]()
+                                           { docBroker->setTileStore(hash, std::move(*store)); });
+                })
+                .detach();
+        }
+#endif
     }
 
 #if !MOBILEAPP
@@ -1444,6 +2050,12 @@ void DocumentBroker::handleSaveResponse(const std::shared_ptr<ClientSession>& se
     // Record that we got a response to avoid timing out on saving.
     _saveManager.setLastSaveResult(success || result == "unmodified");
 
+#if !MOBILEAPP
+    static LatencyHistogram& saveHistogram = LatencyHistogram::get(
+        "document_save_duration_seconds", "", "Duration of saving documents in Core.");
+    saveHistogram.observe(_saveManager.lastSaveDuration());
+#endif
+
     if (success)
         LOG_DBG("Save result from Core: saved (during "
                 << DocumentState::toString(_docState.activity()) << ") in "
@@ -1697,10 +2309,73 @@ void DocumentBroker::uploadToStorageInternal(const std::shared_ptr<ClientSession
         return;
     }
 
+    // Saving touches the file even when its contents are what we uploaded last,
+    // e.g. when only the modified flag had toggled. Don't upload the same bytes again.
+    std::string newFileHash;
+    if (!isSaveAs && !isRename)
+    {
+        if (newFileModifiedTime == _hashedFileModifiedTime)
+            newFileHash = _hashedFile;
+#if !MOBILEAPP
+        else if (_sharedPoll)
+        {
+            // Hashing a large document would stall the other documents of the shared thread.
+            LOG_DBG("Hashing [" << _docKey << "] off the poll thread before uploading");
+            _uploadHashing = true;
+            std::shared_ptr<DocumentBroker> docBroker = shared_from_this();
+            std::thread(
+                [=]()
+                {
+                    Util::setThreadName("dochash_" + docBroker->_docId);
+                    const std::string fileHash = FileUtil::hashFile(filePath);
+                    docBroker->addCallback(
+                        [=]()
+                        {
+                            docBroker->_uploadHashing = false;
+                            docBroker->_hashedFileModifiedTime = newFileModifiedTime;
+                            docBroker->_hashedFile = fileHash;
+                            docBroker->uploadToStorageInternal(session, saveAsPath, saveAsFilename,
+                                                               isRename, isExport, force);
+                        });
+                })
+                .detach();
+            return;
+        }
+#endif
+        else
+            newFileHash = FileUtil::hashFile(filePath);
+
+        if (!force && !newFileHash.empty() &&
+            newFileHash == _storageManager.getLastUploadedFileHash() &&
+            _storageManager.lastUploadSuccessful() && !_documentChangedInStorage &&
+            _docState.activity() != DocumentState::Activity::Rename &&
+            !(isUnloading() && _alwaysSaveOnExit))
+        {
+            const std::size_t size = FileUtil::Stat(filePath).size();
+            LOG_DBG("Skipping unnecessary uploading to URI ["
+                    << uriAnonym << "] with docKey [" << _docKey << "]. The " << size
+                    << " bytes saved are identical to those uploaded last.");
+
+            // The storage has this very file; as if we had just uploaded it.
+            _saveManager.setLastModifiedTime(newFileModifiedTime);
+            _storageManager.setLastUploadedFileModifiedTime(newFileModifiedTime);
+
+#if !MOBILEAPP
+            Admin::instance().addSkippedUpload(size);
+            if (!isModified())
+                Admin::instance().uploadedAlert(_docKey, getPid(), true);
+#endif
+
+            _poll->wakeup();
+            broadcastSaveResult(true, "unmodified");
+            return;
+        }
+    }
+
     LOG_DBG("Uploading [" << _docKey << "] after saving to URI [" << uriAnonym << "].");
 
-    _uploadRequest = Util::make_unique<UploadRequest>(uriAnonym, newFileModifiedTime, session,
-                                                      isSaveAs, isExport, isRename);
+    _uploadRequest = Util::make_unique<UploadRequest>(uriAnonym, newFileModifiedTime, newFileHash,
+                                                      session, isSaveAs, isExport, isRename);
 
     StorageBase::AsyncUploadCallback asyncUploadCallback =
         [this](const StorageBase::AsyncUpload& asyncUp)
@@ -1788,6 +2463,12 @@ void DocumentBroker::handleUploadToStorageResponse(const StorageBase::UploadResu
     LOG_TRC("lastUploadSuccessful: " << lastUploadSuccessful);
     _storageManager.setLastUploadResult(lastUploadSuccessful);
 
+#if !MOBILEAPP
+    static LatencyHistogram& uploadHistogram = LatencyHistogram::get(
+        "document_upload_duration_seconds", "", "Duration of uploading documents to storage.");
+    uploadHistogram.observe(_storageManager.lastUploadDuration());
+#endif
+
     _unitWsd.onDocumentUploaded(lastUploadSuccessful);
 
 #if !MOBILEAPP
@@ -1821,6 +2502,9 @@ void DocumentBroker::handleUploadToStorageResponse(const StorageBase::UploadResu
             // Set the timestamp of the file we uploaded, to detect changes.
             _storageManager.setLastUploadedFileModifiedTime(_uploadRequest->newFileModifiedTime());
 
+            // And its hash, to detect when saving didn't change it.
+            _storageManager.setLastUploadedFileHash(_uploadRequest->newFileHash());
+
             // After a successful save, we are sure that document in the storage is same as ours
             _documentChangedInStorage = false;
 
@@ -2086,9 +2770,36 @@ void DocumentBroker::setLoaded()
             std::max(std::chrono::seconds(minTimeoutSecs), std::chrono::seconds(5)));
         LOG_DBG("Document loaded in " << _loadDuration << ", saving-timeout set to "
                                       << _saveManager.getSavingTimeout());
+        observeLoadPhase("total", _loadDuration);
+
+#if !MOBILEAPP
+        std::unique_lock<std::mutex> lock(HibernatedDocsMutex);
+        if (HibernatedDocs.erase(_docKey))
+        {
+            lock.unlock();
+            LOG_INF("Restored hibernated doc [" << _docKey << "] in " << _loadDuration);
+            static LatencyHistogram& restoreHistogram = LatencyHistogram::get(
+                "document_restore_duration_seconds", "",
+                "Duration of loading hibernated documents again, when their users return.");
+            restoreHistogram.observe(_loadDuration);
+        }
+#endif
     }
 }
 
+void DocumentBroker::observeLoadPhase(const std::string& phase,
+                                      std::chrono::steady_clock::duration duration)
+{
+#if !MOBILEAPP
+    LatencyHistogram::get("document_load_duration_seconds", "phase=\"" + phase + '"',
+                          "Duration of the document load phases, by phase.")
+        .observe(duration);
+#else
+    (void)phase;
+    (void)duration;
+#endif
+}
+
 void DocumentBroker::setInteractive(bool value)
 {
     if (isInteractive() != value)
@@ -2829,11 +3540,34 @@ std::shared_ptr<ClientSession> DocumentBroker::createNewClientSession(
 
 void DocumentBroker::addCallback(const SocketPoll::CallbackFn& fn)
 {
-    _poll->addCallback(fn);
+    if (!_sharedPoll)
+    {
+        _poll->addCallback(fn);
+        return;
+    }
+
+    // Our own thread runs callbacks only once it has a child, and never after it finishes.
+    startSharedPolling();
+
+    std::shared_ptr<DocumentBroker> docBroker = shared_from_this();
+    _poll->addCallback(
+        [docBroker, fn]()
+        {
+            if (docBroker->_pollState == PollState::Queued)
+                docBroker->_queuedCallbacks.emplace_back(
+                    [docBroker, fn]()
+                    {
+                        if (docBroker->_pollState == PollState::Polling)
+                            fn();
+                    });
+            else if (docBroker->_pollState == PollState::Polling)
+                fn();
+        });
 }
 
 void DocumentBroker::addSocketToPoll(const std::shared_ptr<Socket>& socket)
 {
+    trackPolledSocket(socket);
     _poll->insertNewSocket(socket);
 }
 
@@ -2956,6 +3690,27 @@ bool DocumentBroker::handleInput(const std::shared_ptr<Message>& message)
                                                       message->size() - firstLine.size() - 1);
             }
         }
+        else if (message->firstTokenMatches("histograms:"))
+        {
+#if !MOBILEAPP
+            // The latency histograms observed in the kit, since its last report.
+            const auto firstLine = message->firstLine();
+            if (firstLine.size() < message->size())
+                LatencyHistogram::mergeSerialized(
+                    std::string(message->data().data() + firstLine.size() + 1,
+                                message->size() - firstLine.size() - 1),
+                    LatencyHistogram::KitHistograms);
+#endif
+        }
+        else if (message->firstTokenMatches("deltamemory:"))
+        {
+#if !MOBILEAPP
+            uint64_t bytes = 0;
+            if (message->tokens().size() == 2
+                && LOOLProtocol::getTokenUInt64(message->tokens()[1], "bytes", bytes))
+                Admin::instance().setDocDeltaBytes(_docKey, bytes);
+#endif
+        }
         else if (message->firstTokenMatches("forcedtraceevent:"))
         {
             LOG_CHECK_RET(message->tokens().size() == 1, false);
@@ -3837,9 +4592,14 @@ void ConvertToBroker::setLoaded()
     if (isGetThumbnail())
         return;
 
+    sendSaveAs(_format);
+}
+
+void ConvertToBroker::sendSaveAs(const std::string& format)
+{
     // FIXME: Check for security violations.
     Poco::Path toPath(getPublicUri().getPath());
-    toPath.setExtension(_format);
+    toPath.setExtension(format);
 
     // file:///user/docs/filename.ext normally, file:///<jail-root>/user/docs/filename.ext in the nocaps case
     const std::string toJailURL = "file://" +
@@ -3850,7 +4610,7 @@ void ConvertToBroker::setLoaded()
     Poco::URI::encode(toJailURL, "", encodedTo);
 
     // Convert it to the requested format.
-    const std::string saveAsCmd = "saveas url=" + encodedTo + " format=" + _format + " options=" + _sOptions;
+    const std::string saveAsCmd = "saveas url=" + encodedTo + " format=" + format + " options=" + _sOptions;
 
     // Send the save request ...
     std::vector<char> saveasRequest(saveAsCmd.begin(), saveAsCmd.end());
@@ -3858,6 +4618,240 @@ void ConvertToBroker::setLoaded()
     _clientSession->handleMessage(saveasRequest);
 }
 
+bool ConvertBatchBroker::parseOutputs(const std::string& list, std::vector<Output>& outputs)
+{
+    outputs.clear();
+    const StringVector tokens = StringVector::tokenize(list, ',');
+    for (std::size_t i = 0; i < tokens.size(); ++i)
+    {
+        Output output;
+        output._name = Util::trimmed(tokens[i]);
+        output._width = 0;
+        output._height = 0;
+        if (output._name == "extract-link-targets")
+        {
+            output._kind = Output::Kind::LinkTargets;
+        }
+        else if (output._name == "thumbnail")
+        {
+            output._kind = Output::Kind::Thumbnail;
+            output._width = 1200;
+            output._height = 630;
+        }
+        else if (Util::startsWith(output._name, "thumbnail-"))
+        {
+            output._kind = Output::Kind::Thumbnail;
+            char end = '\0';
+            if (std::sscanf(output._name.c_str(), "thumbnail-%dx%d%c", &output._width,
+                            &output._height, &end) != 2 ||
+                output._width <= 0 || output._height <= 0 || output._width > 4096 ||
+                output._height > 4096)
+            {
+                return false;
+            }
+        }
+        else if (!output._name.empty() &&
+                 std::all_of(output._name.begin(), output._name.end(), [](unsigned char c) {
+                     return std::isalnum(c) || c == '-' || c == '_';
+                 }))
+        {
+            output._kind = Output::Kind::SaveAs;
+            output._format = output._name;
+        }
+        else
+        {
+            return false;
+        }
+
+        outputs.push_back(output);
+    }
+
+    return !outputs.empty();
+}
+
+ConvertBatchBroker::ConvertBatchBroker(const std::string& uri,
+                                       const Poco::URI& uriPublic,
+                                       const std::string& docKey,
+                                       std::vector<Output> outputs,
+                                       const std::string& sOptions,
+                                       const std::string& lang)
+    : ConvertToBroker(uri, uriPublic, docKey, std::string(), sOptions, lang)
+    , _outputs(std::move(outputs))
+    , _loadTime(std::chrono::steady_clock::duration::zero())
+    , _start(std::chrono::steady_clock::now())
+{
+}
+
+void ConvertBatchBroker::setLoaded()
+{
+    DocumentBroker::setLoaded();
+
+    // Once, the status is sent again on reloading.
+    if (_loadTime != std::chrono::steady_clock::duration::zero())
+        return;
+
+    _loadTime = std::chrono::steady_clock::now() - _start;
+    startOutput();
+}
+
+void ConvertBatchBroker::startOutput()
+{
+    const Output& output = _outputs[_results.size()];
+    LOG_DBG("Batch conversion of [" << getDocKey() << "] to output " << _results.size() + 1
+                                    << " of " << _outputs.size() << ": " << output._name);
+    _start = std::chrono::steady_clock::now();
+    switch (output._kind)
+    {
+        case Output::Kind::SaveAs:
+            sendSaveAs(output._format);
+            break;
+
+        case Output::Kind::Thumbnail:
+            // Of the start of the document.
+            forwardToChild(_clientSession, "getthumbnail x=0 y=0 width=" +
+                                               std::to_string(output._width) +
+                                               " height=" + std::to_string(output._height));
+            break;
+
+        case Output::Kind::LinkTargets:
+        {
+            std::string encodedFrom;
+            Poco::URI::encode(getPublicUri().getPath(), "", encodedFrom);
+            forwardToChild(_clientSession, "extractlinktargets url=" + encodedFrom);
+            break;
+        }
+    }
+}
+
+void ConvertBatchBroker::outputDone(std::string data, const std::string& contentType,
+                                    const std::string& fileName, const std::string& errorKind)
+{
+    addResult(std::move(data), std::string(), contentType, fileName, errorKind);
+}
+
+void ConvertBatchBroker::outputFileDone(const std::string& path, const std::string& contentType,
+                                        const std::string& fileName)
+{
+    addResult(std::string(), path, contentType, fileName, std::string());
+}
+
+void ConvertBatchBroker::addResult(std::string data, std::string path,
+                                   const std::string& contentType, const std::string& fileName,
+                                   const std::string& errorKind)
+{
+    if (_results.size() >= _outputs.size())
+    {
+        LOG_WRN("Unexpected output of batch conversion of [" << getDocKey() << ']');
+        return;
+    }
+
+    _results.push_back({ std::move(data), std::move(path), contentType, fileName, errorKind,
+                         std::chrono::steady_clock::now() - _start });
+
+    if (_results.size() < _outputs.size())
+        startOutput();
+    else
+        sendResponse();
+}
+
+void ConvertBatchBroker::sendResponse()
+{
+    const auto ms = [](std::chrono::steady_clock::duration duration) {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
+    };
+
+    // The timings, in the standard header for them, so tools show them.
+    std::ostringstream timing;
+    timing << "load;dur=" << ms(_loadTime);
+
+    // The header of each part, and its file, to size the body without building it.
+    const std::string boundary = "batch-" + Util::rng::getHexString(16);
+    std::vector<std::string> partHeaders;
+    std::vector<std::unique_ptr<std::ifstream>> files;
+    std::vector<std::size_t> sizes;
+    std::size_t contentLength = 0;
+    for (std::size_t i = 0; i < _results.size(); ++i)
+    {
+        const Result& result = _results[i];
+        timing << ", " << _outputs[i]._name << ";dur=" << ms(result._duration);
+
+        std::string header = "--" + boundary + "\r\n";
+        header += "Content-Type: " + result._contentType + "\r\n";
+        header += "Content-Disposition: attachment; name=\"" + _outputs[i]._name + '"';
+        if (!result._fileName.empty())
+            header += "; filename=\"" + result._fileName + '"';
+        header += "\r\n";
+        if (!result._errorKind.empty())
+            header += "X-ERROR-KIND: " + result._errorKind + "\r\n";
+        header += "\r\n";
+
+        std::size_t size = result._data.size();
+        std::unique_ptr<std::ifstream> file;
+        if (!result._path.empty())
+        {
+            file = Util::make_unique<std::ifstream>(result._path, std::ios::binary | std::ios::ate);
+            size = file->good() ? static_cast<std::size_t>(file->tellg()) : 0;
+            file->seekg(0);
+        }
+
+        contentLength += header.size() + size + 2;
+        partHeaders.push_back(std::move(header));
+        files.push_back(std::move(file));
+        sizes.push_back(size);
+    }
+
+    const std::string closing = "--" + boundary + "--\r\n";
+    contentLength += closing.size();
+
+    LOG_INF("Batch conversion of [" << getDocKey() << "] done: " << timing.str());
+
+    const std::shared_ptr<StreamSocket> socket = _clientSession->getSaveAsSocket();
+    http::Response httpResponse(http::StatusCode::OK);
+    httpResponse.set("Last-Modified", Util::getHttpTimeNow());
+    httpResponse.set("X-Content-Type-Options", "nosniff");
+    httpResponse.set("Server-Timing", timing.str());
+    httpResponse.set("Content-Type", "multipart/mixed; boundary=" + boundary);
+    httpResponse.set("Content-Length", std::to_string(contentLength));
+    httpResponse.set("Connection", "close");
+    socket->send(httpResponse);
+
+    // Each part straight into the socket, the files in chunks, never the body as a whole.
+    std::vector<char> chunk;
+    for (std::size_t i = 0; i < _results.size(); ++i)
+    {
+        socket->send(partHeaders[i], false);
+        if (!files[i])
+            socket->send(_results[i]._data, false);
+        else
+        {
+            chunk.resize(std::min<std::size_t>(sizes[i], 64 * 1024));
+            std::size_t left = sizes[i];
+            while (left > 0 && files[i]->read(chunk.data(), std::min(left, chunk.size())))
+            {
+                socket->send(chunk.data(), files[i]->gcount(), false);
+                left -= files[i]->gcount();
+            }
+
+            if (left > 0)
+            {
+                // The length is sent already, the client will see the body cut short.
+                LOG_ERR("Failed to read " << left << " bytes of batch output ["
+                                          << _results[i]._path << ']');
+                break;
+            }
+        }
+
+        socket->send("\r\n", 2, false);
+    }
+
+    socket->send(closing);
+    socket->shutdown();
+
+    // Conversion is done, cleanup the fake session.
+    removeSession(_clientSession);
+    stop("Finished batch conversion.");
+}
+
 
 static std::atomic<std::size_t> gRenderSearchResultBrokerInstanceCouter;
 
@@ -4010,6 +5004,7 @@ void DocumentBroker::dumpState(std::ostream& os)
     os << "\n  doc id: " << _docId;
     os << "\n  num sessions: " << _sessions.size();
     os << "\n  thread start: " << Util::getTimeForLog(now, _threadStart);
+    os << "\n  poll: " << _poll->name() << ' ' << name(_pollState.load());
     os << "\n  stop: " << _stop;
     os << "\n  closeReason: " << _closeReason;
     os << "\n  modified?: " << isModified();
@@ -4054,7 +5049,9 @@ void DocumentBroker::dumpState(std::ostream& os)
     if (_tileCache)
         _tileCache->dumpState(os);
 
-    _poll->dumpState(os);
+    // A shared poll has the sockets of all of its documents.
+    if (!_sharedPoll)
+        _poll->dumpState(os);
 
 #if !MOBILEAPP
     // Bit nasty - need a cleaner way to dump state.
@@ -4078,6 +5075,9 @@ bool DocumentBroker::isAsyncUploading() const
     if (!_storage)
         return false;
 
+    if (_uploadHashing)
+        return true;
+
     StorageBase::AsyncUpload::State state = _storage->queryLocalFileToStorageAsyncUploadState().state();
 
     return state == StorageBase::AsyncUpload::State::Running;
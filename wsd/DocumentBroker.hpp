@@ -22,6 +22,7 @@
 #include <string>
 #include <thread>
 #include <utility>
+#include <vector>
 
 #include <Poco/URI.h>
 
@@ -45,6 +46,7 @@ class PrisonerRequestDispatcher;
 class DocumentBroker;
 struct LockContext;
 class TileCache;
+class TileStore;
 class Message;
 
 /// A ChildProcess object represents a Kit process that hosts a document and manipulates the
@@ -224,6 +226,7 @@ class ClientSession;
 class DocumentBroker : public std::enable_shared_from_this<DocumentBroker>
 {
     class DocumentBrokerPoll;
+    class SharedBrokerPoll;
 
     void setupPriorities();
 
@@ -248,8 +251,11 @@ public:
     virtual void dispose() {}
 
     /// setup the transfer of a socket into this DocumentBroker poll.
+    /// On a shared poll, what loading @session needs from the storage is
+    /// got first, off the poll thread, when @session is given.
     void setupTransfer(SocketDisposition &disposition,
-                       SocketDisposition::MoveFunction transferFn);
+                       SocketDisposition::MoveFunction transferFn,
+                       const std::shared_ptr<ClientSession>& session = nullptr);
 
     /// Flag for termination. Note that this doesn't save any unsaved changes in the document
     void stop(const std::string& reason);
@@ -276,9 +282,26 @@ public:
     /// Thread safe termination of this broker if it has a lingering thread
     void joinThread();
 
+    /// Polls all documents on @count shared threads, instead of a thread
+    /// per document, when @count is positive. Call before creating any
+    /// DocumentBroker; a document always polls on the same thread, by its docKey.
+    static void startPollThreads(int count);
+
+    /// Stops and joins the shared poll threads, once the documents are gone.
+    static void stopPollThreads();
+
     /// Notify that the load has completed
     virtual void setLoaded();
 
+    /// Records the duration of a document load phase in the load histogram.
+    static void observeLoadPhase(const std::string& phase,
+                                 std::chrono::steady_clock::duration duration);
+
+#if !MOBILEAPP
+    /// The number of documents unloaded while idle, whose users may yet return.
+    static std::size_t getHibernatedCount();
+#endif
+
     /// Notify that the document has dialogs before load
     virtual void setInteractive(bool value);
 
@@ -698,6 +721,70 @@ private:
     /// associated with this document.
     void pollThread();
 
+    /// The phases of pollThread(), which a SharedBrokerPoll
+    /// runs for each of its documents instead.
+    /// Gets a child process, returns false if there is none.
+    bool startPolling();
+    /// Waits for a new child process, retrying for a while.
+    std::shared_ptr<ChildProcess> getNewChild();
+    /// Does the work due after each poll. Returns false to stop polling.
+    bool stepPolling();
+    /// Flushes and terminates the child, after polling.
+    void finishPolling();
+
+    /// The longest we should wait in poll.
+    std::chrono::microseconds getPollTimeout() const;
+
+    /// Queues starting to poll on our shared poll thread, once.
+    void startSharedPolling();
+
+    /// Polls @moveSocket and hands it to @transferFn if we poll, or closes it,
+    /// after getting from the storage for @session, if any. In our shared poll thread.
+    void transferSocket(const std::shared_ptr<Socket>& moveSocket,
+                        const SocketDisposition::MoveFunction& transferFn,
+                        const std::shared_ptr<ClientSession>& session);
+
+#if !MOBILEAPP
+    /// What download() needs from the storage for a session, got off our shared poll thread.
+    struct StorageFetch
+    {
+        std::unique_ptr<StorageBase> _storage; //< Becomes ours, unless we have one.
+        std::unique_ptr<LockContext> _lockCtx; //< Goes with _storage.
+        std::unique_ptr<WopiStorage::WOPIFileInfo> _wopiFileInfo;
+        std::chrono::steady_clock::duration _checkFileInfoDuration;
+        std::string _localPath; //< Where GetFile wrote the document, if it was called.
+        std::chrono::steady_clock::duration _getFileDuration;
+        std::string _sha1; //< Of the document at _localPath.
+        std::string _fileHash; //< Of the document at _localPath, for the TileStore.
+        std::exception_ptr _error; //< Thrown by the first of these that failed.
+    };
+
+    /// Gets from the storage for @session on a thread of its own, for one
+    /// session at a time, then transfers @moveSocket. In our shared poll thread.
+    void fetchStorage(const std::shared_ptr<Socket>& moveSocket,
+                      const SocketDisposition::MoveFunction& transferFn,
+                      const std::shared_ptr<ClientSession>& session);
+
+    /// Talks to the storage, in a thread that doesn't poll.
+    static std::shared_ptr<StorageFetch> getFromStorage(const Poco::URI& uriPublic,
+                                                        const Authorization& auth,
+                                                        const std::string& jailRoot,
+                                                        const std::string& jailPath,
+                                                        bool takeOwnership, bool download);
+#endif
+
+#if !MOBILEAPP
+    /// Uses the @store opened for the tiles of the document loaded, by its @fileHash,
+    /// unless the document changed since. In our poll thread.
+    void setTileStore(const std::string& fileHash, std::unique_ptr<TileStore> store);
+#endif
+
+    /// Notes @socket as ours, to remove it from the shared poll when we finish.
+    void trackPolledSocket(const std::shared_ptr<Socket>& socket);
+
+    /// Flushes and closes our sockets, and removes them from the shared poll.
+    void removePolledSockets();
+
     /// Sum the I/O stats from all connected sessions
     void getIOStats(uint64_t &sent, uint64_t &recv);
 
@@ -1058,11 +1145,13 @@ private:
     public:
         UploadRequest(std::string uriAnonym,
                       std::chrono::system_clock::time_point newFileModifiedTime,
+                      std::string newFileHash,
                       const std::shared_ptr<class ClientSession>& session, bool isSaveAs,
                       bool isExport, bool isRename)
             : _startTime(std::chrono::steady_clock::now())
             , _uriAnonym(std::move(uriAnonym))
             , _newFileModifiedTime(newFileModifiedTime)
+            , _newFileHash(std::move(newFileHash))
             , _session(session)
             , _isSaveAs(isSaveAs)
             , _isExport(isExport)
@@ -1082,6 +1171,9 @@ private:
             return _newFileModifiedTime;
         }
 
+        /// The hash of the file we are uploading, empty for SaveAs and Rename.
+        const std::string& newFileHash() const { return _newFileHash; }
+
         std::shared_ptr<class ClientSession> session() const { return _session.lock(); }
         bool isSaveAs() const { return _isSaveAs; }
         bool isExport() const { return _isExport; }
@@ -1091,6 +1183,7 @@ private:
         const std::chrono::steady_clock::time_point _startTime; //< The time we made the request.
         const std::string _uriAnonym;
         const std::chrono::system_clock::time_point _newFileModifiedTime;
+        const std::string _newFileHash;
         const std::weak_ptr<class ClientSession> _session;
         const bool _isSaveAs;
         const bool _isExport;
@@ -1156,6 +1249,26 @@ private:
             _lastUploadedFileModifiedTime = modifiedTime;
         }
 
+        /// Get the hash of the contents of the local file we last uploaded.
+        const std::string& getLastUploadedFileHash() const { return _lastUploadedFileHash; }
+
+        /// Set the hash of the contents of the local file we last uploaded.
+        void setLastUploadedFileHash(const std::string& hash)
+        {
+            _lastUploadedFileHash = hash;
+            _downloadedFileHash.clear(); // Superseded.
+        }
+
+        /// Set the hash of the contents of the local file as we downloaded it.
+        void setDownloadedFileHash(const std::string& hash) { _downloadedFileHash = hash; }
+
+        /// Get the hash of the contents of the local file we last uploaded,
+        /// or, until we upload, as we downloaded it.
+        const std::string& getFileHash() const
+        {
+            return _downloadedFileHash.empty() ? _lastUploadedFileHash : _downloadedFileHash;
+        }
+
         /// Set the last modified time of the document.
         void setLastModifiedTime(const std::string& time) { _lastModifiedTime = time; }
 
@@ -1190,6 +1303,8 @@ private:
             os << indent << "last modified time (on server): " << getLastModifiedTime();
             os << indent
                << "file last modified: " << Util::getTimeForLog(now, _lastUploadedFileModifiedTime);
+            os << indent << "file last uploaded hash: " << _lastUploadedFileHash;
+            os << indent << "file downloaded hash: " << _downloadedFileHash;
             os << indent << "last upload was successful: " << std::boolalpha
                << lastUploadSuccessful();
             os << indent << "upload failure count: " << uploadFailureCount();
@@ -1202,6 +1317,12 @@ private:
         /// The modified-timestamp of the local file on disk we uploaded last.
         std::chrono::system_clock::time_point _lastUploadedFileModifiedTime;
 
+        /// The hash of the contents of the local file we uploaded last.
+        std::string _lastUploadedFileHash;
+
+        /// The hash of the contents of the local file as downloaded, until we upload.
+        std::string _downloadedFileHash;
+
         /// The modified time of the document in storage, as reported by the server.
         std::string _lastModifiedTime;
     };
@@ -1388,6 +1509,11 @@ private:
     /// The current upload request, if any.
     /// For now we can only have one at a time.
     std::unique_ptr<UploadRequest> _uploadRequest;
+    /// True while hashing the saved document, before uploading it.
+    bool _uploadHashing;
+    /// The hash of the saved document, and its timestamp then.
+    std::string _hashedFile;
+    std::chrono::system_clock::time_point _hashedFileModifiedTime;
 
     /// Manage uploading to Storage.
     StorageManager _storageManager;
@@ -1420,8 +1546,33 @@ private:
     int _cursorWidth;
     int _cursorHeight;
     mutable std::mutex _mutex;
-    std::unique_ptr<DocumentBrokerPoll> _poll;
+
+    STATE_ENUM(PollState,
+               None, //< Not polling yet.
+               Queued, //< Waiting to start on a shared poll thread.
+               Polling, //< Polling, on our thread or a shared one.
+               Finished //< Done polling.
+    );
+
+    /// Our own DocumentBrokerPoll, or the SharedBrokerPoll of our docKey.
+    std::shared_ptr<TerminatingPoll> _poll;
+    /// True iff _poll is shared with other documents.
+    const bool _sharedPoll;
+    std::atomic<PollState> _pollState;
     std::atomic<bool> _stop;
+    /// The child got for us off the shared poll thread, before polling there.
+    std::shared_ptr<ChildProcess> _sharedPollChild;
+    /// What the shared poll thread got for us while we were getting the child, in order.
+    std::vector<SocketPoll::CallbackFn> _queuedCallbacks;
+#if !MOBILEAPP
+    /// The sessions waiting to get from the storage off the shared poll thread, in order.
+    std::deque<SocketPoll::CallbackFn> _storageFetchQueue;
+    /// What the storage gave for the sessions being added, by their id.
+    std::map<std::string, std::shared_ptr<StorageFetch>> _storageFetches;
+#endif
+    /// Our sockets on the shared poll.
+    std::mutex _polledSocketsMutex;
+    std::vector<std::weak_ptr<Socket>> _polledSockets;
     std::string _closeReason;
     std::unique_ptr<LockContext> _lockCtx;
     std::string _renameFilename; //< The new filename to rename to.
@@ -1446,9 +1597,27 @@ private:
     std::chrono::milliseconds _loadDuration;
     std::chrono::milliseconds _wopiDownloadDuration;
 
+    /// State carried from one stepPolling() to the next.
+    uint64_t _adminSent; //< Bytes sent as of the last B/W update.
+    uint64_t _adminRecv; //< Bytes received as of the last B/W update.
+    std::chrono::steady_clock::time_point _lastBWUpdateTime;
+    std::chrono::steady_clock::time_point _lastClipboardHashUpdateTime;
+    std::chrono::steady_clock::time_point _loadDeadline;
+    int _limitLoadSecs;
+    int _limitStoreFailures;
+
+    /// The poll threads shared by all documents, if any.
+    static std::vector<std::shared_ptr<SharedBrokerPoll>> SharedPolls;
+
     /// Unique DocBroker ID for tracing and debugging.
     static std::atomic<unsigned> DocBrokerId;
 
+#if !MOBILEAPP
+    /// When each hibernated document, by docKey, was unloaded.
+    static std::map<std::string, std::chrono::steady_clock::time_point> HibernatedDocs;
+    static std::mutex HibernatedDocsMutex;
+#endif
+
     // Relevant only in the mobile apps
     const unsigned _mobileAppDocId;
 
@@ -1528,6 +1697,9 @@ protected:
 
     virtual void sendStartMessage(const std::shared_ptr<ClientSession>& clientSession,
                                   const std::string& encodedFrom);
+
+    /// Requests saving the document in @format, next to the original.
+    void sendSaveAs(const std::string& format);
 };
 
 class ExtractLinkTargetsBroker final : public ConvertToBroker
@@ -1569,6 +1741,77 @@ private:
                           const std::string& encodedFrom) override;
 };
 
+/// Converts a document to several outputs, loading it only once: saves it
+/// in formats, renders thumbnails and extracts its link targets, one after
+/// the other, and responds with all of them in a multipart response.
+class ConvertBatchBroker final : public ConvertToBroker
+{
+public:
+    struct Output
+    {
+        enum class Kind
+        {
+            SaveAs,
+            Thumbnail,
+            LinkTargets
+        };
+
+        Kind _kind;
+        std::string _format;
+        int _width;
+        int _height;
+        /// As requested, e.g. "pdf" or "thumbnail-320x180".
+        std::string _name;
+    };
+
+    /// Parses a comma-separated list of outputs: formats to save as,
+    /// "thumbnail" or "thumbnail-<width>x<height>", and "extract-link-targets".
+    /// Returns false when the list is empty or has an invalid output.
+    static bool parseOutputs(const std::string& list, std::vector<Output>& outputs);
+
+    /// Construct DocumentBroker with URI and docKey
+    ConvertBatchBroker(const std::string& uri,
+                       const Poco::URI& uriPublic,
+                       const std::string& docKey,
+                       std::vector<Output> outputs,
+                       const std::string& sOptions,
+                       const std::string& lang);
+
+    /// When the load completes - lets start converting
+    void setLoaded() override;
+
+    /// The current output is done, with @data, or failed with @errorKind.
+    void outputDone(std::string data, const std::string& contentType,
+                    const std::string& fileName, const std::string& errorKind = std::string());
+
+    /// The current output is done, in the file at @path, sent from there with the response.
+    void outputFileDone(const std::string& path, const std::string& contentType,
+                        const std::string& fileName);
+
+private:
+    void startOutput();
+    void addResult(std::string data, std::string path, const std::string& contentType,
+                   const std::string& fileName, const std::string& errorKind);
+    void sendResponse();
+
+    struct Result
+    {
+        std::string _data;
+        /// The file to send instead of _data, if any.
+        std::string _path;
+        std::string _contentType;
+        std::string _fileName;
+        std::string _errorKind;
+        std::chrono::steady_clock::duration _duration;
+    };
+
+    const std::vector<Output> _outputs;
+    std::vector<Result> _results;
+    std::chrono::steady_clock::duration _loadTime;
+    /// When the load, then the current output, started.
+    std::chrono::steady_clock::time_point _start;
+};
+
 class RenderSearchResultBroker final : public StatelessBatchBroker
 {
     std::shared_ptr<std::vector<char>> _pSearchResultContent;
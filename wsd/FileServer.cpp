@@ -9,11 +9,15 @@
 
 #include <config.h>
 
+#include <chrono>
+#include <fstream>
 #include <iomanip>
+#include <set>
 #include <string>
 #include <vector>
 
 #include <dirent.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <zlib.h>
@@ -49,6 +53,7 @@
 #include "ServerURL.hpp"
 #include <Log.hpp>
 #include <Protocol.hpp>
+#include <StringVector.hpp>
 #include <Util.hpp>
 #include <common/ConfigUtil.hpp>
 #include <common/LangUtil.hpp>
@@ -62,8 +67,6 @@ using Poco::Net::HTTPResponse;
 using Poco::Net::NameValueCollection;
 using Poco::Util::Application;
 
-std::map<std::string, std::pair<std::string, std::string>> FileServerRequestHandler::FileHash;
-
 namespace {
 
 int functionConversation(int /*num_msg*/, const struct pam_message** /*msg*/,
@@ -527,9 +530,6 @@ void FileServerRequestHandler::handleRequest(const HTTPRequest& request,
         const std::string relPath = getRequestPathname(request);
         const std::string endPoint = requestSegments[requestSegments.size() - 1];
 
-        static std::string etagString = "\"" LOOLWSD_VERSION_HASH +
-            config.getString("ver_suffix", "") + "\"";
-
 #if ENABLE_DEBUG
         if (Util::startsWith(relPath, std::string("/wopi/files"))) {
             handleWopiRequest(request, requestDetails, message, socket);
@@ -550,8 +550,9 @@ void FileServerRequestHandler::handleRequest(const HTTPRequest& request,
             }
         }
 
-        // Is this a file we read at startup - if not; it's not for serving.
-        if (FileHash.find(relPath) == FileHash.end())
+        // Is this a file we indexed at startup - if not; it's not for serving.
+        const StaticFile* file = findFile(relPath);
+        if (!file)
             throw Poco::FileNotFoundException("Invalid URI request: [" + requestUri.toString() + "].");
 
         if (endPoint == "welcome.html")
@@ -620,20 +621,28 @@ void FileServerRequestHandler::handleRequest(const HTTPRequest& request,
             else
                 mimeType = "text/plain";
 
+            // Each content-coding is a representation with its own ETag.
+            const std::string encoding =
+                negotiateEncoding(request.get("Accept-Encoding", ""), file->_encodings);
+            const StaticFile::Variant& variant =
+                encoding.empty() ? file->_identity : file->_encodings.at(encoding);
+            const std::string vary =
+                file->_encodings.empty() ? std::string() : "Vary: Accept-Encoding\r\n";
+
             auto it = request.find("If-None-Match");
             if (it != request.end())
             {
                 // if ETags match avoid re-sending the file.
-                if (!noCache && it->second == etagString)
+                if (!noCache && isETagMatch(it->second, variant._etag))
                 {
-                    // TESTME: harder ... - do we even want ETag support ?
-                    std::ostringstream oss;
                     Poco::DateTime now;
                     Poco::DateTime later(now.utcTime(), int64_t(1000)*1000 * 60 * 60 * 24 * 128);
                     std::string extraHeaders =
+                        "ETag: " + variant._etag + "\r\n" +
                         "Expires: " + Poco::DateTimeFormatter::format(
                             later, Poco::DateTimeFormat::HTTP_FORMAT) + "\r\n" +
-                        "Cache-Control: max-age=11059200\r\n";
+                        "Cache-Control: max-age=11059200\r\n" + vary;
+                    LOG_TRC('#' << socket->getFD() << ": Not modified: file [" << relPath << ']');
                     HttpHelper::sendErrorAndShutdown(304, socket, std::string(), extraHeaders);
                     return;
                 }
@@ -642,8 +651,6 @@ void FileServerRequestHandler::handleRequest(const HTTPRequest& request,
             response.set("Server", HTTP_SERVER_STRING);
             response.set("Date", Util::getHttpTimeNow());
 
-            bool gzip = request.hasToken("Accept-Encoding", "gzip");
-            const std::string *content;
 #if ENABLE_DEBUG
             if (std::getenv("LOOL_SERVE_FROM_FS"))
             {
@@ -654,30 +661,28 @@ void FileServerRequestHandler::handleRequest(const HTTPRequest& request,
                 return;
             }
 #endif
-            if (gzip)
-            {
-                response.set("Content-Encoding", "gzip");
-                content = getCompressedFile(relPath);
-            }
-            else
-                content = getUncompressedFile(relPath);
+            if (!encoding.empty())
+                response.set("Content-Encoding", encoding);
+
+            if (!vary.empty())
+                response.set("Vary", "Accept-Encoding");
 
             if (!noCache)
             {
                 // 60 * 60 * 24 * 128 (days) = 11059200
                 response.set("Cache-Control", "max-age=11059200");
-                response.set("ETag", etagString);
+                response.set("ETag", variant._etag);
             }
             response.setContentType(mimeType);
+            response.setContentLength(variant._size);
             response.add("X-Content-Type-Options", "nosniff");
 
             std::ostringstream oss;
             response.write(oss);
             const std::string header = oss.str();
             LOG_TRC('#' << socket->getFD() << ": Sending " <<
-                    (!gzip ? "un":"") << "compressed : file [" << relPath << "]: " << header);
-            socket->send(header);
-            socket->send(*content);
+                    (encoding.empty() ? "uncompressed" : encoding) << " file [" << relPath << "]: " << header);
+            sendStaticFile(socket, header, variant);
             // shutdown by caller
         }
     }
@@ -727,109 +732,24 @@ void FileServerRequestHandler::sendError(int errorCode, const Poco::Net::HTTPReq
     HttpHelper::sendError(errorCode, socket, body, headers);
 }
 
-void FileServerRequestHandler::readDirToHash(const std::string &basePath, const std::string &path, const std::string &prefix)
+void FileServerRequestHandler::initialize()
 {
-    LOG_DBG("Caching files in [" << basePath + path << ']');
-
-    DIR* workingdir = opendir((basePath + path).c_str());
-    if (!workingdir)
-    {
-        LOG_SYS("Failed to open directory [" << basePath + path << ']');
-        return;
-    }
-
-    size_t fileCount = 0;
-    std::string filesRead;
-    filesRead.reserve(1024);
-
-    struct dirent *currentFile;
-    while ((currentFile = readdir(workingdir)) != nullptr)
+    // Compressed files go to disk, not to memory.
+    CompressedCacheDir = FileUtil::createRandomTmpDir();
+    if (CompressedCacheDir == FileUtil::getSysTempDirectoryPath())
     {
-        if (currentFile->d_name[0] == '.')
-            continue;
-
-        const std::string relPath = path + '/' + currentFile->d_name;
-        struct stat fileStat;
-        stat ((basePath + relPath).c_str(), &fileStat);
-
-        if (S_ISDIR(fileStat.st_mode))
-            readDirToHash(basePath, relPath);
-
-        else if (S_ISREG(fileStat.st_mode))
-        {
-            fileCount++;
-            filesRead.append(currentFile->d_name);
-            filesRead += ' ';
-
-            std::ifstream file(basePath + relPath, std::ios::binary);
-
-            z_stream strm;
-            strm.zalloc = Z_NULL;
-            strm.zfree = Z_NULL;
-            strm.opaque = Z_NULL;
-            deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 31, 8, Z_DEFAULT_STRATEGY);
-
-            std::unique_ptr<char[]> buf(new char[fileStat.st_size]);
-            std::string compressedFile;
-            compressedFile.reserve(fileStat.st_size);
-            std::string uncompressedFile;
-            uncompressedFile.reserve(fileStat.st_size);
-            do
-            {
-                file.read(&buf[0], fileStat.st_size);
-                const long unsigned int size = file.gcount();
-                if (size == 0)
-                    break;
-
-                const long unsigned int compSize = compressBound(size);
-                char *cbuf = (char *)calloc(compSize, sizeof(char));
-
-                strm.next_in = (unsigned char *)&buf[0];
-                strm.avail_in = size;
-                strm.avail_out = compSize;
-                strm.next_out = (unsigned char *)&cbuf[0];
-
-                deflate(&strm, Z_FINISH);
-
-                const long unsigned int haveComp = compSize - strm.avail_out;
-                std::string partialcompFile(cbuf, haveComp);
-                std::string partialuncompFile(buf.get(), size);
-                compressedFile += partialcompFile;
-                uncompressedFile += partialuncompFile;
-                free(cbuf);
-
-            } while(true);
-
-            FileHash.emplace(prefix + relPath, std::make_pair(uncompressedFile, compressedFile));
-            deflateEnd(&strm);
-        }
+        LOG_WRN("Failed to create a directory for compressed files, serving uncompressed only");
+        CompressedCacheDir.clear();
     }
-    closedir(workingdir);
-
-    if (fileCount > 0)
-        LOG_TRC("Pre-read " << fileCount << " file(s) from directory: " << basePath << path << ": " << filesRead);
-}
 
-void FileServerRequestHandler::initialize()
-{
     // lool files
     try {
-        readDirToHash(LOOLWSD::FileServerRoot, "/browser/dist");
+        indexDir(LOOLWSD::FileServerRoot, "/browser/dist");
     } catch (...) {
         LOG_ERR("Failed to read from directory " << LOOLWSD::FileServerRoot);
     }
 }
 
-const std::string *FileServerRequestHandler::getCompressedFile(const std::string &path)
-{
-    return &FileHash[path].second;
-}
-
-const std::string *FileServerRequestHandler::getUncompressedFile(const std::string &path)
-{
-    return &FileHash[path].first;
-}
-
 std::string FileServerRequestHandler::getRequestPathname(const HTTPRequest& request)
 {
     Poco::URI requestUri(request.getURI());
@@ -853,6 +773,55 @@ constexpr char BRANDING[] = "branding";
 constexpr char BRANDING_UNSUPPORTED[] = "branding-unsupported";
 #endif
 
+namespace
+{
+/// The branding links of lool.html, which only change with the config.
+struct BrandingFragments
+{
+    std::string _key;
+    std::string _css;
+    std::string _js;
+};
+
+/// Returns the branding links, reusing those of the last request
+/// on this thread, as verifying the support key is costly.
+const BrandingFragments& getBranding(const std::string& responseRoot,
+                                     const std::string& themePreFix,
+                                     const Poco::Util::LayeredConfiguration& config)
+{
+    static thread_local BrandingFragments branding;
+
+    std::string key = responseRoot + '\n' + themePreFix;
+#if ENABLE_SUPPORT_KEY
+    // The key expires, so we check it again at least daily.
+    const std::string keyString = config.getString("support_key", "");
+    key += '\n' + keyString + '\n' +
+           std::to_string(std::chrono::duration_cast<std::chrono::hours>(
+                              std::chrono::system_clock::now().time_since_epoch())
+                              .count() /
+                          24);
+#else
+    (void)config;
+#endif
+
+    if (key == branding._key)
+        return branding;
+
+    std::string name = BRANDING;
+#if ENABLE_SUPPORT_KEY
+    SupportKey supportKey(keyString);
+    if (!supportKey.verify() || supportKey.validDaysRemaining() <= 0)
+        name = BRANDING_UNSUPPORTED;
+#endif
+
+    const std::string prefix = responseRoot + "/browser/" LOOLWSD_VERSION_HASH "/" + themePreFix;
+    branding._css = "<link rel=\"stylesheet\" href=\"" + prefix + name + ".css\">";
+    branding._js = "<script src=\"" + prefix + name + ".js\"></script>";
+    branding._key = std::move(key);
+    return branding;
+}
+} // namespace
+
 void FileServerRequestHandler::preprocessFile(const HTTPRequest& request,
                                               const RequestDetails &requestDetails,
                                               Poco::MemoryInputStream& message,
@@ -862,10 +831,16 @@ void FileServerRequestHandler::preprocessFile(const HTTPRequest& request,
 
     const Poco::URI::QueryParameters params = Poco::URI(request.getURI()).getQueryParameters();
 
-    // Is this a file we read at startup - if not; it's not for serving.
+    // Is this a file we indexed at startup - if not; it's not for serving.
     const std::string relPath = getRequestPathname(request);
     LOG_DBG("Preprocessing file: " << relPath);
-    std::string preprocess = *getUncompressedFile(relPath);
+    const StaticFile* file = findFile(relPath);
+    if (!file || !file->_template)
+        throw Poco::FileNotFoundException("Invalid URI request: [" + relPath + "].");
+
+    // Compiled at startup, we fill in the placeholders in a single pass.
+    const PageTemplate& page = *file->_template;
+    PageTemplate::Values values(page);
 
     // We need to pass certain parameters from the lool html GET URI
     // to the embedded document URI. Here we extract those params
@@ -918,34 +893,33 @@ void FileServerRequestHandler::preprocessFile(const HTTPRequest& request,
     std::string socketProxy = "false";
     if (requestDetails.isProxy())
         socketProxy = "true";
-    Poco::replaceInPlace(preprocess, std::string("%SOCKET_PROXY%"), socketProxy);
+    values.set("%SOCKET_PROXY%", socketProxy);
 
     std::string responseRoot = cnxDetails.getResponseRoot();
     std::string userInterfaceMode;
     std::string userInterfaceTheme;
 
 
-    Poco::replaceInPlace(preprocess, std::string("%ACCESS_TOKEN%"), escapedAccessToken);
-    Poco::replaceInPlace(preprocess, std::string("%ACCESS_TOKEN_TTL%"), std::to_string(tokenTtl));
-    Poco::replaceInPlace(preprocess, std::string("%ACCESS_HEADER%"), escapedAccessHeader);
-    Poco::replaceInPlace(preprocess, std::string("%HOST%"), cnxDetails.getWebSocketUrl());
-    Poco::replaceInPlace(preprocess, std::string("%VERSION%"), std::string(LOOLWSD_VERSION_HASH));
-    Poco::replaceInPlace(preprocess, std::string("%LOOLWSD_VERSION%"), std::string(LOOLWSD_VERSION));
-    Poco::replaceInPlace(preprocess, std::string("%SERVICE_ROOT%"), responseRoot);
-    Poco::replaceInPlace(preprocess, std::string("%UI_DEFAULTS%"), uiDefaultsToJSON(uiDefaults, userInterfaceMode, userInterfaceTheme));
-    Poco::replaceInPlace(preprocess, std::string("%UI_THEME%"), userInterfaceTheme);
-    Poco::replaceInPlace(preprocess, std::string("%POSTMESSAGE_ORIGIN%"), escapedPostmessageOrigin);
-    Poco::replaceInPlace(preprocess, std::string("%CHECK_FILE_INFO_OVERRIDE%"),
-                         checkFileInfoToJSON(checkfileinfo_override));
+    values.set("%ACCESS_TOKEN%", escapedAccessToken);
+    values.set("%ACCESS_TOKEN_TTL%", std::to_string(tokenTtl));
+    values.set("%ACCESS_HEADER%", escapedAccessHeader);
+    values.set("%HOST%", cnxDetails.getWebSocketUrl());
+    values.set("%VERSION%", std::string(LOOLWSD_VERSION_HASH));
+    values.set("%LOOLWSD_VERSION%", std::string(LOOLWSD_VERSION));
+    values.set("%SERVICE_ROOT%", responseRoot);
+    values.set("%UI_DEFAULTS%", uiDefaultsToJSON(uiDefaults, userInterfaceMode, userInterfaceTheme));
+    values.set("%UI_THEME%", userInterfaceTheme);
+    values.set("%POSTMESSAGE_ORIGIN%", escapedPostmessageOrigin);
+    values.set("%CHECK_FILE_INFO_OVERRIDE%", checkFileInfoToJSON(checkfileinfo_override));
 
     const auto& config = Application::instance().config();
 
     std::string protocolDebug = stringifyBoolFromConfig(config, "logging.protocol", false);
-    Poco::replaceInPlace(preprocess, std::string("%PROTOCOL_DEBUG%"), protocolDebug);
+    values.set("%PROTOCOL_DEBUG%", protocolDebug);
 
     static const std::string hexifyEmbeddedUrls =
         LOOLWSD::getConfigValue<bool>("hexify_embedded_urls", false) ? "true" : "false";
-    Poco::replaceInPlace(preprocess, std::string("%HEXIFY_URL%"), hexifyEmbeddedUrls);
+    values.set("%HEXIFY_URL%", hexifyEmbeddedUrls);
 
 
     bool useIntegrationTheme = config.getBool("user_interface.use_integration_theme", true);
@@ -953,34 +927,19 @@ void FileServerRequestHandler::preprocessFile(const HTTPRequest& request,
     std::string escapedTheme;
     Poco::URI::encode(theme, "'", escapedTheme);
     const std::string themePreFix = hasIntegrationTheme && useIntegrationTheme ? escapedTheme + "/" : "";
-    const std::string linkCSS("<link rel=\"stylesheet\" href=\"%s/browser/" LOOLWSD_VERSION_HASH "/" + themePreFix + "%s.css\">");
-    const std::string scriptJS("<script src=\"%s/browser/" LOOLWSD_VERSION_HASH "/" + themePreFix + "%s.js\"></script>");
-
-    std::string brandCSS(Poco::format(linkCSS, responseRoot, std::string(BRANDING)));
-    std::string brandJS(Poco::format(scriptJS, responseRoot, std::string(BRANDING)));
-
-#if ENABLE_SUPPORT_KEY
-    const std::string keyString = config.getString("support_key", "");
-    SupportKey key(keyString);
-    if (!key.verify() || key.validDaysRemaining() <= 0)
-    {
-        brandCSS = Poco::format(linkCSS, responseRoot, std::string(BRANDING_UNSUPPORTED));
-        brandJS = Poco::format(scriptJS, responseRoot, std::string(BRANDING_UNSUPPORTED));
-    }
-#endif
-
-    Poco::replaceInPlace(preprocess, std::string("<!--%BRANDING_CSS%-->"), brandCSS);
-    Poco::replaceInPlace(preprocess, std::string("<!--%BRANDING_JS%-->"), brandJS);
-    Poco::replaceInPlace(preprocess, std::string("<!--%CSS_VARIABLES%-->"), cssVarsToStyle(cssVars));
+    const BrandingFragments& branding = getBranding(responseRoot, themePreFix, config);
+    values.set("<!--%BRANDING_CSS%-->", branding._css);
+    values.set("<!--%BRANDING_JS%-->", branding._js);
+    values.set("<!--%CSS_VARIABLES%-->", cssVarsToStyle(cssVars));
 
     const auto loolLogging = stringifyBoolFromConfig(config, "browser_logging", false);
-    Poco::replaceInPlace(preprocess, std::string("%BROWSER_LOGGING%"), loolLogging);
+    values.set("%BROWSER_LOGGING%", loolLogging);
     const auto groupDownloadAs = stringifyBoolFromConfig(config, "per_view.group_download_as", true);
-    Poco::replaceInPlace(preprocess, std::string("%GROUP_DOWNLOAD_AS%"), groupDownloadAs);
+    values.set("%GROUP_DOWNLOAD_AS%", groupDownloadAs);
     const unsigned int outOfFocusTimeoutSecs = config.getUInt("per_view.out_of_focus_timeout_secs", 60);
-    Poco::replaceInPlace(preprocess, std::string("%OUT_OF_FOCUS_TIMEOUT_SECS%"), std::to_string(outOfFocusTimeoutSecs));
+    values.set("%OUT_OF_FOCUS_TIMEOUT_SECS%", std::to_string(outOfFocusTimeoutSecs));
     const unsigned int idleTimeoutSecs = config.getUInt("per_view.idle_timeout_secs", 900);
-    Poco::replaceInPlace(preprocess, std::string("%IDLE_TIMEOUT_SECS%"), std::to_string(idleTimeoutSecs));
+    values.set("%IDLE_TIMEOUT_SECS%", std::to_string(idleTimeoutSecs));
 
     #if ENABLE_WELCOME_MESSAGE
         std::string enableWelcomeMessage = "true";
@@ -994,8 +953,8 @@ void FileServerRequestHandler::preprocessFile(const HTTPRequest& request,
         std::string autoShowWelcome = stringifyBoolFromConfig(config, "welcome.enable", false);
     #endif
 
-    Poco::replaceInPlace(preprocess, std::string("%ENABLE_WELCOME_MSG%"), enableWelcomeMessage);
-    Poco::replaceInPlace(preprocess, std::string("%AUTO_SHOW_WELCOME%"), autoShowWelcome);
+    values.set("%ENABLE_WELCOME_MSG%", enableWelcomeMessage);
+    values.set("%AUTO_SHOW_WELCOME%", autoShowWelcome);
 
     // the config value of 'notebookbar/tabbed' or 'classic/compact' overrides the UIMode
     // from the WOPI
@@ -1014,37 +973,37 @@ void FileServerRequestHandler::preprocessFile(const HTTPRequest& request,
     if (userInterfaceMode != "classic" && userInterfaceMode != "notebookbar")
         userInterfaceMode = "notebookbar";
 
-    Poco::replaceInPlace(preprocess, std::string("%USER_INTERFACE_MODE%"), userInterfaceMode);
+    values.set("%USER_INTERFACE_MODE%", userInterfaceMode);
 
     std::string uiRtlSettings;
     if (LangUtil::isRtlLanguage(requestDetails.getParam("lang")))
         uiRtlSettings = " dir=\"rtl\" ";
-    Poco::replaceInPlace(preprocess, std::string("%UI_RTL_SETTINGS%"), uiRtlSettings);
+    values.set("%UI_RTL_SETTINGS%", uiRtlSettings);
 
     const std::string useIntegrationThemeString = useIntegrationTheme && hasIntegrationTheme ? "true" : "false";
-    Poco::replaceInPlace(preprocess, std::string("%USE_INTEGRATION_THEME%"), useIntegrationThemeString);
+    values.set("%USE_INTEGRATION_THEME%", useIntegrationThemeString);
 
     std::string enableMacrosExecution = stringifyBoolFromConfig(config, "security.enable_macros_execution", false);
-    Poco::replaceInPlace(preprocess, std::string("%ENABLE_MACROS_EXECUTION%"), enableMacrosExecution);
+    values.set("%ENABLE_MACROS_EXECUTION%", enableMacrosExecution);
 
     if (!config.getBool("feedback.show", true) && config.getBool("home_mode.enable", false))
     {
-        Poco::replaceInPlace(preprocess, std::string("%AUTO_SHOW_FEEDBACK%"), (std::string)"false");
+        values.set("%AUTO_SHOW_FEEDBACK%", (std::string)"false");
     }
     else
     {
-        Poco::replaceInPlace(preprocess, std::string("%AUTO_SHOW_FEEDBACK%"), (std::string)"true");
+        values.set("%AUTO_SHOW_FEEDBACK%", (std::string)"true");
     }
 
 
-    Poco::replaceInPlace(preprocess, std::string("%FEEDBACK_URL%"), std::string(FEEDBACK_URL));
-    Poco::replaceInPlace(preprocess, std::string("%WELCOME_URL%"), std::string(WELCOME_URL));
+    values.set("%FEEDBACK_URL%", std::string(FEEDBACK_URL));
+    values.set("%WELCOME_URL%", std::string(WELCOME_URL));
 
 
-    Poco::replaceInPlace(preprocess, std::string("%DEEPL_ENABLED%"), (config.getBool("deepl.enabled", false) ? std::string("true"): std::string("false")));
-    Poco::replaceInPlace(preprocess, std::string("%ZOTERO_ENABLED%"), (config.getBool("zotero.enable", true) ? std::string("true"): std::string("false")));
+    values.set("%DEEPL_ENABLED%", (config.getBool("deepl.enabled", false) ? std::string("true"): std::string("false")));
+    values.set("%ZOTERO_ENABLED%", (config.getBool("zotero.enable", true) ? std::string("true"): std::string("false")));
     Poco::URI indirectionURI(config.getString("indirection_endpoint.url", ""));
-    Poco::replaceInPlace(preprocess, std::string("%INDIRECTION_URL%"), indirectionURI.toString());
+    values.set("%INDIRECTION_URL%", indirectionURI.toString());
 
     const std::string mimeType = "text/html";
 
@@ -1096,7 +1055,7 @@ void FileServerRequestHandler::preprocessFile(const HTTPRequest& request,
                 << "frame-ancestors " << frameAncestors;
         std::string escapedFrameAncestors;
         Poco::URI::encode(frameAncestors, "'", escapedFrameAncestors);
-        Poco::replaceInPlace(preprocess, std::string("%FRAME_ANCESTORS%"), escapedFrameAncestors);
+        values.set("%FRAME_ANCESTORS%", escapedFrameAncestors);
     }
     else
     {
@@ -1106,6 +1065,8 @@ void FileServerRequestHandler::preprocessFile(const HTTPRequest& request,
 
     cspOss << "\r\n";
 
+    const std::string preprocess = page.render(values);
+
     std::ostringstream oss;
     oss << "HTTP/1.1 200 OK\r\n"
         "Date: " << Util::getHttpTimeNow() << "\r\n"
@@ -1179,10 +1140,10 @@ void FileServerRequestHandler::preprocessFile(const HTTPRequest& request,
         }
     }
 
-    oss << "\r\n"
-        << preprocess;
+    oss << "\r\n";
 
-    socket->send(oss.str());
+    socket->send(oss.str(), /*flush=*/false);
+    socket->send(preprocess);
     LOG_TRC("Sent file: " << relPath << ": " << preprocess);
 }
 
@@ -9,7 +9,10 @@
 
 #pragma once
 
+#include <map>
+#include <memory>
 #include <string>
+#include "PageTemplate.hpp"
 #include "Socket.hpp"
 
 #include <Poco/MemoryStream.h>
@@ -58,20 +61,55 @@ public:
                               Poco::MemoryInputStream& message,
                               const std::shared_ptr<StreamSocket>& socket);
 
-    /// Read all files that we can serve into memory and compress them.
+    /// A file we serve, as indexed at startup. Only the templates we
+    /// preprocess per request are kept in memory, the rest is sent from disk.
+    struct StaticFile
+    {
+        /// One representation of the file, e.g. compressed with gzip.
+        struct Variant
+        {
+            std::string _path; ///< Absolute path on disk.
+            std::size_t _size;
+            std::string _etag; ///< Strong and quoted.
+        };
+
+        Variant _identity;
+        /// The compressed representations, by content-coding (e.g. "br").
+        std::map<std::string, Variant> _encodings;
+        /// The compiled page, for templates only.
+        std::unique_ptr<PageTemplate> _template;
+    };
+
+    /// Index all files that we can serve and compress them.
     static void initialize();
 
-    /// Clean cached files.
-    static void uninitialize() { FileHash.clear(); }
+    /// Forget the index and remove the compressed files we generated.
+    static void uninitialize();
 
-    static void readDirToHash(const std::string &basePath, const std::string &path, const std::string &prefix = std::string());
+    static void indexDir(const std::string &basePath, const std::string &path, const std::string &prefix = std::string());
 
-    static const std::string *getCompressedFile(const std::string &path);
+    /// Returns the indexed file, or nullptr if it isn't for serving.
+    static const StaticFile *findFile(const std::string &path);
 
+    /// Returns the content of a template we preprocess.
     static const std::string *getUncompressedFile(const std::string &path);
 
+    /// Returns the content-coding of @encodings we should send, given the Accept-Encoding
+    /// request header, preferring zstd, then br, then gzip. Empty for identity.
+    static std::string negotiateEncoding(const std::string& acceptEncoding,
+                                         const std::map<std::string, StaticFile::Variant>& encodings);
+
+    /// True if an If-None-Match header value matches @etag (weak comparison, as per RFC 7232).
+    static bool isETagMatch(const std::string& ifNoneMatch, const std::string& etag);
+
 private:
-    static std::map<std::string, std::pair<std::string, std::string>> FileHash;
+    /// Sends @header followed by the content of @variant, by sendfile(2) when we can.
+    static void sendStaticFile(const std::shared_ptr<StreamSocket>& socket,
+                               const std::string& header, const StaticFile::Variant& variant);
+
+    static std::map<std::string, StaticFile> FileIndex;
+    /// Where we keep the files we compressed at startup.
+    static std::string CompressedCacheDir;
     static void sendError(int errorCode, const Poco::Net::HTTPRequest& request,
                           const std::shared_ptr<StreamSocket>& socket, const std::string& shortMessage,
                           const std::string& longMessage, const std::string& extraHeader = "");
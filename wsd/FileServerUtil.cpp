@@ -10,9 +10,27 @@
 #include <config.h>
 
 #include "FileServer.hpp"
+#include "FileUtil.hpp"
 #include "StringVector.hpp"
 #include "Util.hpp"
-
+#include <Log.hpp>
+#include <common/SpookyV2.h>
+#include <net/Socket.hpp>
+
+#include <fstream>
+#include <iomanip>
+#include <set>
+#include <sstream>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <Poco/Exception.h>
 #include <Poco/JSON/Object.h>
 
 std::string FileServerRequestHandler::uiDefaultsToJSON(const std::string& uiDefaults, std::string& uiMode, std::string& uiTheme)
@@ -238,4 +256,341 @@ std::string FileServerRequestHandler::stringifyBoolFromConfig(
     return value;
 }
 
+std::map<std::string, FileServerRequestHandler::StaticFile> FileServerRequestHandler::FileIndex;
+std::string FileServerRequestHandler::CompressedCacheDir;
+
+namespace
+{
+/// The content-codings we serve, in order of preference,
+/// with the extension of their precompressed files.
+struct ContentCoding
+{
+    const char* _name;
+    const char* _extension;
+};
+
+constexpr ContentCoding ContentCodings[] = { { "zstd", ".zst" }, { "br", ".br" }, { "gzip", ".gz" } };
+
+/// Text we compress at startup, unless it's already compressed on disk.
+bool isCompressible(const std::string& name)
+{
+    static const char* const extensions[] = { ".js", ".css", ".html", ".svg", ".json", ".txt", ".xml" };
+    for (const char* extension : extensions)
+    {
+        if (Util::endsWith(name, extension))
+            return true;
+    }
+
+    return false;
+}
+
+/// The files we preprocess on every request, which we keep in memory.
+bool isTemplate(const std::string& name)
+{
+    return Util::endsWith(name, ".html") || Util::endsWith(name, "localizations.json") ||
+           Util::endsWith(name, "localizations-override.json");
+}
+
+/// A read-only mapping of a file, to hash and compress it without copying.
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::string& path)
+        : _data(nullptr)
+        , _size(0)
+    {
+        const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return;
+
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED)
+            {
+                _data = static_cast<const char*>(data);
+                _size = st.st_size;
+            }
+        }
+
+        close(fd);
+    }
+
+    ~MappedFile()
+    {
+        if (_data)
+            munmap(const_cast<char*>(_data), _size);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    /// Empty files aren't mapped, but are still valid.
+    const char* data() const { return _data ? _data : ""; }
+    std::size_t size() const { return _size; }
+
+private:
+    const char* _data;
+    std::size_t _size;
+};
+
+/// Returns the strong ETag of the content, quoted.
+std::string makeETag(const char* data, std::size_t size)
+{
+    uint64_t hash1 = 0;
+    uint64_t hash2 = 0;
+    SpookyHash::Hash128(data, size, &hash1, &hash2);
+
+    std::ostringstream oss;
+    oss << '"' << std::hex << std::setfill('0') << std::setw(16) << hash1 << std::setw(16)
+        << hash2 << '"';
+    return oss.str();
+}
+
+/// Each representation needs its own strong ETag, derived from that of the content.
+std::string makeVariantETag(const std::string& etag, const std::string& coding)
+{
+    return etag.substr(0, etag.size() - 1) + '-' + coding + '"';
+}
+
+/// Compresses the content into a gzip file at @path.
+/// Returns the compressed size, or 0 on failure.
+std::size_t gzipToFile(const char* data, std::size_t size, const std::string& path)
+{
+    z_stream strm;
+    strm.zalloc = Z_NULL;
+    strm.zfree = Z_NULL;
+    strm.opaque = Z_NULL;
+    if (deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 31, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return 0;
+
+    std::vector<char> compressed(deflateBound(&strm, size));
+    strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    strm.avail_in = size;
+    strm.next_out = reinterpret_cast<Bytef*>(compressed.data());
+    strm.avail_out = compressed.size();
+
+    const int rc = deflate(&strm, Z_FINISH);
+    const std::size_t compressedSize = compressed.size() - strm.avail_out;
+    deflateEnd(&strm);
+    if (rc != Z_STREAM_END)
+        return 0;
+
+    std::ofstream file(path, std::ios::binary);
+    file.write(compressed.data(), compressedSize);
+    file.close();
+    return file ? compressedSize : 0;
+}
+} // namespace
+
+void FileServerRequestHandler::indexDir(const std::string &basePath, const std::string &path, const std::string &prefix)
+{
+    LOG_DBG("Indexing files in [" << basePath + path << ']');
+
+    DIR* workingdir = opendir((basePath + path).c_str());
+    if (!workingdir)
+    {
+        LOG_SYS("Failed to open directory [" << basePath + path << ']');
+        return;
+    }
+
+    std::set<std::string> fileNames;
+    struct dirent *currentFile;
+    while ((currentFile = readdir(workingdir)) != nullptr)
+    {
+        if (currentFile->d_name[0] == '.')
+            continue;
+
+        const std::string relPath = path + '/' + currentFile->d_name;
+        FileUtil::Stat fileStat(basePath + relPath);
+
+        if (fileStat.isDirectory())
+            indexDir(basePath, relPath, prefix);
+        else if (fileStat.isFile())
+            fileNames.insert(currentFile->d_name);
+    }
+    closedir(workingdir);
+
+    std::size_t compressedCount = 0;
+    for (const std::string& name : fileNames)
+    {
+        // Precompressed variants are indexed with their file.
+        bool isVariant = false;
+        for (const ContentCoding& coding : ContentCodings)
+        {
+            if (Util::endsWith(name, coding._extension) &&
+                fileNames.count(name.substr(0, name.size() - strlen(coding._extension))))
+                isVariant = true;
+        }
+
+        if (isVariant)
+            continue;
+
+        const std::string filePath = basePath + path + '/' + name;
+        const MappedFile file(filePath);
+
+        StaticFile entry;
+        entry._identity = { filePath, file.size(), makeETag(file.data(), file.size()) };
+
+        for (const ContentCoding& coding : ContentCodings)
+        {
+            const std::string variantPath = filePath + coding._extension;
+            if (fileNames.count(name + coding._extension))
+            {
+                entry._encodings[coding._name] = { variantPath, FileUtil::Stat(variantPath).size(),
+                                                   makeVariantETag(entry._identity._etag,
+                                                                   coding._name) };
+            }
+        }
+
+        if (!CompressedCacheDir.empty() && entry._encodings.find("gzip") == entry._encodings.end() &&
+            isCompressible(name))
+        {
+            const std::string gzipPath =
+                CompressedCacheDir + '/' + std::to_string(FileIndex.size()) + ".gz";
+            const std::size_t size = gzipToFile(file.data(), file.size(), gzipPath);
+            if (size > 0 && size < file.size())
+            {
+                entry._encodings["gzip"] = { gzipPath, size,
+                                             makeVariantETag(entry._identity._etag, "gzip") };
+                ++compressedCount;
+            }
+            else
+                FileUtil::removeFile(gzipPath);
+        }
+
+        if (isTemplate(name))
+            entry._template.reset(new PageTemplate(std::string(file.data(), file.size())));
+
+        FileIndex.emplace(prefix + path + '/' + name, std::move(entry));
+    }
+
+    if (!fileNames.empty())
+        LOG_TRC("Indexed " << fileNames.size() << " file(s), compressed " << compressedCount
+                           << ", from directory: " << basePath << path);
+}
+
+void FileServerRequestHandler::uninitialize()
+{
+    FileIndex.clear();
+
+    if (!CompressedCacheDir.empty())
+    {
+        FileUtil::removeFile(CompressedCacheDir, /*recursive=*/true);
+        CompressedCacheDir.clear();
+    }
+}
+
+const FileServerRequestHandler::StaticFile *FileServerRequestHandler::findFile(const std::string &path)
+{
+    const auto it = FileIndex.find(path);
+    return it != FileIndex.end() ? &it->second : nullptr;
+}
+
+const std::string *FileServerRequestHandler::getUncompressedFile(const std::string &path)
+{
+    static const std::string empty;
+    const StaticFile* file = findFile(path);
+    return file && file->_template ? &file->_template->getContent() : &empty;
+}
+
+std::string FileServerRequestHandler::negotiateEncoding(
+    const std::string& acceptEncoding, const std::map<std::string, StaticFile::Variant>& encodings)
+{
+    if (encodings.empty())
+        return std::string();
+
+    // The q-value of each coding, as in "gzip;q=0.8, br, *;q=0.1".
+    std::map<std::string, double> qvalues;
+    double wildcard = -1;
+    for (const std::string& item : Util::splitStringToVector(acceptEncoding, ','))
+    {
+        const StringVector tokens = StringVector::tokenize(item, ';');
+        if (tokens.empty())
+            continue;
+
+        const std::string coding = Util::toLower(Util::trimmed(tokens[0]));
+        double qvalue = 1;
+        for (std::size_t i = 1; i < tokens.size(); ++i)
+        {
+            const std::string param = Util::trimmed(tokens[i]);
+            if (param.size() > 2 && (param[0] == 'q' || param[0] == 'Q') && param[1] == '=')
+                qvalue = std::atof(param.c_str() + 2);
+        }
+
+        if (coding == "*")
+            wildcard = qvalue;
+        else
+            qvalues[coding] = qvalue;
+    }
+
+    std::string best;
+    double bestQvalue = 0;
+    for (const ContentCoding& coding : ContentCodings)
+    {
+        if (encodings.find(coding._name) == encodings.end())
+            continue;
+
+        const auto it = qvalues.find(coding._name);
+        const double qvalue = it != qvalues.end() ? it->second : wildcard;
+        if (qvalue > bestQvalue)
+        {
+            best = coding._name;
+            bestQvalue = qvalue;
+        }
+    }
+
+    return best;
+}
+
+bool FileServerRequestHandler::isETagMatch(const std::string& ifNoneMatch, const std::string& etag)
+{
+    for (const std::string& item : Util::splitStringToVector(ifNoneMatch, ','))
+    {
+        std::string candidate = Util::trimmed(item);
+        if (candidate == "*")
+            return true;
+
+        // If-None-Match uses the weak comparison.
+        if (Util::startsWith(candidate, "W/"))
+            candidate = candidate.substr(2);
+
+        if (candidate == etag)
+            return true;
+    }
+
+    return false;
+}
+
+void FileServerRequestHandler::sendStaticFile(const std::shared_ptr<StreamSocket>& socket,
+                                              const std::string& header,
+                                              const StaticFile::Variant& variant)
+{
+    const int fd = open(variant._path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) != variant._size)
+    {
+        // The file changed since we indexed it; we can't honor the ETag.
+        if (fd >= 0)
+            close(fd);
+        throw Poco::FileNotFoundException("File [" + variant._path + "] changed since startup.");
+    }
+
+    socket->send(header, /*flush=*/false);
+
+#if !MOBILEAPP
+    if (socket->supportsSendFile())
+    {
+        socket->sendFile(fd, 0, variant._size);
+        return;
+    }
+#endif
+
+    // We have to copy through user-space (e.g. to encrypt), but without reading the file.
+    const MappedFile file(variant._path);
+    close(fd);
+    socket->send(file.data(), file.size());
+}
+
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -13,6 +13,7 @@
 #include "ProofKey.hpp"
 #include "CommandControl.hpp"
 #include "HostUtil.hpp"
+#include "PreSpawnController.hpp"
 
 /* Default host used in the start test URI */
 #define LOOLWSD_TEST_HOST "localhost"
@@ -125,7 +126,9 @@ using Poco::Net::PartHandler;
 #include "DocumentBroker.hpp"
 #include "Exceptions.hpp"
 #include "FileServer.hpp"
+#include "ProxyProtocol.hpp"
 #include "ProxyRequestHandler.hpp"
+#include "ShardedRegistry.hpp"
 #include <common/JsonUtil.hpp>
 #include <common/FileUtil.hpp>
 #include <common/JailUtil.hpp>
@@ -140,6 +143,7 @@ using Poco::Net::PartHandler;
 #  include <SslSocket.hpp>
 #endif
 #include "Storage.hpp"
+#include "TileStore.hpp"
 #include "TraceFile.hpp"
 #include <Unit.hpp>
 #include "UserMessages.hpp"
@@ -213,8 +217,12 @@ static std::vector<std::shared_ptr<ChildProcess> > NewChildren;
 
 static std::chrono::steady_clock::time_point LastForkRequestTime = std::chrono::steady_clock::now();
 static std::atomic<int> OutstandingForks(0);
-static std::map<std::string, std::shared_ptr<DocumentBroker> > DocBrokers;
-static std::mutex DocBrokersMutex;
+#if !MOBILEAPP
+/// Sizes the spare children pool, protected by NewChildrenMutex.
+static PreSpawnController PreSpawn;
+#endif
+/// All the DocumentBrokers, by docKey.
+static ShardedRegistry<DocumentBroker> DocBrokers;
 static Poco::AutoPtr<Poco::Util::XMLConfiguration> KitXmlConfig;
 
 extern "C"
@@ -279,18 +287,14 @@ inline void shutdownLimitReached(const std::shared_ptr<ProtocolHandlerInterface>
 /// connected to any document.
 void LOOLWSD::alertAllUsersInternal(const std::string& msg)
 {
-    std::lock_guard<std::mutex> docBrokersLock(DocBrokersMutex);
-
     LOG_INF("Alerting all users: [" << msg << ']');
 
     if (UnitWSD::get().filterAlertAllusers(msg))
         return;
 
-    for (auto& brokerIt : DocBrokers)
-    {
-        std::shared_ptr<DocumentBroker> docBroker = brokerIt.second;
-        docBroker->addCallback([msg, docBroker](){ docBroker->alertAllUsers(msg); });
-    }
+    DocBrokers.forEach(
+        [&msg](const std::string&, const std::shared_ptr<DocumentBroker>& docBroker)
+        { docBroker->addCallback([msg, docBroker]() { docBroker->alertAllUsers(msg); }); });
 }
 #endif
 
@@ -380,37 +384,29 @@ void LOOLWSD::checkDiskSpaceAndWarnClients(const bool cacheLastCheck)
 
 /// Remove dead and idle DocBrokers.
 /// The client of idle document should've greyed-out long ago.
+/// Each shard is locked only while its dead brokers are taken out.
 void cleanupDocBrokers()
 {
-    Util::assertIsLocked(DocBrokersMutex);
+    // Remove only when not alive.
+    const auto removed = DocBrokers.removeIf(
+        [](const std::string&, const std::shared_ptr<DocumentBroker>& docBroker)
+        { return !docBroker->isAlive(); });
 
-    const size_t count = DocBrokers.size();
-    for (auto it = DocBrokers.begin(); it != DocBrokers.end(); )
+    for (const auto& pair : removed)
     {
-        std::shared_ptr<DocumentBroker> docBroker = it->second;
-
-        // Remove only when not alive.
-        if (!docBroker->isAlive())
-        {
-            LOG_INF("Removing DocumentBroker for docKey [" << it->first << "].");
-            docBroker->dispose();
-            it = DocBrokers.erase(it);
-            continue;
-        } else {
-            ++it;
-        }
+        LOG_INF("Removing DocumentBroker for docKey [" << pair.first << "].");
+        pair.second->dispose();
     }
 
-    if (count != DocBrokers.size())
+    if (!removed.empty())
     {
         LOG_TRC("Have " << DocBrokers.size() << " DocBrokers after cleanup.\n"
                         <<
                 [&](auto& log)
                 {
-                    for (auto& pair : DocBrokers)
-                    {
-                        log << "DocumentBroker [" << pair.first << "].\n";
-                    }
+                    DocBrokers.forEach(
+                        [&log](const std::string& docKey, const std::shared_ptr<DocumentBroker>&)
+                        { log << "DocumentBroker [" << docKey << "].\n"; });
                 });
 
 #if !MOBILEAPP && ENABLE_DEBUG
@@ -446,6 +442,7 @@ static int forkChildren(const int number)
 #endif
         OutstandingForks += number;
         LastForkRequestTime = std::chrono::steady_clock::now();
+        PreSpawn.recordForkRequest(LastForkRequestTime, number);
         return number;
     }
 
@@ -494,6 +491,7 @@ static int rebalanceChildren(int balance)
         LOG_WRN("ForKit not responsive for " << durationMs << " forking " << OutstandingForks
                                              << " children. Resetting.");
         OutstandingForks = 0;
+        PreSpawn.resetForkRequests();
     }
 
     balance -= available;
@@ -511,6 +509,28 @@ static int rebalanceChildren(int balance)
     return 0;
 }
 
+/// Returns the number of spare children to keep around.
+/// Static num_prespawn_children, unless adaptive prespawning is enabled.
+static int getPreSpawnTarget()
+{
+    Util::assertIsLocked(NewChildrenMutex);
+
+    if (!PreSpawn.isEnabled())
+        return LOOLWSD::NumPreSpawnedChildren;
+
+    // Reading /proc/meminfo on every wakeup is excessive.
+    static std::chrono::steady_clock::time_point lastMemCheck;
+    static std::size_t memAvailableKb = 0;
+    const auto now = std::chrono::steady_clock::now();
+    if (now - lastMemCheck > std::chrono::seconds(1))
+    {
+        memAvailableKb = Util::getAvailableSystemMemoryKb();
+        lastMemCheck = now;
+    }
+
+    return PreSpawn.getTarget(now, memAvailableKb);
+}
+
 /// Proactively spawn children processes
 /// to load documents with alacrity.
 /// Returns true only if at least one child was requested to spawn.
@@ -518,7 +538,13 @@ static bool prespawnChildren()
 {
     // Rebalance if not forking already.
     std::unique_lock<std::mutex> lock(NewChildrenMutex, std::defer_lock);
-    return lock.try_lock() && (rebalanceChildren(LOOLWSD::NumPreSpawnedChildren) > 0);
+    return lock.try_lock() && (rebalanceChildren(getPreSpawnTarget()) > 0);
+}
+
+std::string LOOLWSD::getPreSpawnStats()
+{
+    std::unique_lock<std::mutex> lock(NewChildrenMutex);
+    return PreSpawn.toJSON(std::chrono::steady_clock::now(), NewChildren.size(), OutstandingForks);
 }
 
 #endif
@@ -535,6 +561,10 @@ static size_t addNewChild(std::shared_ptr<ChildProcess> child)
     if (OutstandingForks < 0)
         ++OutstandingForks;
 
+#if !MOBILEAPP
+    PreSpawn.recordChildSpawned(std::chrono::steady_clock::now());
+#endif
+
     if (LOOLWSD::IsBindMountingEnabled)
     {
         // Reset the child-spawn timeout to the default, now that we're set.
@@ -570,7 +600,9 @@ std::shared_ptr<ChildProcess> getNewChild_Blocks(unsigned mobileAppDocId)
 #if !MOBILEAPP
     (void) mobileAppDocId;
 
-    int numPreSpawn = LOOLWSD::NumPreSpawnedChildren;
+    PreSpawn.recordArrival(startTime, !NewChildren.empty());
+
+    int numPreSpawn = getPreSpawnTarget();
     ++numPreSpawn; // Replace the one we'll dispatch just now.
     LOG_DBG("getNewChild: Rebalancing children to " << numPreSpawn);
     if (rebalanceChildren(numPreSpawn) < 0)
@@ -1915,10 +1947,12 @@ void LOOLWSD::innerInitialize(Application& self)
     static const std::map<std::string, std::string> DefAppConfig = {
         { "allowed_languages", "de_DE en_GB en_US es_ES fr_FR it nl pt_BR pt_PT ru" },
         { "admin_console.enable_pam", "false" },
+        { "admin_console.cgroup_stats", "false" },
         { "child_root_path", "jails" },
         { "file_server_root_path", "browser/.." },
         { "hexify_embedded_urls", "false" },
         { "experimental_features", "false" },
+        { "jail_template", "true" },
         { "logging.protocol", "false" },
         { "logging.anonymize.filenames", "false" }, // Deprecated.
         { "logging.anonymize.usernames", "false" }, // Deprecated.
@@ -1953,9 +1987,19 @@ void LOOLWSD::innerInitialize(Application& self)
         { "net.proto", "all" },
         { "net.service_root", "" },
         { "net.proxy_prefix", "false" },
+        { "net.proxy_protocol.hold_ms", "200" },
+        { "net.proxy_protocol.batch_ms", "5" },
         { "num_prespawn_children", "1" },
+        { "prespawn[@adaptive]", "false" },
+        { "prespawn.min_children", "1" },
+        { "prespawn.max_children", "10" },
+        { "prespawn.cold_open_target", "0.05" },
+        { "prespawn.rate_window_secs", "60" },
+        { "prespawn.spare_kit_mem_mb", "100" },
+        { "prespawn.max_mem_proportion", "10.0" },
         { "per_document.always_save_on_exit", "false" },
         { "per_document.autosave_duration_secs", "300" },
+        { "per_document.background_save", "false" },
         { "per_document.cleanup.cleanup_interval_ms", "10000" },
         { "per_document.cleanup.bad_behavior_period_secs", "60" },
         { "per_document.cleanup.idle_time_secs", "300" },
@@ -1963,6 +2007,7 @@ void LOOLWSD::innerInitialize(Application& self)
         { "per_document.cleanup.limit_cpu_per", "85" },
         { "per_document.cleanup.lost_kit_grace_period_secs", "120" },
         { "per_document.cleanup[@enable]", "false" },
+        { "per_document.hibernate_secs", "0" },
         { "per_document.idle_timeout_secs", "3600" },
         { "per_document.idlesave_duration_secs", "30" },
         { "per_document.limit_file_size_mb", "0" },
@@ -1975,6 +2020,7 @@ void LOOLWSD::innerInitialize(Application& self)
         { "per_document.max_concurrency", "4" },
         { "per_document.min_time_between_saves_ms", "500" },
         { "per_document.min_time_between_uploads_ms", "5000" },
+        { "per_document.poll_threads", "0" },
         { "per_document.batch_priority", "5" },
         { "per_document.pdf_resolution_dpi", "96" },
         { "per_document.redlining_as_comments", "false" },
@@ -1997,14 +2043,21 @@ void LOOLWSD::innerInitialize(Application& self)
         { "ssl.sts.enabled", "false" },
         { "ssl.sts.max_age", "31536000" },
         { "ssl.key_file_path", LOOLWSD_CONFIGDIR "/key.pem" },
+        { "ssl.ktls", "false" },
+        { "ssl.sessions.cache_size", "20480" },
+        { "ssl.sessions.tickets", "true" },
+        { "ssl.sessions.timeout_secs", "3600" },
         { "ssl.termination", "true" },
         { "storage.filesystem[@allow]", "false" },
         // "storage.ssl.enable" - deliberately not set; for back-compat
         { "storage.wopi.max_file_size", "0" },
         { "storage.wopi[@allow]", "true" },
         { "storage.wopi.locking.refresh", "900" },
+        { "storage.wopi.upload.max_concurrent", "8" },
+        { "storage.wopi.upload.max_concurrent_per_host", "4" },
         { "sys_template_path", "systemplate" },
         { "trace_event[@enable]", "false" },
+        { "trace.path[@chunked]", "false" },
         { "trace.path[@compress]", "true" },
         { "trace.path[@snapshot]", "false" },
         { "trace[@enable]", "false" },
@@ -2038,6 +2091,9 @@ void LOOLWSD::innerInitialize(Application& self)
         { "quarantine_files.max_versions_to_maintain", "2" },
         { "quarantine_files.path", "quarantine" },
         { "quarantine_files.expiry_min", "30" },
+        { "tile_cache_persistent[@enable]", "false" },
+        { "tile_cache_persistent.path", "tilecache" },
+        { "tile_cache_persistent.limit_dir_size_mb", "1024" },
         { "remote_config.remote_url", "" },
         { "storage.wopi.alias_groups[@mode]", "first" },
         { "languagetool.base_url", "" },
@@ -2300,6 +2356,13 @@ void LOOLWSD::innerInitialize(Application& self)
 
     IsProxyPrefixEnabled = getConfigValue<bool>(conf, "net.proxy_prefix", false);
 
+#if !MOBILEAPP
+    ProxyProtocolHandler::HoldWindow = std::chrono::milliseconds(
+        getConfigValue<unsigned int>(conf, "net.proxy_protocol.hold_ms", 200));
+    ProxyProtocolHandler::BatchWindow = std::chrono::milliseconds(
+        getConfigValue<unsigned int>(conf, "net.proxy_protocol.batch_ms", 5));
+#endif
+
 #if ENABLE_SSL
     LOOLWSD::SSLEnabled.set(getConfigValue<bool>(conf, "ssl.enable", true));
     LOOLWSD::SSLTermination.set(getConfigValue<bool>(conf, "ssl.termination", true));
@@ -2462,6 +2525,32 @@ void LOOLWSD::innerInitialize(Application& self)
         }
     }
 
+    if (getConfigValue<bool>(conf, "tile_cache_persistent[@enable]", false))
+    {
+        const std::string path = Util::trimmed(getPathFromConfig("tile_cache_persistent.path"));
+        if (path.empty())
+        {
+            LOG_WRN("Persistent tile cache is enabled via tile_cache_persistent config, but no "
+                    "path is set in tile_cache_persistent.path. Disabling it");
+        }
+        else
+        {
+            try
+            {
+                Poco::File(path).createDirectories();
+                TileStore::initialize(
+                    path,
+                    getConfigValue<unsigned int>(conf, "tile_cache_persistent.limit_dir_size_mb",
+                                                 1024) * 1024UL * 1024);
+            }
+            catch (const std::exception& ex)
+            {
+                LOG_WRN("Failed to create persistent tile cache directory ["
+                        << path << "]: " << ex.what() << ". Disabling it");
+            }
+        }
+    }
+
     NumPreSpawnedChildren = getConfigValue<int>(conf, "num_prespawn_children", 1);
     if (NumPreSpawnedChildren < 1)
     {
@@ -2470,6 +2559,26 @@ void LOOLWSD::innerInitialize(Application& self)
     }
     LOG_INF("NumPreSpawnedChildren set to " << NumPreSpawnedChildren << '.');
 
+#if !MOBILEAPP
+    {
+        bool adaptive = getConfigValue<bool>(conf, "prespawn[@adaptive]", false);
+#if ENABLE_DEBUG
+        if (SingleKit)
+            adaptive = false;
+#endif
+        std::unique_lock<std::mutex> lock(NewChildrenMutex);
+        PreSpawn.configure(
+            adaptive,
+            NumPreSpawnedChildren,
+            getConfigValue<int>(conf, "prespawn.min_children", NumPreSpawnedChildren),
+            getConfigValue<int>(conf, "prespawn.max_children", 10),
+            getConfigValue<double>(conf, "prespawn.cold_open_target", 0.05),
+            std::chrono::seconds(getConfigValue<int>(conf, "prespawn.rate_window_secs", 60)),
+            getConfigValue<int>(conf, "prespawn.spare_kit_mem_mb", 100) * 1024,
+            getConfigValue<double>(conf, "prespawn.max_mem_proportion", 10.0));
+    }
+#endif
+
     FileUtil::registerFileSystemForDiskSpaceChecks(ChildRoot);
 
     int nThreads = std::max<int>(std::thread::hardware_concurrency(), 1);
@@ -2493,6 +2602,12 @@ void LOOLWSD::innerInitialize(Application& self)
         setenv("MAX_CONCURRENCY", std::to_string(maxConcurrency).c_str(), 1);
     }
     LOG_INF("MAX_CONCURRENCY set to " << maxConcurrency << '.');
+
+    if (getConfigValue<bool>(conf, "per_document.background_save", false))
+    {
+        setenv("LOOL_BACKGROUND_SAVE", "1", 1);
+        LOG_INF("LOOL_BACKGROUND_SAVE set");
+    }
 #endif
 
     const auto redlining = getConfigValue<bool>(conf, "per_document.redlining_as_comments", false);
@@ -2638,8 +2753,10 @@ void LOOLWSD::innerInitialize(Application& self)
         }
 
         const auto compress = getConfigValue<bool>(conf, "trace.path[@compress]", false);
+        const auto chunked = getConfigValue<bool>(conf, "trace.path[@chunked]", false);
         const auto takeSnapshot = getConfigValue<bool>(conf, "trace.path[@snapshot]", false);
-        TraceDumper = Util::make_unique<TraceFileWriter>(path, recordOutgoing, compress, takeSnapshot, filters);
+        TraceDumper = Util::make_unique<TraceFileWriter>(path, recordOutgoing, compress, chunked,
+                                                         takeSnapshot, filters);
     }
 
 #if !MOBILEAPP
@@ -2703,9 +2820,22 @@ void LOOLWSD::initializeSSL()
             ssl_cipher_list = DEFAULT_CIPHER_SET;
     LOG_INF("SSL Cipher list: " << ssl_cipher_list);
 
+    ssl::SessionSettings sessionSettings;
+    sessionSettings._cacheSize = getConfigValue<unsigned int>("ssl.sessions.cache_size", 20480);
+    sessionSettings._timeout =
+        std::chrono::seconds(getConfigValue<unsigned int>("ssl.sessions.timeout_secs", 3600));
+    sessionSettings._tickets = getConfigValue<bool>("ssl.sessions.tickets", true);
+    sessionSettings._kernelTls = getConfigValue<bool>("ssl.ktls", false);
+    LOG_INF("SSL session cache size: " << sessionSettings._cacheSize << ", timeout: "
+                                       << sessionSettings._timeout << ", tickets: "
+                                       << (sessionSettings._tickets ? "on" : "off")
+                                       << ", kernel TLS: "
+                                       << (sessionSettings._kernelTls ? "on" : "off"));
+
     // Initialize the non-blocking server socket SSL context.
     ssl::Manager::initializeServerContext(ssl_cert_file_path, ssl_key_file_path, ssl_ca_file_path,
-                                          ssl_cipher_list, ssl::CertificateVerification::Disabled);
+                                          ssl_cipher_list, ssl::CertificateVerification::Disabled,
+                                          sessionSettings);
 
     if (!ssl::Manager::isServerContextInitialized())
         LOG_ERR("Failed to initialize Server SSL.");
@@ -3054,11 +3184,9 @@ void LOOLWSD::doHousekeeping()
 
 void LOOLWSD::closeDocument(const std::string& docKey, const std::string& message)
 {
-    std::unique_lock<std::mutex> docBrokersLock(DocBrokersMutex);
-    auto docBrokerIt = DocBrokers.find(docKey);
-    if (docBrokerIt != DocBrokers.end())
+    std::shared_ptr<DocumentBroker> docBroker = DocBrokers.find(docKey);
+    if (docBroker)
     {
-        std::shared_ptr<DocumentBroker> docBroker = docBrokerIt->second;
         docBroker->addCallback([docBroker, message]() {
                 docBroker->closeDocument(message);
             });
@@ -3067,11 +3195,9 @@ void LOOLWSD::closeDocument(const std::string& docKey, const std::string& messag
 
 void LOOLWSD::autoSave(const std::string& docKey)
 {
-    std::unique_lock<std::mutex> docBrokersLock(DocBrokersMutex);
-    auto docBrokerIt = DocBrokers.find(docKey);
-    if (docBrokerIt != DocBrokers.end())
+    std::shared_ptr<DocumentBroker> docBroker = DocBrokers.find(docKey);
+    if (docBroker)
     {
-        std::shared_ptr<DocumentBroker> docBroker = docBrokerIt->second;
         docBroker->addCallback([docBroker]() {
                 docBroker->autoSave(true);
             });
@@ -3080,17 +3206,11 @@ void LOOLWSD::autoSave(const std::string& docKey)
 
 void LOOLWSD::setLogLevelsOfKits(const std::string& level)
 {
-    std::lock_guard<std::mutex> docBrokersLock(DocBrokersMutex);
-
     LOG_INF("Changing kits' log levels: [" << level << ']');
 
-    for (const auto& brokerIt : DocBrokers)
-    {
-        std::shared_ptr<DocumentBroker> docBroker = brokerIt.second;
-        docBroker->addCallback([docBroker, level]() {
-            docBroker->setKitLogLevel(level);
-        });
-    }
+    DocBrokers.forEach(
+        [&level](const std::string&, const std::shared_ptr<DocumentBroker>& docBroker)
+        { docBroker->addCallback([docBroker, level]() { docBroker->setKitLogLevel(level); }); });
 }
 
 /// Really do the house-keeping
@@ -3108,12 +3228,8 @@ void PrisonPoll::wakeupHook()
         prespawnChildren();
     }
 #endif
-    std::unique_lock<std::mutex> docBrokersLock(DocBrokersMutex, std::defer_lock);
-    if (docBrokersLock.try_lock())
-    {
-        cleanupDocBrokers();
-        SigUtil::checkForwardSigUsr2(forwardSigUsr2);
-    }
+    cleanupDocBrokers();
+    SigUtil::checkForwardSigUsr2(forwardSigUsr2);
 }
 
 #if !MOBILEAPP
@@ -3220,8 +3336,10 @@ bool LOOLWSD::createForKit()
     ForKitProc = nullptr;
     PrisonerPoll->setForKitProcess(ForKitProc);
 
-    // ForKit always spawns one.
+    // ForKit always spawns one. We don't account its latency,
+    // as it includes the ForKit startup and preinit.
     ++OutstandingForks;
+    PreSpawn.resetForkRequests();
 
     LOG_INF("Launching forkit process: " << forKitPath << ' ' << args.cat(' ', 0));
 
@@ -3234,7 +3352,7 @@ bool LOOLWSD::createForKit()
     // Init the Admin manager
     Admin::instance().setForKitPid(ForKitProcId);
 
-    const int balance = LOOLWSD::NumPreSpawnedChildren - OutstandingForks;
+    const int balance = getPreSpawnTarget() - OutstandingForks;
     if (balance > 0)
         rebalanceChildren(balance);
 
@@ -3268,8 +3386,6 @@ static std::shared_ptr<DocumentBroker>
     LOG_INF("Find or create DocBroker for docKey [" << docKey <<
             "] for session [" << id << "] on url [" << LOOLWSD::anonymizeUrl(uriPublic.toString()) << "].");
 
-    std::unique_lock<std::mutex> docBrokersLock(DocBrokersMutex);
-
     cleanupDocBrokers();
 
     if (SigUtil::getShutdownRequestFlag())
@@ -3280,15 +3396,12 @@ static std::shared_ptr<DocumentBroker>
         return nullptr;
     }
 
-    std::shared_ptr<DocumentBroker> docBroker;
-
     // Lookup this document.
-    const auto it = DocBrokers.find(docKey);
-    if (it != DocBrokers.end() && it->second)
+    std::shared_ptr<DocumentBroker> docBroker = DocBrokers.find(docKey);
+    if (docBroker)
     {
         // Get the DocumentBroker from the Cache.
         LOG_DBG("Found DocumentBroker with docKey [" << docKey << "].");
-        docBroker = it->second;
 
         // Destroying the document? Let the client reconnect.
         if (docBroker->isUnloading())
@@ -3327,21 +3440,35 @@ static std::shared_ptr<DocumentBroker>
 
     if (!docBroker)
     {
-        Util::assertIsLocked(DocBrokersMutex);
-
+#if ENABLE_SUPPORT_KEY
+        // Checked as the broker is added, lest concurrent loads all get past the limit.
+        const std::size_t maxDocuments = LOOLWSD::MaxDocuments;
+#else
+        const std::size_t maxDocuments = std::numeric_limits<std::size_t>::max();
         if (DocBrokers.size() + 1 > LOOLWSD::MaxDocuments)
+            LOG_INF("Maximum number of open documents of " << LOOLWSD::MaxDocuments << " reached.");
+#endif
+
+        // Another session of the same document may have created it since we looked,
+        // in which case we get that one.
+        docBroker = DocBrokers.findOrCreate(
+            docKey,
+            [&]()
+            {
+                LOG_DBG("New DocumentBroker for docKey [" << docKey << "].");
+                return std::make_shared<DocumentBroker>(type, uri, uriPublic, docKey,
+                                                        mobileAppDocId);
+            },
+            maxDocuments);
+        if (!docBroker)
         {
             LOG_INF("Maximum number of open documents of " << LOOLWSD::MaxDocuments << " reached.");
 #if ENABLE_SUPPORT_KEY
             shutdownLimitReached(proto);
-            return nullptr;
 #endif
+            return nullptr;
         }
 
-        // Set the one we just created.
-        LOG_DBG("New DocumentBroker for docKey [" << docKey << "].");
-        docBroker = std::make_shared<DocumentBroker>(type, uri, uriPublic, docKey, mobileAppDocId);
-        DocBrokers.emplace(docKey, docBroker);
         LOG_TRC("Have " << DocBrokers.size() << " DocBrokers after inserting [" << docKey << "].");
     }
 
@@ -3497,6 +3624,12 @@ private:
 
                 else if (param.first == "version")
                     LOOLWSD::LOKitVersion = param.second;
+
+                else if (param.first == "timings")
+                {
+                    LOG_DBG("New child jail setup times (ms): " << param.second);
+                    Admin::instance().addKitJailSetupTimes(param.second);
+                }
             }
 
             if (pid <= 0)
@@ -3623,6 +3756,14 @@ static std::shared_ptr<ConvertToBroker> getConvertToBrokerImplementation(const s
         return std::make_shared<ExtractLinkTargetsBroker>(fromPath, uriPublic, docKey, lang);
     else if (requestType == "get-thumbnail")
         return std::make_shared<GetThumbnailBroker>(fromPath, uriPublic, docKey, lang, target);
+    else if (requestType == "convert-batch")
+    {
+        // The format is the list of outputs, validated by the caller.
+        std::vector<ConvertBatchBroker::Output> outputs;
+        if (ConvertBatchBroker::parseOutputs(format, outputs))
+            return std::make_shared<ConvertBatchBroker>(fromPath, uriPublic, docKey,
+                                                        std::move(outputs), options, lang);
+    }
 
     return nullptr;
 }
@@ -3671,10 +3812,13 @@ public:
         return hosts.match(address);
     }
 
-    static bool allowConvertTo(const std::string& address, const Poco::Net::HTTPRequest& request)
+    /// Whether the client at @address, connecting to @host, and the proxies
+    /// in @forwardedFor, the X-Forwarded-For header, may convert documents.
+    static bool allowConvertTo(const std::string& address, const std::string& host,
+                               const std::string& forwardedFor)
     {
         std::string addressToCheck = address;
-        std::string hostToCheck = request.getHost();
+        std::string hostToCheck = host;
         bool allow = allowPostFrom(addressToCheck) || HostUtil::allowedWopiHost(hostToCheck);
 
         if (!allow)
@@ -3688,10 +3832,9 @@ public:
         }
 
         // Handle forwarded header and make sure all participating IPs are allowed
-        if (request.has("X-Forwarded-For"))
+        if (!forwardedFor.empty())
         {
-            const std::string fowardedData = request.get("X-Forwarded-For");
-            StringVector tokens = StringVector::tokenize(fowardedData, ',');
+            StringVector tokens = StringVector::tokenize(forwardedFor, ',');
             for (const auto& token : tokens)
             {
                 std::string param = tokens.getParam(token);
@@ -3767,13 +3910,12 @@ private:
         }
 #endif
 
-        Poco::Net::HTTPRequest request;
-
         StreamSocket::MessageMap map;
-        if (!socket->parseHeader("Client", startmessage, request, &map))
+        if (!socket->parseHeader("Client", startmessage, &map))
             return;
 
-        LOG_DBG("Handling request: " << request.getURI());
+        const http::RequestParser& parser = socket->getRequest();
+        LOG_DBG("Handling request: " << parser.getUri());
         try
         {
             // We may need to re-write the chunks moving the inBuffer.
@@ -3784,9 +3926,24 @@ private:
             message.seekg(startmessage.tellg(), std::ios::beg);
 
             // re-write ServiceRoot and cache.
-            RequestDetails requestDetails(request, LOOLWSD::ServiceRoot);
+            RequestDetails requestDetails(parser, LOOLWSD::ServiceRoot);
             // LOG_TRC("Request details " << requestDetails.toString());
 
+            // Copied from the parser only for the handlers that still take a Poco request,
+            // with the URI RequestDetails re-wrote.
+            std::unique_ptr<Poco::Net::HTTPRequest> pocoRequest;
+            const auto request = [&]() -> Poco::Net::HTTPRequest&
+            {
+                if (!pocoRequest)
+                {
+                    pocoRequest = Util::make_unique<Poco::Net::HTTPRequest>();
+                    StreamSocket::setRequest(parser, *pocoRequest);
+                    pocoRequest->setURI(requestDetails.getURI());
+                }
+
+                return *pocoRequest;
+            };
+
             // Config & security ...
             if (requestDetails.isProxy())
             {
@@ -3797,7 +3954,7 @@ private:
             }
 
             // Routing
-            if (UnitWSD::get().handleHttpRequest(request, message, socket))
+            if (UnitWSD::isUnitTesting() && UnitWSD::get().handleHttpRequest(request(), message, socket))
             {
                 // Unit testing, nothing to do here
             }
@@ -3835,7 +3992,7 @@ private:
                 }
                 else
                 {
-                    FileServerRequestHandler::handleRequest(request, requestDetails, message, socket);
+                    FileServerRequestHandler::handleRequest(request(), requestDetails, message, socket);
                     socket->shutdown();
                 }
             }
@@ -3843,8 +4000,8 @@ private:
                      requestDetails.equals(1, "adminws"))
             {
                 // Admin connections
-                LOG_INF("Admin request: " << request.getURI());
-                if (AdminSocketHandler::handleInitialRequest(_socket, request))
+                LOG_INF("Admin request: " << requestDetails.getURI());
+                if (AdminSocketHandler::handleInitialRequest(_socket, request()))
                 {
                     disposition.setMove([](const std::shared_ptr<Socket> &moveSocket){
                             // Hand the socket over to the Admin poll.
@@ -3866,7 +4023,7 @@ private:
                     /* WARNING: security point, we may skip authentication */
                     bool skipAuthentication = LOOLWSD::getConfigValue<bool>("security.enable_metrics_unauthenticated", false);
                     if (!skipAuthentication)
-                        if (!FileServerRequestHandler::isAdminLoggedIn(request, *response))
+                        if (!FileServerRequestHandler::isAdminLoggedIn(request(), *response))
                             throw Poco::Net::NotAuthenticatedException("Invalid admin login");
                 }
                 catch (const Poco::Net::NotAuthenticatedException& exc)
@@ -3907,35 +4064,35 @@ private:
                 if (requestDetails.equals(1, "discovery"))
                     handleWopiDiscoveryRequest(requestDetails, socket);
                 else if (requestDetails.equals(1, "capabilities"))
-                    handleCapabilitiesRequest(request, socket);
+                    handleCapabilitiesRequest(parser, socket);
             }
             else if (requestDetails.isGet("/robots.txt"))
-                handleRobotsTxtRequest(request, socket);
+                handleRobotsTxtRequest(requestDetails, socket);
 
             else if (requestDetails.equals(RequestDetails::Field::Type, "lool") &&
                      requestDetails.equals(1, "media"))
             {
-                handleMediaRequest(request, disposition, socket);
+                handleMediaRequest(requestDetails, disposition, socket);
             }
             else if (requestDetails.equals(RequestDetails::Field::Type, "lool") &&
                      requestDetails.equals(1, "clipboard"))
             {
 //              Util::dumpHex(std::cerr, socket->getInBuffer(), "clipboard:\n"); // lots of data ...
-                handleClipboardRequest(request, message, disposition, socket);
+                handleClipboardRequest(request(), message, disposition, socket);
             }
 
             else if (requestDetails.isProxy() && requestDetails.equals(2, "ws"))
-                handleClientProxyRequest(request, requestDetails, message, disposition);
+                handleClientProxyRequest(request(), requestDetails, message, disposition);
 
             else if (requestDetails.equals(RequestDetails::Field::Type, "lool") &&
                      requestDetails.equals(2, "ws") && requestDetails.isWebSocket())
-                handleClientWsUpgrade(request, requestDetails, disposition, socket);
+                handleClientWsUpgrade(parser, requestDetails, disposition, socket);
 
             else if (!requestDetails.isWebSocket() &&
                      requestDetails.equals(RequestDetails::Field::Type, "lool"))
             {
                 // All post requests have url prefix 'lool'.
-                handlePostRequest(requestDetails, request, message, disposition, socket);
+                handlePostRequest(requestDetails, request(), message, disposition, socket);
             }
             else
             {
@@ -3974,7 +4131,7 @@ private:
         // we expect one request per socket
         socket->eraseFirstInputBytes(map);
 #else
-        Poco::Net::HTTPRequest request;
+        const http::RequestParser request;
 
 #ifdef IOS
         // The URL of the document is sent over the FakeSocket by the code in
@@ -4083,12 +4240,12 @@ private:
         LOG_INF("Sent discovery.xml successfully.");
     }
 
-    void handleCapabilitiesRequest(const Poco::Net::HTTPRequest& request,
+    void handleCapabilitiesRequest(const http::RequestParser& request,
                                    const std::shared_ptr<StreamSocket>& socket)
     {
         assert(socket && "Must have a valid socket");
 
-        LOG_DBG("Wopi capabilities request: " << request.getURI());
+        LOG_DBG("Wopi capabilities request: " << request.getUri());
 
         const std::string capabilities = getCapabilitiesJson(request, socket);
 
@@ -4144,13 +4301,7 @@ private:
 
         const auto docKey = RequestDetails::getDocKey(WOPISrc);
 
-        std::shared_ptr<DocumentBroker> docBroker;
-        {
-            std::unique_lock<std::mutex> docBrokersLock(DocBrokersMutex);
-            auto it = DocBrokers.find(docKey);
-            if (it != DocBrokers.end())
-                docBroker = it->second;
-        }
+        std::shared_ptr<DocumentBroker> docBroker = DocBrokers.find(docKey);
 
         // If we have a valid docBroker, use it.
         // Note: there is a race here as DocBroker may
@@ -4204,12 +4355,12 @@ private:
         }
     }
 
-    static void handleRobotsTxtRequest(const Poco::Net::HTTPRequest& request,
+    static void handleRobotsTxtRequest(const RequestDetails& requestDetails,
                                 const std::shared_ptr<StreamSocket>& socket)
     {
         assert(socket && "Must have a valid socket");
 
-        LOG_DBG_S("HTTP request: " << request.getURI());
+        LOG_DBG_S("HTTP request: " << requestDetails.getURI());
         const std::string responseString = "User-agent: *\nDisallow: /\n";
 
         http::Response httpResponse(http::StatusCode::OK);
@@ -4219,7 +4370,7 @@ private:
         httpResponse.set("Connection", "close");
         httpResponse.writeData(socket->getOutBuffer());
 
-        if (request.getMethod() == Poco::Net::HTTPRequest::HTTP_GET)
+        if (requestDetails.isGet())
         {
             socket->send(responseString);
         }
@@ -4228,16 +4379,17 @@ private:
         LOG_INF_S("Sent robots.txt response successfully");
     }
 
-    static void handleMediaRequest(const Poco::Net::HTTPRequest& request,
+    static void handleMediaRequest(const RequestDetails& requestDetails,
                                    SocketDisposition& /*disposition*/,
                                    const std::shared_ptr<StreamSocket>& socket)
     {
         assert(socket && "Must have a valid socket");
 
-        LOG_DBG_S("Media request: " << request.getURI());
+        const std::string uri = requestDetails.getURI();
+        LOG_DBG_S("Media request: " << uri);
 
         std::string decoded;
-        Poco::URI::decode(request.getURI(), decoded);
+        Poco::URI::decode(uri, decoded);
         Poco::URI requestUri(decoded);
         Poco::URI::QueryParameters params = requestUri.getQueryParameters();
         std::string WOPISrc, serverId, viewId, tag, mime;
@@ -4262,7 +4414,7 @@ private:
         {
             LOG_ERR_S("Cluster configuration error: mis-matching serverid ["
                       << serverId << "] vs. [" << Util::getProcessIdentifier()
-                      << "] on request to URL: " << request.getURI());
+                      << "] on request to URL: " << uri);
 
             // we got the wrong request.
             http::Response httpResponse(http::StatusCode::BadRequest);
@@ -4275,26 +4427,20 @@ private:
         const auto docKey = RequestDetails::getDocKey(WOPISrc);
         LOG_TRC_S("Looking up DocBroker with docKey [" << docKey << "] referenced in WOPISrc ["
                                                        << WOPISrc
-                                                       << "] in media URL: " + request.getURI());
+                                                       << "] in media URL: " + uri);
 
-        std::shared_ptr<DocumentBroker> docBroker;
+        std::shared_ptr<DocumentBroker> docBroker = DocBrokers.find(docKey);
+        if (!docBroker)
         {
-            std::unique_lock<std::mutex> docBrokersLock(DocBrokersMutex);
-            auto it = DocBrokers.find(docKey);
-            if (it == DocBrokers.end())
-            {
-                LOG_ERR_S("Unknown DocBroker with docKey ["
-                          << docKey << "] referenced in WOPISrc [" << WOPISrc
-                          << "] in media URL: " + request.getURI());
-
-                http::Response httpResponse(http::StatusCode::BadRequest);
-                httpResponse.set("Content-Length", "0");
-                socket->sendAndShutdown(httpResponse);
-                socket->ignoreInput();
-                return;
-            }
+            LOG_ERR_S("Unknown DocBroker with docKey ["
+                      << docKey << "] referenced in WOPISrc [" << WOPISrc
+                      << "] in media URL: " + uri);
 
-            docBroker = it->second;
+            http::Response httpResponse(http::StatusCode::BadRequest);
+            httpResponse.set("Content-Length", "0");
+            socket->sendAndShutdown(httpResponse);
+            socket->ignoreInput();
+            return;
         }
 
         // If we have a valid docBroker, use it.
@@ -4476,10 +4622,12 @@ private:
 
         if (requestDetails.equals(1, "convert-to") ||
             requestDetails.equals(1, "extract-link-targets") ||
-            requestDetails.equals(1, "get-thumbnail"))
+            requestDetails.equals(1, "get-thumbnail") ||
+            requestDetails.equals(1, "convert-batch"))
         {
             // Validate sender - FIXME: should do this even earlier.
-            if (!allowConvertTo(socket->clientAddress(), request))
+            if (!allowConvertTo(socket->clientAddress(), request.getHost(),
+                                request.get("X-Forwarded-For", "")))
             {
                 LOG_WRN("Conversion requests not allowed from this address: " << socket->clientAddress());
                 http::Response httpResponse(http::StatusCode::Forbidden);
@@ -4501,6 +4649,15 @@ private:
             if (requestDetails.equals(1, "convert-to") && format.empty())
                 hasRequiredParameters = false;
 
+            if (requestDetails.equals(1, "convert-batch"))
+            {
+                // All the outputs of one load, e.g. "pdf,thumbnail-320x180,extract-link-targets".
+                format = (form.has("outputs") ? form.get("outputs") : "");
+                std::vector<ConvertBatchBroker::Output> outputs;
+                if (!ConvertBatchBroker::parseOutputs(format, outputs))
+                    hasRequiredParameters = false;
+            }
+
             const std::string fromPath = handler.getFilename();
             LOG_INF("Conversion request for URI [" << fromPath << "] format [" << format << "].");
             if (!fromPath.empty() && hasRequiredParameters)
@@ -4542,17 +4699,23 @@ private:
                 std::string lang = (form.has("lang") ? form.get("lang") : std::string());
                 std::string target = (form.has("target") ? form.get("target") : std::string());
 
-                // This lock could become a bottleneck.
-                // In that case, we can use a pool and index by publicPath.
-                std::unique_lock<std::mutex> docBrokersLock(DocBrokersMutex);
-
                 LOG_DBG("New DocumentBroker for docKey [" << docKey << "].");
                 auto docBroker = getConvertToBrokerImplementation(requestDetails[1], fromPath, uriPublic, docKey, format, options, lang, target);
                 handler.takeFile();
 
                 cleanupDocBrokers();
 
-                DocBrokers.emplace(docKey, docBroker);
+                if (!DocBrokers.insert(docKey, docBroker))
+                {
+                    // Converting the same upload twice, which can't be.
+                    LOG_ERR("DocumentBroker with docKey [" << docKey << "] exists already, not converting.");
+                    http::Response httpResponse(http::StatusCode::Conflict);
+                    httpResponse.set("Content-Length", "0");
+                    socket->sendAndShutdown(httpResponse);
+                    socket->ignoreInput();
+                    return;
+                }
+
                 LOG_TRC("Have " << DocBrokers.size() << " DocBrokers after inserting [" << docKey << "].");
 
                 if (!docBroker->startConversion(disposition, _id))
@@ -4587,15 +4750,13 @@ private:
                 const std::string decodedUri = requestDetails.getDocumentURI();
                 const std::string docKey = RequestDetails::getDocKey(decodedUri);
 
-                std::unique_lock<std::mutex> docBrokersLock(DocBrokersMutex);
-                auto docBrokerIt = DocBrokers.find(docKey);
+                std::shared_ptr<DocumentBroker> docBroker = DocBrokers.find(docKey);
 
                 // Maybe just free the client from sending childid in form ?
-                if (docBrokerIt == DocBrokers.end() || docBrokerIt->second->getJailId() != formChildid)
+                if (!docBroker || docBroker->getJailId() != formChildid)
                 {
                     throw BadRequestException("DocKey [" + docKey + "] or childid [" + formChildid + "] is invalid.");
                 }
-                docBrokersLock.unlock();
 
                 // protect against attempts to inject something funny here
                 if (formChildid.find('/') == std::string::npos && formName.find('/') == std::string::npos)
@@ -4631,19 +4792,16 @@ private:
             const std::string decodedUri = requestDetails.getDocumentURI();
             const std::string docKey = RequestDetails::getDocKey(decodedUri);
 
-            std::unique_lock<std::mutex> docBrokersLock(DocBrokersMutex);
-            auto docBrokerIt = DocBrokers.find(docKey);
-            if (docBrokerIt == DocBrokers.end())
+            std::shared_ptr<DocumentBroker> docBroker = DocBrokers.find(docKey);
+            if (!docBroker)
             {
                 throw BadRequestException("DocKey [" + docKey + "] is invalid.");
             }
 
             std::string downloadId = requestDetails[3];
-            std::string url = docBrokerIt->second->getDownloadURL(downloadId);
-            docBrokerIt->second->unregisterDownloadId(downloadId);
-            std::string jailId = docBrokerIt->second->getJailId();
-
-            docBrokersLock.unlock();
+            std::string url = docBroker->getDownloadURL(downloadId);
+            docBroker->unregisterDownloadId(downloadId);
+            std::string jailId = docBroker->getJailId();
 
             bool foundDownloadId = !url.empty();
 
@@ -4719,17 +4877,22 @@ private:
             Poco::URI uriPublic = RequestDetails::sanitizeURI(fromPath);
             const std::string docKey = RequestDetails::getDocKey(uriPublic);
 
-            // This lock could become a bottleneck.
-            // In that case, we can use a pool and index by publicPath.
-            std::unique_lock<std::mutex> docBrokersLock(DocBrokersMutex);
-
             LOG_DBG("New DocumentBroker for docKey [" << docKey << "].");
             auto docBroker = std::make_shared<RenderSearchResultBroker>(fromPath, uriPublic, docKey, handler.getSearchResultContent());
             handler.takeFile();
 
             cleanupDocBrokers();
 
-            DocBrokers.emplace(docKey, docBroker);
+            if (!DocBrokers.insert(docKey, docBroker))
+            {
+                LOG_ERR("DocumentBroker with docKey [" << docKey << "] exists already, not rendering.");
+                http::Response httpResponse(http::StatusCode::Conflict);
+                httpResponse.set("Content-Length", "0");
+                socket->sendAndShutdown(httpResponse);
+                socket->ignoreInput();
+                return;
+            }
+
             LOG_TRC("Have " << DocBrokers.size() << " DocBrokers after inserting [" << docKey << "].");
 
             if (!docBroker->executeCommand(disposition, _id))
@@ -4831,7 +4994,7 @@ private:
     }
 #endif
 
-    void handleClientWsUpgrade(const Poco::Net::HTTPRequest& request,
+    void handleClientWsUpgrade(const http::RequestParser& request,
                                const RequestDetails &requestDetails,
                                SocketDisposition& disposition,
                                const std::shared_ptr<StreamSocket>& socket,
@@ -4952,7 +5115,7 @@ private:
                             ws->shutdown(WebSocketHandler::StatusCodes::POLICY_VIOLATION, msg);
                             moveSocket->ignoreInput();
                         }
-                    });
+                    }, clientSession);
                 }
                 else
                 {
@@ -5073,14 +5236,16 @@ private:
     }
 
     /// Create the /hosting/capabilities JSON and return as string.
-    std::string getCapabilitiesJson(const Poco::Net::HTTPRequest& request,
+    std::string getCapabilitiesJson(const http::RequestParser& request,
                                     const std::shared_ptr<StreamSocket>& socket)
     {
         assert(socket && "Must have a valid socket");
 
         // Can the convert-to be used?
         Poco::JSON::Object::Ptr convert_to = new Poco::JSON::Object;
-        Poco::Dynamic::Var available = allowConvertTo(socket->clientAddress(), request);
+        Poco::Dynamic::Var available =
+            allowConvertTo(socket->clientAddress(), std::string(request.get("Host")),
+                           std::string(request.get("X-Forwarded-For")));
         convert_to->set("available", available);
         if (available)
             convert_to->set("endpoint", "/lool/convert-to");
@@ -5088,6 +5253,13 @@ private:
         Poco::JSON::Object::Ptr capabilities = new Poco::JSON::Object;
         capabilities->set("convert-to", convert_to);
 
+        // Many outputs of one load, allowed as convert-to is.
+        Poco::JSON::Object::Ptr convert_batch = new Poco::JSON::Object;
+        convert_batch->set("available", available);
+        if (available)
+            convert_batch->set("endpoint", "/lool/convert-batch");
+        capabilities->set("convert-batch", convert_batch);
+
         // Supports the TemplateSaveAs in CheckFileInfo?
         // TemplateSaveAs is broken by design, disable it everywhere (and
         // remove at some stage too)
@@ -5268,6 +5440,11 @@ public:
            << "\n  NewChildren: " << NewChildren.size()
            << "\n  OutstandingForks: " << OutstandingForks
            << "\n  NumPreSpawnedChildren: " << LOOLWSD::NumPreSpawnedChildren
+#if !MOBILEAPP
+           << "\n  PreSpawn:";
+        PreSpawn.dumpState(os, "\n    ");
+        os
+#endif
            << "\n  ChildSpawnTimeoutMs: " << ChildSpawnTimeoutMs
            << "\n  Document Brokers: " << DocBrokers.size()
 #if !MOBILEAPP
@@ -5312,8 +5489,8 @@ public:
 
         os << "Document Broker polls "
                   << "[ " << DocBrokers.size() << " ]:\n";
-        for (auto &i : DocBrokers)
-            i.second->dumpState(os);
+        DocBrokers.forEach([&os](const std::string&, const std::shared_ptr<DocumentBroker>& docBroker)
+                           { docBroker->dumpState(os); });
 
 #if !MOBILEAPP
         os << "Converter count: " << ConvertToBroker::getInstanceCount() << '\n';
@@ -5643,6 +5820,10 @@ int LOOLWSD::innerMain()
     // URI with /contents are public and we don't need to anonymize them.
     Util::mapAnonymized("contents", "contents");
 
+#if !MOBILEAPP
+    DocumentBroker::startPollThreads(getConfigValue<int>("per_document.poll_threads", 0));
+#endif
+
     // Start the server.
     Server->start();
 
@@ -5691,6 +5872,7 @@ int LOOLWSD::innerMain()
     const auto startStamp = std::chrono::steady_clock::now();
 #if !MOBILEAPP
     auto stampFetch = startStamp - (fetchUpdateCheck - std::chrono::milliseconds(60000));
+    auto stampTileStore = startStamp;
 #endif
 
     while (!SigUtil::getTerminationFlag() && !SigUtil::getShutdownRequestFlag())
@@ -5713,6 +5895,10 @@ int LOOLWSD::innerMain()
         // Wake the prisoner poll to spawn some children, if necessary.
         PrisonerPoll->wakeup();
 
+        // Write out the trace blocks of the threads that went quiet.
+        if (TraceDumper)
+            TraceDumper->flushStale();
+
         const auto timeNow = std::chrono::steady_clock::now();
         const std::chrono::milliseconds timeSinceStartMs
             = std::chrono::duration_cast<std::chrono::milliseconds>(timeNow - startStamp);
@@ -5730,6 +5916,13 @@ int LOOLWSD::innerMain()
             processFetchUpdate();
             stampFetch = timeNow;
         }
+
+        // Here, as it lists and stats the whole store, rather than as documents close.
+        if (timeNow - stampTileStore > std::chrono::minutes(1))
+        {
+            TileStore::ensureSize();
+            stampTileStore = timeNow;
+        }
 #endif
 
 #if ENABLE_DEBUG && !MOBILEAPP
@@ -5780,13 +5973,11 @@ int LOOLWSD::innerMain()
     constexpr size_t count = (COMMAND_TIMEOUT_MS * 6) / sleepMs;
     for (size_t i = 0; i < count; ++i)
     {
-        std::unique_lock<std::mutex> docBrokersLock(DocBrokersMutex);
         if (DocBrokers.empty())
             break;
 
         LOG_DBG("Waiting for " << DocBrokers.size() << " documents to stop.");
         cleanupDocBrokers();
-        docBrokersLock.unlock();
 
         // Give them time to save and cleanup.
         std::this_thread::sleep_for(std::chrono::milliseconds(sleepMs));
@@ -5805,22 +5996,20 @@ int LOOLWSD::innerMain()
     // Wait for the DocumentBrokers. They must be saving/uploading now.
     // Do not stop them! Otherwise they might not save/upload the document.
     // We block until they finish, or the service stopping times out.
-    {
-        std::unique_lock<std::mutex> docBrokersLock(DocBrokersMutex);
-        for (auto& docBrokerIt : DocBrokers)
+    DocBrokers.forEach(
+        [](const std::string& docKey, const std::shared_ptr<DocumentBroker>& docBroker)
         {
-            std::shared_ptr<DocumentBroker> docBroker = docBrokerIt.second;
             if (docBroker && docBroker->isAlive())
             {
-                LOG_DBG("Joining docBroker [" << docBrokerIt.first << "].");
+                LOG_DBG("Joining docBroker [" << docKey << "].");
                 docBroker->joinThread();
             }
-        }
+        });
 
-        // Now should be safe to destroy what's left.
-        cleanupDocBrokers();
-        DocBrokers.clear();
-    }
+    // Now should be safe to destroy what's left.
+    cleanupDocBrokers();
+    DocBrokers.clear();
+    DocumentBroker::stopPollThreads();
 
     if (TraceEventFile != NULL)
     {
@@ -5929,7 +6118,6 @@ void LOOLWSD::cleanup()
         SocketPoll::InhibitThreadChecks = true;
 
         // Delete these while the static Admin instance is still alive.
-        std::lock_guard<std::mutex> docBrokersLock(DocBrokersMutex);
         DocBrokers.clear();
     }
     catch (const std::exception& ex)
@@ -5981,13 +6169,7 @@ int LOOLWSD::getClientPortNumber()
 
 std::vector<std::shared_ptr<DocumentBroker>> LOOLWSD::getBrokersTestOnly()
 {
-    std::lock_guard<std::mutex> docBrokersLock(DocBrokersMutex);
-    std::vector<std::shared_ptr<DocumentBroker>> result;
-
-    result.reserve(DocBrokers.size());
-    for (auto& brokerIt : DocBrokers)
-        result.push_back(brokerIt.second);
-    return result;
+    return DocBrokers.getAll();
 }
 
 std::set<pid_t> LOOLWSD::getKitPids()
@@ -6003,15 +6185,13 @@ std::set<pid_t> LOOLWSD::getKitPids()
                 pids.emplace(pid);
         }
     }
-    {
-        std::unique_lock<std::mutex> lock(DocBrokersMutex);
-        for (const auto &it : DocBrokers)
+    DocBrokers.forEach(
+        [&pids](const std::string&, const std::shared_ptr<DocumentBroker>& docBroker)
         {
-            pid = it.second->getPid();
-            if (pid > 0)
-                pids.emplace(pid);
-        }
-    }
+            const pid_t brokerPid = docBroker->getPid();
+            if (brokerPid > 0)
+                pids.emplace(brokerPid);
+        });
     return pids;
 }
 
@@ -6050,7 +6230,6 @@ void forwardSigUsr2()
 {
     LOG_TRC("forwardSigUsr2");
 
-    Util::assertIsLocked(DocBrokersMutex);
     std::lock_guard<std::mutex> newChildLock(NewChildrenMutex);
 
 #if !MOBILEAPP
@@ -6072,15 +6251,15 @@ void forwardSigUsr2()
         }
     }
 
-    for (const auto& pair : DocBrokers)
-    {
-        std::shared_ptr<DocumentBroker> docBroker = pair.second;
-        if (docBroker)
+    DocBrokers.forEach(
+        [](const std::string&, const std::shared_ptr<DocumentBroker>& docBroker)
         {
-            LOG_INF("Sending SIGUSR2 to docBroker " << docBroker->getPid());
-            ::kill(docBroker->getPid(), SIGUSR2);
-        }
-    }
+            if (docBroker)
+            {
+                LOG_INF("Sending SIGUSR2 to docBroker " << docBroker->getPid());
+                ::kill(docBroker->getPid(), SIGUSR2);
+            }
+        });
 }
 
 // Avoid this in the Util::isFuzzing() case because libfuzzer defines its own main().
@@ -473,6 +473,11 @@ public:
     /// Sets the log level of current kits.
     static void setLogLevelsOfKits(const std::string& level);
 
+#if !MOBILEAPP
+    /// Returns the state of the spare children pool as JSON, for the admin console.
+    static std::string getPreSpawnStats();
+#endif
+
     /// Anonymize the basename of filenames, preserving the path and extension.
     static std::string anonymizeUrl(const std::string& url)
     {
@@ -0,0 +1,107 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <config.h>
+
+#include "PageTemplate.hpp"
+
+#include <cassert>
+
+namespace
+{
+bool isPlaceholderChar(char c) { return (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_'; }
+} // namespace
+
+void PageTemplate::Values::set(const std::string& placeholder, std::string value)
+{
+    const auto it = _page._placeholders.find(placeholder);
+    if (it == _page._placeholders.end())
+        return;
+
+    _values[it->second] = std::move(value);
+    _isSet[it->second] = true;
+}
+
+PageTemplate::PageTemplate(std::string content)
+    : _content(std::move(content))
+{
+    static const std::string CommentStart("<!--");
+    static const std::string CommentEnd("-->");
+
+    const std::size_t size = _content.size();
+    std::size_t literalStart = 0;
+    std::size_t pos = 0;
+    while ((pos = _content.find('%', pos)) != std::string::npos)
+    {
+        std::size_t end = pos + 1;
+        while (end < size && isPlaceholderChar(_content[end]))
+            ++end;
+
+        // Names start with a letter, which rules out e.g. "%20".
+        if (end == pos + 1 || end >= size || _content[end] != '%' || _content[pos + 1] < 'A' ||
+            _content[pos + 1] > 'Z')
+        {
+            ++pos;
+            continue;
+        }
+
+        std::size_t start = pos;
+        ++end; // The closing '%'.
+        if (start >= literalStart + CommentStart.size() &&
+            _content.compare(start - CommentStart.size(), CommentStart.size(), CommentStart) == 0 &&
+            _content.compare(end, CommentEnd.size(), CommentEnd) == 0)
+        {
+            start -= CommentStart.size();
+            end += CommentEnd.size();
+        }
+
+        addLiteral(literalStart, start);
+
+        const int slot = _placeholders
+                             .emplace(_content.substr(start, end - start),
+                                      static_cast<int>(_placeholders.size()))
+                             .first->second;
+        _segments.push_back({ start, end - start, slot });
+
+        literalStart = pos = end;
+    }
+
+    addLiteral(literalStart, size);
+}
+
+void PageTemplate::addLiteral(std::size_t start, std::size_t end)
+{
+    if (end > start)
+        _segments.push_back({ start, end - start, -1 });
+}
+
+std::string PageTemplate::render(const Values& values) const
+{
+    assert(&values._page == this && "Values are for another page");
+
+    std::size_t size = 0;
+    for (const Segment& segment : _segments)
+    {
+        size += segment._slot >= 0 && values._isSet[segment._slot]
+                    ? values._values[segment._slot].size()
+                    : segment._length;
+    }
+
+    std::string result;
+    result.reserve(size);
+    for (const Segment& segment : _segments)
+    {
+        if (segment._slot >= 0 && values._isSet[segment._slot])
+            result += values._values[segment._slot];
+        else
+            result.append(_content, segment._offset, segment._length);
+    }
+
+    return result;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,77 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/// A page we fill in per request, e.g. lool.html, compiled once into
+/// literal segments and placeholder slots, so that rendering it is a
+/// single pass into one buffer, instead of a scan per placeholder.
+///
+/// Placeholders look like %ACCESS_TOKEN%, or <!--%BRANDING_JS%--> to
+/// keep the unprocessed page valid. Placeholders we have no value for
+/// are rendered as they are, and values are never expanded further.
+class PageTemplate
+{
+public:
+    /// The values to render a page with.
+    class Values
+    {
+    public:
+        explicit Values(const PageTemplate& page)
+            : _page(page)
+            , _values(page._placeholders.size())
+            , _isSet(page._placeholders.size(), false)
+        {
+        }
+
+        /// Sets the value of @placeholder, as it appears in the page (e.g. "%HOST%").
+        /// Placeholders that aren't in the page are ignored.
+        void set(const std::string& placeholder, std::string value);
+
+    private:
+        friend class PageTemplate;
+
+        const PageTemplate& _page;
+        std::vector<std::string> _values;
+        std::vector<bool> _isSet;
+    };
+
+    explicit PageTemplate(std::string content);
+
+    PageTemplate(const PageTemplate&) = delete;
+    PageTemplate& operator=(const PageTemplate&) = delete;
+
+    std::string render(const Values& values) const;
+
+    /// The unprocessed page.
+    const std::string& getContent() const { return _content; }
+
+    /// The number of distinct placeholders.
+    std::size_t getPlaceholderCount() const { return _placeholders.size(); }
+
+private:
+    /// Literal text or a placeholder, as a range of _content.
+    struct Segment
+    {
+        std::size_t _offset;
+        std::size_t _length;
+        int _slot; ///< The placeholder index, or -1 for literal text.
+    };
+
+    void addLiteral(std::size_t start, std::size_t end);
+
+    const std::string _content;
+    std::vector<Segment> _segments;
+    std::unordered_map<std::string, int> _placeholders;
+};
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,240 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <config.h>
+
+#include "PreSpawnController.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+#include <common/Log.hpp>
+
+PreSpawnController::PreSpawnController()
+    : _enabled(false)
+    , _fixedCount(1)
+    , _minChildren(1)
+    , _maxChildren(1)
+    , _coldOpenTarget(0.05)
+    , _rateWindow(std::chrono::seconds(60))
+    , _spareMemKb(0)
+    , _maxMemProportion(0)
+    , _rate(0)
+    , _rateTime(Clock::now())
+    , _latencyBuckets{}
+    , _latencySamples(0)
+    , _lastTarget(1)
+    , _lastTargetMemCapped(false)
+    , _arrivals(0)
+    , _coldOpens(0)
+{
+}
+
+void PreSpawnController::configure(bool enabled, std::size_t fixedCount, std::size_t minChildren,
+                                   std::size_t maxChildren, double coldOpenTarget,
+                                   std::chrono::seconds rateWindow, std::size_t spareMemKb,
+                                   double maxMemProportion)
+{
+    _enabled = enabled;
+    _fixedCount = std::max<std::size_t>(fixedCount, 1);
+    _minChildren = std::max<std::size_t>(minChildren, 1);
+    _maxChildren = std::max(maxChildren, _minChildren);
+    _coldOpenTarget = std::min(std::max(coldOpenTarget, 0.0001), 1.0);
+    _rateWindow = std::max(rateWindow, std::chrono::seconds(1));
+    _spareMemKb = spareMemKb;
+    _maxMemProportion = std::min(std::max(maxMemProportion, 0.0), 100.0);
+    _lastTarget = _enabled ? _minChildren : _fixedCount;
+
+    LOG_INF("Adaptive prespawn " << (_enabled ? "enabled" : "disabled") << ": min " << _minChildren
+                                 << ", max " << _maxChildren << ", cold-open target "
+                                 << _coldOpenTarget << ", rate window " << _rateWindow.count()
+                                 << "s, spare kit cost " << _spareMemKb << " KB, max "
+                                 << _maxMemProportion << "% of available memory.");
+}
+
+void PreSpawnController::decayRate(Clock::time_point now)
+{
+    if (now <= _rateTime)
+        return;
+
+    const double elapsedSecs = std::chrono::duration<double>(now - _rateTime).count();
+    _rate *= std::exp(-elapsedSecs / _rateWindow.count());
+    _rateTime = now;
+}
+
+void PreSpawnController::recordArrival(Clock::time_point now, bool hadSpare)
+{
+    decayRate(now);
+
+    // Each arrival adds an impulse of 1/tau, so a steady stream of
+    // r arrivals per second converges on a rate of r.
+    _rate += 1.0 / _rateWindow.count();
+
+    ++_arrivals;
+    if (!hadSpare)
+        ++_coldOpens;
+}
+
+double PreSpawnController::getArrivalRate(Clock::time_point now) const
+{
+    if (now <= _rateTime)
+        return _rate;
+
+    const double elapsedSecs = std::chrono::duration<double>(now - _rateTime).count();
+    return _rate * std::exp(-elapsedSecs / _rateWindow.count());
+}
+
+void PreSpawnController::recordForkRequest(Clock::time_point now, std::size_t count)
+{
+    _pendingForks.insert(_pendingForks.end(), count, now);
+}
+
+void PreSpawnController::recordChildSpawned(Clock::time_point now)
+{
+    if (_pendingForks.empty())
+        return; // Unexpected child; no latency to account for.
+
+    const auto latencyMs =
+        std::chrono::duration_cast<std::chrono::milliseconds>(now - _pendingForks.front()).count();
+    _pendingForks.pop_front();
+
+    std::size_t bucket = 0;
+    while (bucket < NumBuckets - 1 &&
+           static_cast<std::size_t>(latencyMs) >= (BucketBaseMs << bucket))
+        ++bucket;
+
+    ++_latencyBuckets[bucket];
+    if (++_latencySamples >= HistogramDecayCount)
+    {
+        _latencySamples = 0;
+        for (std::size_t& count : _latencyBuckets)
+        {
+            count /= 2;
+            _latencySamples += count;
+        }
+    }
+
+    LOG_TRC("Child spawned in " << latencyMs << "ms, " << _pendingForks.size()
+                                << " spawn requests outstanding");
+}
+
+std::size_t PreSpawnController::getSpawnLatencyMs(double percentile) const
+{
+    if (_latencySamples == 0)
+        return 0;
+
+    const double wanted = percentile * _latencySamples;
+    std::size_t cumulative = 0;
+    for (std::size_t i = 0; i < NumBuckets; ++i)
+    {
+        cumulative += _latencyBuckets[i];
+        if (cumulative >= wanted)
+            return BucketBaseMs << i; // Upper bound of the bucket.
+    }
+
+    return BucketBaseMs << (NumBuckets - 1);
+}
+
+std::size_t PreSpawnController::poissonQuantile(double mean, double tailProbability,
+                                                std::size_t cap)
+{
+    if (mean <= 0)
+        return 0;
+
+    // Sum the PMF in log-space to avoid underflow for large means.
+    const double logMean = std::log(mean);
+    double cdf = 0;
+    for (std::size_t k = 0; k < cap; ++k)
+    {
+        cdf += std::exp(-mean + k * logMean - std::lgamma(k + 1.0));
+        if (1.0 - cdf <= tailProbability)
+            return k;
+    }
+
+    return cap;
+}
+
+std::size_t PreSpawnController::getTarget(Clock::time_point now, std::size_t memAvailableKb)
+{
+    if (!_enabled)
+    {
+        _lastTarget = _fixedCount;
+        return _lastTarget;
+    }
+
+    // We use the p90 spawn latency; until we have measured any, assume one second.
+    const std::size_t latencyMs = _latencySamples ? getSpawnLatencyMs(0.9) : 1000;
+    const double expectedArrivals = getArrivalRate(now) * latencyMs / 1000.0;
+
+    // Spares needed to absorb the arrivals while their replacements spawn.
+    std::size_t target = poissonQuantile(expectedArrivals, _coldOpenTarget, _maxChildren);
+    target = std::min(std::max(target, _minChildren), _maxChildren);
+
+    _lastTargetMemCapped = false;
+    if (_spareMemKb > 0 && _maxMemProportion > 0 && memAvailableKb > 0)
+    {
+        const std::size_t budgetKb = memAvailableKb * _maxMemProportion / 100;
+        const std::size_t affordable = std::max(budgetKb / _spareMemKb, _minChildren);
+        if (target > affordable)
+        {
+            target = affordable;
+            _lastTargetMemCapped = true;
+        }
+    }
+
+    if (target != _lastTarget)
+    {
+        LOG_DBG("Adaptive prespawn target changed from "
+                << _lastTarget << " to " << target << " (rate " << getArrivalRate(now)
+                << "/s, p90 spawn " << latencyMs << "ms"
+                << (_lastTargetMemCapped ? ", capped by memory" : "") << ')');
+        _lastTarget = target;
+    }
+
+    return target;
+}
+
+std::string PreSpawnController::toJSON(Clock::time_point now, std::size_t available,
+                                       int outstanding) const
+{
+    std::ostringstream oss;
+    oss << "{ \"adaptive\": " << (_enabled ? "true" : "false")
+        << ", \"target\": " << _lastTarget
+        << ", \"available\": " << available
+        << ", \"outstanding\": " << outstanding
+        << ", \"min\": " << _minChildren
+        << ", \"max\": " << _maxChildren
+        << ", \"memCapped\": " << (_lastTargetMemCapped ? "true" : "false")
+        << ", \"arrivalRate\": " << getArrivalRate(now)
+        << ", \"spawnP50Ms\": " << getSpawnLatencyMs(0.5)
+        << ", \"spawnP90Ms\": " << getSpawnLatencyMs(0.9)
+        << ", \"arrivals\": " << _arrivals
+        << ", \"coldOpens\": " << _coldOpens
+        << ", \"spawnHistogram\": [";
+    for (std::size_t i = 0; i < NumBuckets; ++i)
+        oss << (i ? ", " : "") << _latencyBuckets[i];
+    oss << "] }";
+    return oss.str();
+}
+
+void PreSpawnController::dumpState(std::ostream& os, const std::string& indent) const
+{
+    const auto now = Clock::now();
+    os << indent << "adaptive: " << _enabled
+       << indent << "target: " << _lastTarget
+       << (_lastTargetMemCapped ? " (memory capped)" : "")
+       << indent << "min/max: " << _minChildren << '/' << _maxChildren
+       << indent << "cold-open target: " << _coldOpenTarget
+       << indent << "arrival rate: " << getArrivalRate(now) << "/s"
+       << indent << "spawn p50/p90: " << getSpawnLatencyMs(0.5) << '/'
+       << getSpawnLatencyMs(0.9) << "ms"
+       << indent << "pending forks: " << _pendingForks.size()
+       << indent << "arrivals: " << _arrivals << ", cold opens: " << _coldOpens;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,114 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <ostream>
+#include <string>
+
+/// Sizes the pool of pre-spawned (spare) children adaptively.
+///
+/// We track the rate at which documents request a new child and the
+/// time it takes ForKit to deliver one. The number of spares we need is
+/// then the number of arrivals expected while a replacement is being
+/// spawned, such that the probability of a cold open (i.e. a document
+/// finding no spare child and waiting on fork and jail setup) stays
+/// below the configured target. Arrivals are modelled as Poisson.
+///
+/// Not thread-safe; callers must serialize access (we use NewChildrenMutex).
+class PreSpawnController
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    /// Log-scale buckets for the spawn latency histogram.
+    /// Bucket i holds latencies below (BucketBaseMs << i) milliseconds,
+    /// the last bucket is the overflow.
+    static constexpr std::size_t NumBuckets = 14;
+    static constexpr std::size_t BucketBaseMs = 16;
+
+    /// Once we have this many samples in the histogram, we halve all
+    /// buckets to give more weight to recent spawns.
+    static constexpr std::size_t HistogramDecayCount = 256;
+
+    PreSpawnController();
+
+    /// Reads the configuration. When disabled, we always
+    /// target the static @fixedCount.
+    void configure(bool enabled, std::size_t fixedCount, std::size_t minChildren,
+                   std::size_t maxChildren, double coldOpenTarget,
+                   std::chrono::seconds rateWindow, std::size_t spareMemKb,
+                   double maxMemProportion);
+
+    bool isEnabled() const { return _enabled; }
+
+    /// A document requested a child. @hadSpare is false when
+    /// no spare was available, i.e. a cold open.
+    void recordArrival(Clock::time_point now, bool hadSpare);
+
+    /// We asked ForKit to spawn @count children.
+    void recordForkRequest(Clock::time_point now, std::size_t count);
+
+    /// A new child has arrived; match it with the oldest request.
+    void recordChildSpawned(Clock::time_point now);
+
+    /// Forget outstanding requests, ForKit was reset or unresponsive.
+    void resetForkRequests() { _pendingForks.clear(); }
+
+    /// Returns the number of spare children we should keep around,
+    /// given @memAvailableKb of system memory is still available (0 if unknown).
+    std::size_t getTarget(Clock::time_point now, std::size_t memAvailableKb);
+
+    /// The decayed arrival rate in requests per second.
+    double getArrivalRate(Clock::time_point now) const;
+
+    /// Returns the estimated spawn latency at the given percentile (0-1) in milliseconds.
+    std::size_t getSpawnLatencyMs(double percentile) const;
+
+    /// Returns the smallest n such that P(X > n) <= @tailProbability
+    /// for X ~ Poisson(@mean), capped to @cap.
+    static std::size_t poissonQuantile(double mean, double tailProbability, std::size_t cap);
+
+    /// The controller state as a JSON object, for the admin console.
+    std::string toJSON(Clock::time_point now, std::size_t available, int outstanding) const;
+
+    void dumpState(std::ostream& os, const std::string& indent) const;
+
+private:
+    void decayRate(Clock::time_point now);
+
+private:
+    bool _enabled;
+    std::size_t _fixedCount;
+    std::size_t _minChildren;
+    std::size_t _maxChildren;
+    double _coldOpenTarget;
+    std::chrono::seconds _rateWindow;
+    std::size_t _spareMemKb;
+    double _maxMemProportion;
+
+    /// Exponentially-decayed arrival rate (per second) at _rateTime.
+    double _rate;
+    Clock::time_point _rateTime;
+
+    std::array<std::size_t, NumBuckets> _latencyBuckets;
+    std::size_t _latencySamples;
+
+    /// When each outstanding fork was requested, oldest first.
+    std::deque<Clock::time_point> _pendingForks;
+
+    std::size_t _lastTarget;
+    bool _lastTargetMemCapped;
+    std::size_t _arrivals;
+    std::size_t _coldOpens;
+};
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
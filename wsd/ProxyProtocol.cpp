@@ -25,6 +25,7 @@
 #include "LOOLWSD.hpp"
 #include <Socket.hpp>
 
+#include <algorithm>
 #include <atomic>
 #include <cassert>
 
@@ -106,6 +107,9 @@ void DocumentBroker::handleProxyRequest(
     proxy->handleRequest(isWaiting, socket);
 }
 
+std::chrono::milliseconds ProxyProtocolHandler::HoldWindow(200);
+std::chrono::milliseconds ProxyProtocolHandler::BatchWindow(5);
+
 bool ProxyProtocolHandler::parseEmitIncoming(
     const std::shared_ptr<StreamSocket> &socket)
 {
@@ -117,57 +121,36 @@ bool ProxyProtocolHandler::parseEmitIncoming(
     LOG_TRC("Parse message:\n" << oss.str());
 #endif
 
-    while (in.size() > 0)
+    // Parse all the frames in place, and consume them at once at the end.
+    const char* const data = in.getBlock();
+    const std::size_t size = in.size();
+    std::size_t offset = 0;
+    bool valid = true;
+    while (offset < size && _msgHandler)
     {
-        // Type
-        if ((in[0] != 'T' && in[0] != 'B') || in.size() < 2)
-        {
-            LOG_ERR("Invalid message type " << in[0]);
-            return false;
-        }
-        auto it = in.begin() + 1;
-
-        // Serial
-        for (; it != in.end() && *it != '\n'; ++it);
-        *it = '\0';
-        uint64_t serial = strtoll( &in[1], nullptr, 16 );
-        in.erase(in.begin(), it + 1);
-        if (in.size() < 2)
+        Frame frame;
+        const int taken = parseFrame(data + offset, size - offset, frame);
+        if (taken <= 0)
         {
-            LOG_ERR("Invalid message framing size " << in.size());
-            return false;
+            LOG_ERR((taken < 0 ? "Invalid" : "Incomplete") << " message framing at " << offset
+                                                           << " of " << size << " bytes");
+            valid = false;
+            break;
         }
 
-        // Length
-        it = in.begin();
-        for (; it != in.end() && *it != '\n'; ++it);
-        *it = '\0';
-        uint64_t len = strtoll( &in[0], nullptr, 16 );
-        in.erase(in.begin(), it + 1);
-        if (len > in.size())
-        {
-            LOG_ERR("Invalid message length " << len << " vs " << in.size());
-            return false;
-        }
+        offset += taken;
 
-        // far from efficient:
-        std::vector<char> data;
-        data.insert(data.begin(), in.begin(), in.begin() + len + 1);
-        in.eraseFirst(len);
+        if (frame._serial != _inSerial + 1)
+            LOG_ERR("Serial mismatch " << frame._serial << " vs. " << (_inSerial + 1));
+        _inSerial = frame._serial;
 
-        if (in.size() < 1 || in[0] != '\n')
-        {
-            LOG_ERR("Missing final newline");
-            return false;
-        }
-        in.eraseFirst(1);
-
-        if (serial != _inSerial + 1)
-            LOG_ERR("Serial mismatch " << serial << " vs. " << (_inSerial + 1));
-        _inSerial = serial;
-        _msgHandler->handleMessage(data);
+        // The handler wants a vector, so we reuse one, rather than allocate each time.
+        _inMessage.assign(frame._data, frame._data + frame._size);
+        _msgHandler->handleMessage(_inMessage);
     }
-    return true;
+
+    in.eraseFirst(offset);
+    return valid;
 }
 
 void ProxyProtocolHandler::handleRequest(bool isWaiting, const std::shared_ptr<Socket> &socket)
@@ -177,6 +160,8 @@ void ProxyProtocolHandler::handleRequest(bool isWaiting, const std::shared_ptr<S
     LOG_INF("proxy: handle request type: " << (isWaiting ? "wait" : "respond") <<
             " on socket #" << socket->getFD());
 
+    // The client polls with empty requests, and sends with the others.
+    const bool hasPayload = !streamSocket->getInBuffer().empty();
     if (!isWaiting)
     {
         if (!_msgHandler)
@@ -189,41 +174,91 @@ void ProxyProtocolHandler::handleRequest(bool isWaiting, const std::shared_ptr<S
         }
     }
 
-    bool sentMsg = flushQueueTo(streamSocket);
-    if (!sentMsg && isWaiting)
+    if (flushQueueTo(streamSocket))
+    {
+        LOG_TRC("Returned a reply immediately");
+        socket->shutdown();
+    }
+    else if (isWaiting)
     {
-        LOG_TRC("proxy: queue a waiting out socket #" << streamSocket->getFD());
         // longer running 'write socket' (marked 'read' by the client)
-        _outSockets.push_back(streamSocket);
-        if (_outSockets.size() > 16)
+        holdOutSocket(streamSocket, std::chrono::steady_clock::time_point::max());
+    }
+    else if (HoldWindow.count() > 0 && !hasPayload && _outSockets.empty())
+    {
+        // Rather than have the client ask again and again, reply when we have something.
+        // Only one poll at a time: the client keeps polling meanwhile, and takes
+        // a few requests in flight as a stalled server.
+        holdOutSocket(streamSocket, std::chrono::steady_clock::now() + HoldWindow);
+    }
+    else
+    {
+        LOG_TRC("Nothing to send - closing immediately");
+        sendEmptyReply(streamSocket);
+        socket->shutdown();
+    }
+}
+
+void ProxyProtocolHandler::holdOutSocket(const std::shared_ptr<StreamSocket>& socket,
+                                         std::chrono::steady_clock::time_point deadline)
+{
+    LOG_TRC("proxy: queue a waiting out socket #" << socket->getFD());
+    _outSockets.push_back(OutSocket{ socket, deadline });
+    if (_outSockets.size() > 16)
+    {
+        LOG_ERR("proxy: Unexpected - client opening many concurrent waiting connections " << _outSockets.size());
+        // cleanup older waiting sockets.
+        auto sock = _outSockets.front()._socket.lock();
+        _outSockets.erase(_outSockets.begin());
+        if (sock)
         {
-            LOG_ERR("proxy: Unexpected - client opening many concurrent waiting connections " << _outSockets.size());
-            // cleanup older waiting sockets.
-            auto sockWeak = _outSockets.front();
-            _outSockets.erase(_outSockets.begin());
-            auto sock = sockWeak.lock();
-            if (sock)
-                sock->shutdown();
+            sendEmptyReply(sock);
+            sock->shutdown();
         }
     }
-    else
+}
+
+void ProxyProtocolHandler::sendEmptyReply(const std::shared_ptr<StreamSocket>& socket)
+{
+    std::ostringstream oss;
+    oss << "HTTP/1.1 200 OK\r\n"
+        "Last-Modified: " << Util::getHttpTimeNow() << "\r\n"
+        "User-Agent: " WOPI_AGENT_STRING "\r\n"
+        "Content-Length: " << 0 << "\r\n"
+        "\r\n";
+    socket->send(oss.str());
+}
+
+void ProxyProtocolHandler::checkTimeout(std::chrono::steady_clock::time_point now)
+{
+    if (_flushDeadline != std::chrono::steady_clock::time_point() && now >= _flushDeadline)
     {
-        if (!sentMsg)
+        LOG_TRC("proxy: batch window is up");
+        flushToOutSocket();
+    }
+
+    // Collect first, flushing may pop sockets.
+    std::vector<std::shared_ptr<StreamSocket>> expired;
+    for (auto it = _outSockets.begin(); it != _outSockets.end();)
+    {
+        if (now < it->_deadline)
         {
-            // FIXME: we should really wait around a bit.
-            LOG_TRC("Nothing to send - closing immediately");
-            std::ostringstream oss;
-            oss << "HTTP/1.1 200 OK\r\n"
-                "Last-Modified: " << Util::getHttpTimeNow() << "\r\n"
-                "User-Agent: " WOPI_AGENT_STRING "\r\n"
-                "Content-Length: " << 0 << "\r\n"
-                "\r\n";
-            streamSocket->send(oss.str());
+            ++it;
+            continue;
         }
-        else
-            LOG_TRC("Returned a reply immediately");
 
-        socket->shutdown();
+        auto sock = it->_socket.lock();
+        if (sock)
+            expired.push_back(sock);
+        it = _outSockets.erase(it);
+    }
+
+    for (const auto& sock : expired)
+    {
+        LOG_TRC("proxy: nothing to send within the hold window on socket #" << sock->getFD());
+        if (!flushQueueTo(sock))
+            sendEmptyReply(sock);
+        sock->shutdown();
     }
 }
 
@@ -242,16 +277,10 @@ void ProxyProtocolHandler::notifyDisconnected()
 
 int ProxyProtocolHandler::sendMessage(const char *msg, const size_t len, bool text, bool flush)
 {
-    _writeQueue.push_back(std::make_shared<Message>(msg, len, text, _outSerial++));
+    appendFrame(_writeQueue, msg, len, text, _outSerial++);
+    ++_writeQueueCount;
     if (flush)
-    {
-        auto sock = popOutSocket();
-        if (sock)
-        {
-            flushQueueTo(sock);
-            sock->shutdown();
-        }
-    }
+        flushToOutSocket();
 
     return len;
 }
@@ -280,26 +309,42 @@ void ProxyProtocolHandler::getIOStats(uint64_t &sent, uint64_t &recv)
 
 void ProxyProtocolHandler::dumpProxyState(std::ostream& os)
 {
-    os << "proxy protocol sockets: " << _outSockets.size() << " writeQueue: " << _writeQueue.size() << ":\n";
+    os << "proxy protocol sockets: " << _outSockets.size() << " writeQueue: " << _writeQueueCount
+       << " messages, " << _writeQueue.size() << " bytes:\n";
     os << '\t';
     for (auto &it : _outSockets)
     {
-        auto sock = it.lock();
+        auto sock = it._socket.lock();
         os << '#' << (sock ? sock->getFD() : -2) << ' ';
     }
     os << '\n';
-    for (const auto& it : _writeQueue)
-        Util::dumpHex(os, *it, "\twrite queue entry:", "\t\t");
+    if (!_writeQueue.empty())
+        Util::dumpHex(os, _writeQueue, "\twrite queue:", "\t\t");
     if (_msgHandler)
         _msgHandler->dumpState(os);
 }
 
-int ProxyProtocolHandler::getPollEvents(std::chrono::steady_clock::time_point /* now */,
-                                        int64_t &/* timeoutMaxMs */)
+int ProxyProtocolHandler::getPollEvents(std::chrono::steady_clock::time_point now,
+                                        int64_t &timeoutMaxMicroS)
 {
     int events = POLLIN;
     if (_msgHandler && _msgHandler->hasQueuedMessages())
         events |= POLLOUT;
+
+    // Wake up in time to flush the batch, or to reply to a held request.
+    auto next = std::chrono::steady_clock::time_point::max();
+    if (_flushDeadline != std::chrono::steady_clock::time_point())
+        next = _flushDeadline;
+    for (const auto& it : _outSockets)
+        next = std::min(next, it._deadline);
+
+    if (next != std::chrono::steady_clock::time_point::max())
+    {
+        const int64_t untilMicroS =
+            std::chrono::duration_cast<std::chrono::microseconds>(next - now).count();
+        timeoutMaxMicroS = std::max<int64_t>(0, std::min(timeoutMaxMicroS, untilMicroS));
+    }
+
     return events;
 }
 
@@ -309,18 +354,35 @@ bool ProxyProtocolHandler::slurpHasMessages(std::size_t capacity)
     if (_msgHandler)
         _msgHandler->writeQueuedMessages(capacity);
 
-    return _writeQueue.size() > 0;
+    return !_writeQueue.empty();
 }
 
 void ProxyProtocolHandler::performWrites(std::size_t capacity)
 {
-    if (!slurpHasMessages(capacity))
+    if (!slurpHasMessages(capacity) || _outSockets.empty())
+        return;
+
+    // Give the rest of a burst a chance to join, unless we have plenty already.
+    if (_writeQueue.size() < BatchMaxBytes && BatchWindow.count() > 0)
+    {
+        if (_flushDeadline == std::chrono::steady_clock::time_point())
+            _flushDeadline = std::chrono::steady_clock::now() + BatchWindow;
+        return;
+    }
+
+    LOG_TRC("proxy: performWrites");
+    flushToOutSocket();
+}
+
+void ProxyProtocolHandler::flushToOutSocket()
+{
+    _flushDeadline = std::chrono::steady_clock::time_point();
+    if (_writeQueue.empty())
         return;
 
     auto sock = popOutSocket();
     if (sock)
     {
-        LOG_TRC("proxy: performWrites");
         flushQueueTo(sock);
         sock->shutdown();
     }
@@ -331,28 +393,23 @@ bool ProxyProtocolHandler::flushQueueTo(const std::shared_ptr<StreamSocket> &soc
     if (!slurpHasMessages(socket->getSendBufferCapacity()))
         return false;
 
-    size_t totalSize = 0;
-    for (const auto& it : _writeQueue)
-        totalSize += it->size();
-
-    if (!totalSize)
-        return false;
-
-    LOG_TRC("proxy: flushQueue of size " << totalSize << " to socket #" << socket->getFD() << " & close");
+    LOG_TRC("proxy: flushQueue of " << _writeQueueCount << " messages, size " << _writeQueue.size()
+                                    << " to socket #" << socket->getFD() << " & close");
 
     std::ostringstream oss;
     oss << "HTTP/1.1 200 OK\r\n"
         "Last-Modified: " << Util::getHttpTimeNow() << "\r\n"
         "User-Agent: " WOPI_AGENT_STRING "\r\n"
-        "Content-Length: " << totalSize << "\r\n"
+        "Content-Length: " << _writeQueue.size() << "\r\n"
         "Content-Type: application/json; charset=utf-8\r\n"
         "X-Content-Type-Options: nosniff\r\n"
         "\r\n";
     socket->send(oss.str());
 
-    for (const auto& it : _writeQueue)
-        socket->send(it->data(), it->size(), false);
+    socket->send(_writeQueue.data(), _writeQueue.size(), false);
     _writeQueue.clear();
+    _writeQueueCount = 0;
+    _flushDeadline = std::chrono::steady_clock::time_point();
 
     return true;
 }
@@ -360,12 +417,10 @@ bool ProxyProtocolHandler::flushQueueTo(const std::shared_ptr<StreamSocket> &soc
 // LRU-ness ...
 std::shared_ptr<StreamSocket> ProxyProtocolHandler::popOutSocket()
 {
-    std::weak_ptr<StreamSocket> sock;
     while (!_outSockets.empty())
     {
-        sock = _outSockets.front();
+        auto realSock = _outSockets.front()._socket.lock();
         _outSockets.erase(_outSockets.begin());
-        auto realSock = sock.lock();
         if (realSock)
         {
             LOG_TRC("proxy: popped an out socket #" << realSock->getFD() << " leaving: " << _outSockets.size());
@@ -9,7 +9,11 @@
 
 #pragma once
 
+#include <chrono>
+#include <cstdint>
 #include <memory>
+#include <vector>
+
 #include <net/Socket.hpp>
 
 /**
@@ -17,11 +21,37 @@
  * individual proxied HTTP requests back to back.
  *
  * we use a trivial framing: [T(ext)|B(inary)]<hex-serial->\n<hex-length>\n<content>\n
+ *
+ * Requests with nothing to send back are held for a while, as a
+ * long-poll, so clients don't have to keep asking, and output is
+ * batched briefly so a burst of messages goes out in one response.
  */
 class ProxyProtocolHandler : public ProtocolHandlerInterface
 {
 public:
+    /// How long we hold a request, that has nothing to send back yet, for output
+    /// to arrive, before replying empty. 0 replies immediately. Only an empty
+    /// poll is held, while no other request is.
+    static std::chrono::milliseconds HoldWindow;
+
+    /// How long we let output accumulate, once some is ready, before replying,
+    /// so a burst of messages goes out in one response.
+    static std::chrono::milliseconds BatchWindow;
+
+    /// Once this much output is queued, we reply without waiting for the batch window.
+    static constexpr std::size_t BatchMaxBytes = 64 * 1024;
+
+    /// A frame, parsed in place; @_data points into the parsed buffer.
+    struct Frame
+    {
+        bool _text;
+        uint64_t _serial;
+        const char* _data;
+        std::size_t _size;
+    };
+
     ProxyProtocolHandler() :
+        _writeQueueCount(0),
         _inSerial(0),
         _outSerial(0)
     {
@@ -35,12 +65,11 @@ public:
     /// Called after successful socket reads.
     void handleIncomingMessage(SocketDisposition &/* disposition */) override;
 
-    int getPollEvents(std::chrono::steady_clock::time_point /* now */,
-                      int64_t &/* timeoutMaxMs */) override;
+    int getPollEvents(std::chrono::steady_clock::time_point now,
+                      int64_t &timeoutMaxMicroS) override;
 
-    void checkTimeout(std::chrono::steady_clock::time_point /* now */) override
-    {
-    }
+    /// Replies to the held requests whose time is up, and flushes batched output.
+    void checkTimeout(std::chrono::steady_clock::time_point now) override;
 
     void performWrites(std::size_t capacity) override;
 
@@ -68,31 +97,43 @@ public:
     /// tell our handler we've received a close.
     void notifyDisconnected();
 
+    /// Parses the frame at the start of @data into @frame without copying.
+    /// @returns the number of bytes the frame takes, 0 if it is incomplete,
+    /// or -1 if it is malformed.
+    static int parseFrame(const char* data, std::size_t size, Frame& frame);
+
+    /// Appends the frame of a message to @out.
+    static void appendFrame(std::vector<char>& out, const char* msg, std::size_t len, bool text,
+                            uint64_t serial);
+
 private:
     std::shared_ptr<StreamSocket> popOutSocket();
     /// can we find anything to send back if we try ?
     bool slurpHasMessages(std::size_t capacity);
     int sendMessage(const char *msg, const size_t len, bool text, bool flush);
     bool flushQueueTo(const std::shared_ptr<StreamSocket> &socket);
+    /// Sends what we have queued to the oldest held request, if any.
+    void flushToOutSocket();
+    void holdOutSocket(const std::shared_ptr<StreamSocket>& socket,
+                       std::chrono::steady_clock::time_point deadline);
+    static void sendEmptyReply(const std::shared_ptr<StreamSocket>& socket);
 
-    struct Message : public std::vector<char>
+    struct OutSocket
     {
-        Message(const char *msg, const std::size_t len, bool text, uint64_t serial)
-        {
-            const char *type = text ? "T" : "B";
-            insert(end(), type, type + 1);
-            std::ostringstream os;
-            os << std::hex << "0x" << serial << "\n0x" << len << '\n';
-            const std::string str = os.str();
-            insert(end(), str.c_str(), str.c_str() + str.size());
-            insert(end(), msg, msg + len);
-            constexpr const char *terminator = "\n";
-            insert(end(), terminator, terminator + 1);
-        }
+        std::weak_ptr<StreamSocket> _socket;
+        /// When we reply empty, if nothing came up.
+        std::chrono::steady_clock::time_point _deadline;
     };
-    /// queue things when we have no socket to hand.
-    std::vector<std::shared_ptr<Message>> _writeQueue;
-    std::vector<std::weak_ptr<StreamSocket>> _outSockets;
+
+    /// The framed messages to send, queued when we have no socket to hand.
+    std::vector<char> _writeQueue;
+    std::size_t _writeQueueCount;
+    /// When we flush the batch accumulating in _writeQueue, if set.
+    std::chrono::steady_clock::time_point _flushDeadline;
+    /// The requests held for output, oldest first.
+    std::vector<OutSocket> _outSockets;
+    /// The last incoming message; reused to avoid allocating for each.
+    std::vector<char> _inMessage;
     uint64_t _inSerial;
     uint64_t _outSerial;
 };
@@ -0,0 +1,127 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * The framing of the ProxyProtocol messages, kept apart from the
+ * handler so it can be unit tested on its own.
+ */
+
+#include <config.h>
+
+#include "ProxyProtocol.hpp"
+
+#include <limits>
+
+namespace
+{
+/// Parses a hex number, optionally prefixed with 0x, up to and including the newline.
+/// @returns the number of bytes taken, 0 if there is no newline yet, or -1 if malformed.
+int parseHexLine(const char* data, std::size_t size, uint64_t& value)
+{
+    std::size_t i = 0;
+    if (size >= 2 && data[0] == '0' && (data[1] == 'x' || data[1] == 'X'))
+        i = 2;
+
+    const std::size_t digitsStart = i;
+    value = 0;
+    for (; i < size && data[i] != '\n'; ++i)
+    {
+        const char c = data[i];
+        int digit;
+        if (c >= '0' && c <= '9')
+            digit = c - '0';
+        else if (c >= 'a' && c <= 'f')
+            digit = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F')
+            digit = c - 'A' + 10;
+        else
+            return -1;
+
+        if (i - digitsStart >= 16)
+            return -1; // Overflow.
+
+        value = (value << 4) | digit;
+    }
+
+    if (i >= size)
+        return 0;
+
+    return i > digitsStart ? i + 1 : -1;
+}
+
+void appendHex(std::vector<char>& out, uint64_t value)
+{
+    char digits[16];
+    int count = 0;
+    do
+    {
+        digits[count++] = "0123456789abcdef"[value & 0xf];
+        value >>= 4;
+    } while (value);
+
+    out.push_back('0');
+    out.push_back('x');
+    while (count > 0)
+        out.push_back(digits[--count]);
+}
+} // namespace
+
+int ProxyProtocolHandler::parseFrame(const char* data, std::size_t size, Frame& frame)
+{
+    if (size < 1)
+        return 0;
+
+    // Type
+    if (data[0] != 'T' && data[0] != 'B')
+        return -1;
+    frame._text = data[0] == 'T';
+    std::size_t pos = 1;
+
+    // Serial
+    int taken = parseHexLine(data + pos, size - pos, frame._serial);
+    if (taken <= 0)
+        return taken;
+    pos += taken;
+
+    // Length
+    uint64_t len = 0;
+    taken = parseHexLine(data + pos, size - pos, len);
+    if (taken <= 0)
+        return taken;
+    pos += taken;
+
+    if (len > static_cast<uint64_t>(std::numeric_limits<int>::max()) - pos - 1)
+        return -1;
+
+    // Content, with its final newline.
+    if (size - pos < len + 1)
+        return 0;
+
+    if (data[pos + len] != '\n')
+        return -1;
+
+    frame._data = data + pos;
+    frame._size = len;
+    return pos + len + 1;
+}
+
+void ProxyProtocolHandler::appendFrame(std::vector<char>& out, const char* msg, std::size_t len,
+                                       bool text, uint64_t serial)
+{
+    out.reserve(out.size() + len + 2 * (2 + 16 + 1) + 2);
+    out.push_back(text ? 'T' : 'B');
+    appendHex(out, serial);
+    out.push_back('\n');
+    appendHex(out, len);
+    out.push_back('\n');
+    out.insert(out.end(), msg, msg + len);
+    out.push_back('\n');
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
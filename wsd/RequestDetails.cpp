@@ -17,6 +17,7 @@
 
 #include <Poco/URI.h>
 #include "Exceptions.hpp"
+#include <net/HttpParser.hpp>
 
 namespace
 {
@@ -66,6 +67,32 @@ RequestDetails::RequestDetails(Poco::Net::HTTPRequest &request, const std::strin
     processURI();
 }
 
+RequestDetails::RequestDetails(const http::RequestParser& request, const std::string& serviceRoot)
+{
+    const std::string_view uri = request.getUri();
+    if (uri.compare(0, serviceRoot.size(), serviceRoot) != 0)
+        throw BadRequestException("The request does not start with prefix: " + serviceRoot);
+
+    _uriString = std::string(uri.substr(serviceRoot.size()));
+    dehexify();
+    const std::string_view method = request.getMethod();
+    _isGet = method == "GET";
+    _isHead = method == "HEAD";
+    _isProxy = request.has("ProxyPrefix");
+    if (_isProxy)
+        _proxyPrefix = std::string(request.get("ProxyPrefix"));
+    const std::string_view upgrade = request.get("Upgrade");
+    _isWebSocket = Util::iequal(upgrade.data(), upgrade.size(), "websocket", sizeof("websocket") - 1);
+#if !MOBILEAPP
+    // As Poco's getHost, which throws without one.
+    if (!request.has("Host"))
+        throw BadRequestException("The request has no Host");
+    _hostUntrusted = std::string(request.get("Host"));
+#endif
+
+    processURI();
+}
+
 RequestDetails::RequestDetails(const std::string &mobileURI)
     : _isGet(true)
     , _isHead(false)
@@ -16,6 +16,11 @@
 #include <common/Util.hpp>
 #include <common/Log.hpp>
 
+namespace http
+{
+class RequestParser;
+}
+
 /**
  * A class to encapsulate various useful pieces from the request.
  * as well as path parsing goodness.
@@ -129,6 +134,7 @@ private:
 public:
 
     RequestDetails(Poco::Net::HTTPRequest &request, const std::string& serviceRoot);
+    RequestDetails(const http::RequestParser& request, const std::string& serviceRoot);
     RequestDetails(const std::string &mobileURI);
 
     /// Decode and sanitize a URI.
@@ -0,0 +1,250 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+/// A concurrent map of string keys to shared objects, used for the
+/// DocumentBrokers, which are looked up by docKey on every request.
+///
+/// The keys are hashed over a fixed number of shards. Each shard publishes
+/// an immutable snapshot of its entries, which readers load atomically
+/// without taking the shard's mutex. Writers serialize on the shard's mutex
+/// only, and publish a modified copy. Since there are few documents per
+/// shard, the copy is cheap, and modifications are rare compared to lookups.
+///
+/// Note that std::atomic_load and std::atomic_store of a shared_ptr aren't
+/// lock-free in libstdc++, which guards them with a small pool of spinlocks,
+/// so readers may still briefly contend with each other and with writers.
+///
+/// Iteration visits one shard snapshot at a time, so it never blocks
+/// writers, and sees each shard as it was when it got to it.
+template <typename T> class ShardedRegistry
+{
+public:
+    static constexpr std::size_t NumShards = 16;
+
+    using Pointer = std::shared_ptr<T>;
+    using Map = std::map<std::string, Pointer>;
+
+    ShardedRegistry()
+        : _size(0)
+    {
+        for (Shard& shard : _shards)
+            shard._entries = std::make_shared<const Map>();
+    }
+
+    /// Returns the entry for @key, or nullptr. Without taking the shard's mutex.
+    Pointer find(const std::string& key) const
+    {
+        const std::shared_ptr<const Map> entries = getShard(key).load();
+        const auto it = entries->find(key);
+        return it != entries->end() ? it->second : nullptr;
+    }
+
+    /// Adds @value under @key, unless the key exists already.
+    /// Returns true if it was added.
+    bool insert(const std::string& key, Pointer value)
+    {
+        Shard& shard = getShard(key);
+        std::lock_guard<std::mutex> lock(shard._mutex);
+
+        const std::shared_ptr<const Map> entries = shard.load();
+        if (entries->find(key) != entries->end())
+            return false;
+
+        auto modified = std::make_shared<Map>(*entries);
+        modified->emplace(key, std::move(value));
+        shard.store(std::move(modified));
+        ++_size;
+        return true;
+    }
+
+    /// Returns the entry for @key, or what @create returns, which is then
+    /// added, unless it is nullptr. @create is called at most once, with
+    /// the shard locked, so there is never more than one entry per key.
+    /// Nothing is created, and nullptr returned, if there are @maxSize
+    /// entries already. That is checked atomically with the addition.
+    template <typename Creator>
+    Pointer findOrCreate(const std::string& key, Creator create,
+                         std::size_t maxSize = std::numeric_limits<std::size_t>::max())
+    {
+        Pointer existing = find(key);
+        if (existing)
+            return existing;
+
+        Shard& shard = getShard(key);
+        std::lock_guard<std::mutex> lock(shard._mutex);
+
+        // Check again, someone may have beaten us to it.
+        const std::shared_ptr<const Map> entries = shard.load();
+        const auto it = entries->find(key);
+        if (it != entries->end())
+            return it->second;
+
+        // Count it before creating it, so concurrent creations can't exceed maxSize.
+        if (!reserve(maxSize))
+            return nullptr;
+
+        Pointer value;
+        try
+        {
+            value = create();
+        }
+        catch (...)
+        {
+            --_size;
+            throw;
+        }
+
+        if (value)
+        {
+            auto modified = std::make_shared<Map>(*entries);
+            modified->emplace(key, value);
+            shard.store(std::move(modified));
+        }
+        else
+            --_size;
+
+        return value;
+    }
+
+    /// Removes the entries matching @predicate, one shard at a time,
+    /// and returns them, so they can be disposed of without any lock held.
+    std::vector<std::pair<std::string, Pointer>>
+    removeIf(const std::function<bool(const std::string&, const Pointer&)>& predicate)
+    {
+        std::vector<std::pair<std::string, Pointer>> removed;
+        for (Shard& shard : _shards)
+        {
+            // Test without the lock first; most of the time nothing goes.
+            if (!matchesAny(*shard.load(), predicate))
+                continue;
+
+            std::lock_guard<std::mutex> lock(shard._mutex);
+
+            auto modified = std::make_shared<Map>(*shard.load());
+            for (auto it = modified->begin(); it != modified->end();)
+            {
+                if (predicate(it->first, it->second))
+                {
+                    removed.emplace_back(it->first, std::move(it->second));
+                    it = modified->erase(it);
+                    --_size;
+                }
+                else
+                    ++it;
+            }
+
+            shard.store(std::move(modified));
+        }
+
+        return removed;
+    }
+
+    /// Calls @func with each entry. No lock is held during the calls.
+    void forEach(const std::function<void(const std::string&, const Pointer&)>& func) const
+    {
+        for (const Shard& shard : _shards)
+        {
+            const std::shared_ptr<const Map> entries = shard.load();
+            for (const auto& pair : *entries)
+                func(pair.first, pair.second);
+        }
+    }
+
+    /// Returns all the entries.
+    std::vector<Pointer> getAll() const
+    {
+        std::vector<Pointer> result;
+        result.reserve(size());
+        forEach([&result](const std::string&, const Pointer& value) { result.push_back(value); });
+        return result;
+    }
+
+    void clear()
+    {
+        for (Shard& shard : _shards)
+        {
+            std::lock_guard<std::mutex> lock(shard._mutex);
+            _size -= shard.load()->size();
+            shard.store(std::make_shared<const Map>());
+        }
+    }
+
+    /// The number of entries. Approximate while being modified.
+    std::size_t size() const { return _size; }
+
+    bool empty() const { return size() == 0; }
+
+    /// Returns the shard index of @key, which is stable for the process lifetime.
+    static std::size_t getShardIndex(const std::string& key)
+    {
+        return std::hash<std::string>()(key) % NumShards;
+    }
+
+private:
+    struct Shard
+    {
+        std::shared_ptr<const Map> load() const { return std::atomic_load(&_entries); }
+
+        void store(std::shared_ptr<const Map> entries)
+        {
+            std::atomic_store(&_entries, std::move(entries));
+        }
+
+        /// Serializes the writers.
+        std::mutex _mutex;
+        std::shared_ptr<const Map> _entries;
+    };
+
+    /// Counts one more entry, unless there are @maxSize already.
+    bool reserve(std::size_t maxSize)
+    {
+        std::size_t size = _size;
+        do
+        {
+            if (size >= maxSize)
+                return false;
+        } while (!_size.compare_exchange_weak(size, size + 1));
+
+        return true;
+    }
+
+    Shard& getShard(const std::string& key) { return _shards[getShardIndex(key)]; }
+
+    const Shard& getShard(const std::string& key) const { return _shards[getShardIndex(key)]; }
+
+    static bool matchesAny(const Map& entries,
+                           const std::function<bool(const std::string&, const Pointer&)>& predicate)
+    {
+        for (const auto& pair : entries)
+        {
+            if (predicate(pair.first, pair.second))
+                return true;
+        }
+
+        return false;
+    }
+
+private:
+    std::array<Shard, NumShards> _shards;
+    std::atomic<std::size_t> _size;
+};
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -52,6 +52,8 @@
 #include "ProofKey.hpp"
 #include <common/FileUtil.hpp>
 #include <common/JsonUtil.hpp>
+#include <common/LatencyHistogram.hpp>
+#include <common/SigUtil.hpp>
 #include <common/TraceEvent.hpp>
 #include <NetUtil.hpp>
 #include <CommandControl.hpp>
@@ -108,6 +110,10 @@ void StorageBase::initialize()
 
     HostUtil::parseAliases(app.config());
 
+    UploadScheduler::instance().configure(
+        LOOLWSD::getConfigValue<unsigned int>("storage.wopi.upload.max_concurrent", 8),
+        LOOLWSD::getConfigValue<unsigned int>("storage.wopi.upload.max_concurrent_per_host", 4));
+
 #if ENABLE_SSL
     // FIXME: should use our own SSL socket implementation here.
     Poco::Crypto::initializeCrypto();
@@ -570,6 +576,14 @@ std::map<std::string, std::string> GetQueryParams(const Poco::URI& uri)
     return result;
 }
 
+/// Records the latency of a WOPI request for the given operation (e.g. "GetFile").
+void observeWopiRequest(const std::string& op, std::chrono::steady_clock::duration duration)
+{
+    LatencyHistogram::get("wopi_request_duration_seconds", "op=\"" + op + '"',
+                          "Latency of the requests to the WOPI host, by operation.")
+        .observe(duration);
+}
+
 } // anonymous namespace
 
 #endif // !MOBILEAPP
@@ -607,6 +621,17 @@ void LockContext::dumpState(std::ostream& os) const
 
 #if !MOBILEAPP
 
+WopiStorage::~WopiStorage()
+{
+    // An upload granted its turn meanwhile gives it back, instead of starting.
+    std::unique_lock<std::mutex> lock(_uploadToken->_mutex);
+    _uploadToken->_storage = nullptr;
+
+    // Don't leave an upload waiting for its turn on our behalf.
+    if (_uploadRequestId)
+        UploadScheduler::instance().cancel(_uploadRequestId);
+}
+
 void WopiStorage::initHttpRequest(Poco::Net::HTTPRequest& request, const Poco::URI& uri,
                                   const Authorization& auth) const
 {
@@ -672,6 +697,7 @@ WopiStorage::getWOPIFileInfoForUri(Poco::URI uriObject, const Authorization& aut
 
         callDurationMs = std::chrono::duration_cast<std::chrono::milliseconds>(
             std::chrono::steady_clock::now() - startTime);
+        observeWopiRequest("CheckFileInfo", std::chrono::steady_clock::now() - startTime);
 
         const http::StatusCode statusCode = httpResponse->statusLine().statusCode();
         if (statusCode == http::StatusCode::MovedPermanently ||
@@ -972,6 +998,7 @@ StorageBase::LockUpdateResult WopiStorage::updateLockState(const Authorization&
         // IIS requires content-length for POST requests: see https://forums.iis.net/t/1119456.aspx
         request.setContentLength(0);
 
+        const auto startTime = std::chrono::steady_clock::now();
         psession->sendRequest(request);
         Poco::Net::HTTPResponse response;
         std::istream& rs = psession->receiveResponse(response);
@@ -979,6 +1006,7 @@ StorageBase::LockUpdateResult WopiStorage::updateLockState(const Authorization&
         std::ostringstream oss;
         Poco::StreamCopier::copyStream(rs, oss);
         std::string responseString = oss.str();
+        observeWopiRequest(lock ? "Lock" : "Unlock", std::chrono::steady_clock::now() - startTime);
 
         LOG_INF(wopiLog << " response: " << responseString <<
                 " status " << response.getStatus());
@@ -1126,6 +1154,7 @@ std::string WopiStorage::downloadDocument(const Poco::URI& uriObject, const std:
 
     const std::chrono::milliseconds diff = std::chrono::duration_cast<std::chrono::milliseconds>(
         std::chrono::steady_clock::now() - startTime);
+    observeWopiRequest("GetFile", std::chrono::steady_clock::now() - startTime);
 
     const http::StatusCode statusCode = httpResponse->statusLine().statusCode();
     if (statusCode == http::StatusCode::OK)
@@ -1251,7 +1280,6 @@ void WopiStorage::uploadLocalFileToStorageAsync(const Authorization& auth, LockC
     LOG_INF("Uploading " << size << " bytes from [" << filePathAnonym << "] to URI via WOPI ["
                          << uriAnonym << "].");
 
-    const auto startTime = std::chrono::steady_clock::now();
     try
     {
         assert(!_uploadHttpSession && "Unexpected to have an upload http::session");
@@ -1337,20 +1365,35 @@ void WopiStorage::uploadLocalFileToStorageAsync(const Authorization& auth, LockC
         httpHeader.setContentType("application/octet-stream");
         httpHeader.setContentLength(size);
 
-        httpRequest.setBodyFile(filePath);
+        // Stream the file as the socket drains, accounting for the bytes sent.
+        auto file = std::make_shared<std::ifstream>(filePath, std::ios::binary);
+        httpRequest.setBodySource(
+            [file](char* buf, int64_t len) -> int64_t
+            {
+                file->read(buf, len);
+                const int64_t read = file->gcount();
+                UploadScheduler::instance().addSentBytes(read);
+                return read;
+            },
+            size);
 
         http::Session::FinishedCallback finishedCallback =
             [=](const std::shared_ptr<http::Session>& httpSession)
         {
-            // Retire.
+            // Retire, and let the next upload start.
             _uploadHttpSession.reset();
+            _uploadSlot.reset();
 
             assert(httpSession && "Expected a valid http::Session");
             const std::shared_ptr<const http::Response> httpResponse = httpSession->response();
 
+            // Not counting the wait for our turn, which the UploadScheduler reports.
             _wopiSaveDuration = std::chrono::duration_cast<std::chrono::milliseconds>(
-                std::chrono::steady_clock::now() - startTime);
+                std::chrono::steady_clock::now() - _uploadStartTime);
             LOG_TRC("Finished async uploading in " << _wopiSaveDuration);
+            observeWopiRequest(isSaveAs ? "PutRelativeFile"
+                                        : (isRename ? "RenameFile" : "PutFile"),
+                               std::chrono::steady_clock::now() - _uploadStartTime);
 
             WopiUploadDetails details = { filePathAnonym,
                                           uriAnonym,
@@ -1372,8 +1415,43 @@ void WopiStorage::uploadLocalFileToStorageAsync(const Authorization& auth, LockC
 
         LOG_DBG("Async upload request: " << httpRequest.header().toString());
 
-        // Make the request.
-        _uploadHttpSession->asyncRequest(httpRequest, socketPoll);
+        // Make the request when it's our turn; our poll makes it, whichever thread grants it.
+        const std::shared_ptr<http::Session> httpSession = _uploadHttpSession;
+        const UploadScheduler::Priority priority =
+            SigUtil::getShutdownRequestFlag()
+                ? UploadScheduler::Priority::Drain
+                : (attribs.isAutosave() && !isSaveAs && !isRename
+                       ? UploadScheduler::Priority::Autosave
+                       : UploadScheduler::Priority::User);
+        const std::weak_ptr<UploadToken> weakToken = _uploadToken;
+        _uploadRequestId = UploadScheduler::instance().enqueue(
+            uriObject.getHost(), priority,
+            [weakToken, httpSession, httpRequest,
+             &socketPoll](const std::shared_ptr<UploadScheduler::Slot>& slot)
+            {
+                // Granted before we could cancel, so we, and our poll, are still there.
+                socketPoll.addCallback(
+                    [weakToken, httpSession, httpRequest, &socketPoll, slot = slot]() mutable
+                    {
+                        const std::shared_ptr<UploadToken> token = weakToken.lock();
+                        std::unique_lock<std::mutex> lock;
+                        if (token)
+                            lock = std::unique_lock<std::mutex>(token->_mutex);
+
+                        if (!token || !token->_storage)
+                        {
+                            LOG_DBG("Storage gone before its upload started, releasing its turn");
+                            slot.reset();
+                            return;
+                        }
+
+                        WopiStorage* const storage = token->_storage;
+                        storage->_uploadRequestId = 0;
+                        storage->_uploadSlot = std::move(slot);
+                        storage->_uploadStartTime = std::chrono::steady_clock::now();
+                        httpSession->asyncRequest(httpRequest, socketPoll);
+                    });
+            });
 
         scopedInvokeCallback.setArg(
             AsyncUpload(AsyncUpload::State::Running, UploadResult(UploadResult::Result::OK)));
@@ -23,6 +23,7 @@
 #include "HttpRequest.hpp"
 #include "LOOLWSD.hpp"
 #include "Log.hpp"
+#include "UploadScheduler.hpp"
 #include "Util.hpp"
 #include <common/Authorization.hpp>
 #include <net/HttpRequest.hpp>
@@ -557,12 +558,16 @@ public:
                 const std::string& jailPath)
         : StorageBase(uri, localStorePath, jailPath)
         , _wopiSaveDuration(std::chrono::milliseconds::zero())
+        , _uploadRequestId(0)
+        , _uploadToken(std::make_shared<UploadToken>(this))
     {
         LOG_INF("WopiStorage ctor with localStorePath: ["
                 << localStorePath << "], jailPath: [" << jailPath << "], uri: ["
                 << LOOLWSD::anonymizeUrl(uri.toString()) << ']');
     }
 
+    ~WopiStorage();
+
     class WOPIFileInfo : public FileInfo
     {
         void init();
@@ -765,6 +770,29 @@ private:
 
     /// The http::Session used for uploading asynchronously.
     std::shared_ptr<http::Session> _uploadHttpSession;
+
+    /// The upload waiting for its turn in the UploadScheduler, if any.
+    std::uint64_t _uploadRequestId;
+
+    /// Our turn to upload, held until the upload is over.
+    std::shared_ptr<UploadScheduler::Slot> _uploadSlot;
+
+    /// When our turn to upload came, and the request was made.
+    std::chrono::steady_clock::time_point _uploadStartTime;
+
+    /// Lets an upload granted its turn, but not started yet, find us, unless we are gone.
+    struct UploadToken
+    {
+        explicit UploadToken(WopiStorage* storage)
+            : _storage(storage)
+        {
+        }
+
+        std::mutex _mutex;
+        WopiStorage* _storage;
+    };
+
+    std::shared_ptr<UploadToken> _uploadToken;
 };
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -24,12 +24,14 @@
 #include <vector>
 
 #include "ClientSession.hpp"
+#include "TileStore.hpp"
 #include <Common.hpp>
 #include <Protocol.hpp>
 #include <StringVector.hpp>
 #include <Unit.hpp>
 #include <Util.hpp>
 #include <common/FileUtil.hpp>
+#include <common/LatencyHistogram.hpp>
 
 using namespace LOOLProtocol;
 
@@ -63,6 +65,10 @@ void TileCache::clear()
     for (std::map<std::string, Blob>& i : _streamCache)
         i.clear();
 
+#if !MOBILEAPP
+    closeStore();
+#endif
+
     LOG_INF("Completely cleared tile cache for: " << _docURL);
 }
 
@@ -171,6 +177,10 @@ Tile TileCache::lookupTile(const TileDesc& tile)
         return Tile();
 
     Tile ret = findTile(tile);
+#if !MOBILEAPP
+    if (!ret && _store)
+        ret = loadFromStore(tile);
+#endif
 
     UnitWSD::get().lookupTile(tile.getPart(), tile.getEditMode(),
                               tile.getWidth(), tile.getHeight(),
@@ -210,6 +220,16 @@ void TileCache::saveTileAndNotify(const TileDesc& desc, const char *data, const
     else
         LOG_TRC("Got (non-cached) tile: " << cacheFileName(desc));
 
+#if !MOBILEAPP
+    // Deltas only follow invalidations, which close the store.
+    if (_store && tile && TileData::isKeyframe(data, size))
+    {
+        const std::string key = storeKey(desc);
+        if (!key.empty() && !_store->contains(key))
+            _store->append(key, data, size);
+    }
+#endif
+
     // Notify subscribers, if any.
     if (tileBeingRendered)
     {
@@ -233,6 +253,13 @@ void TileCache::saveTileAndNotify(const TileDesc& desc, const char *data, const
         // Remove subscriptions.
         LOG_DBG("STATISTICS: tile " << desc.getVersion() << " internal roundtrip " <<
                 tileBeingRendered->getElapsedTimeMs());
+#if !MOBILEAPP
+        static LatencyHistogram& roundtripHistogram = LatencyHistogram::get(
+            "tile_roundtrip_duration_seconds", "",
+            "Time from requesting a tile from the kit until it is sent to the clients.");
+        roundtripHistogram.observe(std::chrono::steady_clock::now()
+                                   - tileBeingRendered->getStartTime());
+#endif
         forgetTileBeingRendered(desc, tileBeingRendered);
     }
     else
@@ -299,6 +326,11 @@ void TileCache::invalidateTiles(int part, int mode, int x, int y, int width, int
 
     ASSERT_CORRECT_THREAD_OWNER(_owner);
 
+#if !MOBILEAPP
+    // The document no longer looks as it was stored, nor are the tiles we render worth storing.
+    closeStore();
+#endif
+
     for (auto it = _cache.begin(); it != _cache.end();)
     {
         if (intersectsTile(it->first, part, mode, x, y, width, height, normalizedViewId))
@@ -406,6 +438,101 @@ std::string TileCache::cacheFileName(const TileDesc& tile)
     return oss.str();
 }
 
+#if !MOBILEAPP
+std::string TileCache::storeKey(const TileDesc& tile) const
+{
+    const auto it = _viewProps.find(tile.getNormalizedViewId());
+    if (it == _viewProps.end())
+        return std::string();
+
+    // The view properties and the zoom, as the size in pixels of the tile's twips, render it.
+    std::ostringstream oss;
+    oss << it->second << '_' << tile.getPart() << '_' << tile.getEditMode() << '_'
+        << tile.getWidth() << 'x' << tile.getHeight() << '.'
+        << tile.getTilePosX() << ',' << tile.getTilePosY() << '.'
+        << tile.getTileWidth() << 'x' << tile.getTileHeight();
+    return oss.str();
+}
+
+bool TileCache::setStore(std::unique_ptr<TileStore> store)
+{
+    if (_storeClosed)
+        return false;
+
+    _store = std::move(store);
+    return true;
+}
+
+void TileCache::closeStore()
+{
+    _storeClosed = true;
+    if (_store)
+    {
+        LOG_DBG("Closing tile store with " << _store->count() << " tiles");
+        _store.reset();
+    }
+}
+
+void TileCache::setViewProps(int normalizedViewId, const std::string& viewProps)
+{
+    _viewProps[normalizedViewId] = viewProps;
+}
+
+std::size_t TileCache::persistTiles(const std::string& contentHash)
+{
+    // Still storing means the document is as it was opened, so is its hash.
+    if (!_store)
+        _store = TileStore::open(contentHash);
+
+    if (!_store)
+        return 0;
+
+    std::size_t count = 0;
+    std::vector<char> data;
+    for (const auto& it : _cache)
+    {
+        // Only keyframes, which the cache keeps without their 'Z'.
+        const Tile& tile = it.second;
+        if (!tile->isValid() || tile->_wids.size() != 1 || tile->isPng())
+            continue;
+
+        const std::string key = storeKey(it.first);
+        if (key.empty() || _store->contains(key))
+            continue;
+
+        data.assign(1, 'Z');
+        data.insert(data.end(), tile->data().begin(), tile->data().end());
+        if (!_store->append(key, data.data(), data.size()))
+            break;
+
+        ++count;
+    }
+
+    LOG_DBG("Persisted " << count << " tiles, the store has " << _store->count() << " tiles in "
+                         << _store->size() << " bytes");
+    return count;
+}
+
+Tile TileCache::loadFromStore(const TileDesc& desc)
+{
+    const std::string key = storeKey(desc);
+    const char* data = nullptr;
+    std::size_t size = 0;
+    if (key.empty() || !_store->lookup(key, data, size))
+        return Tile();
+
+    ensureCacheSize();
+
+    // The lowest wire id, so whatever the kit renders supersedes it.
+    Tile tile = std::make_shared<TileData>(1, data, size);
+    _cache[desc] = tile;
+    _cacheSize += itemCacheSize(tile);
+
+    LOG_TRC("Loaded stored tile: " << cacheFileName(desc) << " of size " << size << " bytes");
+    return tile;
+}
+#endif
+
 bool TileCache::parseCacheFileName(const std::string& fileName, int& part, int& mode, int& width, int& height,
                                    int& tilePosX, int& tilePosY, int& tileWidth, int& tileHeight,
                                    int& nviewid)
@@ -727,6 +854,11 @@ void TileCache::dumpState(std::ostream& os)
         }
     }
 
+#if !MOBILEAPP
+    if (_store)
+        os << "    store: " << _store->count() << " tiles in " << _store->size() << " bytes\n";
+#endif
+
     os << "    tiles being rendered " << _tilesBeingRendered.size() << '\n';
     for (const auto& it : _tilesBeingRendered)
         it.second->dumpState(os);
@@ -23,6 +23,7 @@
 #include "TileDesc.hpp"
 
 class ClientSession;
+class TileStore;
 
 // The cache cares about only some properties.
 struct TileDescCacheCompareEq final
@@ -220,6 +221,24 @@ public:
     /// Find the tile with this description
     Tile lookupTile(const TileDesc& tile);
 
+#if !MOBILEAPP
+    /// Serve tiles from, and save keyframes to, the @store on disk,
+    /// until the document changes. Returns false, dropping the @store,
+    /// when the document changed already.
+    bool setStore(std::unique_ptr<TileStore> store);
+
+    /// Stop using the store, for the rest of this session.
+    void closeStore();
+
+    /// Sets the hash of the view properties that render the tiles
+    /// of the canonical @normalizedViewId, keying them in the store.
+    void setViewProps(int normalizedViewId, const std::string& viewProps);
+
+    /// Stores the valid keyframes in memory, e.g. before unloading the document,
+    /// in the segment of @contentHash unless already storing. Returns how many.
+    std::size_t persistTiles(const std::string& contentHash);
+#endif
+
     void saveTileAndNotify(const TileDesc& tile, const char* data, size_t size);
 
     enum StreamType {
@@ -280,6 +299,11 @@ private:
     Tile findTile(const TileDesc &desc);
 
     static std::string cacheFileName(const TileDesc& tileDesc);
+#if !MOBILEAPP
+    /// The key of the tile in the store, or empty when its view properties are unknown.
+    std::string storeKey(const TileDesc& tileDesc) const;
+    Tile loadFromStore(const TileDesc& desc);
+#endif
     static bool parseCacheFileName(const std::string& fileName, int& part, int& mode,
                                    int& width, int& height, int& tilePosX, int& tilePosY,
                                    int& tileWidth, int& tileHeight, int& nviewid);
@@ -315,6 +339,14 @@ private:
 
     // old-style file-name to data grab-bag.
     std::map<std::string, Blob> _streamCache[static_cast<int>(StreamType::Last)];
+
+#if !MOBILEAPP
+    std::unique_ptr<TileStore> _store;
+    /// Set once the store is closed, to not take one opened before the document changed.
+    bool _storeClosed = false;
+    /// The view properties hash of each canonical view id.
+    std::unordered_map<int, std::string> _viewProps;
+#endif
 };
 
 /// Tracks view-port area tiles to track which we last
@@ -0,0 +1,423 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <config.h>
+
+#include "TileStore.hpp"
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+#include <Poco/File.h>
+
+#include <common/FileUtil.hpp>
+#include <common/Log.hpp>
+#include <common/SpookyV2.h>
+#include <common/Util.hpp>
+
+namespace
+{
+/// Precedes each tile in a segment, followed by the key and the data,
+/// each padded to keep the data aligned, as SpookyHash needs.
+struct RecordHeader
+{
+    uint32_t _magic;
+    uint32_t _keySize;
+    uint32_t _dataSize;
+    /// Of the data, verified when first read.
+    uint32_t _checksum;
+};
+
+/// "LTS1", changed when the format changes, to ignore old segments.
+constexpr uint32_t RecordMagic = 0x3153544c;
+
+/// Keys are short, a longer one means garbage.
+constexpr uint32_t MaxKeySize = 1024;
+
+constexpr const char* SegmentSuffix = ".tiles";
+
+/// Appended tiles are written once this many bytes are pending.
+constexpr std::size_t FlushSize = 256 * 1024;
+
+constexpr std::size_t padded(std::size_t size) { return (size + 7) & ~std::size_t(7); }
+
+uint32_t checksum(const char* data, std::size_t size)
+{
+    return SpookyHash::Hash32(data, size, 0);
+}
+
+/// Writes all of @size bytes of @data to @fd at @offset.
+bool writeAll(int fd, const char* data, std::size_t size, off_t offset)
+{
+    while (size > 0)
+    {
+        const ssize_t written = pwrite(fd, data, size, offset);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            return false;
+        }
+
+        data += written;
+        size -= written;
+        offset += written;
+    }
+
+    return true;
+}
+
+} // namespace
+
+std::string TileStore::StorePath;
+std::size_t TileStore::MaxSizeBytes = 0;
+std::mutex TileStore::Mutex;
+
+void TileStore::initialize(const std::string& path, std::size_t maxSizeBytes)
+{
+    StorePath = path;
+    while (StorePath.size() > 1 && StorePath.back() == '/')
+        StorePath.pop_back();
+
+    MaxSizeBytes = maxSizeBytes;
+
+    LOG_INF("Storing tiles in [" << StorePath << "] within " << MaxSizeBytes / 1024 / 1024
+                                 << " MB");
+    ensureSize();
+}
+
+std::unique_ptr<TileStore> TileStore::open(const std::string& contentHash)
+{
+    if (!isEnabled() || contentHash.empty())
+        return nullptr;
+
+    const std::string path = StorePath + '/' + contentHash + SegmentSuffix;
+
+    // Retry when ensureSize removed the segment between opening and locking it.
+    for (int attempt = 0; attempt < 2; ++attempt)
+    {
+        const int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+        if (fd < 0)
+        {
+            LOG_SYS("Failed to open tile store segment [" << path << ']');
+            return nullptr;
+        }
+
+        // The lock is on the open file, so it excludes other documents in this process too.
+        if (flock(fd, LOCK_EX | LOCK_NB) != 0)
+        {
+            LOG_DBG("Tile store segment [" << path << "] is in use, not storing tiles");
+            ::close(fd);
+            return nullptr;
+        }
+
+        struct stat opened;
+        struct stat linked;
+        if (fstat(fd, &opened) != 0 || stat(path.c_str(), &linked) != 0
+            || opened.st_ino != linked.st_ino)
+        {
+            ::close(fd);
+            continue;
+        }
+
+        // The modified time orders the segments for removal.
+        futimens(fd, nullptr);
+
+        std::unique_ptr<TileStore> store(new TileStore(path, fd, opened.st_size));
+        store->index();
+        LOG_DBG("Opened tile store segment [" << path << "] with " << store->count()
+                                              << " tiles in " << store->size() << " bytes");
+        return store;
+    }
+
+    return nullptr;
+}
+
+TileStore::TileStore(std::string path, int fd, std::size_t size)
+    : _path(std::move(path))
+    , _fd(fd)
+    , _map(nullptr)
+    , _mapSize(0)
+    , _size(size)
+    , _written(size)
+    , _full(false)
+{
+}
+
+TileStore::~TileStore()
+{
+    flush();
+    map(0);
+    ::close(_fd);
+}
+
+bool TileStore::map(std::size_t size)
+{
+    if (_map)
+    {
+        munmap(_map, _mapSize);
+        _map = nullptr;
+        _mapSize = 0;
+    }
+
+    if (size == 0)
+        return true;
+
+    void* map = mmap(nullptr, size, PROT_READ, MAP_SHARED, _fd, 0);
+    if (map == MAP_FAILED)
+    {
+        LOG_SYS("Failed to map " << size << " bytes of tile store segment [" << _path << ']');
+        return false;
+    }
+
+    _map = static_cast<char*>(map);
+    _mapSize = size;
+    return true;
+}
+
+void TileStore::index()
+{
+    const std::size_t fileSize = _size;
+    if (!map(fileSize))
+    {
+        _size = 0;
+        _full = true;
+        return;
+    }
+
+    std::size_t offset = 0;
+    while (offset + sizeof(RecordHeader) <= fileSize)
+    {
+        RecordHeader header;
+        std::memcpy(&header, _map + offset, sizeof(header));
+        if (header._magic != RecordMagic || header._keySize == 0
+            || header._keySize > MaxKeySize
+            || fileSize - offset - sizeof(header)
+                   < padded(header._keySize) + padded(header._dataSize))
+        {
+            break;
+        }
+
+        const char* key = _map + offset + sizeof(header);
+        const std::size_t dataOffset = offset + sizeof(header) + padded(header._keySize);
+        _index[std::string(key, header._keySize)] = { dataOffset, header._dataSize,
+                                                      header._checksum };
+        offset = dataOffset + padded(header._dataSize);
+    }
+
+    _size = offset;
+    _written = offset;
+    if (_size < fileSize)
+    {
+        // A crash while appending, or an older format: drop the rest, and append over it.
+        LOG_WRN("Dropping " << fileSize - _size << " bytes of invalid tiles at the end of tile"
+                            << " store segment [" << _path << ']');
+        if (ftruncate(_fd, _size) != 0)
+        {
+            LOG_SYS("Failed to truncate tile store segment [" << _path << ']');
+            _full = true;
+        }
+    }
+}
+
+bool TileStore::lookup(const std::string& key, const char*& data, std::size_t& size)
+{
+    const auto it = _index.find(key);
+    if (it == _index.end())
+        return false;
+
+    Entry& entry = it->second;
+
+    // Not written yet.
+    if (entry._offset >= _written)
+    {
+        data = _pending.data() + (entry._offset - _written);
+        size = entry._size;
+        return true;
+    }
+
+    // Written since we mapped.
+    if (entry._offset + entry._size > _mapSize && !map(_written))
+        return false;
+
+    data = _map + entry._offset;
+    size = entry._size;
+
+    if (entry._checksum != 0)
+    {
+        if (checksum(data, size) != entry._checksum)
+        {
+            LOG_WRN("Corrupt tile [" << key << "] in tile store segment [" << _path << ']');
+            _index.erase(it);
+            return false;
+        }
+
+        // Verified once is enough, we never overwrite.
+        entry._checksum = 0;
+    }
+
+    return true;
+}
+
+bool TileStore::append(const std::string& key, const char* data, std::size_t size)
+{
+    if (_full)
+        return false;
+
+    assert(!key.empty() && key.size() <= MaxKeySize);
+
+    const std::size_t dataOffset = sizeof(RecordHeader) + padded(key.size());
+    const std::size_t recordSize = dataOffset + padded(size);
+    if (_size + recordSize > MaxSizeBytes)
+    {
+        LOG_DBG("Tile store segment [" << _path << "] of " << _size
+                                       << " bytes is full, not storing more tiles");
+        _full = true;
+        return false;
+    }
+
+    if (_pending.empty())
+        _pending.reserve(FlushSize + recordSize);
+
+    // Zeroed, for the padding.
+    const std::size_t recordOffset = _pending.size();
+    _pending.resize(recordOffset + recordSize);
+    char* record = _pending.data() + recordOffset;
+    std::memcpy(record + sizeof(RecordHeader), key.data(), key.size());
+    std::memcpy(record + dataOffset, data, size);
+
+    RecordHeader header;
+    header._magic = RecordMagic;
+    header._keySize = key.size();
+    header._dataSize = size;
+    header._checksum = checksum(record + dataOffset, size);
+    std::memcpy(record, &header, sizeof(header));
+
+    // The data was checked as we copied it.
+    _index[key] = { _size + dataOffset, size, 0 };
+    _size += recordSize;
+
+    return _pending.size() < FlushSize || flush();
+}
+
+bool TileStore::flush()
+{
+    if (_pending.empty())
+        return true;
+
+    if (!writeAll(_fd, _pending.data(), _pending.size(), _written))
+    {
+        LOG_SYS("Failed to append " << _pending.size() << " bytes to tile store segment [" << _path
+                                    << ']');
+
+        // Don't leave a torn tile to index on the next open.
+        if (ftruncate(_fd, _written) != 0)
+            LOG_SYS("Failed to truncate tile store segment [" << _path << ']');
+
+        for (auto it = _index.begin(); it != _index.end();)
+        {
+            if (it->second._offset >= _written)
+                it = _index.erase(it);
+            else
+                ++it;
+        }
+
+        _pending.clear();
+        _size = _written;
+        _full = true;
+        return false;
+    }
+
+    _written += _pending.size();
+    _pending.clear();
+    return true;
+}
+
+void TileStore::ensureSize()
+{
+    if (!isEnabled())
+        return;
+
+    std::lock_guard<std::mutex> lock(Mutex);
+
+    struct Segment
+    {
+        std::string _path;
+        int64_t _modifiedTimeUs;
+        std::size_t _size;
+    };
+
+    std::vector<std::string> files;
+    try
+    {
+        Poco::File(StorePath).list(files);
+    }
+    catch (const std::exception& exc)
+    {
+        LOG_ERR("Failed to list tile store [" << StorePath << "]: " << exc.what());
+        return;
+    }
+
+    std::vector<Segment> segments;
+    std::size_t total = 0;
+    for (const std::string& file : files)
+    {
+        if (!Util::endsWith(file, SegmentSuffix))
+            continue;
+
+        const std::string path = StorePath + '/' + file;
+        const FileUtil::Stat stat(path);
+        if (!stat.isFile())
+            continue;
+
+        segments.push_back({ path, stat.modifiedTimeUs(), stat.size() });
+        total += stat.size();
+    }
+
+    if (total <= MaxSizeBytes)
+        return;
+
+    std::sort(segments.begin(), segments.end(), [](const Segment& lhs, const Segment& rhs) {
+        return lhs._modifiedTimeUs < rhs._modifiedTimeUs;
+    });
+
+    for (const Segment& segment : segments)
+    {
+        if (total <= MaxSizeBytes)
+            break;
+
+        const int fd = ::open(segment._path.c_str(), O_RDWR | O_CLOEXEC);
+        if (fd < 0)
+            continue;
+
+        // Skip the open ones.
+        if (flock(fd, LOCK_EX | LOCK_NB) == 0)
+        {
+            LOG_DBG("Removing tile store segment [" << segment._path << "] of " << segment._size
+                                                    << " bytes");
+            if (unlink(segment._path.c_str()) == 0)
+                total -= segment._size;
+        }
+
+        ::close(fd);
+    }
+
+    LOG_TRC("Tile store is now " << total << " bytes");
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,117 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/// Stores the tiles of documents on disk, to serve them when
+/// a document is opened again, without waiting for the kit to
+/// render them.
+///
+/// Each document, by the hash of its contents, has a segment
+/// file in the store directory: its tiles one after the other,
+/// each after a header with its key and size. Tiles are only
+/// ever appended, and a later tile supersedes an earlier one
+/// with the same key. A segment is indexed when opened, and
+/// mapped in memory to read the tiles. Appended tiles are
+/// buffered, and written in batches.
+///
+/// The segments of the least recently opened documents are
+/// removed by housekeeping, to keep the directory within its
+/// size limit.
+class TileStore
+{
+public:
+    /// Stores the segments in @path, within @maxSizeBytes in total.
+    static void initialize(const std::string& path, std::size_t maxSizeBytes);
+
+    static bool isEnabled() { return !StorePath.empty(); }
+
+    /// Opens the segment of the document whose contents hash to @contentHash,
+    /// creating it if needed. Returns nullptr when the store is disabled,
+    /// or when another document has the segment open.
+    static std::unique_ptr<TileStore> open(const std::string& contentHash);
+
+    ~TileStore();
+
+    TileStore(const TileStore&) = delete;
+    TileStore& operator=(const TileStore&) = delete;
+
+    bool contains(const std::string& key) const { return _index.find(key) != _index.end(); }
+
+    /// Finds the tile stored with @key. The data is valid until the next append.
+    bool lookup(const std::string& key, const char*& data, std::size_t& size);
+
+    /// Appends a tile with @key. Returns false when the segment
+    /// has no room left for it, or writing the batch failed.
+    bool append(const std::string& key, const char* data, std::size_t size);
+
+    /// Writes the tiles appended since the last flush.
+    bool flush();
+
+    /// The number of tiles indexed.
+    std::size_t count() const { return _index.size(); }
+
+    /// The size of the segment in bytes.
+    std::size_t size() const { return _size; }
+
+    /// Removes the segments of the least recently opened documents,
+    /// except the open ones, until the store is within its limit.
+    static void ensureSize();
+
+private:
+    TileStore(std::string path, int fd, std::size_t size);
+
+    /// Indexes the tiles of the segment, dropping a torn last one.
+    void index();
+
+    /// Maps the first @size bytes of the segment.
+    bool map(std::size_t size);
+
+    struct Entry
+    {
+        std::size_t _offset;
+        std::size_t _size;
+        uint32_t _checksum;
+    };
+
+    const std::string _path;
+    const int _fd;
+
+    char* _map;
+    std::size_t _mapSize;
+
+    /// The size of the complete tiles in the segment, including those pending.
+    std::size_t _size;
+
+    /// The size of the tiles written to the segment, followed by _pending.
+    std::size_t _written;
+
+    /// The records appended since the last flush.
+    std::vector<char> _pending;
+
+    /// Set when a tile didn't fit, to not try again.
+    bool _full;
+
+    std::unordered_map<std::string, Entry> _index;
+
+    static std::string StorePath;
+    static std::size_t MaxSizeBytes;
+    /// Serializes the removal of segments.
+    static std::mutex Mutex;
+};
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
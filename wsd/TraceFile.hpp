@@ -9,12 +9,24 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
 #include <fstream>
+#include <limits>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <set>
 #include <sstream>
 #include <string>
 #include <vector>
 
+#include <zstd.h>
+
 #include <Poco/DateTime.h>
 #include <Poco/DateTimeFormatter.h>
 #include <Poco/DeflatingStream.h>
@@ -58,9 +70,9 @@ public:
 
     Direction getDir() const { return _dir; }
 
-    void setTimestampUs(unsigned timestampUs) { _timestampUs = timestampUs; }
+    void setTimestampUs(int64_t timestampUs) { _timestampUs = timestampUs; }
 
-    unsigned getTimestampUs() const { return _timestampUs; }
+    int64_t getTimestampUs() const { return _timestampUs; }
 
     void setPid(unsigned pid) { _pid = pid; }
 
@@ -76,47 +88,160 @@ public:
 
 private:
     Direction _dir;
-    unsigned _timestampUs;
+    int64_t _timestampUs;
     unsigned _pid;
     std::string _sessionId;
     std::string _payload;
 };
 
+/// The chunked trace format, for long traces of busy servers: the records,
+/// as in the text format but with their full timestamps, in zstd-compressed
+/// blocks. Each block is preceded by a header with the time range and the
+/// sessions of its records, so readers index a trace by skipping from header
+/// to header, and only decompress the blocks they replay. Each thread fills
+/// its own block, so the blocks overlap in time, and readers merge them.
+/// There is no index at the end to lose in a crash: all complete blocks can
+/// be read.
+namespace TraceChunk
+{
+/// At the start of the file.
+constexpr char FileMagic[8] = { 'L', 'O', 'O', 'L', 'T', 'R', 'C', '1' };
+
+/// "BLK1", changed when the format changes.
+constexpr uint32_t BlockMagic = 0x314b4c42;
+
+/// A thread writes its block when it is this big,
+constexpr std::size_t BlockSize = 256 * 1024;
+/// or this old, to keep the blocks of quiet threads short.
+constexpr int64_t BlockMaxAgeUs = 10 * 1000 * 1000;
+
+constexpr int CompressionLevel = 3;
+
+/// Followed by the sessions, comma-separated, and then the compressed records.
+struct BlockHeader
+{
+    uint32_t _magic;
+    uint32_t _compressedSize;
+    uint32_t _rawSize;
+    uint32_t _recordCount;
+    uint32_t _sessionsSize;
+    /// Keeps the times aligned.
+    uint32_t _unused;
+    int64_t _firstTimeUs;
+    int64_t _lastTimeUs;
+};
+} // namespace TraceChunk
+
+/// Selects the records of a trace to replay.
+struct TraceFileFilter
+{
+    TraceFileFilter() :
+        _fromUs(0),
+        _toUs(std::numeric_limits<int64_t>::max())
+    {
+    }
+
+    bool selectsAll() const
+    {
+        return _fromUs <= 0 && _toUs == std::numeric_limits<int64_t>::max() && _sessionId.empty();
+    }
+
+    bool matches(const TraceFileRecord& rec) const
+    {
+        return rec.getTimestampUs() >= _fromUs && rec.getTimestampUs() <= _toUs &&
+               (_sessionId.empty() || rec.getSessionId() == _sessionId);
+    }
+
+    /// The time range, since the start of the trace.
+    int64_t _fromUs;
+    int64_t _toUs;
+    /// Empty for all the sessions.
+    std::string _sessionId;
+};
+
 /// Trace-file generator class.
 /// Writes records into a trace file.
 class TraceFileWriter
 {
 public:
+    /// When @chunked, writes the chunked format, always compressed, instead of text.
     TraceFileWriter(const std::string& path,
                     const bool recordOutgoing,
                     const bool compress,
+                    const bool chunked,
                     const bool takeSnapshot,
                     const std::vector<std::string>& filters) :
         _epochStart(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now()
                                                             .time_since_epoch()).count()),
         _recordOutgoing(recordOutgoing),
         _compress(compress),
+        _chunked(chunked),
         _takeSnapshot(takeSnapshot),
         _path(Poco::Path(path).parent().toString()),
         _lastTime(_epochStart),
         _filter(true),
-        _stream(processPath(path), compress ? std::ios::binary : std::ios::out),
-        _deflater(_stream, Poco::DeflatingStreamBuf::STREAM_GZIP)
+        _stream(processPath(path), compress || chunked ? std::ios::binary : std::ios::out),
+        _deflater(_stream, Poco::DeflatingStreamBuf::STREAM_GZIP),
+        _id(nextId())
     {
         for (const auto& f : filters)
         {
             _filter.deny(f);
         }
+
+        if (_chunked)
+            _stream.write(TraceChunk::FileMagic, sizeof(TraceChunk::FileMagic));
     }
 
     ~TraceFileWriter()
     {
         std::unique_lock<std::mutex> lock(_mutex);
 
-        _deflater.close();
+        if (_chunked)
+        {
+            std::unique_lock<std::mutex> blocksLock(_blocksMutex);
+            for (const auto& block : _blocks)
+            {
+                std::unique_lock<std::mutex> blockLock(block->_mutex);
+                writeBlock(*block);
+                // Its thread mustn't write it out after us.
+                block->_writer = nullptr;
+            }
+        }
+        else
+            _deflater.close();
+
         _stream.close();
     }
 
+    /// Of the chunked format: writes out the blocks of the threads that have
+    /// not written for long, and forgets those of the threads that ended.
+    void flushStale()
+    {
+        if (!_chunked)
+            return;
+
+        const int64_t usec = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count() - _epochStart;
+
+        std::unique_lock<std::mutex> lock(_blocksMutex);
+        for (auto it = _blocks.begin(); it != _blocks.end();)
+        {
+            std::unique_lock<std::mutex> blockLock((*it)->_mutex);
+            if (!(*it)->_writer)
+            {
+                blockLock.unlock();
+                it = _blocks.erase(it);
+                continue;
+            }
+
+            if ((*it)->_count > 0 && usec - (*it)->_firstTimeUs >= TraceChunk::BlockMaxAgeUs)
+                writeBlock(**it);
+
+            ++it;
+        }
+    }
+
     void newSession(const std::string& id, const std::string& sessionId, const std::string& uri, const std::string& localPath)
     {
         std::unique_lock<std::mutex> lock(_mutex);
@@ -193,6 +318,14 @@ public:
 
     void writeIncoming(const std::string& id, const std::string& sessionId, const std::string& data)
     {
+        // Only loads need the snapshots, the rest goes to the block of the thread.
+        if (_chunked && !LOOLProtocol::matchPrefix("load", data))
+        {
+            if (_filter.match(data) && !LOOLProtocol::matchPrefix("tileprocessed ", data))
+                writeChunked(id, sessionId, data, static_cast<char>(TraceFileRecord::Direction::Incoming));
+            return;
+        }
+
         std::unique_lock<std::mutex> lock(_mutex);
 
         if (_filter.match(data))
@@ -240,6 +373,13 @@ public:
 
     void writeOutgoing(const std::string& id, const std::string& sessionId, const std::string& data)
     {
+        if (_chunked)
+        {
+            if (_recordOutgoing && _filter.match(data))
+                writeChunked(id, sessionId, data, static_cast<char>(TraceFileRecord::Direction::Outgoing));
+            return;
+        }
+
         std::unique_lock<std::mutex> lock(_mutex);
 
         if (_recordOutgoing && _filter.match(data))
@@ -253,6 +393,15 @@ private:
     {
         Util::assertIsLocked(_mutex);
 
+        if (_chunked)
+        {
+            // Events are rare, write them out at once, as in the text format.
+            ThreadBlock& block = getThreadBlock();
+            std::unique_lock<std::mutex> blockLock(block._mutex);
+            writeBlock(block);
+            return;
+        }
+
         _deflater.flush();
         _stream.flush();
     }
@@ -261,6 +410,12 @@ private:
     {
         Util::assertIsLocked(_mutex);
 
+        if (_chunked)
+        {
+            writeChunked(id, sessionId, data, delim);
+            return;
+        }
+
         const int64_t usec = std::chrono::duration_cast<std::chrono::microseconds>(
             std::chrono::system_clock::now().time_since_epoch()).count();
         const int64_t deltaT = usec - _lastTime;
@@ -291,6 +446,174 @@ private:
         }
     }
 
+    /// The records of a thread, until they make a block.
+    struct ThreadBlock
+    {
+        explicit ThreadBlock(TraceFileWriter* writer) :
+            _writer(writer),
+            _count(0),
+            _firstTimeUs(0),
+            _lastTimeUs(0)
+        {
+        }
+
+        /// Only contended when writing out all the blocks.
+        std::mutex _mutex;
+        /// Null once the thread or the writer is done with it.
+        TraceFileWriter* _writer;
+        std::string _records;
+        std::size_t _count;
+        int64_t _firstTimeUs;
+        int64_t _lastTimeUs;
+        std::set<std::string> _sessions;
+    };
+
+    /// The block of a thread, written out when the thread ends,
+    /// or moves on to another writer.
+    class ThreadBlockHolder
+    {
+    public:
+        ThreadBlockHolder() :
+            _id(0)
+        {
+        }
+
+        ~ThreadBlockHolder() { reset(); }
+
+        ThreadBlock& get(TraceFileWriter& writer)
+        {
+            if (_id != writer._id)
+            {
+                reset();
+                _block = std::make_shared<ThreadBlock>(&writer);
+                _id = writer._id;
+
+                std::unique_lock<std::mutex> lock(writer._blocksMutex);
+                writer._blocks.push_back(_block);
+            }
+
+            return *_block;
+        }
+
+    private:
+        /// Writes out our block, unless its writer is gone, which then forgets it.
+        void reset()
+        {
+            if (!_block)
+                return;
+
+            std::unique_lock<std::mutex> lock(_block->_mutex);
+            if (_block->_writer)
+            {
+                _block->_writer->writeBlock(*_block);
+                _block->_writer = nullptr;
+            }
+
+            lock.unlock();
+            _block.reset();
+            _id = 0;
+        }
+
+        uint64_t _id;
+        std::shared_ptr<ThreadBlock> _block;
+    };
+
+    static uint64_t nextId()
+    {
+        static std::atomic<uint64_t> lastId(0);
+        return ++lastId;
+    }
+
+    ThreadBlock& getThreadBlock()
+    {
+        // Kept by each thread, for the writer it was created for.
+        thread_local ThreadBlockHolder holder;
+        return holder.get(*this);
+    }
+
+    /// Adds a record to the block of this thread, and writes
+    /// out the block when it's full, or old.
+    void writeChunked(const std::string& id, const std::string& sessionId, const std::string& data, const char delim)
+    {
+        const int64_t usec = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count() - _epochStart;
+
+        ThreadBlock& block = getThreadBlock();
+        std::unique_lock<std::mutex> lock(block._mutex);
+
+        // The clock can go back.
+        block._firstTimeUs = block._count > 0 ? std::min(block._firstTimeUs, usec) : usec;
+        block._lastTimeUs = block._count > 0 ? std::max(block._lastTimeUs, usec) : usec;
+        ++block._count;
+        block._sessions.insert(sessionId);
+
+        std::string& records = block._records;
+        records += delim;
+        records += std::to_string(usec);
+        records += delim;
+        records += id;
+        records += delim;
+        records += sessionId;
+        records += delim;
+        records += data;
+        records += '\n';
+
+        if (records.size() >= TraceChunk::BlockSize ||
+            usec - block._firstTimeUs >= TraceChunk::BlockMaxAgeUs)
+        {
+            writeBlock(block);
+        }
+    }
+
+    /// Compresses the records of @block, and appends them to the file.
+    void writeBlock(ThreadBlock& block)
+    {
+        Util::assertIsLocked(block._mutex);
+
+        if (block._count == 0)
+            return;
+
+        std::string sessions;
+        for (const std::string& session : block._sessions)
+        {
+            if (!sessions.empty())
+                sessions += ',';
+            sessions += session;
+        }
+
+        std::vector<char> compressed(ZSTD_COMPRESSBOUND(block._records.size()));
+        const std::size_t compressedSize
+            = ZSTD_compress(compressed.data(), compressed.size(), block._records.data(),
+                            block._records.size(), TraceChunk::CompressionLevel);
+        if (ZSTD_isError(compressedSize))
+        {
+            LOG_ERR("TraceFile: Failed to compress " << block._count << " records with "
+                                                     << ZSTD_getErrorName(compressedSize));
+        }
+        else
+        {
+            TraceChunk::BlockHeader header;
+            header._magic = TraceChunk::BlockMagic;
+            header._compressedSize = compressedSize;
+            header._rawSize = block._records.size();
+            header._recordCount = block._count;
+            header._sessionsSize = sessions.size();
+            header._unused = 0;
+            header._firstTimeUs = block._firstTimeUs;
+            header._lastTimeUs = block._lastTimeUs;
+
+            std::unique_lock<std::mutex> lock(_streamMutex);
+            _stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            _stream.write(sessions.data(), sessions.size());
+            _stream.write(compressed.data(), compressedSize);
+            _stream.flush();
+        }
+
+        block._records.clear();
+        block._count = 0;
+        block._sessions.clear();
+    }
+
     static std::string processPath(const std::string& path)
     {
         const size_t pos = path.find('%');
@@ -336,6 +659,7 @@ private:
     const int64_t _epochStart;
     const bool _recordOutgoing;
     const bool _compress;
+    const bool _chunked;
     const bool _takeSnapshot;
     const std::string _path;
     int64_t _lastTime;;
@@ -344,15 +668,24 @@ private:
     Poco::DeflatingOutputStream _deflater;
     std::mutex _mutex;
     std::map<std::string, SnapshotData> _urlToSnapshot;
+
+    /// Of the chunked format: identifies the blocks of the threads as ours.
+    const uint64_t _id;
+    /// Serializes writing the blocks, taken after the lock of a block.
+    std::mutex _streamMutex;
+    std::mutex _blocksMutex;
+    std::vector<std::shared_ptr<ThreadBlock>> _blocks;
 };
 
 /// Trace-file parser class.
-/// Reads records from a trace file.
+/// Reads records from a trace file, the ones selected by @filter.
+/// Text traces are read whole, chunked ones streamed, a few blocks at a time.
 class TraceFileReader
 {
 public:
-    TraceFileReader(const std::string& path) :
+    TraceFileReader(const std::string& path, const TraceFileFilter& filter = TraceFileFilter()) :
         _compressed(path.size() > 2 && path.substr(path.size() - 2) == "gz"),
+        _filter(filter),
         _epochStart(0),
         _epochEnd(0),
         _stream(path, _compressed ? std::ios::binary : std::ios::in),
@@ -361,7 +694,14 @@ public:
         _indexIn(-1),
         _indexOut(-1)
     {
-        readFile();
+        if (isChunked(path))
+        {
+            _chunks = Util::make_unique<ChunkReader>(path, filter);
+            _epochStart = _chunks->getEpochStart();
+            _epochEnd = _chunks->getEpochEnd();
+        }
+        else
+            readFile();
     }
 
     ~TraceFileReader()
@@ -374,6 +714,9 @@ public:
 
     TraceFileRecord getNextRecord()
     {
+        if (_chunks)
+            return _chunks->getNextRecord();
+
         if (_index < _records.size())
         {
             return _records[_index++];
@@ -383,8 +726,20 @@ public:
         return TraceFileRecord();
     }
 
+    /// Of the chunked format, this shares the position of getNextRecord().
     TraceFileRecord getNextRecord(const TraceFileRecord::Direction dir)
     {
+        if (_chunks)
+        {
+            TraceFileRecord rec;
+            do
+            {
+                rec = _chunks->getNextRecord();
+            } while (rec.getDir() != dir && rec.getDir() != TraceFileRecord::Direction::Invalid);
+
+            return rec;
+        }
+
         if (dir == TraceFileRecord::Direction::Incoming)
         {
             if (_indexIn < _records.size())
@@ -409,12 +764,219 @@ public:
     }
 
 private:
+    /// Streams the records of a chunked trace, decompressing only the blocks
+    /// with selected records, and only when replay gets to their time.
+    class ChunkReader
+    {
+    public:
+        ChunkReader(const std::string& path, const TraceFileFilter& filter) :
+            _filter(filter),
+            _stream(path, std::ios::binary),
+            _nextBlock(0),
+            _epochEnd(0)
+        {
+            index();
+
+            _next = readRecord();
+            if (_next.getDir() == TraceFileRecord::Direction::Invalid ||
+                (_filter.selectsAll() && (_next.getDir() != TraceFileRecord::Direction::Event ||
+                                          _next.getPayload().find("NewSession") != 0)))
+            {
+                fprintf(stderr, "Invalid chunked trace file with %ld selected blocks. First record: %s\n",
+                        static_cast<long>(_blocks.size()), _next.getPayload().c_str());
+                throw std::runtime_error("Invalid trace file.");
+            }
+        }
+
+        int64_t getEpochStart() const { return _next.getTimestampUs(); }
+
+        /// At most, as the blocks have records of other sessions.
+        int64_t getEpochEnd() const { return _epochEnd; }
+
+        TraceFileRecord getNextRecord()
+        {
+            const TraceFileRecord rec = _next;
+            if (rec.getDir() != TraceFileRecord::Direction::Invalid)
+                _next = readRecord();
+
+            return rec;
+        }
+
+    private:
+        struct Block
+        {
+            std::streamoff _offset;
+            uint32_t _compressedSize;
+            uint32_t _rawSize;
+            int64_t _firstTimeUs;
+        };
+
+        /// Indexes the blocks with records selected by the filter, by their first time.
+        void index()
+        {
+            _stream.seekg(0, std::ios::end);
+            const std::streamoff fileSize = _stream.tellg();
+            _stream.seekg(sizeof(TraceChunk::FileMagic));
+
+            std::size_t count = 0;
+            TraceChunk::BlockHeader header;
+            while (_stream.read(reinterpret_cast<char*>(&header), sizeof(header)))
+            {
+                const std::streamoff remaining = fileSize - static_cast<std::streamoff>(_stream.tellg());
+                if (header._magic != TraceChunk::BlockMagic ||
+                    remaining < static_cast<std::streamoff>(header._sessionsSize) + header._compressedSize)
+                {
+                    // A crash while writing it.
+                    fprintf(stderr, "Invalid trace block after %ld blocks, ignoring the rest.\n",
+                            static_cast<long>(count));
+                    break;
+                }
+
+                std::string sessions(header._sessionsSize, '\0');
+                _stream.read(&sessions[0], sessions.size());
+
+                ++count;
+                const Block block = { static_cast<std::streamoff>(_stream.tellg()),
+                                      header._compressedSize, header._rawSize, header._firstTimeUs };
+                _stream.seekg(header._compressedSize, std::ios::cur);
+
+                if (header._lastTimeUs < _filter._fromUs || header._firstTimeUs > _filter._toUs)
+                    continue;
+
+                if (!_filter._sessionId.empty())
+                {
+                    const StringVector tokens = StringVector::tokenize(sessions, ',');
+                    bool found = false;
+                    for (std::size_t i = 0; i < tokens.size() && !found; ++i)
+                        found = tokens.equals(i, _filter._sessionId);
+
+                    if (!found)
+                        continue;
+                }
+
+                _blocks.push_back(block);
+                _epochEnd = std::max(_epochEnd, std::min(header._lastTimeUs, _filter._toUs));
+            }
+
+            _stream.clear();
+
+            // The threads write their blocks as they fill, not in order.
+            std::stable_sort(_blocks.begin(), _blocks.end(), [](const Block& lhs, const Block& rhs) {
+                return lhs._firstTimeUs < rhs._firstTimeUs;
+            });
+        }
+
+        /// Decompresses @block, keeping its selected records.
+        void load(const Block& block)
+        {
+            std::vector<char> compressed(block._compressedSize);
+            std::string raw(block._rawSize, '\0');
+            _stream.seekg(block._offset);
+            if (!_stream.read(compressed.data(), compressed.size()))
+            {
+                fprintf(stderr, "Failed to read trace block at %ld.\n", static_cast<long>(block._offset));
+                _stream.clear();
+                return;
+            }
+
+            const std::size_t size
+                = ZSTD_decompress(&raw[0], raw.size(), compressed.data(), compressed.size());
+            if (ZSTD_isError(size) || size != raw.size())
+            {
+                fprintf(stderr, "Failed to decompress trace block at %ld.\n",
+                        static_cast<long>(block._offset));
+                return;
+            }
+
+            std::deque<TraceFileRecord> records;
+            int64_t lastTime = 0;
+            std::size_t pos = 0;
+            while (pos < raw.size())
+            {
+                std::size_t end = raw.find('\n', pos);
+                if (end == std::string::npos)
+                    end = raw.size();
+
+                TraceFileRecord rec;
+                const std::string line = raw.substr(pos, end - pos);
+                if (!extractRecord(line, lastTime, rec))
+                    fprintf(stderr, "Invalid trace file record, expected 4 tokens. [%s]\n", line.c_str());
+                else if (_filter.matches(rec))
+                    records.push_back(rec);
+
+                pos = end + 1;
+            }
+
+            // In order, unless the clock went back.
+            std::stable_sort(records.begin(), records.end(),
+                             [](const TraceFileRecord& lhs, const TraceFileRecord& rhs) {
+                                 return lhs.getTimestampUs() < rhs.getTimestampUs();
+                             });
+
+            if (!records.empty())
+                _loaded.push_back(std::move(records));
+        }
+
+        /// Merges the records of the loaded blocks, loading the next ones as needed.
+        TraceFileRecord readRecord()
+        {
+            for (;;)
+            {
+                auto earliest = _loaded.end();
+                for (auto it = _loaded.begin(); it != _loaded.end(); ++it)
+                {
+                    if (earliest == _loaded.end() ||
+                        it->front().getTimestampUs() < earliest->front().getTimestampUs())
+                    {
+                        earliest = it;
+                    }
+                }
+
+                // A block starting before may have earlier records.
+                if (_nextBlock < _blocks.size() &&
+                    (earliest == _loaded.end() ||
+                     _blocks[_nextBlock]._firstTimeUs <= earliest->front().getTimestampUs()))
+                {
+                    load(_blocks[_nextBlock++]);
+                    continue;
+                }
+
+                if (earliest == _loaded.end())
+                    return TraceFileRecord();
+
+                const TraceFileRecord rec = earliest->front();
+                earliest->pop_front();
+                if (earliest->empty())
+                    _loaded.erase(earliest);
+
+                return rec;
+            }
+        }
+
+        const TraceFileFilter _filter;
+        std::ifstream _stream;
+        std::vector<Block> _blocks;
+        std::size_t _nextBlock;
+        /// The records left of the loaded blocks, a block per thread writing at the time.
+        std::vector<std::deque<TraceFileRecord>> _loaded;
+        TraceFileRecord _next;
+        int64_t _epochEnd;
+    };
+
+    static bool isChunked(const std::string& path)
+    {
+        std::ifstream stream(path, std::ios::binary);
+        char magic[sizeof(TraceChunk::FileMagic)];
+        return stream.read(magic, sizeof(magic)) &&
+               std::memcmp(magic, TraceChunk::FileMagic, sizeof(magic)) == 0;
+    }
+
     void readFile()
     {
         _records.clear();
 
         std::string line;
-        unsigned lastTime = 0;
+        int64_t lastTime = 0;
         for (;;)
         {
             if (_compressed)
@@ -432,15 +994,16 @@ private:
             }
 
             TraceFileRecord rec;
-            if (extractRecord(line, lastTime, rec))
-                _records.push_back(rec);
-            else
+            if (!extractRecord(line, lastTime, rec))
                 fprintf(stderr, "Invalid trace file record, expected 4 tokens. [%s]\n", line.c_str());
+            else if (_filter.matches(rec))
+                _records.push_back(rec);
         }
 
         if (_records.empty() ||
-            _records[0].getDir() != TraceFileRecord::Direction::Event ||
-            _records[0].getPayload().find("NewSession") != 0)
+            (_filter.selectsAll() &&
+             (_records[0].getDir() != TraceFileRecord::Direction::Event ||
+              _records[0].getPayload().find("NewSession") != 0)))
         {
             fprintf(stderr, "Invalid trace file with %ld records. First record: %s\n", static_cast<long>(_records.size()),
                     _records.empty() ? "<empty>" : _records[0].getPayload().c_str());
@@ -454,7 +1017,7 @@ private:
         _epochEnd = _records[_records.size() - 1].getTimestampUs();
     }
 
-    static bool extractRecord(const std::string& s, unsigned &lastTime, TraceFileRecord& rec)
+    static bool extractRecord(const std::string& s, int64_t &lastTime, TraceFileRecord& rec)
     {
         if (s.length() < 1)
             return false;
@@ -472,12 +1035,12 @@ private:
             {
                 case 0:
                     if (s[pos] == '+') { // incremental timestamps
-                        unsigned time = std::atol(s.substr(pos, next - pos).c_str());
+                        const int64_t time = std::atoll(s.substr(pos, next - pos).c_str());
                         rec.setTimestampUs(lastTime + time);
                         lastTime += time;
                     }
                     else
-                        rec.setTimestampUs(std::atol(s.substr(pos, next - pos).c_str()));
+                        rec.setTimestampUs(std::atoll(s.substr(pos, next - pos).c_str()));
                     break;
                 case 1:
                     rec.setPid(std::atoi(s.substr(pos, next - pos).c_str()));
@@ -514,6 +1077,7 @@ private:
 
 private:
     const bool _compressed;
+    const TraceFileFilter _filter;
     int64_t _epochStart;
     int64_t _epochEnd;
     std::ifstream _stream;
@@ -522,6 +1086,7 @@ private:
     unsigned _index;
     unsigned _indexIn;
     unsigned _indexOut;
+    std::unique_ptr<ChunkReader> _chunks;
 };
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,166 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <config.h>
+
+#include "UploadScheduler.hpp"
+
+#include <common/LatencyHistogram.hpp>
+#include <common/Log.hpp>
+
+const char* UploadScheduler::nameOf(Priority priority)
+{
+    switch (priority)
+    {
+        case Priority::User:
+            return "user";
+        case Priority::Autosave:
+            return "autosave";
+        case Priority::Drain:
+            return "drain";
+    }
+
+    return "unknown";
+}
+
+UploadScheduler::UploadScheduler()
+    : _maxUploads(0)
+    , _maxUploadsPerHost(0)
+    , _nextId(1)
+    , _activeCount(0)
+    , _sentBytes(0)
+{
+}
+
+UploadScheduler& UploadScheduler::instance()
+{
+    static UploadScheduler scheduler;
+    return scheduler;
+}
+
+void UploadScheduler::configure(std::size_t maxUploads, std::size_t maxUploadsPerHost)
+{
+    std::vector<std::shared_ptr<Slot>> granted;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _maxUploads = maxUploads;
+        _maxUploadsPerHost = maxUploadsPerHost;
+        dispatch(granted);
+    }
+
+    LOG_INF("Uploading at most " << maxUploads << " documents at a time, " << maxUploadsPerHost
+                                 << " per host (0 for no limit).");
+}
+
+std::uint64_t UploadScheduler::enqueue(const std::string& host, Priority priority, Grant grant)
+{
+    // Declared before the lock, so unused slots are released after unlocking.
+    std::vector<std::shared_ptr<Slot>> granted;
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    const std::uint64_t id = _nextId++;
+    _waiting.push_back({ id, host, priority, std::move(grant), std::chrono::steady_clock::now() });
+    dispatch(granted);
+
+    if (granted.empty())
+        LOG_DBG("Upload #" << id << " to [" << host << "] waits behind " << _activeCount
+                           << " uploads running and " << _waiting.size() - 1 << " waiting.");
+
+    return id;
+}
+
+bool UploadScheduler::cancel(std::uint64_t id)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (auto it = _waiting.begin(); it != _waiting.end(); ++it)
+    {
+        if (it->_id == id)
+        {
+            _waiting.erase(it);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+std::size_t UploadScheduler::getQueueLength() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _waiting.size();
+}
+
+std::size_t UploadScheduler::getActiveCount() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _activeCount;
+}
+
+void UploadScheduler::dispatch(std::vector<std::shared_ptr<Slot>>& granted)
+{
+    while (!_waiting.empty() && (_maxUploads == 0 || _activeCount < _maxUploads))
+    {
+        // The first of the highest priority, preferring the least busy hosts.
+        auto best = _waiting.end();
+        std::size_t bestActive = 0;
+        for (auto it = _waiting.begin(); it != _waiting.end(); ++it)
+        {
+            const auto activeIt = _active.find(it->_host);
+            const std::size_t active = activeIt != _active.end() ? activeIt->second : 0;
+            if (_maxUploadsPerHost > 0 && active >= _maxUploadsPerHost)
+                continue;
+
+            if (best == _waiting.end() || it->_priority < best->_priority ||
+                (it->_priority == best->_priority && active < bestActive))
+            {
+                best = it;
+                bestActive = active;
+            }
+        }
+
+        if (best == _waiting.end())
+            break; // Only busy hosts are waiting.
+
+        const auto now = std::chrono::steady_clock::now();
+        static LatencyHistogram* waitHistograms[PriorityCount] = {};
+        LatencyHistogram*& waitHistogram = waitHistograms[static_cast<int>(best->_priority)];
+        if (!waitHistogram)
+            waitHistogram = &LatencyHistogram::get(
+                "document_upload_queue_wait_seconds",
+                std::string("priority=\"") + nameOf(best->_priority) + '"',
+                "Time uploads to storage waited for their turn.");
+        waitHistogram->observe(now - best->_enqueued);
+
+        LOG_TRC("Starting " << nameOf(best->_priority) << " upload #" << best->_id << " to ["
+                            << best->_host << "] after waiting "
+                            << std::chrono::duration_cast<std::chrono::milliseconds>(
+                                   now - best->_enqueued));
+
+        ++_active[best->_host];
+        ++_activeCount;
+        granted.push_back(std::make_shared<Slot>(*this, best->_host));
+
+        const Request request = std::move(*best);
+        _waiting.erase(best);
+        request._grant(granted.back());
+    }
+}
+
+void UploadScheduler::release(const std::string& host)
+{
+    std::vector<std::shared_ptr<Slot>> granted;
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    const auto it = _active.find(host);
+    if (it != _active.end() && --it->second == 0)
+        _active.erase(it);
+    --_activeCount;
+
+    dispatch(granted);
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
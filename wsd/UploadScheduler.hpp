@@ -0,0 +1,124 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/// Schedules the uploads to storage of all the documents on this node.
+///
+/// Without it, draining a node, i.e. having every document save and upload
+/// at once, saturates the network and the WOPI hosts. Instead, at most a
+/// fixed number of uploads run at a time, and at most a fixed number to any
+/// one host. The rest wait, user-initiated saves first, then autosaves,
+/// then the saves of documents unloaded on shutdown, and in order of arrival
+/// otherwise. Among those, the hosts with the fewest uploads running go first.
+///
+/// Uploads come from the DocumentBroker threads, so this is thread-safe.
+class UploadScheduler
+{
+public:
+    /// In order of precedence.
+    enum class Priority
+    {
+        User, ///< Saved by the user.
+        Autosave, ///< Saved automatically, while editing.
+        Drain, ///< Saved because we are shutting down.
+    };
+
+    static constexpr int PriorityCount = static_cast<int>(Priority::Drain) + 1;
+
+    static const char* nameOf(Priority priority);
+
+    /// An upload in progress, which makes room for the next when destroyed.
+    class Slot
+    {
+    public:
+        Slot(UploadScheduler& scheduler, std::string host)
+            : _scheduler(scheduler)
+            , _host(std::move(host))
+        {
+        }
+
+        ~Slot() { _scheduler.release(_host); }
+
+        Slot(const Slot&) = delete;
+        Slot& operator=(const Slot&) = delete;
+
+    private:
+        UploadScheduler& _scheduler;
+        const std::string _host;
+    };
+
+    /// Called with the slot to hold while uploading. Called with the scheduler
+    /// locked, possibly from another thread, so it must only hand the upload
+    /// over to the thread of the requester (e.g. with SocketPoll::addCallback).
+    using Grant = std::function<void(const std::shared_ptr<Slot>&)>;
+
+    UploadScheduler();
+
+    /// The scheduler of this process.
+    static UploadScheduler& instance();
+
+    /// Sets the maximum uploads at a time, in total and per host. 0 for no limit.
+    void configure(std::size_t maxUploads, std::size_t maxUploadsPerHost);
+
+    /// Queues an upload to @host. @grant is called when it may start, which may be right away.
+    /// Returns the id of the request, to cancel it with.
+    std::uint64_t enqueue(const std::string& host, Priority priority, Grant grant);
+
+    /// Cancels the request @id, unless it has been granted already.
+    /// Returns true if it was waiting.
+    bool cancel(std::uint64_t id);
+
+    /// Accounts for the bytes sent by the uploads.
+    void addSentBytes(std::uint64_t bytes) { _sentBytes += bytes; }
+
+    std::size_t getQueueLength() const;
+    std::size_t getActiveCount() const;
+    std::uint64_t getSentBytes() const { return _sentBytes; }
+
+private:
+    struct Request
+    {
+        std::uint64_t _id;
+        std::string _host;
+        Priority _priority;
+        Grant _grant;
+        std::chrono::steady_clock::time_point _enqueued;
+    };
+
+    /// Grants the waiting requests that may start.
+    /// The slots are appended to @granted, to be released after unlocking.
+    void dispatch(std::vector<std::shared_ptr<Slot>>& granted);
+
+    void release(const std::string& host);
+
+private:
+    mutable std::mutex _mutex;
+    std::size_t _maxUploads;
+    std::size_t _maxUploadsPerHost;
+    std::uint64_t _nextId;
+    /// In order of arrival.
+    std::list<Request> _waiting;
+    /// The uploads running, by host.
+    std::map<std::string, std::size_t> _active;
+    std::size_t _activeCount;
+    std::atomic<std::uint64_t> _sentBytes;
+};
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */